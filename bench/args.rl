@@ -0,0 +1,7 @@
+; Tail calls with more arguments than registers
+; expect: 20000000
+(let ((spin (lambda (self n a b c d e f g)
+              (if (fxzero? n)
+                  (fx+ a (fx+ b (fx+ c (fx+ d (fx+ e (fx+ f g))))))
+                  (self self (fxsub1 n) b c d e f g (fxadd1 a))))))
+  (spin spin 20000000 0 0 0 0 0 0 0))
@@ -0,0 +1,15 @@
+; A dense case in a loop, dispatched through a jump table
+; expect: 675000000
+(define (score n)
+  (case (fxlogand n 7)
+    ((0) 1)
+    ((1 2) 3)
+    ((3) 5)
+    ((4) 7)
+    ((5 6) 11)
+    (else 13)))
+(define (sum n)
+  (do ((i 0 (fxadd1 i))
+       (acc 0 (fx+ acc (score i))))
+      ((fx= i n) acc)))
+(sum 100000000)
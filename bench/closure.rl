@@ -0,0 +1,8 @@
+; Allocation of closures and calls through them
+; expect: 499999500000
+(let ((adder (lambda (n) (lambda (x) (fx+ x n)))))
+  (let ((loop (lambda (self i acc)
+                (if (fxzero? i)
+                    acc
+                    (self self (fxsub1 i) ((adder i) acc))))))
+    (loop loop 999999 0)))
@@ -0,0 +1,7 @@
+; A counted do loop with an invariant product in its body
+; expect: 300000000
+(define (sum n k)
+  (do ((i 0 (fxadd1 i))
+       (acc 0 (fx+ acc (fx* k 3))))
+      ((fx= i n) acc)))
+(sum 100000000 1)
@@ -0,0 +1,7 @@
+; Doubly recursive calls, with generic arithmetic
+; expect: 832040
+(let ((fib (lambda (self n)
+             (if (fx< n 2)
+                 n
+                 (+ (self self (fx- n 1)) (self self (fx- n 2)))))))
+  (fib fib 30))
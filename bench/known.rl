@@ -0,0 +1,8 @@
+; Doubly recursive direct calls to a known procedure, with generic
+; arithmetic
+; expect: 832040
+(define (fib n)
+  (if (fx< n 2)
+      n
+      (+ (fib (fx- n 1)) (fib (fx- n 2)))))
+(fib 30)
@@ -0,0 +1,7 @@
+; Tail calls only, which have to run in constant stack
+; expect: 100000000
+(let ((loop (lambda (self n acc)
+              (if (fxzero? n)
+                  acc
+                  (self self (fxsub1 n) (fxadd1 acc))))))
+  (loop loop 100000000 0))
@@ -0,0 +1,12 @@
+; Two independent chains of arithmetic in each iteration, a chain of
+; multiplications and one of additions, that can overlap
+; expect: 46465
+(define (step x y)
+  (fxlogand (fx+ (fx* (fx* (fx* x 3) 5) 7)
+                (fxadd1 (fxadd1 (fxadd1 (fx+ y 11)))))
+            65535))
+(define (run n)
+  (do ((i 0 (fxadd1 i))
+       (x 1 (step x i)))
+      ((fx= i n) x)))
+(run 100000000)
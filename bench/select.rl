@@ -0,0 +1,10 @@
+; A conditional on pseudo-random bits, which no branch predictor gets right
+; expect: 100000032
+(define (pick x acc)
+  (if (fxzero? (fxlogand x 65536)) (fx+ acc 3) (fxsub1 acc)))
+(define (sum n)
+  (do ((i 0 (fxadd1 i))
+       (x 1 (fxlogand (fx+ (fx* x 69069) 1) 4294967295))
+       (acc 0 (pick x acc)))
+      ((fx= i n) acc)))
+(sum 100000000)
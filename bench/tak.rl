@@ -0,0 +1,10 @@
+; Takeuchi function: non-tail calls with three arguments
+; expect: 9
+(let ((tak (lambda (self x y z)
+             (if (fx< y x)
+                 (self self
+                       (self self (fxsub1 x) y z)
+                       (self self (fxsub1 y) z x)
+                       (self self (fxsub1 z) x y))
+                 z))))
+  (tak tak 24 16 8))
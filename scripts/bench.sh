@@ -0,0 +1,51 @@
+#!/bin/sh
+# Runs the micro-benchmarks given as arguments, compiled by rattle with
+# the flags in $RATTLE_FLAGS, and reports the best time out of $RUNS
+# runs of each. A benchmark states the value it prints in a comment:
+#   ; expect: <value>
+#
+# With $PERF_EVENTS set to a list of events for perf stat, such as
+# instructions,cycles,branch-misses, each benchmark runs once more under
+# it, and the counts follow the time, with the instructions per cycle
+# when both are counted.
+set -e
+
+RUNS=${RUNS:-5}
+
+for b in "$@"; do
+  exe=$(mktemp)
+  ./rattle $RATTLE_FLAGS -o "$exe" -c "$b" 2> /dev/null
+  expect=$(sed -n 's/^; expect: //p' "$b")
+
+  best=
+  for _ in $(seq "$RUNS"); do
+    start=$(date +%s%N)
+    out=$("$exe")
+    end=$(date +%s%N)
+    if [ "$out" != "$expect" ]; then
+      echo "$b: expected $expect, got $out" >&2
+      rm -f "$exe"
+      exit 1
+    fi
+    t=$(((end - start) / 1000000))
+    if [ -z "$best" ] || [ "$t" -lt "$best" ]; then
+      best=$t
+    fi
+  done
+
+  printf "%-24s %8s ms" "$b" "$best"
+  if [ -n "$PERF_EVENTS" ]; then
+    perf stat -x, -e "$PERF_EVENTS" -o "$exe.perf" "$exe" > /dev/null
+    awk -F, '$1 ~ /^[0-9]+$/ {
+               n[$3] = $1
+               printf "  %s %s", $3, $1
+             }
+             END {
+               if (n["instructions"] && n["cycles"])
+                 printf "  ipc %.2f", n["instructions"] / n["cycles"]
+             }' "$exe.perf"
+    rm -f "$exe.perf"
+  fi
+  printf "\n"
+  rm -f "$exe"
+done
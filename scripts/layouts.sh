@@ -0,0 +1,55 @@
+#!/bin/sh
+# Builds rattle with each of the pointer tag layouts given as arguments,
+# headers written by scripts/ptrtags.c, and prints the number of
+# instructions emitted with it for the micro-benchmarks and for the tests
+# in $TESTS, compiled with the flags in $RATTLE_FLAGS, along with the
+# number of tests that give a value other than the one expected. Tests are
+# separated by lines with --, and have their expected value after =>. A
+# test that runs for longer than 10 seconds counts as failed. With
+# $BENCH set, the micro-benchmarks are also run. The layout in src/common.h
+# is built again at the end.
+set -e
+
+TESTS=${TESTS:-tests/*.tests}
+
+# Prints the instructions emitted for each test, then the failures
+run_tests() {
+  awk 'BEGIN { RS = "--\n" }
+       { gsub(/\n/, " "); i = index($0, "=>"); if (i == 0) next;
+         e = substr($0, i + 2); gsub(/^ +| +$/, "", e);
+         print substr($0, 1, i - 1) "\t" e }' $TESTS |
+    while IFS="$(printf '\t')" read -r expr expect; do
+      if out=$(timeout 10 ./rattle $RATTLE_FLAGS -d -e -- "$expr" 2> /dev/null)
+      then
+        value=$(printf "%s\n" "$out" | sed '1,/^End of Assembly dump/d' |
+          tr '\n' ' ' | sed 's/^ *//; s/ *$//')
+      else
+        value=error
+      fi
+      k=$(printf "%s\n" "$out" | grep -c '^    [a-z]' || true)
+      [ "$value" = "$expect" ] && f=0 || f=1
+      echo "$k $f"
+    done | awk '{ n += $1; f += $2 } END { print n + 0, f + 0 }'
+}
+
+for l in "$@"; do
+  make -s clean
+  if ! make -s PTRTAGS="$l" > /dev/null 2>&1; then
+    echo "$l: does not build"
+    continue
+  fi
+  n=0
+  for b in bench/*.rl; do
+    k=$(./rattle $RATTLE_FLAGS -d -c "$b" -o /dev/null 2> /dev/null |
+      grep -c '^    [a-z]' || true)
+    n=$((n + k))
+  done
+  r=$(run_tests)
+  echo "$l: bench $n, tests ${r% *} instructions, ${r#* } tests failed"
+  if [ -n "$BENCH" ]; then
+    scripts/bench.sh bench/*.rl
+  fi
+done
+
+make -s clean
+make -s > /dev/null 2>&1
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Counts the loads and stores to stack slots in the code that rattle emits,
+# with the flags in $RATTLE_FLAGS, for the tests in the files given as
+# arguments, without and with register allocation. Tests are separated by
+# lines with --, and have their expected value after =>. The code of
+# scheme_entry, which is the same for all, is left out.
+set -e
+
+count() {
+  awk 'BEGIN { RS = "--\n" } { sub(/=>.*/, ""); gsub(/\n/, " "); print }' "$1" |
+    while read -r expr; do
+      (./rattle $RATTLE_FLAGS $2 -d -e -- "$expr" || true) 2> /dev/null |
+        sed -n '/^Assembly dump:/,/^scheme_entry:/p' |
+        grep -c '(%rsp' || true
+    done | awk '{ n += $1 } END { print n + 0 }'
+}
+
+printf "%-24s %10s %10s\n" "" "stack" "registers"
+for f in "$@"; do
+  printf "%-24s %10s %10s\n" "$f" "$(count "$f" "-f no-regalloc")" \
+    "$(count "$f" "-f regalloc")"
+done
@@ -0,0 +1,221 @@
+// Searches the pointer tag layouts of characters and booleans, with the
+// constraints of scripts/ptrtags.rkt checked on every character, both
+// booleans, every low byte of a pointer and a range of fixnums rather than
+// by a solver, and writes each layout found to a header in the directory
+// given, for scripts/layouts.sh to build and score with the emitters.
+//
+//   cc -o ptrtags scripts/ptrtags.c && ./ptrtags layouts
+//
+// Pointers keep tag 0 and fixnums keep their single set tag bit, which is
+// what the static asserts in src/common.h allow: a fixnum tag of 0 would
+// need pointers, which the heap and the runtime use untagged, to be tagged.
+// Of the tags that satisfy the constraints, the smallest character tag and
+// then the smallest boolean tag are taken, the empty list is the smallest
+// valid immediate left, and the tag of the values word the smallest low
+// byte left that reads as none of the types.
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#define PTR_MASK UINT64_C (0x7)
+#define FX_TAG UINT64_C (0x1)
+#define FX_MASK UINT64_C (0x1)
+#define FX_SHIFT 1
+// As in src/common.h
+#define VALUES_MASK UINT64_C (0xff)
+#define VALUES_MEMORY UINT64_C (0x100)
+#define VALUES_COUNT_SHIFT 16
+#define VALUES_MAX 256
+
+typedef struct
+{
+  uint64_t tag, mask;
+  unsigned shift;
+} tag_t;
+
+typedef struct
+{
+  tag_t chr, bln;
+  uint64_t null, values;
+} layout_t;
+
+static bool
+tag_p (uint64_t v, tag_t t)
+{
+  return (v & t.mask) == t.tag;
+}
+
+// The number of types V reads as.
+static int
+types (const layout_t *l, uint64_t v)
+{
+  return ((v & PTR_MASK) == 0) + ((v & FX_MASK) == FX_TAG)
+         + tag_p (v, l->chr) + tag_p (v, l->bln) + (v == l->null);
+}
+
+// Whether V reads as exactly one type, and not as the values word.
+static bool
+valid_p (const layout_t *l, uint64_t v)
+{
+  return types (l, v) == 1 && (v & VALUES_MASK) != l->values;
+}
+
+// Whether every values word with tag T, whatever the number of values and
+// wherever they are kept, reads as none of the types.
+static bool
+values_valid_p (const layout_t *l, uint64_t t)
+{
+  for (uint64_t c = 0; c <= VALUES_MAX; c++)
+    for (uint64_t m = 0; m <= VALUES_MEMORY; m += VALUES_MEMORY)
+      if (types (l, t | m | (c << VALUES_COUNT_SHIFT)) != 0)
+        return false;
+  return true;
+}
+
+static bool
+immediates_valid_p (const layout_t *l)
+{
+  for (uint64_t p = 0; p < 0x100; p += PTR_MASK + 1)
+    if (!valid_p (l, p))
+      return false;
+
+  const int64_t fx_max = INT64_MAX >> FX_SHIFT, fx_min = INT64_MIN >> FX_SHIFT;
+  const int64_t fxs[] = { 0, fx_max, fx_min, fx_max - 1, fx_min + 1 };
+  for (size_t i = 0; i < sizeof fxs / sizeof fxs[0] + 0x200; i++)
+    {
+      int64_t n = i < sizeof fxs / sizeof fxs[0] ? fxs[i]
+                                                 : (int64_t) i - 0x100;
+      uint64_t v = ((uint64_t) n << FX_SHIFT) | FX_TAG;
+      if (!valid_p (l, v) || (int64_t) v >> FX_SHIFT != n)
+        return false;
+    }
+
+  for (uint64_t c = 0; c < 0x100; c++)
+    {
+      uint64_t v = (c << l->chr.shift) | l->chr.tag;
+      if (!tag_p (v, l->chr) || !valid_p (l, v) || v >> l->chr.shift != c)
+        return false;
+    }
+
+  for (uint64_t b = 0; b < 2; b++)
+    {
+      uint64_t v = (b << l->bln.shift) | l->bln.tag;
+      if (!tag_p (v, l->bln) || !valid_p (l, v) || v >> l->bln.shift != b)
+        return false;
+    }
+
+  return true;
+}
+
+// Completes the layout with the character and boolean shifts and masks
+// in L, returning false if no tags satisfy the constraints.
+static bool
+layout_complete (layout_t *l)
+{
+  for (l->chr.tag = 0; l->chr.tag <= l->chr.mask; l->chr.tag++)
+    for (l->bln.tag = 0; l->bln.tag <= l->bln.mask; l->bln.tag++)
+      {
+        if ((l->chr.tag & ~l->chr.mask) || (l->bln.tag & ~l->bln.mask))
+          continue;
+        l->null = 0;
+        l->values = 0;
+        for (uint64_t n = 1; n < 0x100 && !l->null; n++)
+          {
+            l->null = n;
+            if (!valid_p (l, n))
+              l->null = 0;
+          }
+        for (uint64_t t = 1; t <= VALUES_MASK && !l->values; t++)
+          if (values_valid_p (l, t))
+            l->values = t;
+        if (l->null && l->values && immediates_valid_p (l))
+          return true;
+      }
+  return false;
+}
+
+static void
+layout_print (FILE *f, const layout_t *l)
+{
+  fprintf (f, "/////////////////////////////////////////////////////\n");
+  fprintf (f, "// Generated by ptrtags.c\n");
+  fprintf (f, "// bitwidth: 64, tag bitwidth: 4, pointer mask: 0x%" PRIx64
+              "\n", PTR_MASK);
+  fprintf (f, "#define PTR_TAG UINT64_C (0)\n");
+  fprintf (f, "#define PTR_MASK UINT64_C (0x%" PRIx64 ")\n", PTR_MASK);
+  fprintf (f, "#define PTR_SHIFT UINT8_C (0)\n");
+  fprintf (f, "//\n");
+  fprintf (f, "#define FX_TAG UINT64_C (0x%" PRIx64 ")\n", FX_TAG);
+  fprintf (f, "#define FX_MASK UINT64_C (0x%" PRIx64 ")\n", FX_MASK);
+  fprintf (f, "#define FX_SHIFT UINT8_C (%d)\n", FX_SHIFT);
+  fprintf (f, "#define FX_MAX INT64_C (%" PRId64 ")\n", INT64_MAX >> FX_SHIFT);
+  fprintf (f, "#define FX_MIN INT64_C (%" PRId64 ")\n", INT64_MIN >> FX_SHIFT);
+  fprintf (f, "//\n");
+  fprintf (f, "#define CHAR_TAG UINT64_C (0x%" PRIx64 ")\n", l->chr.tag);
+  fprintf (f, "#define CHAR_MASK UINT64_C (0x%" PRIx64 ")\n", l->chr.mask);
+  fprintf (f, "#define CHAR_SHIFT UINT8_C (%u)\n", l->chr.shift);
+  fprintf (f, "//\n");
+  fprintf (f, "#define BOOL_TAG UINT64_C (0x%" PRIx64 ")\n", l->bln.tag);
+  fprintf (f, "#define BOOL_MASK UINT64_C (0x%" PRIx64 ")\n", l->bln.mask);
+  fprintf (f, "#define BOOL_SHIFT UINT8_C (%u)\n", l->bln.shift);
+  fprintf (f, "//\n");
+  fprintf (f, "#define NULL_CST UINT64_C (0x%" PRIx64 ")\n", l->null);
+  fprintf (f, "#define TRUE_CST UINT64_C (0x%" PRIx64 ")\n",
+           (UINT64_C (1) << l->bln.shift) | l->bln.tag);
+  fprintf (f, "#define FALSE_CST UINT64_C (0x%" PRIx64 ")\n", l->bln.tag);
+  fprintf (f, "//\n");
+  fprintf (f, "#define VALUES_TAG UINT64_C (0x%" PRIx64 ")\n", l->values);
+  fprintf (f, "//\n");
+  fprintf (f, "/////////////////////////////////////////////////////\n");
+}
+
+int
+main (int argc, char *argv[])
+{
+  if (argc != 2)
+    {
+      fprintf (stderr, "usage: %s directory\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  mkdir (argv[1], 0777);
+
+  // Candidates, as the shift and mask of characters and of booleans. The
+  // shifts are those of a scaled index, a byte, and the one of the layout
+  // that ptrtags.rkt solved for.
+  static const unsigned char_shifts[] = { 2, 3, 4, 8 };
+  static const unsigned bool_shifts[] = { 2, 3, 4, 8, 34 };
+  static const uint64_t masks[] = { 0x3, 0x7, 0xf };
+#define N(a) (sizeof (a) / sizeof ((a)[0]))
+
+  for (size_t cs = 0; cs < N (char_shifts); cs++)
+    for (size_t cm = 0; cm < N (masks); cm++)
+      for (size_t bs = 0; bs < N (bool_shifts); bs++)
+        for (size_t bm = 0; bm < N (masks); bm++)
+          {
+            layout_t l = { .chr = { .mask = masks[cm],
+                                    .shift = char_shifts[cs] },
+                           .bln = { .mask = masks[bm],
+                                    .shift = bool_shifts[bs] } };
+            if (!layout_complete (&l))
+              continue;
+
+            char path[4096];
+            snprintf (path, sizeof path, "%s/c%u-%" PRIx64 "-b%u-%" PRIx64
+                      ".h", argv[1], l.chr.shift, l.chr.mask, l.bln.shift,
+                      l.bln.mask);
+            FILE *f = fopen (path, "w");
+            if (!f)
+              {
+                perror (path);
+                return EXIT_FAILURE;
+              }
+            layout_print (f, &l);
+            fclose (f);
+            puts (path);
+          }
+  return EXIT_SUCCESS;
+}
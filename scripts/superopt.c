@@ -0,0 +1,576 @@
+// Superoptimizer for the code of the primitives in src/primitives.h.
+//
+// For each primitive, and each representation of its fixnum operands and
+// result that its emitter handles (tagged, or untagged with the tag bit
+// clear, see the untag pass), it finds the shortest sequence of
+// instructions, out of a subset of x86-64, that leaves the result in %rax
+// given the operands in the registers they are allocated to, which it
+// leaves alone, with %r8 as scratch. Every sequence of up to SEQ_LEN_MAX
+// instructions of the subset is tried by increasing length, so the first
+// one that gives the right result for a set of operands, and then for the
+// operands it is checked on, is the shortest in the subset. The checks
+// test it rather than prove it: every character, every pair of small
+// fixnums, the extreme ones and CHECKS random ones.
+//
+// The subset is moves, the ALU operations with register and immediate
+// operands, shifts, imul and lea, with immediates from -4 to 4. Predicates
+// are left out, since their result is in the flags.
+//
+// The sequences are written as src/superopt.h, which the emitters in
+// src/emit.c use for operands in registers, and the search is logged on
+// the standard output, see scripts/superopt.log. The layout is the one in
+// src/common.h.
+//
+//   make superopt
+
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SEQ_LEN_MAX 3
+#define TESTS 16
+#define CHECKS (1 << 20)
+
+// Machine
+//
+// Registers are %rax, where the result is left, %r8, and those of the
+// operands, which are only read.
+
+enum
+{
+  R_RAX,
+  R_R8,
+  R_A,
+  R_B,
+  R_NONE
+};
+
+#define REGS R_NONE
+#define WRITABLE 2
+
+static const char *reg_names[] = { "%0", "%1", "%2", "%3" };
+
+typedef enum
+{
+  OP_MOV,
+  OP_ADD,
+  OP_SUB,
+  OP_AND,
+  OP_OR,
+  OP_XOR,
+  OP_IMUL,
+  OP_NOT,
+  OP_NEG,
+  OP_MOV_IMM,
+  OP_ADD_IMM,
+  OP_AND_IMM,
+  OP_OR_IMM,
+  OP_XOR_IMM,
+  OP_IMUL_IMM,
+  OP_SHL,
+  OP_SAR,
+  OP_SHR,
+  OP_LEA
+} op_t;
+
+static const char *op_names[]
+    = { "movq", "addq", "subq",  "andq", "orq",  "xorq", "imulq",
+        "notq", "negq", "movq",  "addq", "andq", "orq",  "xorq",
+        "imulq", "shlq", "sarq", "shrq", "leaq" };
+
+// An instruction writes dst from src, and for lea also from idx times
+// scale, plus imm, which is also the count of shifts
+typedef struct
+{
+  op_t op;
+  unsigned char dst, src, idx, scale;
+  int64_t imm;
+} insn_t;
+
+static uint64_t
+insn_run (const insn_t *i, const uint64_t *r)
+{
+  const uint64_t d = r[i->dst], s = r[i->src], k = (uint64_t)i->imm;
+  switch (i->op)
+    {
+    case OP_MOV:
+      return s;
+    case OP_ADD:
+      return d + s;
+    case OP_SUB:
+      return d - s;
+    case OP_AND:
+      return d & s;
+    case OP_OR:
+      return d | s;
+    case OP_XOR:
+      return d ^ s;
+    case OP_IMUL:
+      return d * s;
+    case OP_NOT:
+      return ~d;
+    case OP_NEG:
+      return -d;
+    case OP_MOV_IMM:
+      return k;
+    case OP_ADD_IMM:
+      return d + k;
+    case OP_AND_IMM:
+      return d & k;
+    case OP_OR_IMM:
+      return d | k;
+    case OP_XOR_IMM:
+      return d ^ k;
+    case OP_IMUL_IMM:
+      return s * k;
+    case OP_SHL:
+      return d << k;
+    case OP_SAR:
+      return (uint64_t)((int64_t)d >> k);
+    case OP_SHR:
+      return d >> k;
+    case OP_LEA:
+      return (i->src == R_NONE ? 0 : s)
+             + (i->idx == R_NONE ? 0 : r[i->idx] * i->scale) + k;
+    }
+  abort ();
+}
+
+#define OPND_MAX 16
+
+// Writes the operands of i to args, in AT&T order, and returns how many
+static size_t
+insn_operands (const insn_t *i, char args[][OPND_MAX])
+{
+  const char *d = reg_names[i->dst];
+  const char *s = i->src == R_NONE ? "" : reg_names[i->src];
+  switch (i->op)
+    {
+    case OP_NOT:
+    case OP_NEG:
+      strcpy (args[0], d);
+      return 1;
+    case OP_MOV_IMM:
+    case OP_ADD_IMM:
+    case OP_AND_IMM:
+    case OP_OR_IMM:
+    case OP_XOR_IMM:
+    case OP_SHL:
+    case OP_SAR:
+    case OP_SHR:
+      snprintf (args[0], OPND_MAX, "$%" PRId64, i->imm);
+      strcpy (args[1], d);
+      return 2;
+    case OP_IMUL_IMM:
+      snprintf (args[0], OPND_MAX, "$%" PRId64, i->imm);
+      strcpy (args[1], s);
+      strcpy (args[2], d);
+      return 3;
+    case OP_LEA:
+      {
+        char disp[OPND_MAX] = "";
+        if (i->imm)
+          snprintf (disp, sizeof disp, "%" PRId64, i->imm);
+        if (i->idx == R_NONE)
+          snprintf (args[0], OPND_MAX, "%s(%s)", disp, s);
+        else if (i->scale == 1)
+          snprintf (args[0], OPND_MAX, "%s(%s,%s)", disp, s,
+                    reg_names[i->idx]);
+        else
+          snprintf (args[0], OPND_MAX, "%s(%s,%s,%u)", disp, s,
+                    reg_names[i->idx], i->scale);
+        strcpy (args[1], d);
+        return 2;
+      }
+    default:
+      strcpy (args[0], s);
+      strcpy (args[1], d);
+      return 2;
+    }
+}
+
+// Instructions of the subset, for operands in the first nregs registers
+static insn_t insns[4096];
+static size_t ninsns;
+
+static void
+insns_add (op_t op, unsigned dst, unsigned src, unsigned idx,
+           unsigned scale, int64_t imm)
+{
+  insns[ninsns++] = (insn_t){ op, dst, src, idx, scale, imm };
+}
+
+// Cheaper instructions come first, so that of the shortest sequences the
+// first one found uses them
+static void
+insns_init (unsigned nregs)
+{
+  static const unsigned shifts[] = { 1, 2, 3, 63 };
+  ninsns = 0;
+  for (op_t op = OP_MOV; op <= OP_XOR; op++)
+    for (unsigned d = 0; d < WRITABLE; d++)
+      for (unsigned s = 0; s < nregs; s++)
+        if (s != d)
+          insns_add (op, d, s, R_NONE, 0, 0);
+  for (unsigned d = 0; d < WRITABLE; d++)
+    {
+      insns_add (OP_NOT, d, d, R_NONE, 0, 0);
+      insns_add (OP_NEG, d, d, R_NONE, 0, 0);
+    }
+  for (op_t op = OP_MOV_IMM; op <= OP_XOR_IMM; op++)
+    for (unsigned d = 0; d < WRITABLE; d++)
+      for (int64_t k = -4; k <= 4; k++)
+        if (k || op == OP_MOV_IMM)
+          insns_add (op, d, d, R_NONE, 0, k);
+  for (op_t op = OP_SHL; op <= OP_SHR; op++)
+    for (unsigned d = 0; d < WRITABLE; d++)
+      for (size_t n = 0; n < sizeof shifts / sizeof shifts[0]; n++)
+        insns_add (op, d, d, R_NONE, 0, shifts[n]);
+
+  // lea with a base, then with an index too, then with a scaled one
+  for (unsigned d = 0; d < WRITABLE; d++)
+    for (unsigned s = 0; s < nregs; s++)
+      for (int64_t k = -4; k <= 4; k++)
+        if (k)
+          insns_add (OP_LEA, d, s, R_NONE, 1, k);
+  for (unsigned scale = 1; scale <= 8; scale *= 2)
+    for (unsigned d = 0; d < WRITABLE; d++)
+      for (unsigned s = 0; s <= nregs; s++)
+        for (unsigned x = 0; x < nregs; x++)
+          for (int64_t k = -4; k <= 4; k++)
+            if (s < nregs || scale > 1)
+              insns_add (OP_LEA, d, s < nregs ? s : R_NONE, x, scale, k);
+
+  for (unsigned d = 0; d < WRITABLE; d++)
+    for (unsigned s = 0; s < nregs; s++)
+      {
+        if (s != d)
+          insns_add (OP_IMUL, d, s, R_NONE, 0, 0);
+        for (int64_t k = -4; k <= 4; k++)
+          if (k)
+            insns_add (OP_IMUL_IMM, d, s, R_NONE, 0, k);
+      }
+}
+
+// Primitives
+//
+// A fixnum n is kept as 2n plus its tag bit, 0 if it is untagged, and a
+// character c as c shifted by CHAR_SHIFT plus its tag.
+
+typedef enum
+{
+  K_FX,
+  K_CHAR
+} kind_t;
+
+typedef struct
+{
+  const char *name;
+  unsigned nargs;
+  kind_t arg, result;
+  bool untagged_args, untagged_result;
+  uint64_t (*fn) (uint64_t, uint64_t);
+} prim_t;
+
+static uint64_t fn_add1 (uint64_t a, uint64_t b) { (void) b; return a + 1; }
+static uint64_t fn_sub1 (uint64_t a, uint64_t b) { (void) b; return a - 1; }
+static uint64_t fn_not (uint64_t a, uint64_t b) { (void) b; return ~a; }
+static uint64_t fn_id (uint64_t a, uint64_t b) { (void) b; return a; }
+static uint64_t fn_add (uint64_t a, uint64_t b) { return a + b; }
+static uint64_t fn_sub (uint64_t a, uint64_t b) { return a - b; }
+static uint64_t fn_mul (uint64_t a, uint64_t b) { return a * b; }
+static uint64_t fn_and (uint64_t a, uint64_t b) { return a & b; }
+static uint64_t fn_or (uint64_t a, uint64_t b) { return a | b; }
+static uint64_t fn_xor (uint64_t a, uint64_t b) { return a ^ b; }
+
+static const prim_t prims[]
+    = { { "fxadd1", 1, K_FX, K_FX, true, true, fn_add1 },
+        { "fxsub1", 1, K_FX, K_FX, true, true, fn_sub1 },
+        { "fxlognot", 1, K_FX, K_FX, true, true, fn_not },
+        { "char->fixnum", 1, K_CHAR, K_FX, false, true, fn_id },
+        { "fixnum->char", 1, K_FX, K_CHAR, true, false, fn_id },
+        { "fx+", 2, K_FX, K_FX, true, true, fn_add },
+        { "fx-", 2, K_FX, K_FX, true, true, fn_sub },
+        { "fx*", 2, K_FX, K_FX, true, true, fn_mul },
+        { "fxlogand", 2, K_FX, K_FX, true, true, fn_and },
+        { "fxlogor", 2, K_FX, K_FX, true, true, fn_or },
+        { "fxlogxor", 2, K_FX, K_FX, true, true, fn_xor } };
+
+#define NPRIMS (sizeof prims / sizeof prims[0])
+
+// The primitive being searched, and whether its operands and result are
+// tagged
+static const prim_t *prim;
+static bool tagged[3];
+
+static uint64_t
+encode (kind_t kind, uint64_t v, bool t)
+{
+  if (kind == K_CHAR)
+    return (v << CHAR_SHIFT) | CHAR_TAG;
+  return (v << FX_SHIFT) | (t ? FX_TAG : 0);
+}
+
+// Characters have 8 bit codes, and fixnum->char takes one of those, so
+// other operands are cut down to them
+static uint64_t
+operand (uint64_t v)
+{
+  if (prim->arg == K_CHAR || prim->result == K_CHAR)
+    return v & 0xff;
+  return (uint64_t)((int64_t)(v << FX_SHIFT) >> FX_SHIFT);
+}
+
+// Registers for the operands a and b, and the result wanted
+static void
+setup (uint64_t a, uint64_t b, uint64_t scratch, uint64_t *r, uint64_t *want)
+{
+  a = operand (a);
+  b = operand (b);
+  r[R_RAX] = scratch;
+  r[R_R8] = ~scratch;
+  r[R_A] = encode (prim->arg, a, tagged[0]);
+  r[R_B] = encode (prim->arg, b, tagged[1]);
+  *want = encode (prim->result, prim->fn (a, b), tagged[2]);
+}
+
+static uint64_t
+rand64 (void)
+{
+  static uint64_t x = 0x9e3779b97f4a7c15;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return x;
+}
+
+static const uint64_t edges[]
+    = { 0, 1, 2, 0xff, ~UINT64_C (0), (uint64_t)FX_MAX, (uint64_t)FX_MIN,
+        (uint64_t)FX_MAX - 1, (uint64_t)FX_MIN + 1 };
+#define NEDGES (sizeof edges / sizeof edges[0])
+
+static uint64_t tests[TESTS][REGS], wants[TESTS];
+
+static void
+tests_init (void)
+{
+  for (size_t t = 0; t < TESTS; t++)
+    setup (t < NEDGES ? edges[t] : rand64 (), rand64 (), rand64 (),
+           tests[t], &wants[t]);
+}
+
+// Runs seq on a and b, and returns whether it leaves the result wanted
+static bool
+check (const insn_t *seq, size_t len, uint64_t a, uint64_t b)
+{
+  uint64_t r[REGS], want;
+  setup (a, b, rand64 (), r, &want);
+  for (size_t i = 0; i < len; i++)
+    r[seq[i].dst] = insn_run (&seq[i], r);
+  return r[R_RAX] == want;
+}
+
+// Checks seq, and returns the number of operands it is checked on, or 0
+// if it fails on any
+static size_t
+check_all (const insn_t *seq, size_t len)
+{
+  size_t n = 0;
+  for (uint64_t a = 0; a < 0x100; a++, n++)
+    if (!check (seq, len, a, a ^ 0x5a))
+      return 0;
+  for (int64_t a = -64; a < 64; a++)
+    for (int64_t b = -64; b < 64; b++, n++)
+      if (!check (seq, len, (uint64_t)a, (uint64_t)b))
+        return 0;
+  for (size_t a = 0; a < NEDGES; a++)
+    for (size_t b = 0; b < NEDGES; b++, n++)
+      if (!check (seq, len, edges[a], edges[b]))
+        return 0;
+  for (size_t i = 0; i < CHECKS; i++, n++)
+    if (!check (seq, len, rand64 (), rand64 ()))
+      return 0;
+  return n;
+}
+
+static insn_t seq[SEQ_LEN_MAX];
+static size_t candidates, checked;
+
+// Searches the instructions of seq from depth on, given the registers
+// for each test, and returns whether it found a sequence of len
+static bool
+search (size_t depth, size_t len, uint64_t (*regs)[REGS])
+{
+  for (size_t n = 0; n < ninsns; n++)
+    {
+      const insn_t *i = &insns[n];
+      seq[depth] = *i;
+      if (depth + 1 == len)
+        {
+          if (i->dst != R_RAX)
+            continue;
+          candidates++;
+          size_t t = 0;
+          while (t < TESTS && insn_run (i, regs[t]) == wants[t])
+            t++;
+          if (t < TESTS)
+            continue;
+          if ((checked = check_all (seq, len)))
+            return true;
+          continue;
+        }
+
+      uint64_t next[TESTS][REGS];
+      memcpy (next, regs, sizeof next);
+      for (size_t t = 0; t < TESTS; t++)
+        next[t][i->dst] = insn_run (i, regs[t]);
+      if (search (depth + 1, len, next))
+        return true;
+    }
+  return false;
+}
+
+// Writes the entry of the sequence found to h, and logs it
+static void
+found (FILE *h, size_t len)
+{
+  fprintf (h, "  { \"%s\", { %d, %d, %d },\n    { ", prim->name,
+           tagged[0], tagged[1], tagged[2]);
+  for (size_t i = 0; i < len; i++)
+    {
+      char args[3][OPND_MAX];
+      const size_t n = insn_operands (&seq[i], args);
+      fprintf (h, "%s{ \"%s\", { ", i ? ",\n      " : "",
+               op_names[seq[i].op]);
+      printf ("    %-6s", op_names[seq[i].op]);
+      for (size_t a = 0; a < n; a++)
+        {
+          fprintf (h, "%s\"%s\"", a ? ", " : "", args[a]);
+          printf ("%s%s", a ? ", " : " ", args[a]);
+        }
+      fprintf (h, " } }");
+      printf ("\n");
+    }
+  fprintf (h, " } },\n");
+  printf ("  %zu instructions, %zu candidates, checked on %zu operands\n",
+          len, candidates, checked);
+}
+
+static const char *license
+    = "/*\n"
+      " * Copyright 2020 Paulo Matos\n"
+      " *\n"
+      " * Licensed under the Apache License, Version 2.0 (the \"License\");\n"
+      " * you may not use this file except in compliance with the "
+      "License.\n"
+      " * You may obtain a copy of the License at\n"
+      " *\n"
+      " *     http://www.apache.org/licenses/LICENSE-2.0\n"
+      " *\n"
+      " * Unless required by applicable law or agreed to in writing, "
+      "software\n"
+      " * distributed under the License is distributed on an \"AS IS\" "
+      "BASIS,\n"
+      " * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or "
+      "implied.\n"
+      " * See the License for the specific language governing permissions "
+      "and\n"
+      " * limitations under the License.\n"
+      " */\n";
+
+int
+main (int argc, char *argv[])
+{
+  if (argc != 2)
+    {
+      fprintf (stderr, "usage: %s header\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  FILE *h = fopen (argv[1], "w");
+  if (!h)
+    {
+      perror (argv[1]);
+      return EXIT_FAILURE;
+    }
+
+  fprintf (h, "%s\n", license);
+  fprintf (h, "// Generated by scripts/superopt.c, see make superopt.\n"
+              "//\n"
+              "// Shortest sequences for the primitives with their operands "
+              "in the\n"
+              "// registers they are allocated to, by whether the operands "
+              "and the\n"
+              "// result are tagged, with the second operand of a unary "
+              "primitive\n"
+              "// taken as tagged. The result is left in %%0, which is "
+              "%%rax, %%1 is\n"
+              "// %%r8, and %%2 and %%3 are the registers of the operands.\n"
+              "\n"
+              "#pragma once\n"
+              "#include <stdbool.h>\n"
+              "#include <stddef.h>\n"
+              "\n"
+              "#define SUPEROPT_LEN_MAX %d\n"
+              "\n"
+              "// The layout of fixnums and characters the sequences are "
+              "for\n"
+              "#define SUPEROPT_FX_TAG 0x%" PRIx64 "\n"
+              "#define SUPEROPT_FX_SHIFT %d\n"
+              "#define SUPEROPT_CHAR_TAG 0x%" PRIx64 "\n"
+              "#define SUPEROPT_CHAR_SHIFT %d\n"
+              "\n"
+              "typedef struct\n"
+              "{\n"
+              "  const char *op;\n"
+              "  const char *args[3]; // Up to NULL\n"
+              "} superopt_insn_t;\n"
+              "\n"
+              "typedef struct\n"
+              "{\n"
+              "  const char *prim;     // Name of the primitive\n"
+              "  bool tagged[3];       // Whether the operands and result "
+              "are tagged\n"
+              "  superopt_insn_t insns[SUPEROPT_LEN_MAX + 1]; // Up to no op\n"
+              "} superopt_seq_t;\n"
+              "\n"
+              "static const superopt_seq_t superopt_seqs[] = {\n",
+           SEQ_LEN_MAX, FX_TAG, FX_SHIFT, CHAR_TAG, CHAR_SHIFT);
+
+  for (size_t p = 0; p < NPRIMS; p++)
+    {
+      prim = &prims[p];
+      insns_init (R_A + prim->nargs);
+      for (int ta = 1; ta >= !prim->untagged_args; ta--)
+        for (int tb = 1; tb >= (prim->nargs == 1 ? 1 : !prim->untagged_args);
+             tb--)
+          for (int tr = 1; tr >= !prim->untagged_result; tr--)
+            {
+              tagged[0] = ta;
+              tagged[1] = tb;
+              tagged[2] = tr;
+              printf ("%s, %s", prim->name, ta ? "tagged" : "untagged");
+              if (prim->nargs == 2)
+                printf (" and %s", tb ? "tagged" : "untagged");
+              printf (" operands, %s result:\n",
+                      tr ? "tagged" : "untagged");
+              fflush (stdout);
+
+              tests_init ();
+              candidates = 0;
+              size_t len;
+              for (len = 1; len <= SEQ_LEN_MAX; len++)
+                if (search (0, len, tests))
+                  break;
+              if (len <= SEQ_LEN_MAX)
+                found (h, len);
+              else
+                printf ("  none of up to %d instructions, %zu candidates\n",
+                        SEQ_LEN_MAX, candidates);
+            }
+    }
+
+  fprintf (h, "};\n");
+  fclose (h);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "err.h"
+#include "ir.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section IR Analysis
+//
+// Queries about IR values and instructions shared by the passes.
+//
+///////////////////////////////////////////////////////////////////////
+
+// vtype_of_imm: returns the type of the immediate imm
+vtype_t
+vtype_of_imm (schptr_t imm)
+{
+  if (sch_imm_fixnum_p (imm))
+    return VT_FIXNUM;
+  if (sch_imm_char_p (imm))
+    return VT_CHAR;
+  if (sch_imm_true_p (imm))
+    return VT_TRUE;
+  if (sch_imm_false_p (imm))
+    return VT_FALSE;
+  if (sch_imm_null_p (imm))
+    return VT_NULL;
+  return VT_OTHER;
+}
+
+// ir_insn_effects: returns the effects of evaluating instruction i.
+// The effects of a conditional are those of any of its arms, and those
+// of a loop the ones of its body, plus raising: a loop that never ends
+// must not be removed either. A division raises unless it is by a
+// constant other than 0.
+effects_t
+ir_insn_effects (const ir_insn_t *i)
+{
+  switch (i->op)
+    {
+    case IR_PRIM:
+      if (i->prim->effects & EFFECT_DIVIDE)
+        {
+          const ir_opnd_t d = i->args[i->nargs - 1];
+          const effects_t e = i->prim->effects & ~EFFECT_DIVIDE;
+          if (d.kind == IR_OPND_IMM && sch_decode_imm_fixnum (d.imm))
+            return e;
+          return e | EFFECT_RAISE;
+        }
+      return i->prim->effects;
+    case IR_MOVE:
+      return EFFECT_NONE;
+    case IR_IF:
+      return ir_block_effects (i->thenb) | ir_block_effects (i->elseb);
+    case IR_CHECK:
+      return EFFECT_RAISE;
+    case IR_CLOSURE:
+      return EFFECT_ALLOC;
+    case IR_FREF:
+    case IR_DATA:
+    case IR_VALUES:
+    case IR_VREF:
+      return EFFECT_NONE;
+    case IR_RECEIVE:
+      return i->checked ? EFFECT_RAISE : EFFECT_NONE;
+    case IR_CALL:
+    case IR_CALL_KNOWN:
+    case IR_CALL_VALUES:
+      // Anything could happen in the procedure
+      return EFFECT_RAISE | EFFECT_WRITE | EFFECT_ALLOC;
+    case IR_LOOP:
+      return ir_block_effects (i->body) | EFFECT_RAISE;
+    case IR_CONTINUE:
+      // Accounted for by the loop
+      return EFFECT_NONE;
+    case IR_SWITCH:
+      {
+        effects_t e = EFFECT_NONE;
+        for (size_t k = 0; k < i->narms; k++)
+          e |= ir_block_effects (i->arms[k]);
+        return e;
+      }
+    }
+  err_unreachable ("unknown instruction");
+}
+
+effects_t
+ir_block_effects (const ir_block_t *b)
+{
+  effects_t e = EFFECT_NONE;
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    e |= ir_insn_effects (i);
+  return e;
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Type Checks
+//
+// Safe mode: every argument of a primitive that is not statically known
+// to have the type the primitive expects goes through an IR_CHECK first.
+// The check tests the argument where it is kept, and the primitive goes
+// on using it: the types pass knows it to have the right type in the
+// region the check dominates. A check on a constant, which always fails,
+// defines a new temporary that replaces the constant in the primitive,
+// so that no pass sees the primitive applied to a constant of the wrong
+// type. Checks can raise, so they are never removed as dead code, but the
+// types pass removes those on values whose type is already known, for
+// example because an earlier check or primitive application dominates
+// them.
+//
+// Primitives that may raise, like generic arithmetic, check their
+// arguments themselves and get no IR_CHECK.
+//
+// A check that both arms of a conditional start with, on the same value
+// and for the same type, is hoisted in front of the conditional, and the
+// one in the else arm becomes a move of its result. The arms are then
+// left without anything that raises, so that the cmov pass can still
+// select between them. Only instructions without effects may come before
+// such checks in the arms, so no effect happens before the error that it
+// would not happen before otherwise; the error names the primitive of the
+// then arm.
+//
+// Calls are marked as checked instead: the emitter then verifies that the
+// operator is a procedure that takes as many arguments as it is given.
+// So are the receivers of multiple values, which then verify that there
+// are as many as they take.
+//
+///////////////////////////////////////////////////////////////////////
+
+typedef struct checks
+{
+  ir_proc_t *p;
+  size_t inserted;
+  size_t hoisted;
+  size_t calls;
+} checks_t;
+
+// True if i neither raises nor has any other effect
+static bool
+checks_pure_p (const ir_insn_t *i)
+{
+  return i->op == IR_MOVE
+         || (i->op == IR_PRIM && ir_insn_effects (i) == EFFECT_NONE);
+}
+
+// Returns the check of o for type t that block b starts with, after
+// instructions without effects that do not define o, or NULL
+static ir_insn_t *
+checks_leading (const ir_block_t *b, ir_opnd_t o, vtype_t t)
+{
+  for (ir_insn_t *i = b->first; i; i = i->next)
+    {
+      if (i->op == IR_CHECK && ir_opnd_eq (i->args[0], o)
+          && i->prim->atype == t)
+        return i;
+      if (!checks_pure_p (i) || (o.kind == IR_OPND_TEMP && i->dst == o.temp))
+        return NULL;
+    }
+  return NULL;
+}
+
+static void
+checks_unlink (ir_block_t *b, ir_insn_t *c)
+{
+  ir_insn_t *prev = NULL;
+  for (ir_insn_t *i = b->first; i != c; i = i->next)
+    prev = i;
+  if (prev)
+    prev->next = c->next;
+  else
+    b->first = c->next;
+  if (b->last == c)
+    b->last = prev;
+  c->next = NULL;
+}
+
+// Inserts check c in block b before the instructions without effects that
+// it ends with, which compute the test of the conditional after them, so
+// that the test stays next to it, but after the one that defines what c
+// checks
+static void
+checks_insert (ir_block_t *b, ir_insn_t *c)
+{
+  const ir_opnd_t o = c->args[0];
+  ir_insn_t *at = NULL;
+  for (ir_insn_t *i = b->first; i; i = i->next)
+    if (!checks_pure_p (i) || (o.kind == IR_OPND_TEMP && i->dst == o.temp))
+      at = i;
+
+  if (!at)
+    {
+      c->next = b->first;
+      b->first = c;
+    }
+  else
+    {
+      c->next = at->next;
+      at->next = c;
+    }
+  if (!c->next)
+    b->last = c;
+}
+
+// Hoists the checks that both arms of conditional i start with into block
+// b, which ends with its test, see above
+static void
+checks_hoist (checks_t *s, ir_block_t *b, ir_insn_t *i)
+{
+  for (;;)
+    {
+      ir_insn_t *c = i->thenb->first;
+      while (c && checks_pure_p (c))
+        c = c->next;
+      if (!c || c->op != IR_CHECK)
+        return;
+
+      const vtype_t t = c->prim->atype;
+      ir_insn_t *e = checks_leading (i->elseb, c->args[0], t);
+      if (checks_leading (i->thenb, c->args[0], t) != c || !e)
+        return;
+
+      checks_unlink (i->thenb, c);
+      checks_insert (b, c);
+      e->op = IR_MOVE;
+      e->prim = NULL;
+      e->args[0] = ir_opnd_temp (c->dst);
+      s->hoisted++;
+    }
+}
+
+static void
+checks_block (checks_t *s, ir_block_t *b)
+{
+  ir_insn_t *i = b->first;
+
+  b->first = NULL;
+  b->last = NULL;
+  while (i)
+    {
+      ir_insn_t *next = i->next;
+
+      if (i->op == IR_IF)
+        {
+          checks_block (s, i->thenb);
+          checks_block (s, i->elseb);
+          checks_hoist (s, b, i);
+        }
+      else if (i->op == IR_LOOP)
+        checks_block (s, i->body);
+      else if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          checks_block (s, i->arms[k]);
+      else if (i->op == IR_CALL || i->op == IR_CALL_VALUES)
+        {
+          i->checked = true;
+          s->calls++;
+        }
+      else if (i->op == IR_RECEIVE)
+        i->checked = true;
+      else if (i->op == IR_PRIM && i->prim->atype != VT_ANY
+               && !(i->prim->effects & EFFECT_RAISE))
+        for (size_t a = 0; a < i->nargs; a++)
+          {
+            ir_opnd_t o = i->args[a];
+            if (o.kind == IR_OPND_IMM
+                && !(vtype_of_imm (o.imm) & ~i->prim->atype))
+              continue;
+
+            ir_insn_t *c
+                = ir_make_insn (IR_CHECK, ir_new_temp (s->p, NULL), 1);
+            c->prim = i->prim;
+            c->args[0] = o;
+            ir_block_append (b, c);
+
+            if (o.kind == IR_OPND_IMM)
+              i->args[a] = ir_opnd_temp (c->dst);
+            s->inserted++;
+          }
+
+      ir_block_append (b, i);
+      i = next;
+    }
+}
+
+void
+pass_checks (ir_proc_t *p)
+{
+  checks_t s = { p, 0, 0, 0 };
+  checks_block (&s, p->body);
+  pass_record_stat ("checks", "checks inserted", s.inserted);
+  pass_record_stat ("checks", "checks hoisted", s.hoisted);
+  pass_record_stat ("checks", "calls checked", s.calls);
+}
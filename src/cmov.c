@@ -0,0 +1,196 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "memory.h"
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section If Conversion
+//
+// Turns the conditionals whose arms are cheap and have no effects into
+// selects, which the emitter takes with a cmov instead of a branch. The
+// instructions of both arms move before the test, so that they are
+// evaluated whatever it is, leaving the arms with only their values. The
+// test stays right before the conditional, to be fused into it, along
+// with the predicates and nots it is made of. Conditionals that test
+// other conditionals, as and and or do, still branch, and so do the ones
+// that are only the test of the instruction after them.
+//
+// A branch that the processor mispredicts costs about as much as a dozen
+// simple instructions, while a select costs the instructions of the arm
+// that is not taken. Both arms are evaluated when their costs add up to
+// at most CMOV_COST_MAX, where an instruction costs 1, or 3 for a
+// predicate, which has to turn its flags into a boolean. With -f
+// cmov-force the costs are not limited, to find out whether a branch
+// that the processor cannot predict is better off as a select anyway.
+//
+///////////////////////////////////////////////////////////////////////
+
+#define CMOV_COST_MAX 4
+
+typedef struct cmov
+{
+  ir_proc_t *p;
+  size_t cost_max;
+  size_t selected;
+} cmov_t;
+
+// Returns the cost of evaluating block b whatever the test, or SIZE_MAX
+// if it may not be
+static size_t
+cmov_cost (const ir_block_t *b)
+{
+  size_t n = 0;
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      if (i->op == IR_MOVE)
+        n += 1;
+      else if (i->op == IR_PRIM && ir_insn_effects (i) == EFFECT_NONE)
+        n += i->prim->tester ? 3 : 1;
+      else
+        return SIZE_MAX;
+    }
+  return n;
+}
+
+// True if instruction i defines the first operand of instruction u
+static bool
+cmov_feeds_p (const ir_insn_t *i, const ir_insn_t *u)
+{
+  return u->nargs && u->args[0].kind == IR_OPND_TEMP
+         && u->args[0].temp == i->dst;
+}
+
+// True if an instruction of block b uses a temporary defined by one of
+// the n instructions in v
+static bool
+cmov_uses_p (const ir_block_t *b, ir_insn_t **v, size_t n)
+{
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    for (size_t a = 0; a < i->nargs; a++)
+      for (size_t k = 0; k < n; k++)
+        if (i->args[a].kind == IR_OPND_TEMP && i->args[a].temp == v[k]->dst)
+          return true;
+  return false;
+}
+
+// Returns the index in v where the arms of conditional v[k] move to, which
+// is the first of the predicates right before it that make its test, or n
+// if it stays a branch, given the most the arms may cost together
+static size_t
+cmov_hoist_at (ir_insn_t **v, size_t k, size_t n, size_t cost_max)
+{
+  const ir_insn_t *c = v[k];
+  if (c->args[0].kind != IR_OPND_TEMP)
+    return n;
+  const size_t t = cmov_cost (c->thenb);
+  const size_t e = cmov_cost (c->elseb);
+  if (t == SIZE_MAX || e == SIZE_MAX || t + e > cost_max)
+    return n;
+  if (k + 1 < n && cmov_feeds_p (c, v[k + 1])
+      && (v[k + 1]->op == IR_IF
+          || (v[k + 1]->op == IR_PRIM && v[k + 1]->prim->tester)))
+    return n;
+
+  size_t s = k;
+  while (s > 0 && cmov_feeds_p (v[s - 1], v[s]))
+    {
+      if (v[s - 1]->op == IR_IF)
+        return n;
+      if (v[s - 1]->op != IR_PRIM || !v[s - 1]->prim->tester)
+        break;
+      s--;
+    }
+
+  // The arms cannot move before what they use
+  if (cmov_uses_p (c->thenb, v + s, k - s)
+      || cmov_uses_p (c->elseb, v + s, k - s))
+    s = k;
+  return s;
+}
+
+static void
+cmov_block (cmov_t *s, ir_block_t *b)
+{
+  size_t n = 0;
+  for (ir_insn_t *i = b->first; i; i = i->next)
+    {
+      n++;
+      if (i->op == IR_IF)
+        {
+          cmov_block (s, i->thenb);
+          cmov_block (s, i->elseb);
+        }
+      if (i->op == IR_LOOP)
+        cmov_block (s, i->body);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          cmov_block (s, i->arms[k]);
+    }
+
+  ir_insn_t **v = alloc ((n + 1) * sizeof (*v));
+  size_t *hoisted = alloc ((n + 1) * sizeof (*hoisted));
+  size_t k = 0;
+  for (ir_insn_t *i = b->first; i; i = i->next)
+    {
+      hoisted[k] = n;
+      v[k++] = i;
+    }
+
+  // hoisted[j] is the conditional whose arms move before v[j], if any,
+  // which is at most one since their tests do not overlap
+  for (k = 0; k < n; k++)
+    if (v[k]->op == IR_IF)
+      {
+        const size_t at = cmov_hoist_at (v, k, n, s->cost_max);
+        if (at < n)
+          hoisted[at] = k;
+      }
+
+  b->first = NULL;
+  b->last = NULL;
+  for (size_t j = 0; j < n; j++)
+    {
+      if (hoisted[j] < n)
+        {
+          ir_insn_t *c = v[hoisted[j]];
+          ir_block_splice (b, c->thenb);
+          ir_block_splice (b, c->elseb);
+          c->select = true;
+          s->selected++;
+        }
+      ir_block_append (b, v[j]);
+    }
+
+  free (v);
+  free (hoisted);
+}
+
+void
+pass_cmov (ir_proc_t *p)
+{
+  cmov_t s;
+  s.p = p;
+  s.cost_max = pass_enabled_p ("cmov-force", 0) ? SIZE_MAX - 1 : CMOV_COST_MAX;
+  s.selected = 0;
+
+  cmov_block (&s, p->body);
+  pass_record_stat ("cmov", "conditionals selected", s.selected);
+}
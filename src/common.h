@@ -16,6 +16,7 @@
 #pragma once
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -67,8 +68,16 @@ arch_64_p (void)
 // We just need a non-zero tag for all immediates that live on those
 // bits.
 
+// The layout below is the first of those that scripts/ptrtags.c writes
+// that emits the fewest instructions for the micro-benchmarks and the
+// tests, as make bench-layouts counts them, see scripts/layouts.log.
+// Building with PTRTAGS set to another header it writes uses that layout
+// instead.
+#ifdef PTRTAGS
+#include PTRTAGS
+#else
 /////////////////////////////////////////////////////
-// Generated by ptrtags.rkt
+// Generated by ptrtags.c
 // bitwidth: 64, tag bitwidth: 4, pointer mask: 0x7
 #define PTR_TAG UINT64_C (0)
 #define PTR_MASK UINT64_C (0x7)
@@ -81,18 +90,41 @@ arch_64_p (void)
 #define FX_MIN INT64_C (-4611686018427387904)
 //
 #define CHAR_TAG UINT64_C (0x2)
-#define CHAR_MASK UINT64_C (0x3)
-#define CHAR_SHIFT UINT8_C (2)
+#define CHAR_MASK UINT64_C (0x7)
+#define CHAR_SHIFT UINT8_C (3)
 //
 #define BOOL_TAG UINT64_C (0x4)
-#define BOOL_MASK UINT64_C (0xf)
-#define BOOL_SHIFT UINT8_C (34)
+#define BOOL_MASK UINT64_C (0x7)
+#define BOOL_SHIFT UINT8_C (3)
 //
-#define NULL_CST UINT64_C (0xc)
-#define TRUE_CST UINT64_C (0x400000004)
+#define NULL_CST UINT64_C (0x6)
+#define TRUE_CST UINT64_C (0xc)
 #define FALSE_CST UINT64_C (0x4)
 //
+#define VALUES_TAG UINT64_C (0xe)
+//
 /////////////////////////////////////////////////////
+#endif
+
+// These are the layouts scripts/ptrtags.c searches. Pointers are used
+// untagged by the heap and the runtime, the fixnum fast paths of the
+// emitters rely on fixnums having a single tag bit, which is set, and the
+// conversions between characters and fixnums on characters having at least
+// as many tag bits as fixnums. Characters and booleans have at most four
+// tag bits. The values word, see below, reads as none of the types.
+_Static_assert (PTR_TAG == 0 && PTR_MASK == 7, "pointers are untagged");
+_Static_assert (FX_MASK == 1 && FX_TAG == FX_MASK && FX_SHIFT == 1,
+                "fixnums have one tag bit, which is set");
+_Static_assert (CHAR_SHIFT >= FX_SHIFT,
+                "characters have at least as many tag bits as fixnums");
+_Static_assert (CHAR_MASK <= 0xf && BOOL_MASK <= 0xf,
+                "characters and booleans have at most four tag bits");
+_Static_assert ((VALUES_TAG & PTR_MASK) != PTR_TAG
+                    && (VALUES_TAG & FX_MASK) != FX_TAG
+                    && (VALUES_TAG & CHAR_MASK) != CHAR_TAG
+                    && (VALUES_TAG & BOOL_MASK) != BOOL_TAG
+                    && VALUES_TAG != NULL_CST,
+                "the values word is not a value");
 
 // This header contains common declaration to be used by both the
 // compiler and the runtime.
@@ -109,6 +141,59 @@ sch_ptr_p (schptr_t sptr)
   return (sptr & PTR_MASK) == PTR_TAG;
 }
 
+//
+// Heap objects
+//
+// Every object in the heap starts with a header word that keeps the type
+// of the object in its low byte.
+//
+
+#define HEAP_TYPE_MASK UINT64_C (0xff)
+#define HEAP_BIGNUM UINT64_C (0x1)
+#define HEAP_CLOSURE UINT64_C (0x2)
+
+// A closure is its header, with the number of arguments the procedure
+// takes above CLOSURE_ARITY_SHIFT, followed by the address of the code of
+// the procedure and the values of its free variables.
+#define CLOSURE_ARITY_SHIFT 16
+#define CLOSURE_CODE_OFFSET 8
+#define CLOSURE_FREE_OFFSET 16
+
+// A bignum is its header, with the sign in BIGNUM_SIGN and the number of
+// limbs of its magnitude above BIGNUM_SIZE_SHIFT, followed by the limbs,
+// least significant first.
+#define BIGNUM_SIGN UINT64_C (0x100)
+#define BIGNUM_SIZE_SHIFT 16
+
+//
+// Multiple values
+//
+// Any number of values other than one is a single word with VALUES_TAG,
+// which is part of the layout above, in its low byte, which no other value
+// has, and the number of values above VALUES_COUNT_SHIFT. A procedure
+// returns the first VALUES_REGS of them in the registers that take the
+// arguments of a call after the closure, and the others in runtime_values,
+// at their index. With VALUES_MEMORY set, all of them are in
+// runtime_values instead, which is how they are kept anywhere else than on
+// the way back from a procedure.
+#define VALUES_MASK UINT64_C (0xff)
+#define VALUES_MEMORY UINT64_C (0x100)
+#define VALUES_COUNT_SHIFT 16
+#define VALUES_REGS 5
+#define VALUES_MAX 256
+
+static inline bool
+sch_values_p (schptr_t sptr)
+{
+  return (sptr & VALUES_MASK) == VALUES_TAG;
+}
+
+static inline size_t
+sch_values_count (schptr_t sptr)
+{
+  return sch_values_p (sptr) ? sptr >> VALUES_COUNT_SHIFT : 1;
+}
+
 //
 // Immediates
 //
@@ -218,3 +303,64 @@ sch_decode_imm_char (schptr_t sptr)
 {
   return sptr >> CHAR_SHIFT;
 }
+
+//
+// Printing
+//
+
+static inline void
+sch_print_char (FILE *f, unsigned char code)
+{
+  switch (code)
+    {
+    case 0x7:
+      fprintf (f, "#\\alarm");
+      break;
+    case 0x8:
+      fprintf (f, "#\\backspace");
+      break;
+    case 0x7f:
+      fprintf (f, "#\\delete");
+      break;
+    case 0x1b:
+      fprintf (f, "#\\escape");
+      break;
+    case 0xa:
+      fprintf (f, "#\\newline");
+      break;
+    case 0x0:
+      fprintf (f, "#\\null");
+      break;
+    case 0xd:
+      fprintf (f, "#\\return");
+      break;
+    case ' ':
+      fprintf (f, "#\\space");
+      break;
+    case 0x9:
+      fprintf (f, "#\\tab");
+      break;
+    default:
+      fprintf (f, "#\\%c", (char)code);
+      break;
+    }
+}
+
+// sch_print_imm: prints the external representation of an immediate.
+// Used by the runtime and by the compiler to print folded programs.
+static inline void
+sch_print_imm (FILE *f, schptr_t x)
+{
+  if (sch_imm_fixnum_p (x))
+    fprintf (f, "%" PRIi64, sch_decode_imm_fixnum (x));
+  else if (sch_imm_char_p (x))
+    sch_print_char (f, sch_decode_imm_char (x));
+  else if (sch_imm_false_p (x))
+    fprintf (f, "#f");
+  else if (sch_imm_true_p (x))
+    fprintf (f, "#t");
+  else if (sch_imm_null_p (x))
+    fprintf (f, "()");
+  else
+    fprintf (f, "#<unknown 0x%08" PRIxPTR ">", x);
+}
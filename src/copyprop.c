@@ -0,0 +1,81 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Copy Propagation
+//
+// Every IR_MOVE is removed and the uses of its destination are replaced
+// by its source.
+//
+///////////////////////////////////////////////////////////////////////
+
+static size_t
+copyprop_block (ir_block_t *b, ir_opnd_t *subst)
+{
+  size_t removed = 0;
+  ir_insn_t *i = b->first;
+
+  b->first = NULL;
+  b->last = NULL;
+  while (i)
+    {
+      ir_insn_t *next = i->next;
+
+      for (size_t a = 0; a < i->nargs; a++)
+        i->args[a] = ir_subst_opnd (i->args[a], subst);
+
+      if (i->op == IR_IF)
+        {
+          removed += copyprop_block (i->thenb, subst);
+          removed += copyprop_block (i->elseb, subst);
+        }
+      if (i->op == IR_LOOP)
+        removed += copyprop_block (i->body, subst);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          removed += copyprop_block (i->arms[k], subst);
+
+      if (i->op == IR_MOVE)
+        {
+          subst[i->dst] = i->args[0];
+          ir_free_insn (i);
+          removed++;
+        }
+      else
+        ir_block_append (b, i);
+
+      i = next;
+    }
+
+  b->result = ir_subst_opnd (b->result, subst);
+  return removed;
+}
+
+void
+pass_copyprop (ir_proc_t *p)
+{
+  ir_opnd_t *subst = ir_make_subst (p);
+
+  size_t removed = copyprop_block (p->body, subst);
+  pass_record_stat ("copyprop", "moves removed", removed);
+
+  free (subst);
+}
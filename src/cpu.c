@@ -0,0 +1,74 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cpu.h"
+
+#include <cpuid.h>
+#include <stddef.h>
+#include <string.h>
+
+// Processors that -m cpu takes, named like the x86-64 microarchitecture
+// levels, with native for the host
+static const struct
+{
+  const char *name;
+  cpu_features_t features;
+} cpu_names[] = {
+  { "x86-64", 0 },
+  { "x86-64-v2", CPU_POPCNT },
+  { "x86-64-v3", CPU_POPCNT | CPU_LZCNT | CPU_BMI1 | CPU_BMI2 },
+};
+
+// Returns the features of the host, as cpuid reports them
+cpu_features_t
+cpu_host_features (void)
+{
+  cpu_features_t f = 0;
+  unsigned int a, b, c, d;
+
+  if (__get_cpuid (1, &a, &b, &c, &d) && (c & bit_POPCNT))
+    f |= CPU_POPCNT;
+  if (__get_cpuid (0x80000001, &a, &b, &c, &d) && (c & bit_LZCNT))
+    f |= CPU_LZCNT;
+  if (__get_cpuid_count (7, 0, &a, &b, &c, &d))
+    {
+      if (b & bit_BMI)
+        f |= CPU_BMI1;
+      if (b & bit_BMI2)
+        f |= CPU_BMI2;
+    }
+  return f;
+}
+
+// Sets *f to the features of the processor called name, and returns
+// false if there is none
+bool
+cpu_parse (const char *name, cpu_features_t *f)
+{
+  if (!strcmp (name, "native"))
+    {
+      *f = cpu_host_features ();
+      return true;
+    }
+
+  for (size_t k = 0; k < sizeof (cpu_names) / sizeof (cpu_names[0]); k++)
+    if (!strcmp (cpu_names[k].name, name))
+      {
+        *f = cpu_names[k].features;
+        return true;
+      }
+  return false;
+}
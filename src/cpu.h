@@ -0,0 +1,41 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section CPU Features
+//
+// Extensions to x86-64 that the emitters use when the processor the code
+// is for has them, given by -m cpu=<name> or else by cpuid on the host.
+//
+///////////////////////////////////////////////////////////////////////
+
+typedef enum
+{
+  CPU_POPCNT = 1 << 0, // popcnt
+  CPU_LZCNT = 1 << 1,  // lzcnt
+  CPU_BMI1 = 1 << 2,   // tzcnt
+  CPU_BMI2 = 1 << 3,   // sarx, shlx
+} cpu_feature;
+
+typedef unsigned int cpu_features_t;
+
+cpu_features_t cpu_host_features (void);
+bool cpu_parse (const char *, cpu_features_t *);
@@ -0,0 +1,207 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include "memory.h"
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Common Subexpression Elimination
+//
+// Dominator based value numbering. The value number of an operand is the
+// operand itself once substitutions are applied, and a primitive
+// application is identified by its primitive and the value numbers of its
+// arguments. The table of available expressions is scoped by block: the
+// entries added in an arm of a conditional or the body of a loop are
+// dropped when it is left, so an expression is only reused where its
+// first computation dominates it.
+//
+// Moves do not compute anything, their destination simply gets the value
+// number of their source.
+//
+///////////////////////////////////////////////////////////////////////
+
+typedef struct cse_entry
+{
+  const ir_insn_t *insn; // first instruction computing the expression
+  size_t hash;
+  size_t next; // next entry in the same bucket, or CSE_NONE
+} cse_entry_t;
+
+#define CSE_NONE ((size_t)-1)
+
+typedef struct cse
+{
+  ir_opnd_t *subst;      // value number of each temporary
+  cse_entry_t *entries;  // stack of available expressions
+  size_t nentries;
+  size_t *buckets;       // heads of the hash chains, indices into entries
+  size_t nbuckets;       // power of two
+  size_t eliminated;     // number of instructions eliminated
+} cse_t;
+
+// Only primitives that neither write nor allocate produce the same value
+// when evaluated twice. Raising is fine: if the first evaluation did not
+// raise, the second one would not either.
+static bool
+cse_candidate_p (const ir_insn_t *i)
+{
+  return i->op == IR_PRIM && !(ir_insn_effects (i) & ~EFFECT_RAISE);
+}
+
+static size_t
+cse_hash (const ir_insn_t *i)
+{
+  size_t h = (size_t)i->prim;
+  for (size_t a = 0; a < i->nargs; a++)
+    {
+      const ir_opnd_t *o = &i->args[a];
+      size_t v = o->kind == IR_OPND_TEMP ? o->temp : (size_t)o->imm;
+      h = (h ^ (v + o->kind)) * 0x100000001b3;
+    }
+  return h;
+}
+
+static bool
+cse_equal_p (const ir_insn_t *x, const ir_insn_t *y)
+{
+  if (x->prim != y->prim || x->nargs != y->nargs)
+    return false;
+
+  for (size_t a = 0; a < x->nargs; a++)
+    if (!ir_opnd_eq (x->args[a], y->args[a]))
+      return false;
+  return true;
+}
+
+static const ir_insn_t *
+cse_lookup (const cse_t *c, const ir_insn_t *i, size_t h)
+{
+  for (size_t e = c->buckets[h & (c->nbuckets - 1)]; e != CSE_NONE;
+       e = c->entries[e].next)
+    if (c->entries[e].hash == h && cse_equal_p (c->entries[e].insn, i))
+      return c->entries[e].insn;
+  return NULL;
+}
+
+static void
+cse_push (cse_t *c, const ir_insn_t *i, size_t h)
+{
+  size_t *head = &c->buckets[h & (c->nbuckets - 1)];
+  cse_entry_t *e = &c->entries[c->nentries];
+
+  e->insn = i;
+  e->hash = h;
+  e->next = *head;
+  *head = c->nentries++;
+}
+
+// Drops the entries pushed after the table had mark entries. Entries are
+// removed in the reverse order they were pushed, so each one is at the
+// head of its chain.
+static void
+cse_pop (cse_t *c, size_t mark)
+{
+  while (c->nentries > mark)
+    {
+      cse_entry_t *e = &c->entries[--c->nentries];
+      c->buckets[e->hash & (c->nbuckets - 1)] = e->next;
+    }
+}
+
+static void
+cse_block (cse_t *c, ir_block_t *b)
+{
+  const size_t mark = c->nentries;
+  ir_insn_t *i = b->first;
+
+  b->first = NULL;
+  b->last = NULL;
+  while (i)
+    {
+      ir_insn_t *next = i->next;
+      bool keep = true;
+
+      for (size_t a = 0; a < i->nargs; a++)
+        i->args[a] = ir_subst_opnd (i->args[a], c->subst);
+
+      if (i->op == IR_IF)
+        {
+          cse_block (c, i->thenb);
+          cse_block (c, i->elseb);
+        }
+      else if (i->op == IR_LOOP)
+        cse_block (c, i->body);
+      else if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          cse_block (c, i->arms[k]);
+      else if (i->op == IR_MOVE)
+        {
+          c->subst[i->dst] = i->args[0];
+          c->eliminated++;
+          keep = false;
+        }
+      else if (cse_candidate_p (i))
+        {
+          const size_t h = cse_hash (i);
+          const ir_insn_t *prev = cse_lookup (c, i, h);
+          if (prev)
+            {
+              c->subst[i->dst] = ir_opnd_temp (prev->dst);
+              c->eliminated++;
+              keep = false;
+            }
+          else
+            cse_push (c, i, h);
+        }
+
+      if (keep)
+        ir_block_append (b, i);
+      else
+        ir_free_insn (i);
+
+      i = next;
+    }
+
+  b->result = ir_subst_opnd (b->result, c->subst);
+  cse_pop (c, mark);
+}
+
+void
+pass_cse (ir_proc_t *p)
+{
+  cse_t c;
+  c.subst = ir_make_subst (p);
+  c.entries = alloc ((p->ntemps + 1) * sizeof (*c.entries));
+  c.nentries = 0;
+
+  c.nbuckets = 16;
+  while (c.nbuckets < 2 * p->ntemps)
+    c.nbuckets *= 2;
+  c.buckets = alloc (c.nbuckets * sizeof (*c.buckets));
+  for (size_t k = 0; k < c.nbuckets; k++)
+    c.buckets[k] = CSE_NONE;
+  c.eliminated = 0;
+
+  cse_block (&c, p->body);
+  pass_record_stat ("cse", "eliminated", c.eliminated);
+
+  free (c.subst);
+  free (c.entries);
+  free (c.buckets);
+}
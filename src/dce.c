@@ -0,0 +1,331 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include "memory.h"
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Dead Code Elimination
+//
+// Runs in two phases. The first one walks the program forward, computing
+// the type of each temporary (on top of what the types pass found) and
+// replacing conditionals whose test can never (or can only) be #f by the
+// arm that is taken. Cases of a switch whose value has a type the key
+// cannot have are dropped, with the arms only they took. The second one
+// walks each block backwards, removing the instructions whose value is
+// unused and whose evaluation has no observable effect. Walking
+// backwards sees every use of a temporary before its definition, so
+// chains of dead instructions disappear in a single sweep.
+//
+// This is what removes the discarded expressions of a body or program,
+// unused let bindings and unreachable arms.
+//
+///////////////////////////////////////////////////////////////////////
+
+typedef struct dce
+{
+  ir_proc_t *p;
+  ir_opnd_t *subst; // replacements for conditionals that were removed
+  size_t *uses;     // number of uses of each temporary
+  size_t removed;   // number of instructions removed
+  size_t arms;      // number of unreachable arms removed
+} dce_t;
+
+static vtype_t
+dce_opnd_type (const dce_t *d, ir_opnd_t o)
+{
+  switch (o.kind)
+    {
+    case IR_OPND_IMM:
+      return vtype_of_imm (o.imm);
+    case IR_OPND_TEMP:
+      return d->p->temps[o.temp].type;
+    default:
+      return VT_ANY;
+    }
+}
+
+// Phase 1: removal of unreachable arms
+
+// Drops the cases of switch i that the key cannot be, and the arms that
+// no case takes any more. Returns the arm that is always taken, if any.
+static ir_block_t *
+dce_prune_switch (dce_t *d, ir_insn_t *i)
+{
+  const vtype_t t = dce_opnd_type (d, i->args[0]);
+  size_t n = 0;
+  for (size_t c = 0; c < i->ncases; c++)
+    if (vtype_of_imm (i->cases[c].value) & t)
+      i->cases[n++] = i->cases[c];
+  i->ncases = n;
+
+  // Marks the arms still taken, the default one always is, and then
+  // renumbers them in order
+  size_t *renum = alloc (i->narms * sizeof (*renum));
+  for (size_t k = 0; k < i->narms; k++)
+    renum[k] = k + 1 == i->narms;
+  for (size_t c = 0; c < i->ncases; c++)
+    renum[i->cases[c].arm] = true;
+
+  size_t m = 0;
+  for (size_t k = 0; k < i->narms; k++)
+    if (renum[k])
+      {
+        i->arms[m] = i->arms[k];
+        renum[k] = m++;
+      }
+    else
+      {
+        ir_free_block (i->arms[k]);
+        d->arms++;
+      }
+  for (size_t c = 0; c < i->ncases; c++)
+    i->cases[c].arm = renum[i->cases[c].arm];
+  i->narms = m;
+
+  free (renum);
+  return m == 1 ? i->arms[0] : NULL;
+}
+
+static void
+dce_prune_block (dce_t *d, ir_block_t *b)
+{
+  ir_insn_t *i = b->first;
+
+  b->first = NULL;
+  b->last = NULL;
+  while (i)
+    {
+      ir_insn_t *next = i->next;
+      vtype_t *type = &d->p->temps[i->dst].type;
+      bool keep = true;
+
+      for (size_t a = 0; a < i->nargs; a++)
+        i->args[a] = ir_subst_opnd (i->args[a], d->subst);
+
+      switch (i->op)
+        {
+        case IR_PRIM:
+          *type &= i->prim->rtype;
+          break;
+        case IR_MOVE:
+          *type &= dce_opnd_type (d, i->args[0]);
+          break;
+        case IR_CHECK:
+          *type &= dce_opnd_type (d, i->args[0]) & i->prim->atype;
+          break;
+        case IR_CLOSURE:
+          *type &= VT_OTHER;
+          break;
+        case IR_DATA:
+          *type &= i->data->type;
+          break;
+        case IR_FREF:
+        case IR_CALL:
+        case IR_CALL_KNOWN:
+        case IR_CONTINUE:
+        case IR_VALUES:
+        case IR_RECEIVE:
+        case IR_VREF:
+        case IR_CALL_VALUES:
+          break;
+        case IR_LOOP:
+          dce_prune_block (d, i->body);
+          break;
+        case IR_IF:
+          {
+            vtype_t t = dce_opnd_type (d, i->args[0]);
+            ir_block_t *taken = NULL;
+
+            if (!(t & VT_FALSE))
+              taken = i->thenb;
+            else if (t == VT_FALSE)
+              taken = i->elseb;
+
+            if (taken)
+              {
+                dce_prune_block (d, taken);
+                ir_block_splice (b, taken);
+                d->subst[i->dst] = taken->result;
+                d->arms++;
+                keep = false;
+              }
+            else
+              {
+                dce_prune_block (d, i->thenb);
+                dce_prune_block (d, i->elseb);
+                *type &= dce_opnd_type (d, i->thenb->result)
+                         | dce_opnd_type (d, i->elseb->result);
+              }
+          }
+          break;
+        case IR_SWITCH:
+          {
+            ir_block_t *taken = dce_prune_switch (d, i);
+            if (taken)
+              {
+                dce_prune_block (d, taken);
+                ir_block_splice (b, taken);
+                d->subst[i->dst] = taken->result;
+                keep = false;
+                break;
+              }
+
+            vtype_t t = VT_NONE;
+            for (size_t k = 0; k < i->narms; k++)
+              {
+                dce_prune_block (d, i->arms[k]);
+                t |= dce_opnd_type (d, i->arms[k]->result);
+              }
+            *type &= t;
+          }
+          break;
+        }
+
+      if (keep)
+        ir_block_append (b, i);
+      else
+        ir_free_insn (i);
+
+      i = next;
+    }
+
+  b->result = ir_subst_opnd (b->result, d->subst);
+}
+
+// Phase 2: removal of unused instructions
+
+static void
+dce_count_opnd (dce_t *d, ir_opnd_t o, bool use_p)
+{
+  if (o.kind != IR_OPND_TEMP)
+    return;
+
+  if (use_p)
+    d->uses[o.temp]++;
+  else
+    d->uses[o.temp]--;
+}
+
+// Adds (or removes, if use_p is false) the uses made inside block b
+static void
+dce_count_block (dce_t *d, const ir_block_t *b, bool use_p)
+{
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      for (size_t a = 0; a < i->nargs; a++)
+        dce_count_opnd (d, i->args[a], use_p);
+
+      if (i->op == IR_IF)
+        {
+          dce_count_block (d, i->thenb, use_p);
+          dce_count_block (d, i->elseb, use_p);
+        }
+      if (i->op == IR_LOOP)
+        dce_count_block (d, i->body, use_p);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          dce_count_block (d, i->arms[k], use_p);
+    }
+  dce_count_opnd (d, b->result, use_p);
+}
+
+static void
+dce_sweep_block (dce_t *d, ir_block_t *b)
+{
+  size_t n = 0;
+  for (ir_insn_t *i = b->first; i; i = i->next)
+    n++;
+
+  if (!n)
+    return;
+
+  ir_insn_t **insns = alloc (n * sizeof (*insns));
+  size_t k = 0;
+  for (ir_insn_t *i = b->first; i; i = i->next)
+    insns[k++] = i;
+
+  for (k = n; k-- > 0;)
+    {
+      ir_insn_t *i = insns[k];
+
+      if (d->uses[i->dst] == 0
+          && !(ir_insn_effects (i) & EFFECT_OBSERVABLE))
+        {
+          // Dead: forget about the uses it was making
+          for (size_t a = 0; a < i->nargs; a++)
+            dce_count_opnd (d, i->args[a], false);
+          if (i->op == IR_IF)
+            {
+              dce_count_block (d, i->thenb, false);
+              dce_count_block (d, i->elseb, false);
+            }
+          if (i->op == IR_LOOP)
+            dce_count_block (d, i->body, false);
+          if (i->op == IR_SWITCH)
+            for (size_t a = 0; a < i->narms; a++)
+              dce_count_block (d, i->arms[a], false);
+          ir_free_insn (i);
+          insns[k] = NULL;
+          d->removed++;
+        }
+      else if (i->op == IR_IF)
+        {
+          dce_sweep_block (d, i->thenb);
+          dce_sweep_block (d, i->elseb);
+        }
+      else if (i->op == IR_LOOP)
+        dce_sweep_block (d, i->body);
+      else if (i->op == IR_SWITCH)
+        for (size_t a = 0; a < i->narms; a++)
+          dce_sweep_block (d, i->arms[a]);
+    }
+
+  b->first = NULL;
+  b->last = NULL;
+  for (k = 0; k < n; k++)
+    if (insns[k])
+      ir_block_append (b, insns[k]);
+
+  free (insns);
+}
+
+void
+pass_dce (ir_proc_t *p)
+{
+  dce_t d;
+  d.p = p;
+  d.subst = ir_make_subst (p);
+  d.uses = alloc ((p->ntemps + 1) * sizeof (*d.uses));
+  d.removed = 0;
+  d.arms = 0;
+
+  for (size_t t = 0; t < p->ntemps; t++)
+    d.uses[t] = 0;
+
+  dce_prune_block (&d, p->body);
+  dce_count_block (&d, p->body, true);
+  dce_sweep_block (&d, p->body);
+
+  pass_record_stat ("dce", "instructions removed", d.removed);
+  pass_record_stat ("dce", "unreachable arms removed", d.arms);
+
+  free (d.subst);
+  free (d.uses);
+}
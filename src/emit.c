@@ -16,14 +16,30 @@
 
 #include "emit.h"
 
+#include <ctype.h>
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "err.h"
+#include "memory.h"
+#include "pass.h"
+#include "peephole.h"
+#include "superopt.h"
 
 #define LABEL_MAX 64
 
+#if defined(__APPLE__) || defined(__MACH__)
+#define ASM_CSTRING_SECTION "__TEXT,__cstring"
+#define ASM_RODATA_SECTION "__TEXT,__const"
+#define ASM_PLT_SUFFIX ""
+#else
+#define ASM_CSTRING_SECTION ".rodata"
+#define ASM_RODATA_SECTION ".rodata"
+#define ASM_PLT_SUFFIX "@PLT"
+#endif
+
 void
 gen_new_temp_label (char *str)
 {
@@ -37,617 +53,3465 @@ gen_new_temp_label (char *str)
 //
 // Section EMIT_ASM_
 //
-// The functions in this section are used to emit assembly to a FILE *
-//
+// The functions in this section are used to emit assembly to an asm_list_t.
+// They act as the instruction selector for the IR: each temporary lives
+// in the register it is allocated to or else in a stack slot, operands are
+// loaded into registers unless the instruction can take them as they are,
+// and the result of each instruction is computed into %rax before being
+// stored in the location of its destination temporary.
 //
 ///////////////////////////////////////////////////////////////////////
 
+// Registers used by the instruction selector
+typedef enum
+{
+  REG_RAX,
+  REG_R8,
+  REG_RDI,
+  REG_RSI,
+  REG_RDX,
+  REG_RCX,
+  REG_R9
+} x86_reg;
+
+static const char *reg64_names[]
+    = { "%rax", "%r8", "%rdi", "%rsi", "%rdx", "%rcx", "%r9" };
+static const char *reg32_names[]
+    = { "%eax", "%r8d", "%edi", "%esi", "%edx", "%ecx", "%r9d" };
+static const char *reg8_names[]
+    = { "%al", "%r8b", "%dil", "%sil", "%dl", "%cl", "%r9b" };
+
+// Program, and procedure of the program, being emitted
+static const ir_program_t *emit_program = NULL;
+static const ir_proc_t *emit_proc = NULL;
+
+// Features of the processor the program is emitted for
+static cpu_features_t emit_cpu = 0;
+
+// Whether the program is emitted for size, with -Os
+static bool emit_size = false;
+
+// Stack slot offset (from %rsp) of temporary t
+static size_t
+temp_slot (size_t t)
+{
+  return (t + 1) * WORD_BYTES;
+}
+
+// Registers the temporaries are allocated to, by their number. They are
+// saved across calls into the runtime, which follows the C conventions.
+static const char *temp_reg_names[REGALLOC_REGS + 1]
+    = { NULL, "%rbx", "%r12", "%r13", "%r14", "%rbp" };
+static const char *temp_reg8_names[REGALLOC_REGS + 1]
+    = { NULL, "%bl", "%r12b", "%r13b", "%r14b", "%bpl" };
+
+// Operand for the location of temporary t: the register it is allocated
+// to, or else its stack slot
+static void
+temp_loc (char *str, size_t t)
+{
+  const unsigned int reg = emit_proc->temps[t].reg;
+  if (reg)
+    strcpy (str, temp_reg_names[reg]);
+  else
+    sprintf (str, "-%zu(%%rsp)", temp_slot (t));
+}
+
+// Operand for the low byte of the location of temporary t
+static const char *
+temp_loc8 (size_t t)
+{
+  static char str[LABEL_MAX];
+  const unsigned int reg = emit_proc->temps[t].reg;
+  if (reg)
+    return temp_reg8_names[reg];
+  sprintf (str, "-%zu(%%rsp)", temp_slot (t));
+  return str;
+}
+
+// Size of the frame of the procedure being emitted. Temporaries live
+// below %rsp, so calls are made with %rsp moved below all of them. %rsp is
+// 8 bytes off a 16 byte boundary on entry to a procedure, and has to be on
+// one at a call.
+static size_t
+frame_size (void)
+{
+  return (emit_proc->ntemps | 1) * WORD_BYTES;
+}
+
+// Label of the code of procedure k
+static void
+proc_label (char *str, size_t k)
+{
+  sprintf (str, ".LTproc%zu", k);
+}
+
+// Label of static object k of the program
+static void
+data_label (char *str, size_t k)
+{
+  sprintf (str, ".LTdata%zu", k);
+}
+
+// True if operand o is a temporary holding an untagged fixnum
+static bool
+untagged_p (ir_opnd_t o)
+{
+  return o.kind == IR_OPND_TEMP && emit_proc->temps[o.temp].untagged;
+}
+
+// True if the primitive application pe has any untagged operand or
+// destination, in which case its emitter computes on untagged fixnums
+static bool
+emit_untagged_p (const ir_insn_t *pe)
+{
+  if (emit_proc->temps[pe->dst].untagged)
+    return true;
+
+  for (size_t a = 0; a < pe->nargs; a++)
+    if (untagged_p (pe->args[a]))
+      return true;
+  return false;
+}
+
 // Emit assembly for function decorations - prologue and epilogue
 void
-emit_asm_prologue (FILE *f, const char *name)
+emit_asm_prologue (asm_list_t *l, const char *name)
 {
 #if defined(__APPLE__) || defined(__MACH__)
-  fprintf (f, "    .section	__TEXT,__text,regular,pure_instructions\n");
-  fprintf (f, "    .globl " ASM_SYMBOL_PREFIX "%s\n", name);
-  fprintf (f, "    .p2align 4, 0x90\n");
-  fprintf (f, ASM_SYMBOL_PREFIX "%s:\n", name);
+  asm_directive (l, ".section\t__TEXT,__text,regular,pure_instructions");
+  asm_directive (l, ".globl " ASM_SYMBOL_PREFIX "%s", name);
+  asm_directive (l, ".p2align 4, 0x90");
+  asm_label (l, asm_fmt (ASM_SYMBOL_PREFIX "%s", name).s);
 #elif defined(__linux__)
-  fprintf (f, "    .text\n");
-  fprintf (f, "    .globl " ASM_SYMBOL_PREFIX "%s\n", name);
-  fprintf (f, "    .type " ASM_SYMBOL_PREFIX "%s, @function\n", name);
-  fprintf (f, ASM_SYMBOL_PREFIX "%s:\n", name);
+  asm_directive (l, ".text");
+  asm_directive (l, ".globl " ASM_SYMBOL_PREFIX "%s", name);
+  asm_directive (l, ".type " ASM_SYMBOL_PREFIX "%s, @function", name);
+  asm_label (l, asm_fmt (ASM_SYMBOL_PREFIX "%s", name).s);
 #endif
 }
 
 void
-emit_asm_epilogue (FILE *f)
+emit_asm_epilogue (asm_list_t *l)
 {
-  fprintf (f, "    ret\n");
+  asm_insn (l, "ret");
 }
 
+// Emit the end of the code, and a word named name with its size from the
+// label start on
 void
-emit_asm_identifier (FILE *f, schptr_t sptr, env_t *env)
+emit_asm_text_size (asm_list_t *l, const char *start, const char *name)
 {
-  schid_t *id = (schid_t *)sptr;
-  assert (id->type == SCH_ID);
-
-  size_t si;
-
-  // get the stack offset where the value of id is.
-  // issue a load from that stack location to obtain it's value and put it in
-  // rax
-  if (env_ref (id, env, &si))
-    fprintf (f, "    movq   -%zu(%%rsp), %%rax\n", si);
-  else
-    {
-      fprintf (stderr, "undefined variable: %s\n", id->name);
-      exit (EXIT_FAILURE);
-    }
+  char end[LABEL_MAX];
+  gen_new_temp_label (end);
+  asm_label (l, end);
+  asm_directive (l, ".section " ASM_RODATA_SECTION);
+  asm_directive (l, ".globl " ASM_SYMBOL_PREFIX "%s", name);
+  asm_directive (l, ".p2align 3");
+  asm_label (l, asm_fmt (ASM_SYMBOL_PREFIX "%s", name).s);
+  asm_directive (l, ".quad  %s - " ASM_SYMBOL_PREFIX "%s", end, start);
+  asm_directive (l, ".text");
 }
 
 // EMIT_ASM_IMM
 // Emit assembly for immediates
 void
-emit_asm_imm (FILE *f, schptr_t imm)
+emit_asm_imm (asm_list_t *l, schptr_t imm, x86_reg r)
 {
-  if (imm > 4294967295)
-    fprintf (f, "    movabsq $%" PRIu64 ", %%rax\n", (uint64_t)imm);
+  if ((int64_t)imm < 0 && (int64_t)imm >= INT32_MIN)
+    asm_insn (l, "movq", asm_fmt ("$%" PRId64, (int64_t)imm).s,
+              reg64_names[r]);
+  else if (imm > 4294967295)
+    asm_insn (l, "movabsq", asm_fmt ("$%" PRIu64, (uint64_t)imm).s,
+              reg64_names[r]);
   else
-    fprintf (f, "    movl $%" PRIu64 ", %%eax\n", (uint64_t)imm);
+    asm_insn (l, "movl", asm_fmt ("$%" PRIu64, (uint64_t)imm).s,
+              reg32_names[r]);
 }
 
-void
-emit_asm_prim (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// Emit assembly to tag the untagged fixnum in register r
+static void
+emit_asm_tag (asm_list_t *l, x86_reg r)
 {
-  schprim_eval_t *pe = (schprim_eval_t *)sptr;
-  pe->prim->emitter (f, sptr, si, env);
+  asm_insn (l, "orq", asm_fmt ("$%" PRIu64, FX_TAG).s, reg64_names[r]);
 }
 
+// EMIT_ASM_LOAD
+// Emit assembly to load an operand into register r, tagged
 void
-emit_asm_expr (FILE *f, schptr_t sptr, size_t si, env_t *env)
+emit_asm_load (asm_list_t *l, ir_opnd_t o, x86_reg r)
 {
-  if (sch_imm_p (sptr))
+  switch (o.kind)
     {
-      emit_asm_imm (f, sptr);
-      return;
+    case IR_OPND_IMM:
+      emit_asm_imm (l, o.imm, r);
+      break;
+    case IR_OPND_TEMP:
+      {
+        char loc[LABEL_MAX];
+        temp_loc (loc, o.temp);
+        asm_insn (l, "movq", loc, reg64_names[r]);
+        if (untagged_p (o))
+          emit_asm_tag (l, r);
+      }
+      break;
+    case IR_OPND_NONE:
+      err_unreachable ("loading empty operand");
     }
+}
 
-  assert (sch_ptr_p (sptr));
+// EMIT_ASM_LOAD_UNTAGGED
+// Emit assembly to load the fixnum operand o into register r, untagged
+static void
+emit_asm_load_untagged (asm_list_t *l, ir_opnd_t o, x86_reg r)
+{
+  if (o.kind == IR_OPND_IMM)
+    {
+      emit_asm_imm (l, o.imm & ~FX_MASK, r);
+      return;
+    }
 
-  sch_type type = *((sch_type *)sptr);
-  switch (type)
+  char loc[LABEL_MAX];
+  temp_loc (loc, o.temp);
+  if (untagged_p (o))
+    asm_insn (l, "movq", loc, reg64_names[r]);
+  else if (emit_proc->temps[o.temp].reg)
+    asm_insn (l, "leaq", asm_fmt ("-%" PRIu64 "(%s)", FX_TAG, loc).s,
+              reg64_names[r]);
+  else
     {
-    case SCH_PRIM:
-      fprintf (stderr, "cannot emit singleton primitive types\n");
-      exit (EXIT_FAILURE);
-      break;
-    case SCH_PRIM_EVAL1:
-    case SCH_PRIM_EVAL2:
-      emit_asm_prim (f, sptr, si, env);
-      break;
-    case SCH_IF:
-      emit_asm_if (f, sptr, si, env);
-      break;
-    case SCH_ID:
-      emit_asm_identifier (f, sptr, env);
-      break;
-    case SCH_LET:
-      emit_asm_let (f, sptr, si, env);
-      break;
-    case SCH_EXPR_SEQ:
-      emit_asm_expr_seq (f, sptr, si, env);
-      break;
-    default:
-      fprintf (stderr, "unknown type 0x%08x\n", type);
-      err_unreachable ("unknown type");
-      break;
+      asm_insn (l, "movq", loc, reg64_names[r]);
+      asm_insn (l, "andq", asm_fmt ("$%" PRIu64, ~FX_MASK).s, reg64_names[r]);
     }
 }
 
-// Primitives Emitter
-void
-emit_asm_prim_fxadd1 (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// EMIT_ASM_LOAD_DECODED
+// Emit assembly to load the value of the fixnum operand o into register r
+static void
+emit_asm_load_decoded (asm_list_t *l, ir_opnd_t o, x86_reg r)
 {
-  schprim_eval1_t *pe = (schprim_eval1_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL1);
-  emit_asm_expr (f, pe->arg1, si, env);
+  if (o.kind == IR_OPND_IMM)
+    {
+      emit_asm_imm (l, (schptr_t)sch_decode_imm_fixnum (o.imm), r);
+      return;
+    }
 
-  const uint64_t cst = UINT64_C (1) << FX_SHIFT;
-  fprintf (f, "    addq $%" PRIu64 ", %%rax\n", cst);
+  // Shifting drops the tag, if there is one
+  char loc[LABEL_MAX];
+  temp_loc (loc, o.temp);
+  asm_insn (l, "movq", loc, reg64_names[r]);
+  asm_insn (l, "sarq", asm_fmt ("$%" PRIu8, FX_SHIFT).s, reg64_names[r]);
 }
 
-void
-emit_asm_prim_fxsub1 (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// Emit assembly to turn the untagged fixnum result in %rax into the
+// representation of the destination of pe
+static void
+emit_asm_untagged_result (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval1_t *pe = (schprim_eval1_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL1);
-  emit_asm_expr (f, pe->arg1, si, env);
-
-  const uint64_t cst = UINT64_C (1) << FX_SHIFT;
-  fprintf (f, "    subq $%" PRIu64 ", %%rax\n", cst);
+  if (!emit_proc->temps[pe->dst].untagged)
+    emit_asm_tag (l, REG_RAX);
 }
 
 void
-emit_asm_prim_fxzerop (FILE *f, schptr_t sptr, size_t si, env_t *env)
+emit_asm_store (asm_list_t *l, size_t temp)
 {
-  schprim_eval1_t *pe = (schprim_eval1_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL1);
-  emit_asm_expr (f, pe->arg1, si, env);
-
-  fprintf (f, "    movl   $%" PRIu64 ", %%edx\n", FALSE_CST);
-  fprintf (f, "    cmpq   $%" PRIu64 ", %%rax\n", FX_TAG);
-  fprintf (f, "    movabsq $%" PRIu64 ", %%rax\n", TRUE_CST);
-  fprintf (f, "    cmovne %%rdx, %%rax\n");
+  char loc[LABEL_MAX];
+  temp_loc (loc, temp);
+  asm_insn (l, "movq", "%rax", loc);
 }
 
-void
-emit_asm_prim_char_to_fixnum (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// Operand selection
+//
+// The emitters of the fixnum primitives fold their operands into the
+// instructions that use them where x86 allows it. A constant that fits in
+// the sign-extended 32 bits of an immediate is an immediate operand, a
+// temporary allocated to a register is used in place, and one in a stack
+// slot is a memory operand. Additions, and multiplications by 2, 3, 4, 5,
+// 8 and 9, are done by lea, whose displacement also makes up for the tags.
+//
+// A fixnum n is kept as 2n plus its tag bit, which is 0 for an untagged
+// temporary, so the tag bits of the result of such an operation are only
+// a constant away from the ones wanted.
+//
+// With all their operands in registers, the primitives take the shortest
+// sequences that scripts/superopt.c found, see src/superopt.h, where it
+// found one.
+
+// True if value fits in the sign-extended immediate of an instruction
+static bool
+imm32_p (uint64_t value)
 {
-  schprim_eval1_t *pe = (schprim_eval1_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL1);
-  emit_asm_expr (f, pe->arg1, si, env);
+  return (int64_t)value == (int32_t)value;
+}
 
-  // This can be improved if we set the tags, masks and shifts in stone
-  fprintf (f, "    sarq   $%" PRIu8 ", %%rax\n", CHAR_SHIFT);
-  fprintf (f, "    salq   $%" PRIu8 ", %%rax\n", FX_SHIFT);
-  fprintf (f, "    orq    $%" PRIu64 ", %%rax\n", FX_TAG);
+// Tag bits of the fixnum operand o as it is kept
+static uint64_t
+fx_bias (ir_opnd_t o)
+{
+  return untagged_p (o) ? 0 : FX_TAG;
 }
 
-void
-emit_asm_prim_fixnum_to_char (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// Tag bits of the fixnum destination of pe as it is kept
+static uint64_t
+fx_dst_bias (const ir_insn_t *pe)
 {
-  schprim_eval1_t *pe = (schprim_eval1_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL1);
-  emit_asm_expr (f, pe->arg1, si, env);
+  return emit_proc->temps[pe->dst].untagged ? 0 : FX_TAG;
+}
 
-  // This can be improved if we set the tags, masks and shifts in stone
-  fprintf (f, "    sarq   $%" PRIu8 ", %%rax\n", FX_SHIFT);
-  fprintf (f, "    salq   $%" PRIu8 ", %%rax\n", CHAR_SHIFT);
-  fprintf (f, "    orq    $%" PRIu64 ", %%rax\n", CHAR_TAG);
+// Returns the name of a register holding temporary o as it is kept: the
+// one it is allocated to, or else r after loading it
+static const char *
+emit_asm_in_reg (asm_list_t *l, ir_opnd_t o, x86_reg r)
+{
+  assert (o.kind == IR_OPND_TEMP);
+  const unsigned int reg = emit_proc->temps[o.temp].reg;
+  if (reg)
+    return temp_reg_names[reg];
+
+  char loc[LABEL_MAX];
+  temp_loc (loc, o.temp);
+  asm_insn (l, "movq", loc, reg64_names[r]);
+  return reg64_names[r];
 }
 
-void
-emit_asm_prim_fixnump (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// Emit the sequence in src/superopt.h for the primitive pe, if its
+// operands are all temporaries allocated to registers and there is one for
+// the representations of its operands and result. Returns false, having
+// emitted nothing, otherwise, or when the sequences were found for a
+// layout other than the one in src/common.h.
+static bool
+emit_asm_superopt (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval1_t *pe = (schprim_eval1_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL1);
-  emit_asm_expr (f, pe->arg1, si, env);
+  if (FX_TAG != SUPEROPT_FX_TAG || FX_SHIFT != SUPEROPT_FX_SHIFT
+      || CHAR_TAG != SUPEROPT_CHAR_TAG || CHAR_SHIFT != SUPEROPT_CHAR_SHIFT)
+    return false;
+
+  const char *regs[] = { "%rax", "%r8", NULL, NULL };
+  bool tagged[] = { true, true, !emit_proc->temps[pe->dst].untagged };
+  for (size_t a = 0; a < pe->nargs; a++)
+    {
+      const ir_opnd_t o = pe->args[a];
+      if (o.kind != IR_OPND_TEMP || !emit_proc->temps[o.temp].reg)
+        return false;
+      regs[2 + a] = temp_reg_names[emit_proc->temps[o.temp].reg];
+      tagged[a] = !untagged_p (o);
+    }
 
-  // This can be improved if we set the tags, masks and shifts in stone
-  fprintf (f, "    andq   $%" PRIu64 ", %%rax\n", FX_MASK);
-  fprintf (f, "    cmpq   $%" PRIu64 ", %%rax\n", FX_TAG);
-  fprintf (f, "    sete   %%al\n");
-  fprintf (f, "    movzbl %%al, %%eax\n");
-  fprintf (f, "    salq   $%" PRIu8 ", %%rax\n", BOOL_SHIFT);
-  fprintf (f, "    orq    $%" PRIu64 ", %%rax\n", BOOL_TAG);
+  for (size_t k = 0; k < sizeof (superopt_seqs) / sizeof (superopt_seqs[0]);
+       k++)
+    {
+      const superopt_seq_t *seq = &superopt_seqs[k];
+      if (strcmp (seq->prim, pe->prim->name)
+          || memcmp (seq->tagged, tagged, sizeof (tagged)))
+        continue;
+
+      for (const superopt_insn_t *i = seq->insns; i->op; i++)
+        {
+          char args[ASM_ARGS_MAX][ASM_OPND_MAX];
+          const char *argv[ASM_ARGS_MAX + 2] = { i->op };
+          for (size_t a = 0; a < ASM_ARGS_MAX && i->args[a]; a++)
+            {
+              char *d = args[a];
+              for (const char *c = i->args[a]; *c; c++)
+                if (c[0] == '%' && c[1] >= '0' && c[1] <= '3')
+                  d = stpcpy (d, regs[*++c - '0']);
+                else
+                  *d++ = *c;
+              *d = '\0';
+              argv[a + 1] = args[a];
+            }
+          asm_insn_args (l, argv);
+        }
+      return true;
+    }
+  return false;
 }
 
-void
-emit_asm_prim_booleanp (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// Emit assembly to compute temporary o, as it is kept, plus disp in %rax
+static void
+emit_asm_add_disp (asm_list_t *l, ir_opnd_t o, uint64_t disp)
 {
-  schprim_eval1_t *pe = (schprim_eval1_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL1);
-  emit_asm_expr (f, pe->arg1, si, env);
-
-  // This can be improved if we set the tags, masks and shifts in stone
-  fprintf (f, "    andq   $%" PRIu64 ", %%rax\n", BOOL_MASK);
-  fprintf (f, "    cmpq   $%" PRIu64 ", %%rax\n", BOOL_TAG);
-  fprintf (f, "    sete   %%al\n");
-  fprintf (f, "    salq   $%" PRIu8 ", %%rax\n", BOOL_SHIFT);
-  fprintf (f, "    orq    $%" PRIu64 ", %%rax\n", BOOL_TAG);
+  assert (imm32_p (disp));
+  const char *r = emit_asm_in_reg (l, o, REG_RAX);
+  if (r == reg64_names[REG_RAX])
+    {
+      if (disp)
+        asm_insn (l, "addq", asm_fmt ("$%" PRId64, (int64_t)disp).s, "%rax");
+    }
+  else if (disp)
+    asm_insn (l, "leaq", asm_fmt ("%" PRId64 "(%s)", (int64_t)disp, r).s,
+              "%rax");
+  else
+    asm_insn (l, "movq", r, "%rax");
 }
 
-// Not will return #t for #f and #f for anything else,
-// because all values evaluate to #t
-// section 6.3 of r7rs:
-//     "Of all the Scheme values, only#fcounts as false
-//      in condi-tional expressions.  All other Scheme
-//      values, including#t,count as true."
-void
-emit_asm_prim_not (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// Emit assembly to add the constant fixnum n to the fixnum operand of the
+// unary primitive pe
+static void
+emit_asm_fx_add_const (asm_list_t *l, const ir_insn_t *pe, int64_t n)
 {
-  schprim_eval1_t *pe = (schprim_eval1_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL1);
-  emit_asm_expr (f, pe->arg1, si, env);
+  assert (pe->op == IR_PRIM && pe->nargs == 1);
+  if (emit_asm_superopt (l, pe))
+    return;
+  const ir_opnd_t a = pe->args[0];
+  if (a.kind == IR_OPND_TEMP)
+    {
+      emit_asm_add_disp (l, a, ((uint64_t)n << FX_SHIFT) + fx_dst_bias (pe)
+                                   - fx_bias (a));
+      return;
+    }
 
-  // I *don't* think this one can be optimized by fixing the values
-  fprintf (f, "    movq    $%" PRIu64 ", %%rdx\n", FALSE_CST);
-  fprintf (f, "    cmpq    $%" PRIu64 ", %%rax\n", FALSE_CST);
-  fprintf (f, "    movabsq $%" PRIu64 ", %%rax\n", TRUE_CST);
-  fprintf (f, "    cmovne  %%rdx, %%rax\n");
+  emit_asm_load_untagged (l, a, REG_RAX);
+  asm_insn (l, "addq",
+            asm_fmt ("$%" PRId64, (int64_t)((uint64_t)n << FX_SHIFT)).s,
+            "%rax");
+  emit_asm_untagged_result (l, pe);
 }
 
-void
-emit_asm_prim_charp (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// Predicates
+//
+// The emitter of a predicate is split in two. Its tester leaves the result
+// in the flags, as a condition on them, and emit_asm_prim_predicate turns
+// that into a boolean when the value is needed. The test of a conditional
+// only needs the flags, see emit_asm_test.
+
+// Names of the conditions, as the suffixes of jcc and setcc
+static const char *cond_names[] = { "e", "ne", "l", "ge", "le", "g" };
+
+// Conditions that hold where each one does, with the operands of the
+// comparison the other way round
+static const cond_code cond_swapped[]
+    = { COND_E, COND_NE, COND_G, COND_LE, COND_GE, COND_L };
+
+// Negation of condition cond
+static cond_code
+cond_negated (cond_code cond)
+{
+  return cond ^ 1;
+}
+
+// Operand for o as it is kept: the location of a temporary, or else %rax
+// after loading the immediate into it
+static void
+emit_asm_opnd (asm_list_t *l, char *str, ir_opnd_t o)
 {
-  schprim_eval1_t *pe = (schprim_eval1_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL1);
-  emit_asm_expr (f, pe->arg1, si, env);
+  if (o.kind == IR_OPND_TEMP)
+    {
+      temp_loc (str, o.temp);
+      return;
+    }
+
+  emit_asm_load (l, o, REG_RAX);
+  strcpy (str, "%rax");
+}
 
-  // This can be improved if we set the tags, masks and shifts in stone
-  fprintf (f, "    andq   $%" PRIu64 ", %%rax\n", CHAR_MASK);
-  fprintf (f, "    cmpq   $%" PRIu64 ", %%rax\n", CHAR_TAG);
-  fprintf (f, "    sete   %%al\n");
-  fprintf (f, "    movzbl %%al, %%eax\n");
-  fprintf (f, "    salq   $%" PRIu8 ", %%rax\n", BOOL_SHIFT);
-  fprintf (f, "    orq    $%" PRIu64 ", %%rax\n", BOOL_TAG);
+// Emit the code that turns condition cond on the flags into a boolean in
+// %rax
+static void
+emit_asm_cond_to_bool (asm_list_t *l, cond_code cond)
+{
+  asm_insn (l, asm_fmt ("set%s", cond_names[cond]).s, "%al");
+  asm_insn (l, "movzbl", "%al", "%eax");
+  if (BOOL_SHIFT <= 3)
+    asm_insn (l, "leaq",
+              asm_fmt ("%" PRIu64 "(,%%rax,%" PRIu64 ")", BOOL_TAG,
+                       UINT64_C (1) << BOOL_SHIFT).s, "%rax");
+  else
+    {
+      asm_insn (l, "salq", asm_fmt ("$%" PRIu8, BOOL_SHIFT).s, "%rax");
+      asm_insn (l, "orq", asm_fmt ("$%" PRIu64, BOOL_TAG).s, "%rax");
+    }
 }
+
+// With -Os, that code is in a stub for each condition, shared by the
+// program, which predicates call. The call leaves its return address in
+// the slot of temporary 0, right below %rsp, so predicates keep the code
+// inline in the procedures with that temporary on the stack.
+//
+// The code is 14 bytes, and a call 5, so a stub of 15 bytes only pays
+// off for a condition that at least BOOL_STUB_USES_MIN predicates call.
+// The program is emitted once with the code inline to count them.
+
+#define COND_COUNT (sizeof (cond_names) / sizeof (cond_names[0]))
+#define BOOL_STUB_USES_MIN 2
+
+static char bool_stubs[COND_COUNT][LABEL_MAX];
+static bool bool_stubs_used[COND_COUNT];
+static size_t bool_stubs_uses[COND_COUNT];
+static bool bool_stubs_counting = false;
+static size_t bool_stubs_calls = 0;
+
 void
-emit_asm_prim_nullp (FILE *f, schptr_t sptr, size_t si, env_t *env)
+emit_asm_prim_predicate (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval1_t *pe = (schprim_eval1_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL1);
-  emit_asm_expr (f, pe->arg1, si, env);
+  assert (pe->op == IR_PRIM && pe->prim->tester);
+  const cond_code cond = pe->prim->tester (l, pe);
+  const bool stub_p
+      = emit_size && !(emit_proc->ntemps && !emit_proc->temps[0].reg);
+  if (stub_p && bool_stubs_counting)
+    bool_stubs_uses[cond]++;
+  if (!stub_p || bool_stubs_counting
+      || bool_stubs_uses[cond] < BOOL_STUB_USES_MIN)
+    {
+      emit_asm_cond_to_bool (l, cond);
+      return;
+    }
 
-  // I *don't* think this one can be optimized by fixing the values
-  fprintf (f, "    cmpq   $%" PRIu64 ", %%rax\n", NULL_CST);
-  fprintf (f, "    sete   %%al\n");
-  fprintf (f, "    movzbl %%al, %%eax\n");
-  fprintf (f, "    salq   $%" PRIu8 ", %%rax\n", BOOL_SHIFT);
-  fprintf (f, "    orq    $%" PRIu64 ", %%rax\n", BOOL_TAG);
+  if (!bool_stubs_used[cond])
+    {
+      gen_new_temp_label (bool_stubs[cond]);
+      bool_stubs_used[cond] = true;
+    }
+  asm_insn (l, "call", bool_stubs[cond]);
+  bool_stubs_calls++;
 }
 
+// Primitives Emitter
 void
-emit_asm_prim_fxlognot (FILE *f, schptr_t sptr, size_t si, env_t *env)
+emit_asm_prim_fxadd1 (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval1_t *pe = (schprim_eval1_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL1);
-  emit_asm_expr (f, pe->arg1, si, env);
-
-  // This can be improved if we set the tags, masks and shifts in stone
-  fprintf (f, "    notq   %%rax\n");
-  fprintf (f, "    andq   $%" PRIu64 ", %%rax\n", ~FX_MASK);
-  fprintf (f, "    orq    $%" PRIu64 ", %%rax\n", FX_TAG);
+  emit_asm_fx_add_const (l, pe, 1);
 }
 
 void
-emit_asm_prim_fxadd (FILE *f, schptr_t sptr, size_t si, env_t *env)
+emit_asm_prim_fxsub1 (asm_list_t *l, const ir_insn_t *pe)
+{
+  emit_asm_fx_add_const (l, pe, -1);
+}
+
+cond_code
+emit_asm_test_fxzerop (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
+  assert (pe->op == IR_PRIM && pe->nargs == 1);
+  char loc[LABEL_MAX];
+  emit_asm_opnd (l, loc, pe->args[0]);
+  asm_insn (l, "cmpq", asm_fmt ("$%" PRIu64, fx_bias (pe->args[0])).s, loc);
+  return COND_E;
+}
 
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    xorq   $%" PRIu64 ", %%rax\n", FX_MASK);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+// Characters have at least as many tag bits as fixnums, so shifting a
+// character right by the difference of their shifts leaves its code where
+// the value of a fixnum goes, under the top tag bits of the character
+#define CHAR_FX_SHIFT (CHAR_SHIFT - FX_SHIFT)
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    addq   -%zu(%%rsp), %%rax\n", si);
+void
+emit_asm_prim_char_to_fixnum (asm_list_t *l, const ir_insn_t *pe)
+{
+  assert (pe->op == IR_PRIM && pe->nargs == 1);
+  if (emit_asm_superopt (l, pe))
+    return;
+  emit_asm_load (l, pe->args[0], REG_RAX);
+
+  const uint64_t left = CHAR_TAG >> CHAR_FX_SHIFT;
+  if (CHAR_FX_SHIFT)
+    asm_insn (l, "shrq", asm_fmt ("$%u", CHAR_FX_SHIFT).s, "%rax");
+  if (left != fx_dst_bias (pe))
+    asm_insn (l, "xorq", asm_fmt ("$%" PRIu64, left ^ fx_dst_bias (pe)).s,
+              "%rax");
 }
 
 void
-emit_asm_prim_fxsub (FILE *f, schptr_t sptr, size_t si, env_t *env)
+emit_asm_prim_fixnum_to_char (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
+  assert (pe->op == IR_PRIM && pe->nargs == 1);
+  if (emit_asm_superopt (l, pe))
+    return;
+  const ir_opnd_t a = pe->args[0];
+
+  // Shifting the fixnum left leaves its tag bits under the ones of the
+  // character, which are a constant away
+  const uint64_t disp = CHAR_TAG - (fx_bias (a) << CHAR_FX_SHIFT);
+  const char *r = reg64_names[REG_RAX];
+  if (a.kind == IR_OPND_TEMP)
+    r = emit_asm_in_reg (l, a, REG_RAX);
+  else
+    emit_asm_load (l, a, REG_RAX);
+
+  char d[LABEL_MAX] = "";
+  if (disp)
+    sprintf (d, "%" PRId64, (int64_t)disp);
+  if (CHAR_FX_SHIFT == 0)
+    asm_insn (l, "leaq", asm_fmt ("%s(%s)", d, r).s, "%rax");
+  else if (CHAR_FX_SHIFT == 1)
+    asm_insn (l, "leaq", asm_fmt ("%s(%s,%s)", d, r, r).s, "%rax");
+  else if (CHAR_FX_SHIFT <= 3)
+    asm_insn (l, "leaq", asm_fmt ("%s(,%s,%u)", d, r, 1u << CHAR_FX_SHIFT).s,
+              "%rax");
+  else
+    {
+      if (r != reg64_names[REG_RAX])
+        asm_insn (l, "movq", r, "%rax");
+      asm_insn (l, "shlq", asm_fmt ("$%u", CHAR_FX_SHIFT).s, "%rax");
+      if (disp)
+        asm_insn (l, "addq", asm_fmt ("$%s", d).s, "%rax");
+    }
+}
 
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    sarq   $%" PRIu8 ", %%rax\n", FX_SHIFT);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+// Emit the test of the type of the operand of pe, given by its tag in the
+// low bits set in mask. A single tag bit is tested in place, and otherwise
+// the tag is subtracted, which leaves the tag bits clear for the type.
+static cond_code
+emit_asm_test_tag (asm_list_t *l, const ir_insn_t *pe, uint64_t mask,
+                   uint64_t tag)
+{
+  assert (pe->op == IR_PRIM && pe->nargs == 1);
+  assert (mask <= UINT8_MAX && !(mask & (mask + 1)));
+  const ir_opnd_t a = pe->args[0];
+  if (!(mask & (mask - 1)))
+    {
+      char loc[LABEL_MAX];
+      emit_asm_opnd (l, loc, a);
+      asm_insn (l, "testq", asm_fmt ("$%" PRIu64, mask).s, loc);
+      return tag ? COND_NE : COND_E;
+    }
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    sarq   $%" PRIu8 ", %%rax\n", FX_SHIFT);
-  fprintf (f, "    movq   %%rax, %%r8\n");
-  fprintf (f, "    movq   -%zu(%%rsp), %%rax\n", si);
-  fprintf (f, "    subq   %%r8, %%rax\n");
-  fprintf (f, "    salq   $%" PRIu8 ", %%rax\n", FX_SHIFT);
-  fprintf (f, "    orq    $%" PRIu64 ", %%rax\n", FX_TAG);
+  const char *r = reg64_names[REG_RAX];
+  if (a.kind == IR_OPND_TEMP)
+    r = emit_asm_in_reg (l, a, REG_RAX);
+  else
+    emit_asm_load (l, a, REG_RAX);
+  asm_insn (l, "leaq", asm_fmt ("%" PRId64 "(%s)", -(int64_t)tag, r).s,
+            "%rax");
+  asm_insn (l, "testb", asm_fmt ("$%" PRIu64, mask).s, "%al");
+  return COND_E;
 }
 
-void
-emit_asm_prim_fxmul (FILE *f, schptr_t sptr, size_t si, env_t *env)
+cond_code
+emit_asm_test_fixnump (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
-
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    sarq   $%" PRIu8 ", %%rax\n", FX_SHIFT);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+  return emit_asm_test_tag (l, pe, FX_MASK, FX_TAG);
+}
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    sarq   $%" PRIu8 ", %%rax\n", FX_SHIFT);
-  fprintf (f, "    imulq  -%zu(%%rsp), %%rax\n", si);
-  fprintf (f, "    salq   $%" PRIu8 ", %%rax\n", FX_SHIFT);
-  fprintf (f, "    orq    $%" PRIu64 ", %%rax\n", FX_TAG);
+cond_code
+emit_asm_test_booleanp (asm_list_t *l, const ir_insn_t *pe)
+{
+  return emit_asm_test_tag (l, pe, BOOL_MASK, BOOL_TAG);
 }
 
-void
-emit_asm_prim_fxlogand (FILE *f, schptr_t sptr, size_t si, env_t *env)
+cond_code
+emit_asm_test_charp (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
+  return emit_asm_test_tag (l, pe, CHAR_MASK, CHAR_TAG);
+}
 
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+// Not will return #t for #f and #f for anything else,
+// because all values evaluate to #t
+// section 6.3 of r7rs:
+//     "Of all the Scheme values, only#fcounts as false
+//      in condi-tional expressions.  All other Scheme
+//      values, including#t,count as true."
+cond_code
+emit_asm_test_not (asm_list_t *l, const ir_insn_t *pe)
+{
+  assert (pe->op == IR_PRIM && pe->nargs == 1);
+  char loc[LABEL_MAX];
+  emit_asm_opnd (l, loc, pe->args[0]);
+  asm_insn (l, "cmpq", asm_fmt ("$%" PRIu64, FALSE_CST).s, loc);
+  return COND_E;
+}
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    andq   -%zu(%%rsp), %%rax\n", si);
+cond_code
+emit_asm_test_nullp (asm_list_t *l, const ir_insn_t *pe)
+{
+  assert (pe->op == IR_PRIM && pe->nargs == 1);
+  char loc[LABEL_MAX];
+  emit_asm_opnd (l, loc, pe->args[0]);
+  asm_insn (l, "cmpq", asm_fmt ("$%" PRIu64, NULL_CST).s, loc);
+  return COND_E;
 }
 
 void
-emit_asm_prim_fxlogor (FILE *f, schptr_t sptr, size_t si, env_t *env)
+emit_asm_prim_fxlognot (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
+  assert (pe->op == IR_PRIM && pe->nargs == 1);
+  if (emit_asm_superopt (l, pe))
+    return;
+  const ir_opnd_t a = pe->args[0];
+
+  // Flipping the bits above the tag complements the value, and the tag
+  // bits flip where the representations of the operand and the result
+  // differ
+  const uint64_t flip = ~FX_MASK ^ fx_bias (a) ^ fx_dst_bias (pe);
+  if (a.kind == IR_OPND_TEMP)
+    emit_asm_add_disp (l, a, 0);
+  else
+    emit_asm_load (l, a, REG_RAX);
+
+  if (flip == ~UINT64_C (0))
+    asm_insn (l, "notq", "%rax");
+  else
+    asm_insn (l, "xorq", asm_fmt ("$%" PRId64, (int64_t)flip).s, "%rax");
+}
+
+// Binary primitives load their first operand into %r8 and the second
+// one into %rax, where the result is computed.
 
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+// Emit a binary fixnum operation on untagged operands
+static void
+emit_asm_untagged_binop (asm_list_t *l, const ir_insn_t *pe, const char *op)
+{
+  emit_asm_load_untagged (l, pe->args[0], REG_R8);
+  emit_asm_load_untagged (l, pe->args[1], REG_RAX);
+  asm_insn (l, op, "%r8", "%rax");
+  emit_asm_untagged_result (l, pe);
+}
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    orq   -%zu(%%rsp), %%rax\n", si);
+// Returns the index of the only temporary argument of the binary primitive
+// pe whose other argument is an immediate, or 2 if there is none
+static size_t
+emit_imm_other (const ir_insn_t *pe)
+{
+  for (size_t a = 0; a < 2; a++)
+    if (pe->args[a].kind == IR_OPND_TEMP
+        && pe->args[1 - a].kind == IR_OPND_IMM)
+      return a;
+  return 2;
 }
 
 void
-emit_asm_prim_fxeq (FILE *f, schptr_t sptr, size_t si, env_t *env)
+emit_asm_prim_fxadd (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
+  assert (pe->op == IR_PRIM && pe->nargs == 2);
+  if (emit_asm_superopt (l, pe))
+    return;
+  const ir_opnd_t a = pe->args[0];
+  const ir_opnd_t b = pe->args[1];
+  const size_t t = emit_imm_other (pe);
+  if (t < 2)
+    {
+      // The immediate is 2n + 1 for a fixnum n
+      const uint64_t disp = pe->args[1 - t].imm - FX_TAG + fx_dst_bias (pe)
+                            - fx_bias (pe->args[t]);
+      if (imm32_p (disp))
+        {
+          emit_asm_add_disp (l, pe->args[t], disp);
+          return;
+        }
+    }
+  if (a.kind == IR_OPND_TEMP && b.kind == IR_OPND_TEMP)
+    {
+      const uint64_t disp = fx_dst_bias (pe) - fx_bias (a) - fx_bias (b);
+      const char *ra = emit_asm_in_reg (l, a, REG_R8);
+      const char *rb = emit_asm_in_reg (l, b, REG_RAX);
+      asm_insn (l, "leaq",
+                asm_fmt ("%" PRId64 "(%s,%s)", (int64_t)disp, ra, rb).s,
+                "%rax");
+      return;
+    }
+
+  if (emit_untagged_p (pe))
+    {
+      emit_asm_untagged_binop (l, pe, "addq");
+      return;
+    }
 
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+  emit_asm_load (l, pe->args[0], REG_R8);
+  asm_insn (l, "xorq", asm_fmt ("$%" PRIu64, FX_MASK).s, "%r8");
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    cmpq      -%zu(%%rsp), %%rax\n", si);
-  fprintf (f, "    movq      $%" PRIu64 ", %%rdx\n", FALSE_CST);
-  fprintf (f, "    movabsq   $%" PRIu64 ", %%rax\n", TRUE_CST);
-  fprintf (f, "    cmovne    %%rdx, %%rax\n");
+  emit_asm_load (l, pe->args[1], REG_RAX);
+  asm_insn (l, "addq", "%r8", "%rax");
 }
 
 void
-emit_asm_prim_fxlt (FILE *f, schptr_t sptr, size_t si, env_t *env)
+emit_asm_prim_fxsub (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
-
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+  assert (pe->op == IR_PRIM && pe->nargs == 2);
+  if (emit_asm_superopt (l, pe))
+    return;
+  const ir_opnd_t a = pe->args[0];
+  const ir_opnd_t b = pe->args[1];
+  const uint64_t want = fx_dst_bias (pe);
+  if (a.kind == IR_OPND_TEMP && b.kind == IR_OPND_IMM)
+    {
+      const uint64_t disp = want - fx_bias (a) - (b.imm - FX_TAG);
+      if (imm32_p (disp))
+        {
+          emit_asm_add_disp (l, a, disp);
+          return;
+        }
+    }
+  if (a.kind == IR_OPND_IMM && b.kind == IR_OPND_TEMP)
+    {
+      const uint64_t disp = a.imm - FX_TAG + fx_bias (b) + want;
+      if (imm32_p (disp))
+        {
+          if (disp)
+            {
+              char loc[LABEL_MAX];
+              temp_loc (loc, b.temp);
+              asm_insn (l, "movq", asm_fmt ("$%" PRId64, (int64_t)disp).s,
+                        "%rax");
+              asm_insn (l, "subq", loc, "%rax");
+              return;
+            }
+          emit_asm_add_disp (l, b, 0);
+          asm_insn (l, "negq", "%rax");
+          return;
+        }
+    }
+  if (a.kind == IR_OPND_TEMP && b.kind == IR_OPND_TEMP)
+    {
+      const uint64_t disp = want - fx_bias (a) + fx_bias (b);
+      char loc[LABEL_MAX];
+      temp_loc (loc, b.temp);
+      emit_asm_add_disp (l, a, disp);
+      asm_insn (l, "subq", loc, "%rax");
+      return;
+    }
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    sarq      $%" PRIu8 ", -%zu(%%rsp)\n", FX_SHIFT, si);
-  fprintf (f, "    sarq      $%" PRIu8 ", %%rax\n", FX_SHIFT);
-  fprintf (f, "    cmpq      -%zu(%%rsp), %%rax\n", si);
-  fprintf (f, "    movq      $%" PRIu64 ", %%rdx\n", FALSE_CST);
-  fprintf (f, "    movabsq   $%" PRIu64 ", %%rax\n", TRUE_CST);
-  fprintf (f, "    cmovle    %%rdx, %%rax\n");
+  emit_asm_load_untagged (l, pe->args[0], REG_RAX);
+  emit_asm_load_untagged (l, pe->args[1], REG_R8);
+  asm_insn (l, "subq", "%r8", "%rax");
+  emit_asm_untagged_result (l, pe);
 }
 
 void
-emit_asm_prim_fxle (FILE *f, schptr_t sptr, size_t si, env_t *env)
+emit_asm_prim_fxmul (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
+  assert (pe->op == IR_PRIM && pe->nargs == 2);
+  if (emit_asm_superopt (l, pe))
+    return;
+  const size_t t = emit_imm_other (pe);
+  const ir_opnd_t a = pe->args[t < 2 ? t : 0];
+  const int64_t k
+      = t < 2 ? sch_decode_imm_fixnum (pe->args[1 - t].imm) : 0;
+  // (2n + bias) * k is 2nk + bias * k
+  const uint64_t disp = fx_dst_bias (pe) - fx_bias (a) * (uint64_t)k;
+  if (t < 2 && imm32_p ((uint64_t)k) && imm32_p (disp))
+    {
+      // lea multiplies its index by 1, 2, 4 or 8, and adds its base
+      const bool base = k == 2 || k == 3 || k == 5 || k == 9;
+      if (k == 1)
+        emit_asm_add_disp (l, a, disp);
+      else if (base || k == 4 || k == 8)
+        {
+          const char *r = emit_asm_in_reg (l, a, REG_RAX);
+          asm_insn (l, "leaq",
+                    asm_fmt ("%" PRId64 "(%s,%s,%" PRId64 ")", (int64_t)disp,
+                             base ? r : "", r, base ? k - 1 : k).s, "%rax");
+        }
+      else
+        {
+          char loc[LABEL_MAX];
+          temp_loc (loc, a.temp);
+          asm_insn (l, "imulq", asm_fmt ("$%" PRId64, k).s, loc, "%rax");
+          if (disp)
+            asm_insn (l, "addq", asm_fmt ("$%" PRId64, (int64_t)disp).s,
+                      "%rax");
+        }
+      return;
+    }
 
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+  emit_asm_load_decoded (l, pe->args[0], REG_R8);
+  emit_asm_load_untagged (l, pe->args[1], REG_RAX);
+  asm_insn (l, "imulq", "%r8", "%rax");
+  emit_asm_untagged_result (l, pe);
+}
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    sarq      $%" PRIu8 ", -%zu(%%rsp)\n", FX_SHIFT, si);
-  fprintf (f, "    sarq      $%" PRIu8 ", %%rax\n", FX_SHIFT);
-  fprintf (f, "    cmpq      -%zu(%%rsp), %%rax\n", si);
-  fprintf (f, "    movq      $%" PRIu64 ", %%rdx\n", FALSE_CST);
-  fprintf (f, "    movabsq   $%" PRIu64 ", %%rax\n", TRUE_CST);
-  fprintf (f, "    cmovl     %%rdx, %%rax\n");
+// Emit assembly to turn the fixnum result in %rax, whose tag bits are
+// have, into the representation of the destination of pe
+static void
+emit_asm_fix_tag (asm_list_t *l, const ir_insn_t *pe, uint64_t have)
+{
+  const uint64_t want = fx_dst_bias (pe);
+  if (want && !have)
+    emit_asm_tag (l, REG_RAX);
+  if (!want && have)
+    asm_insn (l, "andq", asm_fmt ("$%" PRIu64, ~FX_MASK).s, "%rax");
 }
 
-void
-emit_asm_prim_fxgt (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// Bitwise operations, which compute the tag bits of their result from the
+// ones of their operands like any other bits
+typedef enum
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
+  LOGOP_AND,
+  LOGOP_OR,
+  LOGOP_XOR
+} logop_t;
 
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+static const char *logop_names[] = { "andq", "orq", "xorq" };
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    sarq      $%" PRIu8 ", -%zu(%%rsp)\n", FX_SHIFT, si);
-  fprintf (f, "    sarq      $%" PRIu8 ", %%rax\n", FX_SHIFT);
-  fprintf (f, "    cmpq      -%zu(%%rsp), %%rax\n", si);
-  fprintf (f, "    movq      $%" PRIu64 ", %%rdx\n", FALSE_CST);
-  fprintf (f, "    movabsq   $%" PRIu64 ", %%rax\n", TRUE_CST);
-  fprintf (f, "    cmovge    %%rdx, %%rax\n");
+// Returns the bits of op applied to x and y
+static uint64_t
+logop_apply (logop_t op, uint64_t x, uint64_t y)
+{
+  switch (op)
+    {
+    case LOGOP_AND:
+      return x & y;
+    case LOGOP_OR:
+      return x | y;
+    case LOGOP_XOR:
+      return x ^ y;
+    }
+  err_unreachable ("unknown bitwise operation");
 }
 
-void
-emit_asm_prim_fxge (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// Emit the bitwise operation op of the binary primitive pe with its
+// second operand as an immediate or memory operand. Returns false, having
+// emitted nothing, if it does not fit.
+static bool
+emit_asm_fx_logop (asm_list_t *l, const ir_insn_t *pe, logop_t op)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
+  const size_t t = emit_imm_other (pe);
+  const ir_opnd_t a = pe->args[t < 2 ? t : 0];
+  const ir_opnd_t b = pe->args[t < 2 ? 1 - t : 1];
+  char src[LABEL_MAX];
+  uint64_t have;
 
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+  if (t < 2 && imm32_p (b.imm))
+    {
+      sprintf (src, "$%" PRId64, (int64_t)b.imm);
+      have = logop_apply (op, fx_bias (a), FX_TAG);
+    }
+  else if (a.kind == IR_OPND_TEMP && b.kind == IR_OPND_TEMP)
+    {
+      temp_loc (src, b.temp);
+      have = logop_apply (op, fx_bias (a), fx_bias (b));
+    }
+  else
+    return false;
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    sarq      $%" PRIu8 ", -%zu(%%rsp)\n", FX_SHIFT, si);
-  fprintf (f, "    sarq      $%" PRIu8 ", %%rax\n", FX_SHIFT);
-  fprintf (f, "    cmpq      -%zu(%%rsp), %%rax\n", si);
-  fprintf (f, "    movq      $%" PRIu64 ", %%rdx\n", FALSE_CST);
-  fprintf (f, "    movabsq   $%" PRIu64 ", %%rax\n", TRUE_CST);
-  fprintf (f, "    cmovg     %%rdx, %%rax\n");
+  emit_asm_add_disp (l, a, 0);
+  asm_insn (l, logop_names[op], src, "%rax");
+  emit_asm_fix_tag (l, pe, have);
+  return true;
 }
 
-void
-emit_asm_prim_chareq (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// Emit the bitwise primitive pe, which does op
+static void
+emit_asm_prim_logop (asm_list_t *l, const ir_insn_t *pe, logop_t op)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
-
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+  assert (pe->op == IR_PRIM && pe->nargs == 2);
+  if (emit_asm_superopt (l, pe))
+    return;
+  if (emit_asm_fx_logop (l, pe, op))
+    return;
+  if (emit_untagged_p (pe))
+    {
+      emit_asm_untagged_binop (l, pe, logop_names[op]);
+      return;
+    }
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    cmpq      -%zu(%%rsp), %%rax\n", si);
-  fprintf (f, "    movq      $%" PRIu64 ", %%rdx\n", FALSE_CST);
-  fprintf (f, "    movabsq   $%" PRIu64 ", %%rax\n", TRUE_CST);
-  fprintf (f, "    cmovne    %%rdx, %%rax\n");
+  emit_asm_load (l, pe->args[0], REG_R8);
+  emit_asm_load (l, pe->args[1], REG_RAX);
+  asm_insn (l, logop_names[op], "%r8", "%rax");
+  emit_asm_fix_tag (l, pe, logop_apply (op, FX_TAG, FX_TAG));
 }
 
 void
-emit_asm_prim_charlt (FILE *f, schptr_t sptr, size_t si, env_t *env)
+emit_asm_prim_fxlogand (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
-
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+  emit_asm_prim_logop (l, pe, LOGOP_AND);
+}
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    sarq      $%" PRIu8 ", -%zu(%%rsp)\n", CHAR_SHIFT, si);
-  fprintf (f, "    sarq      $%" PRIu8 ", %%rax\n", CHAR_SHIFT);
-  fprintf (f, "    cmpq      -%zu(%%rsp), %%rax\n", si);
-  fprintf (f, "    movq      $%" PRIu64 ", %%rdx\n", FALSE_CST);
-  fprintf (f, "    movabsq   $%" PRIu64 ", %%rax\n", TRUE_CST);
-  fprintf (f, "    cmovle    %%rdx, %%rax\n");
+void
+emit_asm_prim_fxlogor (asm_list_t *l, const ir_insn_t *pe)
+{
+  emit_asm_prim_logop (l, pe, LOGOP_OR);
 }
 
 void
-emit_asm_prim_charle (FILE *f, schptr_t sptr, size_t si, env_t *env)
+emit_asm_prim_fxlogxor (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
+  emit_asm_prim_logop (l, pe, LOGOP_XOR);
+}
 
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+// Bit primitives
+//
+// Counting bits and shifting by a variable amount take a single
+// instruction on processors with POPCNT, LZCNT, BMI1 and BMI2, which the
+// emitters use when emit_cpu has them, and a few more otherwise.
+//
+// The count of fxarithmetic-shift saturates at the 63 bits of a fixnum,
+// so that shifting left by that much or more leaves 0 and shifting right
+// leaves the sign, while the processor takes shift counts modulo 64.
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    sarq      $%" PRIu8 ", -%zu(%%rsp)\n", CHAR_SHIFT, si);
-  fprintf (f, "    sarq      $%" PRIu8 ", %%rax\n", CHAR_SHIFT);
-  fprintf (f, "    cmpq      -%zu(%%rsp), %%rax\n", si);
-  fprintf (f, "    movq      $%" PRIu64 ", %%rdx\n", FALSE_CST);
-  fprintf (f, "    movabsq   $%" PRIu64 ", %%rax\n", TRUE_CST);
-  fprintf (f, "    cmovl     %%rdx, %%rax\n");
-}
+#define FX_BITS (64 - FX_SHIFT)
 
 void
-emit_asm_prim_chargt (FILE *f, schptr_t sptr, size_t si, env_t *env)
+emit_asm_prim_fxash (asm_list_t *l, const ir_insn_t *pe)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
+  assert (pe->op == IR_PRIM && pe->nargs == 2);
+  const ir_opnd_t a = pe->args[0];
+  const ir_opnd_t b = pe->args[1];
+  const uint64_t want = fx_dst_bias (pe);
 
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+  if (b.kind == IR_OPND_IMM)
+    {
+      int64_t k = sch_decode_imm_fixnum (b.imm);
+      if (k > FX_BITS)
+        k = FX_BITS;
+      if (k < -FX_BITS)
+        k = -FX_BITS;
+
+      if (k > 0 && k <= 3 && a.kind == IR_OPND_TEMP)
+        {
+          // (2n + bias) << k is 2n << k plus bias << k
+          const char *r = emit_asm_in_reg (l, a, REG_RAX);
+          asm_insn (l, "leaq",
+                    asm_fmt ("%" PRId64 "(,%s,%d)",
+                             (int64_t)(want - (fx_bias (a) << k)), r,
+                             1 << k).s, "%rax");
+        }
+      else if (k >= 0)
+        {
+          emit_asm_load_untagged (l, a, REG_RAX);
+          if (k)
+            asm_insn (l, "salq", asm_fmt ("$%" PRId64, k).s, "%rax");
+          emit_asm_untagged_result (l, pe);
+        }
+      else
+        {
+          // The bit shifted into the tag is dropped, whatever the tag of
+          // the operand was
+          if (a.kind == IR_OPND_TEMP)
+            emit_asm_add_disp (l, a, 0);
+          else
+            emit_asm_load (l, a, REG_RAX);
+          asm_insn (l, "sarq", asm_fmt ("$%" PRId64, -k).s, "%rax");
+          if (want)
+            emit_asm_tag (l, REG_RAX);
+          else
+            asm_insn (l, "andq", asm_fmt ("$%" PRIu64, ~FX_MASK).s, "%rax");
+        }
+      return;
+    }
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    sarq      $%" PRIu8 ", -%zu(%%rsp)\n", CHAR_SHIFT, si);
-  fprintf (f, "    sarq      $%" PRIu8 ", %%rax\n", CHAR_SHIFT);
-  fprintf (f, "    cmpq      -%zu(%%rsp), %%rax\n", si);
-  fprintf (f, "    movq      $%" PRIu64 ", %%rdx\n", FALSE_CST);
-  fprintf (f, "    movabsq   $%" PRIu64 ", %%rax\n", TRUE_CST);
-  fprintf (f, "    cmovge    %%rdx, %%rax\n");
+  // Both shifts are computed, with their counts saturated, and the sign
+  // of the count picks one of them
+  emit_asm_load_decoded (l, b, REG_RCX);
+  emit_asm_load_untagged (l, a, REG_RAX);
+  asm_insn (l, "movq", "%rcx", "%rdx");
+  asm_insn (l, "negq", "%rdx");
+  asm_insn (l, "movl", asm_fmt ("$%d", FX_BITS).s, "%esi");
+  asm_insn (l, "cmpq", "%rsi", "%rcx");
+  asm_insn (l, "cmovg", "%rsi", "%rcx");
+  asm_insn (l, "cmpq", "%rsi", "%rdx");
+  asm_insn (l, "cmovg", "%rsi", "%rdx");
+  if (emit_cpu & CPU_BMI2)
+    {
+      asm_insn (l, "shlxq", "%rcx", "%rax", "%r8");
+      asm_insn (l, "sarxq", "%rdx", "%rax", "%rax");
+    }
+  else
+    {
+      asm_insn (l, "movq", "%rax", "%r8");
+      asm_insn (l, "salq", "%cl", "%r8");
+      asm_insn (l, "movl", "%edx", "%ecx");
+      asm_insn (l, "sarq", "%cl", "%rax");
+    }
+  asm_insn (l, "andq", asm_fmt ("$%" PRIu64, ~FX_MASK).s, "%rax");
+  asm_insn (l, "testq", "%rdx", "%rdx");
+  asm_insn (l, "cmovs", "%r8", "%rax");
+  emit_asm_untagged_result (l, pe);
 }
 
-void
-emit_asm_prim_charge (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// Emit assembly to load into %rdx the value of the fixnum operand o, with
+// its bits flipped if it is negative, as fxbit-count and fxlength count
+// them, and the sign of o, 0 or -1, into %rax
+static void
+emit_asm_load_magnitude (asm_list_t *l, ir_opnd_t o)
 {
-  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
-  assert (pe->type == SCH_PRIM_EVAL2);
+  emit_asm_load_decoded (l, o, REG_RDX);
+  asm_insn (l, "movq", "%rdx", "%rax");
+  asm_insn (l, "sarq", "$63", "%rax");
+  asm_insn (l, "xorq", "%rax", "%rdx");
+}
 
-  schptr_t arg1 = pe->arg1;
-  emit_asm_expr (f, arg1, si, env);
-  fprintf (f, "    movq   %%rax, -%zu(%%rsp)\n", si);
+// Emit assembly to count the bits set in %rdx, into %rdx, with popcnt or
+// with the sum of the bits in ever wider fields
+static void
+emit_asm_popcount (asm_list_t *l)
+{
+  if (emit_cpu & CPU_POPCNT)
+    {
+      asm_insn (l, "popcntq", "%rdx", "%rdx");
+      return;
+    }
 
-  schptr_t arg2 = pe->arg2;
-  emit_asm_expr (f, arg2, si + WORD_BYTES, env);
-  fprintf (f, "    sarq      $%" PRIu8 ", -%zu(%%rsp)\n", CHAR_SHIFT, si);
-  fprintf (f, "    sarq      $%" PRIu8 ", %%rax\n", CHAR_SHIFT);
-  fprintf (f, "    cmpq      -%zu(%%rsp), %%rax\n", si);
-  fprintf (f, "    movq      $%" PRIu64 ", %%rdx\n", FALSE_CST);
-  fprintf (f, "    movabsq   $%" PRIu64 ", %%rax\n", TRUE_CST);
-  fprintf (f, "    cmovg     %%rdx, %%rax\n");
+  static const struct
+  {
+    unsigned int shift;
+    uint64_t mask;
+  } fields[] = { { 1, UINT64_C (0x5555555555555555) },
+                 { 2, UINT64_C (0x3333333333333333) },
+                 { 4, UINT64_C (0x0f0f0f0f0f0f0f0f) } };
+  for (size_t k = 0; k < sizeof (fields) / sizeof (fields[0]); k++)
+    {
+      emit_asm_imm (l, fields[k].mask, REG_RSI);
+      asm_insn (l, "movq", "%rdx", "%rcx");
+      asm_insn (l, "shrq", asm_fmt ("$%u", fields[k].shift).s, "%rcx");
+      if (k == 0)
+        {
+          asm_insn (l, "andq", "%rsi", "%rcx");
+          asm_insn (l, "subq", "%rcx", "%rdx");
+        }
+      else if (k == 1)
+        {
+          asm_insn (l, "andq", "%rsi", "%rcx");
+          asm_insn (l, "andq", "%rsi", "%rdx");
+          asm_insn (l, "addq", "%rcx", "%rdx");
+        }
+      else
+        {
+          asm_insn (l, "addq", "%rcx", "%rdx");
+          asm_insn (l, "andq", "%rsi", "%rdx");
+        }
+    }
+  emit_asm_imm (l, UINT64_C (0x0101010101010101), REG_RSI);
+  asm_insn (l, "imulq", "%rsi", "%rdx");
+  asm_insn (l, "shrq", "$56", "%rdx");
 }
 
 void
-emit_asm_label (FILE *f, char *label)
+emit_asm_prim_fxbit_count (asm_list_t *l, const ir_insn_t *pe)
 {
-  fprintf (f, "%s:\n", label);
+  assert (pe->op == IR_PRIM && pe->nargs == 1);
+
+  // The count of a negative fixnum is the complement of the count of its
+  // complement
+  emit_asm_load_magnitude (l, pe->args[0]);
+  emit_asm_popcount (l);
+  asm_insn (l, "xorq", "%rdx", "%rax");
+  asm_insn (l, "leaq",
+            asm_fmt ("%" PRIu64 "(%%rax,%%rax)", fx_dst_bias (pe)).s, "%rax");
 }
 
-// Emitting asm for conditional
 void
-emit_asm_if (FILE *f, schptr_t p, size_t si, env_t *env)
+emit_asm_prim_fxlength (asm_list_t *l, const ir_insn_t *pe)
 {
-  schif_t *pif = (schif_t *)p;
-  assert (pif->type == SCH_IF);
+  assert (pe->op == IR_PRIM && pe->nargs == 1);
+  const uint64_t want = fx_dst_bias (pe);
 
-  char elsel[LABEL_MAX];
-  gen_new_temp_label (elsel);
+  emit_asm_load_magnitude (l, pe->args[0]);
+  if (emit_cpu & CPU_LZCNT)
+    {
+      // The length is 64 minus the leading zeros, which are 64 for 0
+      asm_insn (l, "lzcntq", "%rdx", "%rax");
+      asm_insn (l, "negq", "%rax");
+      asm_insn (l, "leaq", asm_fmt ("%" PRIu64 "(%%rax,%%rax)", 128 + want).s,
+                "%rax");
+      return;
+    }
 
-  char endl[LABEL_MAX];
-  gen_new_temp_label (endl);
+  // bsr gives the index of the highest bit set, and sets ZF for 0, whose
+  // length is one more than -1
+  asm_insn (l, "bsrq", "%rdx", "%rax");
+  asm_insn (l, "movq", "$-1", "%rcx");
+  asm_insn (l, "cmovz", "%rcx", "%rax");
+  asm_insn (l, "leaq", asm_fmt ("%" PRIu64 "(%%rax,%%rax)", 2 + want).s,
+            "%rax");
+}
 
-  emit_asm_expr (f, pif->condition, si, env);
+void
+emit_asm_prim_fxfirst_bit_set (asm_list_t *l, const ir_insn_t *pe)
+{
+  assert (pe->op == IR_PRIM && pe->nargs == 1);
 
-  // Check if boolean value is true of false and jump accordingly
-  fprintf (f, "    cmpq   $%" PRIu64 ", %%rax\n", FALSE_CST);
-  fprintf (f, "    je     %s\n", elsel);
-  emit_asm_expr (f, pif->thenv, si, env);
-  fprintf (f, "    jmp    %s\n", endl);
-  emit_asm_label (f, elsel);
-  emit_asm_expr (f, pif->elsev, si, env);
-  emit_asm_label (f, endl);
+  // The untagged fixnum has its lowest bit set one place higher than the
+  // value, and is 0 for 0, whose result is -1. tzcnt sets CF for 0, and
+  // bsf sets ZF, leaving its destination undefined.
+  emit_asm_load_untagged (l, pe->args[0], REG_RDX);
+  if (emit_cpu & CPU_BMI1)
+    {
+      asm_insn (l, "tzcntq", "%rdx", "%rax");
+      asm_insn (l, "cmovc", "%rdx", "%rax");
+    }
+  else
+    {
+      asm_insn (l, "bsfq", "%rdx", "%rax");
+      asm_insn (l, "cmovz", "%rdx", "%rax");
+    }
+  asm_insn (l, "leaq",
+            asm_fmt ("%" PRId64 "(%%rax,%%rax)",
+                     (int64_t)fx_dst_bias (pe) - 2).s, "%rax");
 }
 
-void
-emit_asm_let (FILE *f, schptr_t sptr, size_t si, env_t *env)
+// Emits a comparison of the first operand of the binary primitive pe with
+// the second one, and returns cond, the relation tested between them, for
+// the order they are compared in. Fixnums and characters are kept in the
+// same order as their values, as long as both operands are tagged or both
+// untagged, so they need no decoding. A temporary is compared in place
+// with an immediate or with another temporary.
+static cond_code
+emit_asm_cmp (asm_list_t *l, const ir_insn_t *pe, cond_code cond)
 {
-  // We have to evaluate all let bindings right hand sides.
-  // Add definitions for all of them into an environment and
-  // emit code for the body of the let with the environment properly
-  // filled.
-  schlet_t *let = (schlet_t *)sptr;
-  assert (let->type == SCH_LET);
+  assert (pe->op == IR_PRIM && pe->nargs == 2);
+  const ir_opnd_t a = pe->args[0];
+  const ir_opnd_t b = pe->args[1];
+  char loc[LABEL_MAX];
 
-  // Evaluate each of the bindings in the bindings list
-  env_t *nenv = env;
-  size_t freesi = si; // currently free si
-  for (binding_spec_list_t *bs = let->bindings; bs != NULL; bs = bs->next)
+  const size_t t = emit_imm_other (pe);
+  if (t < 2)
     {
-      emit_asm_expr (f, bs->expr, freesi, let->star_p ? nenv : env);
+      uint64_t c = pe->args[1 - t].imm;
+      if (untagged_p (pe->args[t]))
+        c &= ~FX_MASK;
+      if (imm32_p (c))
+        {
+          temp_loc (loc, pe->args[t].temp);
+          asm_insn (l, "cmpq", asm_fmt ("$%" PRId64, (int64_t)c).s, loc);
+          return t == 0 ? cond : cond_swapped[cond];
+        }
+    }
 
-      fprintf (f, "    movq %%rax, -%zu(%%rsp)\n", freesi);
+  if (a.kind == IR_OPND_TEMP && b.kind == IR_OPND_TEMP
+      && untagged_p (a) == untagged_p (b))
+    {
+      const char *ra = emit_asm_in_reg (l, a, REG_RAX);
+      temp_loc (loc, b.temp);
+      asm_insn (l, "cmpq", loc, ra);
+      return cond;
+    }
 
-      nenv = env_add (bs->id, freesi, nenv);
-      freesi += WORD_BYTES;
+  if (emit_untagged_p (pe))
+    {
+      emit_asm_load_untagged (l, a, REG_RAX);
+      emit_asm_load_untagged (l, b, REG_R8);
+    }
+  else
+    {
+      emit_asm_load (l, a, REG_RAX);
+      emit_asm_load (l, b, REG_R8);
     }
+  asm_insn (l, "cmpq", "%r8", "%rax");
+  return cond;
+}
 
-  emit_asm_expr (f, let->body, freesi, nenv);
-  free_env_partial (nenv, env, /*shallow=*/true);
+cond_code
+emit_asm_test_fxeq (asm_list_t *l, const ir_insn_t *pe)
+{
+  return emit_asm_cmp (l, pe, COND_E);
 }
 
-void
-emit_asm_expr_seq (FILE *f, schptr_t sptr, size_t si, env_t *env)
+cond_code
+emit_asm_test_fxlt (asm_list_t *l, const ir_insn_t *pe)
+{
+  return emit_asm_cmp (l, pe, COND_L);
+}
+
+cond_code
+emit_asm_test_fxle (asm_list_t *l, const ir_insn_t *pe)
+{
+  return emit_asm_cmp (l, pe, COND_LE);
+}
+
+cond_code
+emit_asm_test_fxgt (asm_list_t *l, const ir_insn_t *pe)
+{
+  return emit_asm_cmp (l, pe, COND_G);
+}
+
+cond_code
+emit_asm_test_fxge (asm_list_t *l, const ir_insn_t *pe)
 {
-  schexprseq_t *seq = (schexprseq_t *)sptr;
-  assert (seq->type == SCH_EXPR_SEQ);
+  return emit_asm_cmp (l, pe, COND_GE);
+}
 
-  expression_list_t *s = seq->seq;
+cond_code
+emit_asm_test_chareq (asm_list_t *l, const ir_insn_t *pe)
+{
+  return emit_asm_cmp (l, pe, COND_E);
+}
 
-  for (; s; s = s->next)
-    emit_asm_expr (f, s->expr, si, env);
+cond_code
+emit_asm_test_charlt (asm_list_t *l, const ir_insn_t *pe)
+{
+  return emit_asm_cmp (l, pe, COND_L);
+}
+
+cond_code
+emit_asm_test_charle (asm_list_t *l, const ir_insn_t *pe)
+{
+  return emit_asm_cmp (l, pe, COND_LE);
+}
+
+cond_code
+emit_asm_test_chargt (asm_list_t *l, const ir_insn_t *pe)
+{
+  return emit_asm_cmp (l, pe, COND_G);
+}
+
+cond_code
+emit_asm_test_charge (asm_list_t *l, const ir_insn_t *pe)
+{
+  return emit_asm_cmp (l, pe, COND_GE);
+}
+
+void
+emit_asm_label (asm_list_t *l, const char *label)
+{
+  asm_label (l, label);
+}
+
+void emit_asm_insn (asm_list_t *, const ir_insn_t *);
+void emit_asm_block (asm_list_t *, const ir_block_t *);
+static void emit_asm_tail_block (asm_list_t *, const ir_block_t *);
+static bool continue_p (const ir_block_t *);
+
+// Short-circuit conditionals
+//
+// and, or and cond leave conditionals whose value is only the test of
+// another one. Such a conditional is not emitted on its own: its arms jump
+// straight to the arm of the other one that their value selects, and an
+// arm whose value is a constant, or its own test, needs no code at all.
+// A conditional is only fused into the test that comes right after it,
+// either as the next instruction or as the value of a block that is itself
+// a test, so that nothing is evaluated out of order.
+
+// Number of uses of each temporary of the procedure being emitted, and
+// the instruction defining it
+static size_t *emit_uses = NULL;
+static const ir_insn_t **emit_defs = NULL;
+
+static void
+emit_count_uses (const ir_block_t *b)
+{
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      emit_defs[i->dst] = i;
+      for (size_t a = 0; a < i->nargs; a++)
+        if (i->args[a].kind == IR_OPND_TEMP)
+          emit_uses[i->args[a].temp]++;
+      if (i->op == IR_IF)
+        {
+          emit_count_uses (i->thenb);
+          emit_count_uses (i->elseb);
+        }
+      if (i->op == IR_LOOP)
+        emit_count_uses (i->body);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          emit_count_uses (i->arms[k]);
+    }
+  if (b->result.kind == IR_OPND_TEMP)
+    emit_uses[b->result.temp]++;
+}
+
+// Temporaries that hold multiple values, which a call that defines them
+// has to spill out of the registers they are returned in
+static bool *emit_values = NULL;
+
+static void
+emit_mark_values (ir_opnd_t o)
+{
+  if (o.kind != IR_OPND_TEMP || emit_values[o.temp])
+    return;
+
+  emit_values[o.temp] = true;
+  const ir_insn_t *i = emit_defs[o.temp];
+  if (!i)
+    return;
+  switch (i->op)
+    {
+    case IR_MOVE:
+    case IR_RECEIVE:
+      emit_mark_values (i->args[0]);
+      break;
+    case IR_IF:
+      emit_mark_values (i->thenb->result);
+      emit_mark_values (i->elseb->result);
+      break;
+    case IR_LOOP:
+      emit_mark_values (i->body->result);
+      break;
+    case IR_SWITCH:
+      for (size_t k = 0; k < i->narms; k++)
+        emit_mark_values (i->arms[k]->result);
+      break;
+    default:
+      break;
+    }
+}
+
+static void
+emit_find_values (const ir_block_t *b)
+{
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      if (i->op == IR_RECEIVE || i->op == IR_VREF)
+        emit_mark_values (i->args[0]);
+      if (i->op == IR_CALL_VALUES)
+        emit_mark_values (i->args[1]);
+      if (i->op == IR_IF)
+        {
+          emit_find_values (i->thenb);
+          emit_find_values (i->elseb);
+        }
+      if (i->op == IR_LOOP)
+        emit_find_values (i->body);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          emit_find_values (i->arms[k]);
+    }
+}
+
+// True if i is a conditional or a predicate whose value is used once, as
+// operand o
+static bool
+test_only_p (const ir_insn_t *i, ir_opnd_t o)
+{
+  return (i->op == IR_IF || (i->op == IR_PRIM && i->prim->tester))
+         && o.kind == IR_OPND_TEMP && o.temp == i->dst
+         && emit_uses[i->dst] == 1;
+}
+
+// True if i is an application of not
+static bool
+not_p (const ir_insn_t *i)
+{
+  return i->op == IR_PRIM && i->prim->tester == emit_asm_test_not;
+}
+
+// True if i is only the test of the instruction after it, which emits it.
+// That is a conditional, or a not that is either fused in turn or, when
+// last_p, the last instruction of a block whose value is only a test.
+static bool
+fused_in_p (const ir_insn_t *i, bool last_p)
+{
+  const ir_insn_t *n = i->next;
+  if (!n || !n->nargs || !test_only_p (i, n->args[0]))
+    return false;
+  if (n->op == IR_IF)
+    return true;
+  return not_p (n) && (n->next ? fused_in_p (n, last_p) : last_p);
+}
+
+static bool
+fused_p (const ir_insn_t *i)
+{
+  return fused_in_p (i, false);
+}
+
+// Returns the instruction fused into the test of conditional or not i, if
+// any
+static const ir_insn_t *
+fused_test (const ir_insn_t *i)
+{
+  const ir_opnd_t o = i->args[0];
+  if (o.kind != IR_OPND_TEMP || !emit_defs[o.temp]
+      || emit_defs[o.temp]->next != i || !test_only_p (emit_defs[o.temp], o))
+    return NULL;
+  return emit_defs[o.temp];
+}
+
+static void emit_asm_branch (asm_list_t *, const ir_insn_t *, const char *,
+                             const char *, const char *);
+
+// Emit the jumps to truel if cond holds, or to falsel if it does not. The
+// label in fall comes right after, so there is no jump to it.
+static void
+emit_asm_jcc (asm_list_t *l, cond_code cond, const char *truel,
+              const char *falsel, const char *fall)
+{
+  if (fall == truel)
+    asm_insn (l, asm_fmt ("j%s", cond_names[cond_negated (cond)]).s, falsel);
+  else
+    {
+      asm_insn (l, asm_fmt ("j%s", cond_names[cond]).s, truel);
+      if (fall != falsel)
+        asm_insn (l, "jmp", falsel);
+    }
+}
+
+// Emit the test of whether operand o is not #f, where c is the
+// instruction fused into o, if any, and return the condition that holds
+// when it is. A predicate sets the flags of its own test, and not those
+// of its operand the other way round.
+static cond_code
+emit_asm_cond (asm_list_t *l, ir_opnd_t o, const ir_insn_t *c)
+{
+  if (c && not_p (c))
+    return cond_negated (emit_asm_cond (l, c->args[0], fused_test (c)));
+  if (c)
+    {
+      assert (c->op == IR_PRIM && c->prim->tester);
+      return c->prim->tester (l, c);
+    }
+
+  char loc[LABEL_MAX];
+  emit_asm_opnd (l, loc, o);
+  asm_insn (l, "cmpq", asm_fmt ("$%" PRIu64, FALSE_CST).s, loc);
+  return COND_NE;
+}
+
+// Emit the jumps to truel if operand o is not #f, or to falsel if it is,
+// where c is the instruction fused into o, if any. A not jumps on the test
+// of its operand, with the labels the other way round. The label in fall
+// comes right after, so there is no jump to it.
+static void
+emit_asm_test (asm_list_t *l, ir_opnd_t o, const ir_insn_t *c,
+               const char *truel, const char *falsel, const char *fall)
+{
+  if (c && c->op == IR_IF)
+    {
+      emit_asm_branch (l, c, truel, falsel, fall);
+      return;
+    }
+  if (c && not_p (c))
+    {
+      emit_asm_test (l, c->args[0], fused_test (c), falsel, truel, fall);
+      return;
+    }
+  if (!c && o.kind == IR_OPND_IMM)
+    {
+      const char *target = sch_imm_false_p (o.imm) ? falsel : truel;
+      if (target != fall)
+        asm_insn (l, "jmp", target);
+      return;
+    }
+
+  emit_asm_jcc (l, emit_asm_cond (l, o, c), truel, falsel, fall);
+}
+
+// Emit block b, whose value is only used as a test, followed by the jumps
+// on that value
+static void
+emit_asm_branch_block (asm_list_t *l, const ir_block_t *b, const char *truel,
+                       const char *falsel, const char *fall)
+{
+  const ir_insn_t *c = NULL;
+  if (b->last && test_only_p (b->last, b->result))
+    c = b->last;
+
+  for (const ir_insn_t *i = b->first; i != c; i = i->next)
+    if (!fused_in_p (i, c != NULL))
+      emit_asm_insn (l, i);
+  emit_asm_test (l, b->result, c, truel, falsel, fall);
+}
+
+// Returns the label an arm of conditional c jumps to when it has no code,
+// or NULL if it has some. truth is the value of the test in that arm.
+static const char *
+branch_target (const ir_insn_t *c, const ir_block_t *arm, bool truth,
+               const char *truel, const char *falsel)
+{
+  if (arm->first)
+    return NULL;
+  if (arm->result.kind == IR_OPND_IMM)
+    return sch_imm_false_p (arm->result.imm) ? falsel : truel;
+  if (ir_opnd_eq (arm->result, c->args[0]))
+    return truth ? truel : falsel;
+  return NULL;
+}
+
+// Emit conditional c, whose value is only used as a test, as the jumps to
+// truel if its value is not #f, or to falsel if it is
+static void
+emit_asm_branch (asm_list_t *l, const ir_insn_t *c, const char *truel,
+                 const char *falsel, const char *fall)
+{
+  const char *thent = branch_target (c, c->thenb, true, truel, falsel);
+  const char *elset = branch_target (c, c->elseb, false, truel, falsel);
+  char thenl[LABEL_MAX];
+  char elsel[LABEL_MAX];
+
+  if (!thent)
+    {
+      gen_new_temp_label (thenl);
+      thent = thenl;
+    }
+  if (!elset)
+    {
+      gen_new_temp_label (elsel);
+      elset = elsel;
+    }
+
+  const char *next = fall;
+  if (thent == thenl)
+    next = thenl;
+  else if (elset == elsel)
+    next = elsel;
+  emit_asm_test (l, c->args[0], fused_test (c), thent, elset, next);
+
+  if (thent == thenl)
+    {
+      emit_asm_label (l, thenl);
+      emit_asm_branch_block (l, c->thenb, truel, falsel,
+                             elset == elsel ? NULL : fall);
+    }
+  if (elset == elsel)
+    {
+      emit_asm_label (l, elsel);
+      emit_asm_branch_block (l, c->elseb, truel, falsel, fall);
+    }
+}
+
+// Emit conditional pif, marked as a select by the cmov pass, whose arms
+// are left with only their values. Those that are not kept tagged in a
+// temporary are loaded before the test, since loading them may change the
+// flags, and the one of the arm not taken is then dropped with a cmov.
+static void
+emit_asm_select (asm_list_t *l, const ir_insn_t *pif)
+{
+  const ir_opnd_t thenr = pif->thenb->result;
+  const ir_opnd_t elser = pif->elseb->result;
+  char thenl[LABEL_MAX];
+  char elsel[LABEL_MAX];
+
+  if (thenr.kind == IR_OPND_TEMP && !untagged_p (thenr))
+    temp_loc (thenl, thenr.temp);
+  else
+    {
+      emit_asm_load (l, thenr, REG_RSI);
+      strcpy (thenl, "%rsi");
+    }
+  if (elser.kind == IR_OPND_TEMP && !untagged_p (elser))
+    temp_loc (elsel, elser.temp);
+  else
+    {
+      emit_asm_load (l, elser, REG_RDX);
+      strcpy (elsel, "%rdx");
+    }
+
+  const cond_code cond = emit_asm_cond (l, pif->args[0], fused_test (pif));
+  asm_insn (l, "movq", thenl, "%rax");
+  asm_insn (l, asm_fmt ("cmov%s", cond_names[cond_negated (cond)]).s, elsel,
+            "%rax");
+}
+
+// Emitting asm for conditional. In tail position, each arm returns from
+// the procedure on its own.
+void
+emit_asm_if (asm_list_t *l, const ir_insn_t *pif, bool tail)
+{
+  assert (pif->op == IR_IF);
+
+  if (pif->select)
+    {
+      assert (!pif->thenb->first && !pif->elseb->first);
+      emit_asm_select (l, pif);
+      if (tail)
+        emit_asm_epilogue (l);
+      return;
+    }
+
+  char thenl[LABEL_MAX];
+  char elsel[LABEL_MAX];
+  gen_new_temp_label (thenl);
+  gen_new_temp_label (elsel);
+
+  emit_asm_test (l, pif->args[0], fused_test (pif), thenl, elsel, thenl);
+  emit_asm_label (l, thenl);
+  if (tail)
+    {
+      emit_asm_tail_block (l, pif->thenb);
+      emit_asm_label (l, elsel);
+      emit_asm_tail_block (l, pif->elseb);
+      return;
+    }
+
+  char endl[LABEL_MAX];
+  gen_new_temp_label (endl);
+
+  emit_asm_block (l, pif->thenb);
+  if (!continue_p (pif->thenb))
+    {
+      emit_asm_load (l, pif->thenb->result, REG_RAX);
+      asm_insn (l, "jmp", endl);
+    }
+  emit_asm_label (l, elsel);
+  emit_asm_block (l, pif->elseb);
+  if (!continue_p (pif->elseb))
+    emit_asm_load (l, pif->elseb->result, REG_RAX);
+  emit_asm_label (l, endl);
+}
+
+// Loops
+//
+// The variables of a loop live in the stack slots of their temporaries,
+// like everything else, so going back to the start of the body is a
+// plain jmp once the new values are in the slots. The labels of the
+// loops being emitted are kept in a stack, where an IR_CONTINUE finds the
+// one of its loop.
+
+typedef struct loop_label
+{
+  size_t vars;
+  char label[LABEL_MAX];
+} loop_label_t;
+
+static loop_label_t *loop_labels = NULL;
+static size_t loop_labels_count = 0;
+static size_t loop_labels_cap = 0;
+
+// True if block b ends by going back to the start of a loop, so that it
+// has no value to jump anywhere with
+static bool
+continue_p (const ir_block_t *b)
+{
+  return b->last && b->last->op == IR_CONTINUE;
+}
+
+void
+emit_asm_loop (asm_list_t *l, const ir_insn_t *pl, bool tail)
+{
+  assert (pl->op == IR_LOOP);
+
+  for (size_t a = 0; a < pl->nargs; a++)
+    {
+      emit_asm_load (l, pl->args[a], REG_RAX);
+      emit_asm_store (l, pl->vars + a);
+    }
+
+  if (loop_labels_count == loop_labels_cap)
+    {
+      loop_labels_cap = loop_labels_cap ? 2 * loop_labels_cap : 8;
+      loop_labels
+          = grow (loop_labels, loop_labels_cap * sizeof (*loop_labels));
+    }
+  loop_label_t *entry = &loop_labels[loop_labels_count++];
+  entry->vars = pl->vars;
+  gen_new_temp_label (entry->label);
+  emit_asm_label (l, entry->label);
+
+  if (tail)
+    emit_asm_tail_block (l, pl->body);
+  else
+    {
+      emit_asm_block (l, pl->body);
+      if (!continue_p (pl->body))
+        emit_asm_load (l, pl->body->result, REG_RAX);
+    }
+  loop_labels_count--;
+}
+
+// Emit the parallel assignment of the arguments of pc to the variables
+// of its loop, and the jump back to its start. A move is done once no
+// other move left reads the variable it writes. When all the moves left
+// are in cycles, one variable of a cycle is saved in %rdx, and read from
+// there instead.
+void
+emit_asm_continue (asm_list_t *l, const ir_insn_t *pc)
+{
+  assert (pc->op == IR_CONTINUE);
+
+  size_t k = loop_labels_count;
+  while (loop_labels[--k].vars != pc->vars)
+    ;
+  const char *label = loop_labels[k].label;
+
+  const size_t n = pc->nargs;
+  ir_opnd_t *src = alloc ((n + 1) * sizeof (*src));
+  bool *saved = alloc ((n + 1) * sizeof (*saved));
+  size_t left = 0;
+  for (size_t a = 0; a < n; a++)
+    {
+      src[a] = pc->args[a];
+      saved[a] = false;
+      if (src[a].kind != IR_OPND_TEMP || src[a].temp != pc->vars + a)
+        left++;
+      else
+        src[a].kind = IR_OPND_NONE;
+    }
+
+  while (left)
+    {
+      bool moved = false;
+      for (size_t a = 0; a < n; a++)
+        {
+          if (src[a].kind == IR_OPND_NONE)
+            continue;
+
+          bool read_p = false;
+          for (size_t b = 0; b < n && !read_p; b++)
+            read_p = b != a && !saved[b] && src[b].kind == IR_OPND_TEMP
+                     && src[b].temp == pc->vars + a;
+          if (read_p)
+            continue;
+
+          if (saved[a])
+            {
+              char loc[LABEL_MAX];
+              temp_loc (loc, pc->vars + a);
+              asm_insn (l, "movq", "%rdx", loc);
+            }
+          else
+            {
+              emit_asm_load (l, src[a], REG_RAX);
+              emit_asm_store (l, pc->vars + a);
+            }
+          src[a].kind = IR_OPND_NONE;
+          left--;
+          moved = true;
+        }
+      if (moved)
+        continue;
+
+      // Every variable left is read by another move: save the first one
+      size_t a = 0;
+      while (src[a].kind == IR_OPND_NONE)
+        a++;
+      emit_asm_load (l, ir_opnd_temp (pc->vars + a), REG_RDX);
+      for (size_t b = 0; b < n; b++)
+        if (src[b].kind == IR_OPND_TEMP && src[b].temp == pc->vars + a)
+          saved[b] = true;
+    }
+
+  asm_insn (l, "jmp", label);
+  free (src);
+  free (saved);
+}
+
+// Switches
+//
+// A switch over at least SWITCH_TABLE_MIN cases, all fixnums or all
+// characters, that fill at least half of the range between the smallest
+// and the largest, jumps through a table with the offset of the arm of
+// each value in the range. The index in the table is the key minus the
+// smallest value, rotated right by the shift of their type. The tag bits
+// of a key of any other type do not cancel out in the subtraction, so the
+// rotation leaves them at the top of the index, which is then out of the
+// table. Other switches go down a balanced tree of comparisons.
+
+#define SWITCH_TABLE_MIN 4
+
+// True if switch ps jumps through a table, in which case shift is the
+// shift of the type of its cases
+static bool
+switch_table_p (const ir_insn_t *ps, uint8_t *shift)
+{
+  if (ps->ncases < SWITCH_TABLE_MIN)
+    return false;
+
+  const vtype_t t = vtype_of_imm (ps->cases[0].value);
+  if (t == VT_FIXNUM)
+    *shift = FX_SHIFT;
+  else if (t == VT_CHAR)
+    *shift = CHAR_SHIFT;
+  else
+    return false;
+
+  for (size_t c = 1; c < ps->ncases; c++)
+    if (vtype_of_imm (ps->cases[c].value) != t)
+      return false;
+  const uint64_t last
+      = (ps->cases[ps->ncases - 1].value - ps->cases[0].value) >> *shift;
+  return last < 2 * ps->ncases;
+}
+
+// Emit the comparison of %rax with value
+static void
+emit_asm_cmp_imm (asm_list_t *l, schptr_t value)
+{
+  if ((int64_t)value == (int32_t)value)
+    asm_insn (l, "cmpq", asm_fmt ("$%" PRId64, (int64_t)value).s, "%rax");
+  else
+    {
+      asm_insn (l, "movabsq", asm_fmt ("$%" PRIu64, value).s, "%rdx");
+      asm_insn (l, "cmpq", "%rdx", "%rax");
+    }
+}
+
+// Emit the jump through the table of switch ps, for a key in %rax
+static void
+emit_asm_switch_table (asm_list_t *l, const ir_insn_t *ps, uint8_t shift,
+                       char (*labels)[LABEL_MAX])
+{
+  const schptr_t min = ps->cases[0].value;
+  const uint64_t last
+      = (ps->cases[ps->ncases - 1].value - ps->cases[0].value) >> shift;
+  char tablel[LABEL_MAX];
+  gen_new_temp_label (tablel);
+
+  if ((int64_t)min == (int32_t)min)
+    asm_insn (l, "subq", asm_fmt ("$%" PRId64, (int64_t)min).s, "%rax");
+  else
+    {
+      asm_insn (l, "movabsq", asm_fmt ("$%" PRIu64, min).s, "%rdx");
+      asm_insn (l, "subq", "%rdx", "%rax");
+    }
+  asm_insn (l, "rorq", asm_fmt ("$%" PRIu8, shift).s, "%rax");
+  asm_insn (l, "cmpq", asm_fmt ("$%" PRIu64, last).s, "%rax");
+  asm_insn (l, "ja", labels[ps->narms - 1]);
+  asm_insn (l, "leaq", asm_fmt ("%s(%%rip)", tablel).s, "%rdx");
+  asm_insn (l, "movslq", "(%rdx,%rax,4)", "%rax");
+  asm_insn (l, "addq", "%rdx", "%rax");
+  asm_insn (l, "jmp", "*%rax");
+
+  asm_directive (l, ".section " ASM_RODATA_SECTION);
+  asm_directive (l, ".p2align 2");
+  emit_asm_label (l, tablel);
+  size_t c = 0;
+  for (uint64_t k = 0; k <= last; k++)
+    {
+      size_t arm = ps->narms - 1;
+      if (ps->cases[c].value == min + (k << shift))
+        arm = ps->cases[c++].arm;
+      asm_directive (l, ".long  %s-%s", labels[arm], tablel);
+    }
+  asm_directive (l, ".text");
+}
+
+// Emit the tree of comparisons of %rax with the values of the n cases,
+// sorted, that jumps to the label of the arm of the one it is, or to the
+// label of the default arm
+static void
+emit_asm_switch_tree (asm_list_t *l, const ir_case_t *cases, size_t n,
+                      char (*labels)[LABEL_MAX], const char *deflt)
+{
+  if (n <= 3)
+    {
+      for (size_t c = 0; c < n; c++)
+        {
+          emit_asm_cmp_imm (l, cases[c].value);
+          asm_insn (l, "je", labels[cases[c].arm]);
+        }
+      asm_insn (l, "jmp", deflt);
+      return;
+    }
+
+  const size_t mid = n / 2;
+  char lessl[LABEL_MAX];
+  gen_new_temp_label (lessl);
+
+  emit_asm_cmp_imm (l, cases[mid].value);
+  asm_insn (l, "je", labels[cases[mid].arm]);
+  asm_insn (l, "jl", lessl);
+  emit_asm_switch_tree (l, cases + mid + 1, n - mid - 1, labels, deflt);
+  emit_asm_label (l, lessl);
+  emit_asm_switch_tree (l, cases, mid, labels, deflt);
+}
+
+// Emit a switch. In tail position, each arm returns from the procedure on
+// its own.
+static void
+emit_asm_switch (asm_list_t *l, const ir_insn_t *ps, bool tail)
+{
+  assert (ps->op == IR_SWITCH);
+
+  char(*labels)[LABEL_MAX] = alloc (ps->narms * sizeof (*labels));
+  for (size_t k = 0; k < ps->narms; k++)
+    gen_new_temp_label (labels[k]);
+
+  uint8_t shift;
+  emit_asm_load (l, ps->args[0], REG_RAX);
+  if (switch_table_p (ps, &shift))
+    emit_asm_switch_table (l, ps, shift, labels);
+  else
+    emit_asm_switch_tree (l, ps->cases, ps->ncases, labels,
+                          labels[ps->narms - 1]);
+
+  char endl[LABEL_MAX];
+  gen_new_temp_label (endl);
+  for (size_t k = 0; k < ps->narms; k++)
+    {
+      const ir_block_t *arm = ps->arms[k];
+
+      emit_asm_label (l, labels[k]);
+      if (tail)
+        {
+          emit_asm_tail_block (l, arm);
+          continue;
+        }
+
+      emit_asm_block (l, arm);
+      if (continue_p (arm))
+        continue;
+      emit_asm_load (l, arm->result, REG_RAX);
+      if (k + 1 < ps->narms)
+        asm_insn (l, "jmp", endl);
+    }
+  if (!tail)
+    emit_asm_label (l, endl);
+  free (labels);
+}
+
+// Type checks
+//
+// A fixnum check tests the tag bit of the temporary where it is kept,
+// other checks load it into %rax first. A failed check jumps to a stub,
+// out of line, shared by all the checks of the same primitive on a value
+// in the same place. The stub loads the offending value into %rax, if it
+// is not there, and the message for that primitive, and jumps to a single
+// error stub for the program, which calls into the runtime. Divisions
+// check their divisor against 0 the same way.
+
+typedef struct check_stub
+{
+  const schprim_t *prim;
+  const char *expected;  // what the value should have been
+  char from[LABEL_MAX];  // where the value is, or "" if in %rax
+  char label[LABEL_MAX];
+  char msg[LABEL_MAX];   // shared by the stubs of the same message
+  bool msg_p;            // whether this is the first of those
+} check_stub_t;
+
+static check_stub_t *check_stubs = NULL;
+static size_t check_stubs_count = 0;
+static size_t check_stubs_cap = 0;
+static char check_error_label[LABEL_MAX];
+
+static const char *
+vtype_name (vtype_t t)
+{
+  switch (t)
+    {
+    case VT_FIXNUM:
+      return "fixnum";
+    case VT_CHAR:
+      return "char";
+    case VT_BOOL:
+      return "boolean";
+    default:
+      err_unreachable ("type without a name");
+    }
+}
+
+// Mask and tag identifying values of type t
+static void
+vtype_tag (vtype_t t, uint64_t *mask, uint64_t *tag)
+{
+  switch (t)
+    {
+    case VT_FIXNUM:
+      *mask = FX_MASK;
+      *tag = FX_TAG;
+      break;
+    case VT_CHAR:
+      *mask = CHAR_MASK;
+      *tag = CHAR_TAG;
+      break;
+    case VT_BOOL:
+      *mask = BOOL_MASK;
+      *tag = BOOL_TAG;
+      break;
+    default:
+      err_unreachable ("checking type without a tag");
+    }
+}
+
+// Returns the label of the error stub for checks that the arguments of
+// prim are what is expected, for a value in from, or in %rax if from is
+// empty
+static const char *
+check_stub_label (const schprim_t *prim, const char *expected,
+                  const char *from)
+{
+  const check_stub_t *same = NULL;
+  for (size_t k = 0; k < check_stubs_count; k++)
+    if (check_stubs[k].prim == prim
+        && !strcmp (check_stubs[k].expected, expected))
+      {
+        if (!strcmp (check_stubs[k].from, from))
+          return check_stubs[k].label;
+        same = &check_stubs[k];
+      }
+
+  if (check_stubs_count == check_stubs_cap)
+    {
+      check_stubs_cap = check_stubs_cap ? 2 * check_stubs_cap : 8;
+      check_stubs
+          = grow (check_stubs, check_stubs_cap * sizeof (*check_stubs));
+    }
+
+  check_stub_t *stub = &check_stubs[check_stubs_count++];
+  stub->prim = prim;
+  stub->expected = expected;
+  strcpy (stub->from, from);
+  gen_new_temp_label (stub->label);
+  stub->msg_p = !same;
+  if (same)
+    strcpy (stub->msg, same->msg);
+  else
+    gen_new_temp_label (stub->msg);
+  return stub->label;
+}
+
+void
+emit_asm_check (asm_list_t *l, const ir_insn_t *pc)
+{
+  assert (pc->op == IR_CHECK && pc->nargs == 1);
+
+  uint64_t mask, tag;
+  vtype_tag (pc->prim->atype, &mask, &tag);
+  const char *expected = vtype_name (pc->prim->atype);
+  const ir_opnd_t o = pc->args[0];
+
+  if (mask == tag && mask <= UINT8_MAX && o.kind == IR_OPND_TEMP
+      && !untagged_p (o))
+    {
+      char loc[LABEL_MAX];
+      temp_loc (loc, o.temp);
+      asm_insn (l, "testb", asm_fmt ("$%" PRIu64, mask).s, temp_loc8 (o.temp));
+      asm_insn (l, "jz", check_stub_label (pc->prim, expected, loc));
+      return;
+    }
+
+  const char *stub = check_stub_label (pc->prim, expected, "");
+  emit_asm_load (l, o, REG_RAX);
+  if (mask == tag && mask <= UINT8_MAX)
+    {
+      asm_insn (l, "testb", asm_fmt ("$%" PRIu64, mask).s, "%al");
+      asm_insn (l, "jz", stub);
+    }
+  else
+    {
+      asm_insn (l, "movl", "%eax", "%edx");
+      asm_insn (l, "andl", asm_fmt ("$%" PRIu64, mask).s, "%edx");
+      asm_insn (l, "cmpl", asm_fmt ("$%" PRIu64, tag).s, "%edx");
+      asm_insn (l, "jne", stub);
+    }
+}
+
+// Generic arithmetic
+//
+// The fast path of +, - and * is the code of the fixnum primitive plus a
+// jump on overflow. Each application has its own slow path, out of line,
+// which is also taken when an argument is not a fixnum. It recovers the
+// arguments if the fast path overwrote them, calls into the runtime, and
+// jumps back with the result in %rax.
+
+typedef enum
+{
+  ARITH_ADD,
+  ARITH_SUB,
+  ARITH_MUL
+} arith_op;
+
+typedef struct arith_stub
+{
+  arith_op op;
+  char slow[LABEL_MAX]; // slow path, with the arguments in place
+  char ovf[LABEL_MAX];  // slow path after an overflow
+  char ret[LABEL_MAX];  // back in the fast path
+  size_t frame;         // frame size of the procedure
+} arith_stub_t;
+
+// Runtime routine and registers holding the arguments of each operation
+static const struct
+{
+  const char *routine;
+  x86_reg a;
+  x86_reg b;
+} arith_ops[] = { [ARITH_ADD] = { "runtime_add", REG_R8, REG_RAX },
+                  [ARITH_SUB] = { "runtime_sub", REG_RAX, REG_R8 },
+                  [ARITH_MUL] = { "runtime_mul", REG_R8, REG_RAX } };
+
+static arith_stub_t *arith_stubs = NULL;
+static size_t arith_stubs_count = 0;
+static size_t arith_stubs_cap = 0;
+
+static const arith_stub_t *
+arith_stub (arith_op op)
+{
+  if (arith_stubs_count == arith_stubs_cap)
+    {
+      arith_stubs_cap = arith_stubs_cap ? 2 * arith_stubs_cap : 8;
+      arith_stubs
+          = grow (arith_stubs, arith_stubs_cap * sizeof (*arith_stubs));
+    }
+
+  arith_stub_t *stub = &arith_stubs[arith_stubs_count++];
+  stub->op = op;
+  stub->frame = frame_size ();
+  gen_new_temp_label (stub->slow);
+  gen_new_temp_label (stub->ovf);
+  gen_new_temp_label (stub->ret);
+  return stub;
+}
+
+// True if operand o is known to be a fixnum
+static bool
+fixnum_p (ir_opnd_t o)
+{
+  if (o.kind == IR_OPND_IMM)
+    return sch_imm_fixnum_p (o.imm);
+  return !(emit_proc->temps[o.temp].type & ~VT_FIXNUM);
+}
+
+// Loads the arguments of the generic arithmetic primitive pe in the
+// registers of its operation, and jumps to the slow path of stub unless
+// both are fixnums
+static void
+emit_asm_arith_args (asm_list_t *l, const ir_insn_t *pe,
+                     const arith_stub_t *stub)
+{
+  const x86_reg ra = arith_ops[stub->op].a;
+  const x86_reg rb = arith_ops[stub->op].b;
+  const bool fa = fixnum_p (pe->args[0]);
+  const bool fb = fixnum_p (pe->args[1]);
+
+  emit_asm_load (l, pe->args[0], ra);
+  emit_asm_load (l, pe->args[1], rb);
+  if (fa && fb)
+    return;
+
+  // Fixnums have all their tag bits set
+  if (fa || fb)
+    asm_insn (l, "testb", asm_fmt ("$%" PRIu64, FX_MASK).s,
+              reg8_names[fa ? rb : ra]);
+  else
+    {
+      asm_insn (l, "movl", reg32_names[ra], "%edx");
+      asm_insn (l, "andl", reg32_names[rb], "%edx");
+      asm_insn (l, "testb", asm_fmt ("$%" PRIu64, FX_MASK).s, "%dl");
+    }
+  asm_insn (l, "jz", stub->slow);
+}
+
+void
+emit_asm_prim_add (asm_list_t *l, const ir_insn_t *pe)
+{
+  assert (pe->op == IR_PRIM && pe->nargs == 2);
+  const arith_stub_t *stub = arith_stub (ARITH_ADD);
+
+  emit_asm_arith_args (l, pe, stub);
+  asm_insn (l, "xorq", asm_fmt ("$%" PRIu64, FX_MASK).s, "%r8");
+  asm_insn (l, "addq", "%r8", "%rax");
+  asm_insn (l, "jo", stub->ovf);
+  emit_asm_label (l, stub->ret);
+}
+
+void
+emit_asm_prim_sub (asm_list_t *l, const ir_insn_t *pe)
+{
+  assert (pe->op == IR_PRIM && pe->nargs == 2);
+  const arith_stub_t *stub = arith_stub (ARITH_SUB);
+
+  emit_asm_arith_args (l, pe, stub);
+  asm_insn (l, "subq", "%r8", "%rax");
+  asm_insn (l, "jo", stub->ovf);
+  asm_insn (l, "orq", asm_fmt ("$%" PRIu64, FX_TAG).s, "%rax");
+  emit_asm_label (l, stub->ret);
+}
+
+void
+emit_asm_prim_mul (asm_list_t *l, const ir_insn_t *pe)
+{
+  assert (pe->op == IR_PRIM && pe->nargs == 2);
+  const arith_stub_t *stub = arith_stub (ARITH_MUL);
+
+  emit_asm_arith_args (l, pe, stub);
+  asm_insn (l, "sarq", asm_fmt ("$%" PRIu8, FX_SHIFT).s, "%r8");
+  asm_insn (l, "movq", "%rax", "%rdx");
+  asm_insn (l, "andq", asm_fmt ("$%" PRIu64, ~FX_MASK).s, "%rdx");
+  asm_insn (l, "imulq", "%r8", "%rdx");
+  asm_insn (l, "jo", stub->ovf);
+  asm_insn (l, "leaq", asm_fmt ("%" PRIu64 "(%%rdx)", FX_TAG).s, "%rax");
+  emit_asm_label (l, stub->ret);
+}
+
+// Emit the slow path of a generic arithmetic primitive
+static void
+emit_asm_arith_stub (asm_list_t *l, const arith_stub_t *stub)
+{
+  // Undo the fast path
+  emit_asm_label (l, stub->ovf);
+  switch (stub->op)
+    {
+    case ARITH_ADD:
+      asm_insn (l, "subq", "%r8", "%rax");
+      asm_insn (l, "xorq", asm_fmt ("$%" PRIu64, FX_MASK).s, "%r8");
+      break;
+    case ARITH_SUB:
+      asm_insn (l, "addq", "%r8", "%rax");
+      break;
+    case ARITH_MUL:
+      asm_insn (l, "shlq", asm_fmt ("$%" PRIu8, FX_SHIFT).s, "%r8");
+      asm_insn (l, "orq", asm_fmt ("$%" PRIu64, FX_TAG).s, "%r8");
+      break;
+    }
+
+  emit_asm_label (l, stub->slow);
+  asm_insn (l, "movq", reg64_names[arith_ops[stub->op].a], "%rdi");
+  asm_insn (l, "movq", reg64_names[arith_ops[stub->op].b], "%rsi");
+  asm_insn (l, "subq", asm_fmt ("$%zu", stub->frame).s, "%rsp");
+  asm_insn (l, "call",
+            asm_fmt (ASM_SYMBOL_PREFIX "%s" ASM_PLT_SUFFIX,
+                     arith_ops[stub->op].routine).s);
+  asm_insn (l, "addq", asm_fmt ("$%zu", stub->frame).s, "%rsp");
+  asm_insn (l, "jmp", stub->ret);
+}
+
+// Division
+//
+// fxquotient truncates, fxremainder has the sign of the dividend and
+// fxmodulo the one of the divisor. idivq takes 40 cycles or more, so a
+// constant divisor that fits in an immediate is a mask and shifts when it
+// is a power of 2, and otherwise a multiplication by its reciprocal, as a
+// magic number, keeping the high half (Granlund and Montgomery, see
+// Hacker's Delight, chapter 10). Other divisors go through idivq, once
+// checked against 0.
+//
+// Shifting the untagged dividend, which is twice its value, divides it by
+// one more power of 2, and so does idivq of the untagged dividend by the
+// untagged divisor, which leaves the untagged remainder in %rdx.
+
+typedef enum
+{
+  DIV_QUOTIENT,
+  DIV_REMAINDER,
+  DIV_MODULO
+} div_op;
+
+// Largest power of 2 divided by masks and shifts, whose masks and
+// displacements are immediates
+#define DIV_POW2_MAX (INT64_C (1) << 30)
+
+// Sets *m and *s to the magic number and the shift of the divisions by d,
+// which is neither 0, 1 nor -1
+static void
+div_magic (int64_t d, int64_t *m, unsigned int *s)
+{
+  const uint64_t two63 = UINT64_C (1) << 63;
+  const uint64_t ad = d < 0 ? -(uint64_t)d : (uint64_t)d;
+  const uint64_t t = two63 + ((uint64_t)d >> 63);
+  const uint64_t anc = t - 1 - t % ad;
+  uint64_t q1 = two63 / anc;
+  uint64_t r1 = two63 - q1 * anc;
+  uint64_t q2 = two63 / ad;
+  uint64_t r2 = two63 - q2 * ad;
+  uint64_t delta;
+  unsigned int p = 63;
+  do
+    {
+      p++;
+      q1 *= 2;
+      r1 *= 2;
+      if (r1 >= anc)
+        {
+          q1++;
+          r1 -= anc;
+        }
+      q2 *= 2;
+      r2 *= 2;
+      if (r2 >= ad)
+        {
+          q2++;
+          r2 -= ad;
+        }
+      delta = ad - r2;
+    }
+  while (q1 < delta || (q1 == delta && r1 == 0));
+
+  *m = (int64_t)(d < 0 ? -(q2 + 1) : q2 + 1);
+  *s = p - 64;
+}
+
+// Emit assembly to add to the untagged dividend in %rax, when it is
+// negative, one less than 2^k, into %rdx, so that shifting it right by k
+// truncates
+static void
+emit_asm_div_round (asm_list_t *l, unsigned int k)
+{
+  asm_insn (l, "movq", "%rax", "%rdx");
+  asm_insn (l, "sarq", "$63", "%rdx");
+  asm_insn (l, "shrq", asm_fmt ("$%u", 64 - k).s, "%rdx");
+}
+
+// Emit the division op of pe by d, a power of 2 up to DIV_POW2_MAX, or its
+// negation
+static void
+emit_asm_div_pow2 (asm_list_t *l, const ir_insn_t *pe, div_op op, int64_t d)
+{
+  const ir_opnd_t a = pe->args[0];
+  const uint64_t ad = d < 0 ? -(uint64_t)d : (uint64_t)d;
+  const unsigned int k = (unsigned int)__builtin_ctzll (ad) + FX_SHIFT;
+
+  if (op == DIV_MODULO && d > 0 && a.kind == IR_OPND_TEMP)
+    {
+      // The mask keeps the tag bit, if there is one
+      const uint64_t bias = fx_bias (a);
+      emit_asm_add_disp (l, a, 0);
+      asm_insn (l, "andq",
+                asm_fmt ("$%" PRIu64, ((UINT64_C (1) << k) - 2) | bias).s,
+                "%rax");
+      emit_asm_fix_tag (l, pe, bias);
+      return;
+    }
+
+  emit_asm_load_untagged (l, a, REG_RAX);
+  switch (op)
+    {
+    case DIV_QUOTIENT:
+      emit_asm_div_round (l, k);
+      asm_insn (l, "addq", "%rdx", "%rax");
+      asm_insn (l, "sarq", asm_fmt ("$%u", k - FX_SHIFT).s, "%rax");
+      asm_insn (l, "andq", asm_fmt ("$%" PRIu64, ~FX_MASK).s, "%rax");
+      if (d < 0)
+        asm_insn (l, "negq", "%rax");
+      break;
+    case DIV_REMAINDER:
+      emit_asm_div_round (l, k);
+      asm_insn (l, "addq", "%rdx", "%rax");
+      asm_insn (l, "andq", asm_fmt ("$%" PRIu64, (UINT64_C (1) << k) - 1).s,
+                "%rax");
+      asm_insn (l, "subq", "%rdx", "%rax");
+      break;
+    case DIV_MODULO:
+      asm_insn (l, "andq", asm_fmt ("$%" PRIu64, (UINT64_C (1) << k) - 2).s,
+                "%rax");
+      if (d < 0)
+        {
+          // andq sets ZF for a remainder of 0, which stays 0
+          asm_insn (l, "leaq",
+                    asm_fmt ("-%" PRIu64 "(%%rax)", UINT64_C (1) << k).s,
+                    "%rdx");
+          asm_insn (l, "cmovne", "%rdx", "%rax");
+        }
+      break;
+    }
+  emit_asm_untagged_result (l, pe);
+}
+
+// Emit the division op of pe by d, which fits in an immediate and is
+// neither 0, 1, -1 nor a power of 2 or its negation
+static void
+emit_asm_div_magic (asm_list_t *l, const ir_insn_t *pe, div_op op, int64_t d)
+{
+  int64_t m;
+  unsigned int s;
+  div_magic (d, &m, &s);
+
+  // The high half of the product is in %rdx, and the quotient is one
+  // more than it once shifted if it is negative
+  emit_asm_load_decoded (l, pe->args[0], REG_R8);
+  emit_asm_imm (l, (schptr_t)m, REG_RAX);
+  asm_insn (l, "imulq", "%r8");
+  if (d > 0 && m < 0)
+    asm_insn (l, "addq", "%r8", "%rdx");
+  if (d < 0 && m > 0)
+    asm_insn (l, "subq", "%r8", "%rdx");
+  if (s)
+    asm_insn (l, "sarq", asm_fmt ("$%u", s).s, "%rdx");
+  asm_insn (l, "movq", "%rdx", "%rax");
+  asm_insn (l, "shrq", "$63", "%rax");
+  asm_insn (l, "addq", "%rax", "%rdx");
+
+  if (op == DIV_QUOTIENT)
+    {
+      asm_insn (l, "leaq",
+                asm_fmt ("%" PRIu64 "(%%rdx,%%rdx)", fx_dst_bias (pe)).s,
+                "%rax");
+      return;
+    }
+
+  asm_insn (l, "imulq", asm_fmt ("$%" PRId64, d).s, "%rdx", "%rdx");
+  asm_insn (l, "movq", "%r8", "%rax");
+  asm_insn (l, "subq", "%rdx", "%rax");
+  if (op == DIV_MODULO)
+    {
+      // A remainder of the other sign than the divisor goes past 0
+      asm_insn (l, "leaq", asm_fmt ("%" PRId64 "(%%rax)", d).s, "%rdx");
+      asm_insn (l, "testq", "%rax", "%rax");
+      asm_insn (l, asm_fmt ("cmov%s", d > 0 ? "s" : "g").s, "%rdx", "%rax");
+    }
+  asm_insn (l, "leaq",
+            asm_fmt ("%" PRIu64 "(%%rax,%%rax)", fx_dst_bias (pe)).s, "%rax");
+}
+
+// Emit the division op of pe with idivq
+static void
+emit_asm_div_idiv (asm_list_t *l, const ir_insn_t *pe, div_op op)
+{
+  const ir_opnd_t b = pe->args[1];
+  if (b.kind == IR_OPND_IMM && sch_decode_imm_fixnum (b.imm))
+    emit_asm_imm (l, b.imm & ~FX_MASK, REG_RCX);
+  else
+    {
+      emit_asm_load (l, b, REG_RAX);
+      asm_insn (l, "cmpq", asm_fmt ("$%" PRIu64, FX_TAG).s, "%rax");
+      asm_insn (l, "je", check_stub_label (pe->prim, "nonzero divisor", ""));
+      asm_insn (l, "leaq", asm_fmt ("-%" PRIu64 "(%%rax)", FX_TAG).s, "%rcx");
+    }
+
+  emit_asm_load_untagged (l, pe->args[0], REG_RAX);
+  asm_insn (l, "cqto");
+  asm_insn (l, "idivq", "%rcx");
+  switch (op)
+    {
+    case DIV_QUOTIENT:
+      asm_insn (l, "leaq",
+                asm_fmt ("%" PRIu64 "(%%rax,%%rax)", fx_dst_bias (pe)).s,
+                "%rax");
+      return;
+    case DIV_REMAINDER:
+      asm_insn (l, "leaq", asm_fmt ("%" PRIu64 "(%%rdx)", fx_dst_bias (pe)).s,
+                "%rax");
+      return;
+    case DIV_MODULO:
+      // A remainder of the other sign than the divisor goes past 0, and
+      // the sign of 0 is that of the divisor when they are xored
+      asm_insn (l, "leaq", "(%rdx,%rcx)", "%rsi");
+      asm_insn (l, "movq", "%rdx", "%rax");
+      asm_insn (l, "xorq", "%rdx", "%rcx");
+      asm_insn (l, "cmovs", "%rsi", "%rax");
+      asm_insn (l, "testq", "%rdx", "%rdx");
+      asm_insn (l, "cmovz", "%rdx", "%rax");
+      emit_asm_untagged_result (l, pe);
+      return;
+    }
+}
+
+static void
+emit_asm_div (asm_list_t *l, const ir_insn_t *pe, div_op op)
+{
+  assert (pe->op == IR_PRIM && pe->nargs == 2);
+  const ir_opnd_t b = pe->args[1];
+  const int64_t d = b.kind == IR_OPND_IMM ? sch_decode_imm_fixnum (b.imm) : 0;
+  const uint64_t ad = d < 0 ? -(uint64_t)d : (uint64_t)d;
+
+  if (d == 1 || d == -1)
+    {
+      if (op != DIV_QUOTIENT)
+        emit_asm_imm (l, fx_dst_bias (pe), REG_RAX);
+      else if (d == 1 && pe->args[0].kind == IR_OPND_TEMP)
+        emit_asm_add_disp (l, pe->args[0],
+                           fx_dst_bias (pe) - fx_bias (pe->args[0]));
+      else
+        {
+          emit_asm_load_untagged (l, pe->args[0], REG_RAX);
+          if (d == -1)
+            asm_insn (l, "negq", "%rax");
+          emit_asm_untagged_result (l, pe);
+        }
+    }
+  else if (d && ad <= DIV_POW2_MAX && !(ad & (ad - 1)))
+    emit_asm_div_pow2 (l, pe, op, d);
+  else if (d && imm32_p ((uint64_t)d))
+    emit_asm_div_magic (l, pe, op, d);
+  else
+    emit_asm_div_idiv (l, pe, op);
+}
+
+void
+emit_asm_prim_fxquotient (asm_list_t *l, const ir_insn_t *pe)
+{
+  emit_asm_div (l, pe, DIV_QUOTIENT);
+}
+
+void
+emit_asm_prim_fxremainder (asm_list_t *l, const ir_insn_t *pe)
+{
+  emit_asm_div (l, pe, DIV_REMAINDER);
+}
+
+void
+emit_asm_prim_fxmodulo (asm_list_t *l, const ir_insn_t *pe)
+{
+  emit_asm_div (l, pe, DIV_MODULO);
+}
+
+// Procedures
+//
+// A procedure gets its closure and its first arguments in the registers
+// in param_regs, and stores them in the slots of its parameters on entry.
+// The arguments that do not fit in registers are written straight into
+// those slots by the caller. The value of the procedure is returned in
+// %rax.
+//
+// A call in tail position reuses the frame of the caller and jumps to the
+// procedure, so that loops written as tail recursion run in constant
+// stack. Arguments going to slots are first written below the frame, and
+// only copied into place once the slots they overwrite are not needed.
+//
+// %r15 is the allocation pointer, the address of the next free word of the
+// heap. Closures are allocated by bumping it.
+
+static const x86_reg param_regs[]
+    = { REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9 };
+#define PARAM_REGS_COUNT (sizeof (param_regs) / sizeof (param_regs[0]))
+
+// Checked calls jump to a stub, out of line, shared by all the calls
+// with the same number of arguments, which calls into the runtime with the
+// operator in %rdi and the number of arguments in %esi.
+
+typedef struct call_stub
+{
+  size_t nargs;
+  char label[LABEL_MAX];
+} call_stub_t;
+
+static call_stub_t *call_stubs = NULL;
+static size_t call_stubs_count = 0;
+static size_t call_stubs_cap = 0;
+static char call_error_label[LABEL_MAX];
+
+static const char *
+call_stub_label (size_t nargs)
+{
+  for (size_t k = 0; k < call_stubs_count; k++)
+    if (call_stubs[k].nargs == nargs)
+      return call_stubs[k].label;
+
+  if (call_stubs_count == call_stubs_cap)
+    {
+      call_stubs_cap = call_stubs_cap ? 2 * call_stubs_cap : 8;
+      call_stubs = grow (call_stubs, call_stubs_cap * sizeof (*call_stubs));
+    }
+
+  call_stub_t *stub = &call_stubs[call_stubs_count++];
+  stub->nargs = nargs;
+  gen_new_temp_label (stub->label);
+  return stub->label;
+}
+
+// Emit a call through a closure, or a direct call to a known procedure,
+// which takes no closure so that its arguments start at the second
+// parameter
+void
+emit_asm_call (asm_list_t *l, const ir_insn_t *pc, bool tail)
+{
+  assert ((pc->op == IR_CALL && pc->nargs >= 1) || pc->op == IR_CALL_KNOWN);
+
+  // Slots of the callee, when its frame is right below ours
+  const size_t below = frame_size () + WORD_BYTES;
+  const size_t first = pc->op == IR_CALL_KNOWN ? 1 : 0;
+  const size_t nparams = pc->nargs + first;
+
+  for (size_t k = PARAM_REGS_COUNT; k < nparams; k++)
+    {
+      emit_asm_load (l, pc->args[k - first], REG_RAX);
+      asm_insn (l, "movq", "%rax",
+                asm_fmt ("-%zu(%%rsp)", below + temp_slot (k)).s);
+    }
+  for (size_t k = first; k < nparams && k < PARAM_REGS_COUNT; k++)
+    emit_asm_load (l, pc->args[k - first], param_regs[k]);
+
+  if (pc->checked)
+    {
+      const size_t nargs = pc->nargs - 1;
+      const char *stub = call_stub_label (nargs);
+      const uint64_t header = ((uint64_t)nargs << CLOSURE_ARITY_SHIFT)
+                              | HEAP_CLOSURE;
+
+      asm_insn (l, "testb", asm_fmt ("$%" PRIu64, PTR_MASK).s, "%dil");
+      asm_insn (l, "jnz", stub);
+      asm_insn (l, "cmpq", asm_fmt ("$%" PRIu64, header).s, "(%rdi)");
+      asm_insn (l, "jne", stub);
+    }
+
+  char target[LABEL_MAX];
+  if (pc->op == IR_CALL_KNOWN)
+    proc_label (target, pc->proc);
+  else
+    snprintf (target, sizeof (target), "*%d(%%rdi)", CLOSURE_CODE_OFFSET);
+
+  if (tail)
+    {
+      for (size_t k = PARAM_REGS_COUNT; k < nparams; k++)
+        {
+          asm_insn (l, "movq",
+                    asm_fmt ("-%zu(%%rsp)", below + temp_slot (k)).s, "%rax");
+          asm_insn (l, "movq", "%rax",
+                    asm_fmt ("-%zu(%%rsp)", temp_slot (k)).s);
+        }
+      asm_insn (l, "jmp", target);
+      return;
+    }
+
+  asm_insn (l, "subq", asm_fmt ("$%zu", frame_size ()).s, "%rsp");
+  asm_insn (l, "call", target);
+  asm_insn (l, "addq", asm_fmt ("$%zu", frame_size ()).s, "%rsp");
+  if (emit_values[pc->dst])
+    emit_asm_values_spill (l);
+}
+
+void
+emit_asm_closure (asm_list_t *l, const ir_insn_t *pc)
+{
+  assert (pc->op == IR_CLOSURE);
+
+  const size_t arity = emit_program->procs[pc->proc]->nparams - 1;
+  const uint64_t header = ((uint64_t)arity << CLOSURE_ARITY_SHIFT)
+                          | HEAP_CLOSURE;
+  char label[LABEL_MAX];
+  proc_label (label, pc->proc);
+
+  asm_insn (l, "movq", asm_fmt ("$%" PRIu64, header).s, "(%r15)");
+  asm_insn (l, "leaq", asm_fmt ("%s(%%rip)", label).s, "%rax");
+  asm_insn (l, "movq", "%rax", asm_fmt ("%d(%%r15)", CLOSURE_CODE_OFFSET).s);
+  for (size_t a = 0; a < pc->nargs; a++)
+    {
+      emit_asm_load (l, pc->args[a], REG_RAX);
+      asm_insn (l, "movq", "%rax",
+                asm_fmt ("%zu(%%r15)",
+                         CLOSURE_FREE_OFFSET + a * WORD_BYTES).s);
+    }
+  asm_insn (l, "movq", "%r15", "%rax");
+  asm_insn (l, "addq",
+            asm_fmt ("$%zu", CLOSURE_FREE_OFFSET + pc->nargs * WORD_BYTES).s,
+            "%r15");
+}
+
+void
+emit_asm_fref (asm_list_t *l, const ir_insn_t *pr)
+{
+  assert (pr->op == IR_FREF && pr->nargs == 1);
+
+  emit_asm_load (l, pr->args[0], REG_RAX);
+  asm_insn (l, "movq",
+            asm_fmt ("%zu(%%rax)",
+                     CLOSURE_FREE_OFFSET + pr->index * WORD_BYTES).s, "%rax");
+}
+
+// A constant is already laid out in the data of the program, so it only
+// takes its address, without allocating or loading anything
+void
+emit_asm_data (asm_list_t *l, const ir_insn_t *pd)
+{
+  assert (pd->op == IR_DATA);
+
+  char label[LABEL_MAX];
+  data_label (label, pd->data->index);
+  asm_insn (l, "leaq", asm_fmt ("%s(%%rip)", label).s, "%rax");
+}
+
+// Multiple values
+//
+// A procedure returns multiple values in registers, as described in
+// common.h, only when they are its value in tail position. Everywhere
+// else they are written to runtime_values, and a call whose value is
+// taken apart spills the registers there when it returns. The receivers
+// then read them back from runtime_values, and call-with-values passes
+// them to its consumer as arguments, with their count in %r10.
+
+static const x86_reg values_regs[VALUES_REGS]
+    = { REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9 };
+
+// Checked receivers jump to a stub, out of line, shared by all the
+// receivers of the same number of values, which calls into the runtime
+// with the values in %rax. Checked calls of consumers jump to a single
+// stub, which passes their number of arguments on to the stub of calls.
+static call_stub_t *values_stubs = NULL;
+static size_t values_stubs_count = 0;
+static size_t values_stubs_cap = 0;
+static char values_call_label[LABEL_MAX];
+static bool values_call_p = false;
+
+static const char *
+values_stub_label (size_t n)
+{
+  for (size_t k = 0; k < values_stubs_count; k++)
+    if (values_stubs[k].nargs == n)
+      return values_stubs[k].label;
+
+  if (values_stubs_count == values_stubs_cap)
+    {
+      values_stubs_cap = values_stubs_cap ? 2 * values_stubs_cap : 8;
+      values_stubs
+          = grow (values_stubs, values_stubs_cap * sizeof (*values_stubs));
+    }
+
+  call_stub_t *stub = &values_stubs[values_stubs_count++];
+  stub->nargs = n;
+  gen_new_temp_label (stub->label);
+  return stub->label;
+}
+
+// Emit the spill of the multiple values returned in registers, if the
+// value in %rax is that, to runtime_values
+void
+emit_asm_values_spill (asm_list_t *l)
+{
+  char donel[LABEL_MAX];
+  gen_new_temp_label (donel);
+
+  asm_insn (l, "cmpb", asm_fmt ("$%" PRIu64, VALUES_TAG).s, "%al");
+  asm_insn (l, "jne", donel);
+  asm_insn (l, "testl", asm_fmt ("$%" PRIu64, VALUES_MEMORY).s, "%eax");
+  asm_insn (l, "jnz", donel);
+  for (size_t k = 0; k < VALUES_REGS; k++)
+    asm_insn (l, "movq", reg64_names[values_regs[k]],
+              asm_fmt (ASM_SYMBOL_PREFIX "runtime_values+%zu(%%rip)",
+                       k * WORD_BYTES).s);
+  asm_insn (l, "orq", asm_fmt ("$%" PRIu64, VALUES_MEMORY).s, "%rax");
+  emit_asm_label (l, donel);
+}
+
+// Emit multiple values, returning them from the procedure in tail position
+void
+emit_asm_values (asm_list_t *l, const ir_insn_t *pv, bool tail)
+{
+  assert (pv->op == IR_VALUES);
+
+  const uint64_t marker
+      = ((uint64_t)pv->nargs << VALUES_COUNT_SHIFT) | VALUES_TAG;
+  const size_t first = tail ? VALUES_REGS : 0;
+
+  for (size_t k = first; k < pv->nargs; k++)
+    {
+      emit_asm_load (l, pv->args[k], REG_RAX);
+      asm_insn (l, "movq", "%rax",
+                asm_fmt (ASM_SYMBOL_PREFIX "runtime_values+%zu(%%rip)",
+                         k * WORD_BYTES).s);
+    }
+  if (!tail)
+    {
+      emit_asm_imm (l, marker | VALUES_MEMORY, REG_RAX);
+      return;
+    }
+
+  for (size_t k = 0; k < VALUES_REGS && k < pv->nargs; k++)
+    emit_asm_load (l, pv->args[k], values_regs[k]);
+  emit_asm_imm (l, marker, REG_RAX);
+  emit_asm_epilogue (l);
+}
+
+void
+emit_asm_receive (asm_list_t *l, const ir_insn_t *pr)
+{
+  assert (pr->op == IR_RECEIVE && pr->nargs == 1);
+
+  emit_asm_load (l, pr->args[0], REG_RAX);
+  if (!pr->checked)
+    return;
+
+  const char *stub = values_stub_label (pr->index);
+  if (pr->index == 1)
+    {
+      asm_insn (l, "cmpb", asm_fmt ("$%" PRIu64, VALUES_TAG).s, "%al");
+      asm_insn (l, "je", stub);
+      return;
+    }
+
+  const uint64_t marker
+      = ((uint64_t)pr->index << VALUES_COUNT_SHIFT) | VALUES_TAG;
+  asm_insn (l, "movq", "%rax", "%rdx");
+  asm_insn (l, "andq", asm_fmt ("$%" PRId64, (int64_t)~VALUES_MEMORY).s,
+            "%rdx");
+  asm_insn (l, "cmpq", asm_fmt ("$%" PRIu64, marker).s, "%rdx");
+  asm_insn (l, "jne", stub);
+}
+
+void
+emit_asm_vref (asm_list_t *l, const ir_insn_t *pr)
+{
+  assert (pr->op == IR_VREF && pr->nargs == 1);
+
+  if (pr->index)
+    {
+      asm_insn (l, "movq",
+                asm_fmt (ASM_SYMBOL_PREFIX "runtime_values+%zu(%%rip)",
+                         pr->index * WORD_BYTES).s, "%rax");
+      return;
+    }
+
+  // The first of a single value is the value itself
+  char donel[LABEL_MAX];
+  gen_new_temp_label (donel);
+  emit_asm_load (l, pr->args[0], REG_RAX);
+  asm_insn (l, "cmpb", asm_fmt ("$%" PRIu64, VALUES_TAG).s, "%al");
+  asm_insn (l, "jne", donel);
+  asm_insn (l, "movq", ASM_SYMBOL_PREFIX "runtime_values(%rip)", "%rax");
+  emit_asm_label (l, donel);
+}
+
+// Emit a call of the consumer in the first operand of pc with the values
+// in the second one as arguments. The values after the first VALUES_REGS
+// go to the slots of the parameters of the consumer, in a loop over
+// their index, in %r11.
+void
+emit_asm_call_values (asm_list_t *l, const ir_insn_t *pc)
+{
+  assert (pc->op == IR_CALL_VALUES && pc->nargs == 2);
+
+  const size_t below = frame_size () + WORD_BYTES;
+  char manyl[LABEL_MAX];
+  char loopl[LABEL_MAX];
+  char donel[LABEL_MAX];
+  gen_new_temp_label (manyl);
+  gen_new_temp_label (loopl);
+  gen_new_temp_label (donel);
+
+  emit_asm_load (l, pc->args[1], REG_RAX);
+  asm_insn (l, "cmpb", asm_fmt ("$%" PRIu64, VALUES_TAG).s, "%al");
+  asm_insn (l, "je", manyl);
+  asm_insn (l, "movq", "%rax", "%rsi");
+  asm_insn (l, "movl", "$1", "%r10d");
+  asm_insn (l, "jmp", donel);
+
+  emit_asm_label (l, manyl);
+  asm_insn (l, "movq", "%rax", "%r10");
+  asm_insn (l, "shrq", asm_fmt ("$%d", VALUES_COUNT_SHIFT).s, "%r10");
+  for (size_t k = 0; k < VALUES_REGS; k++)
+    asm_insn (l, "movq",
+              asm_fmt (ASM_SYMBOL_PREFIX "runtime_values+%zu(%%rip)",
+                       k * WORD_BYTES).s, reg64_names[values_regs[k]]);
+  asm_insn (l, "movl", asm_fmt ("$%d", VALUES_REGS).s, "%r11d");
+  asm_insn (l, "leaq", ASM_SYMBOL_PREFIX "runtime_values(%rip)", "%rdi");
+  emit_asm_label (l, loopl);
+  asm_insn (l, "cmpq", "%r10", "%r11");
+  asm_insn (l, "jae", donel);
+  asm_insn (l, "movq", "(%rdi,%r11,8)", "%rax");
+  asm_insn (l, "negq", "%r11");
+  asm_insn (l, "movq", "%rax",
+            asm_fmt ("-%zu(%%rsp,%%r11,8)", below + temp_slot (1)).s);
+  asm_insn (l, "negq", "%r11");
+  asm_insn (l, "incq", "%r11");
+  asm_insn (l, "jmp", loopl);
+
+  emit_asm_label (l, donel);
+  emit_asm_load (l, pc->args[0], REG_RDI);
+  if (pc->checked)
+    {
+      values_call_p = true;
+      asm_insn (l, "movq", "%r10", "%r11");
+      asm_insn (l, "shlq", asm_fmt ("$%d", CLOSURE_ARITY_SHIFT).s, "%r11");
+      asm_insn (l, "orq", asm_fmt ("$%" PRIu64, HEAP_CLOSURE).s, "%r11");
+      asm_insn (l, "testb", asm_fmt ("$%" PRIu64, PTR_MASK).s, "%dil");
+      asm_insn (l, "jnz", values_call_label);
+      asm_insn (l, "cmpq", "%r11", "(%rdi)");
+      asm_insn (l, "jne", values_call_label);
+    }
+
+  asm_insn (l, "subq", asm_fmt ("$%zu", frame_size ()).s, "%rsp");
+  asm_insn (l, "call", asm_fmt ("*%d(%%rdi)", CLOSURE_CODE_OFFSET).s);
+  asm_insn (l, "addq", asm_fmt ("$%zu", frame_size ()).s, "%rsp");
+  if (emit_values[pc->dst])
+    emit_asm_values_spill (l);
+}
+
+// Emit the code that is kept out of the hot path, after the body of the
+// program
+void
+emit_asm_cold (asm_list_t *l)
+{
+  for (size_t c = 0; c < COND_COUNT; c++)
+    if (bool_stubs_used[c])
+      {
+        emit_asm_label (l, bool_stubs[c]);
+        emit_asm_cond_to_bool (l, c);
+        emit_asm_epilogue (l);
+        bool_stubs_used[c] = false;
+      }
+
+  for (size_t k = 0; k < arith_stubs_count; k++)
+    emit_asm_arith_stub (l, &arith_stubs[k]);
+  arith_stubs_count = 0;
+
+  for (size_t k = 0; k < values_stubs_count; k++)
+    {
+      emit_asm_label (l, values_stubs[k].label);
+      asm_insn (l, "movq", "%rax", "%rdi");
+      asm_insn (l, "movl", asm_fmt ("$%zu", values_stubs[k].nargs).s, "%esi");
+      asm_insn (l, "andq", "$-16", "%rsp");
+      asm_insn (l, "call",
+                ASM_SYMBOL_PREFIX "runtime_values_error" ASM_PLT_SUFFIX);
+    }
+  values_stubs_count = 0;
+
+  if (values_call_p)
+    {
+      emit_asm_label (l, values_call_label);
+      asm_insn (l, "movq", "%r10", "%rsi");
+      asm_insn (l, "jmp", call_error_label);
+    }
+
+  if (call_stubs_count || values_call_p)
+    {
+      for (size_t k = 0; k < call_stubs_count; k++)
+        {
+          emit_asm_label (l, call_stubs[k].label);
+          asm_insn (l, "movl", asm_fmt ("$%zu", call_stubs[k].nargs).s,
+                    "%esi");
+          asm_insn (l, "jmp", call_error_label);
+        }
+
+      emit_asm_label (l, call_error_label);
+      asm_insn (l, "andq", "$-16", "%rsp");
+      asm_insn (l, "call",
+                ASM_SYMBOL_PREFIX "runtime_call_error" ASM_PLT_SUFFIX);
+      call_stubs_count = 0;
+      values_call_p = false;
+    }
+
+  if (!check_stubs_count)
+    return;
+
+  for (size_t k = 0; k < check_stubs_count; k++)
+    {
+      emit_asm_label (l, check_stubs[k].label);
+      if (*check_stubs[k].from)
+        asm_insn (l, "movq", check_stubs[k].from, "%rax");
+      asm_insn (l, "leaq", asm_fmt ("%s(%%rip)", check_stubs[k].msg).s,
+                "%rdi");
+      asm_insn (l, "jmp", check_error_label);
+    }
+
+  // The runtime does not return, so the stack can be aligned for the call
+  // without caring about what was in it
+  emit_asm_label (l, check_error_label);
+  asm_insn (l, "movq", "%rax", "%rsi");
+  asm_insn (l, "andq", "$-16", "%rsp");
+  asm_insn (l, "call", ASM_SYMBOL_PREFIX "runtime_type_error" ASM_PLT_SUFFIX);
+
+  asm_directive (l, ".section " ASM_CSTRING_SECTION);
+  for (size_t k = 0; k < check_stubs_count; k++)
+    if (check_stubs[k].msg_p)
+      {
+        emit_asm_label (l, check_stubs[k].msg);
+        asm_directive (l, ".asciz \"%s: expected %s\"",
+                       check_stubs[k].prim->name, check_stubs[k].expected);
+      }
+  asm_directive (l, ".text");
+
+  check_stubs_count = 0;
+}
+
+void
+emit_asm_insn (asm_list_t *l, const ir_insn_t *i)
+{
+  switch (i->op)
+    {
+    case IR_PRIM:
+      i->prim->emitter (l, i);
+      break;
+    case IR_MOVE:
+      emit_asm_load (l, i->args[0], REG_RAX);
+      break;
+    case IR_IF:
+      emit_asm_if (l, i, false);
+      break;
+    case IR_CHECK:
+      emit_asm_check (l, i);
+      // The value checked is used where it is, see src/checks.c
+      if (i->args[0].kind == IR_OPND_TEMP)
+        return;
+      break;
+    case IR_CLOSURE:
+      emit_asm_closure (l, i);
+      break;
+    case IR_FREF:
+      emit_asm_fref (l, i);
+      break;
+    case IR_DATA:
+      emit_asm_data (l, i);
+      break;
+    case IR_CALL:
+    case IR_CALL_KNOWN:
+      emit_asm_call (l, i, false);
+      break;
+    case IR_VALUES:
+      emit_asm_values (l, i, false);
+      break;
+    case IR_RECEIVE:
+      emit_asm_receive (l, i);
+      break;
+    case IR_VREF:
+      emit_asm_vref (l, i);
+      break;
+    case IR_CALL_VALUES:
+      emit_asm_call_values (l, i);
+      break;
+    case IR_LOOP:
+      emit_asm_loop (l, i, false);
+      break;
+    case IR_SWITCH:
+      emit_asm_switch (l, i, false);
+      break;
+    case IR_CONTINUE:
+      // Nothing comes after it
+      emit_asm_continue (l, i);
+      return;
+    default:
+      err_unreachable ("unknown instruction");
+    }
+
+  emit_asm_store (l, i->dst);
+}
+
+void
+emit_asm_block (asm_list_t *l, const ir_block_t *b)
+{
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    if (!fused_p (i))
+      emit_asm_insn (l, i);
+}
+
+// Emit a block in tail position, whose value is returned from the
+// procedure
+static void
+emit_asm_tail_block (asm_list_t *l, const ir_block_t *b)
+{
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      const bool last_p = !i->next && b->result.kind == IR_OPND_TEMP
+                          && b->result.temp == i->dst;
+
+      if (last_p && (i->op == IR_CALL || i->op == IR_CALL_KNOWN))
+        {
+          emit_asm_call (l, i, true);
+          return;
+        }
+      if (last_p && i->op == IR_IF)
+        {
+          emit_asm_if (l, i, true);
+          return;
+        }
+      if (last_p && i->op == IR_LOOP)
+        {
+          emit_asm_loop (l, i, true);
+          return;
+        }
+      if (last_p && i->op == IR_SWITCH)
+        {
+          emit_asm_switch (l, i, true);
+          return;
+        }
+      if (last_p && i->op == IR_VALUES)
+        {
+          emit_asm_values (l, i, true);
+          return;
+        }
+      if (last_p && i->op == IR_CONTINUE)
+        {
+          emit_asm_continue (l, i);
+          return;
+        }
+      if (!fused_p (i))
+        emit_asm_insn (l, i);
+    }
+
+  emit_asm_load (l, b->result, REG_RAX);
+  emit_asm_epilogue (l);
+}
+
+static void
+emit_asm_proc (asm_list_t *l, const ir_proc_t *q)
+{
+  emit_proc = q;
+  emit_uses = alloc ((q->ntemps + 1) * sizeof (*emit_uses));
+  emit_defs = alloc ((q->ntemps + 1) * sizeof (*emit_defs));
+  emit_values = alloc ((q->ntemps + 1) * sizeof (*emit_values));
+  for (size_t t = 0; t < q->ntemps; t++)
+    {
+      emit_uses[t] = 0;
+      emit_defs[t] = NULL;
+      emit_values[t] = false;
+    }
+  emit_count_uses (q->body);
+  emit_find_values (q->body);
+  emit_mark_values (q->body->result);
+
+  // Parameters allocated to registers are moved there, and the others
+  // that come in registers to their slots
+  for (size_t t = 0; t < q->nparams; t++)
+    {
+      char loc[LABEL_MAX];
+      temp_loc (loc, t);
+      if (t < PARAM_REGS_COUNT)
+        asm_insn (l, "movq", reg64_names[param_regs[t]], loc);
+      else if (q->temps[t].reg)
+        asm_insn (l, "movq", asm_fmt ("-%zu(%%rsp)", temp_slot (t)).s, loc);
+    }
+  emit_asm_tail_block (l, q->body);
+
+  free (emit_uses);
+  free (emit_defs);
+  free (emit_values);
+}
+
+// Procedures that the body of the program reaches, through closures and
+// direct calls. The others are left out: once the calls to a procedure
+// are all inlined, or its closures all removed, nothing refers to its
+// label.
+static bool *emit_reached = NULL;
+
+static void
+emit_reach_block (const ir_program_t *p, const ir_block_t *b)
+{
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      if ((i->op == IR_CLOSURE || i->op == IR_CALL_KNOWN)
+          && !emit_reached[i->proc])
+        {
+          emit_reached[i->proc] = true;
+          emit_reach_block (p, p->procs[i->proc]->body);
+        }
+      if (i->op == IR_IF)
+        {
+          emit_reach_block (p, i->thenb);
+          emit_reach_block (p, i->elseb);
+        }
+      if (i->op == IR_LOOP)
+        emit_reach_block (p, i->body);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          emit_reach_block (p, i->arms[k]);
+    }
+}
+
+// Emit procedure q through the peephole optimizer, which rewrites its
+// code on its own
+static void
+emit_asm_proc_peephole (asm_list_t *l, const ir_proc_t *q)
+{
+  asm_list_t *code = asm_new ();
+  emit_asm_proc (code, q);
+  peephole_run (code);
+  asm_append (l, code);
+}
+
+// Identical code folding
+//
+// With -Os, a procedure whose code is the same as the code of an earlier
+// one is left out, and its label is set to the label of that one. The
+// labels that the code defines are fresh in each procedure, so they are
+// compared by the order they are defined in, and so is the label of the
+// procedure itself. Other labels, such as those of the stubs, are shared
+// by the program and compared by name: code that jumps to stubs of its
+// own, like the slow paths of generic arithmetic, is never folded, since
+// those stubs jump back into it.
+
+typedef struct fold_label
+{
+  char name[LABEL_MAX];
+  size_t n; // order it is defined in
+} fold_label_t;
+
+static int
+fold_label_cmp (const void *a, const void *b)
+{
+  return strcmp (((const fold_label_t *)a)->name,
+                 ((const fold_label_t *)b)->name);
+}
+
+static bool
+fold_label_char_p (char c)
+{
+  return isalnum ((unsigned char)c) || c == '_' || c == '.';
+}
+
+// Returns the code in text of the procedure labeled self, with the labels
+// it defines and self replaced by their number, in a new string
+static char *
+fold_canonical (const char *text, const char *self)
+{
+  size_t count = 0;
+  size_t cap = 0;
+  fold_label_t *defs = NULL;
+  for (const char *s = text; *s;)
+    {
+      const char *end = strchr (s, '\n');
+      if (!end)
+        end = s + strlen (s);
+      const size_t n = end - s;
+      if (n > 1 && n < LABEL_MAX && *s != ' ' && s[n - 1] == ':')
+        {
+          if (count == cap)
+            {
+              cap = cap ? 2 * cap : 16;
+              defs = grow (defs, cap * sizeof (*defs));
+            }
+          memcpy (defs[count].name, s, n - 1);
+          defs[count].name[n - 1] = '\0';
+          defs[count].n = count;
+          count++;
+        }
+      s = *end ? end + 1 : end;
+    }
+  if (count)
+    qsort (defs, count, sizeof (*defs), fold_label_cmp);
+
+  char *canon = NULL;
+  size_t size = 0;
+  FILE *m = open_memstream (&canon, &size);
+  if (!m)
+    err_oom ();
+  for (const char *s = text; *s;)
+    {
+      if (*s != '.' || (s > text && fold_label_char_p (s[-1])))
+        {
+          fputc (*s++, m);
+          continue;
+        }
+
+      fold_label_t key;
+      size_t n = 0;
+      while (fold_label_char_p (s[n]) && n < LABEL_MAX - 1)
+        {
+          key.name[n] = s[n];
+          n++;
+        }
+      key.name[n] = '\0';
+
+      const fold_label_t *def
+          = count ? bsearch (&key, defs, count, sizeof (*defs),
+                             fold_label_cmp)
+                  : NULL;
+      if (!strcmp (key.name, self))
+        fputs ("@self", m);
+      else if (def)
+        fprintf (m, "@%zu", def->n);
+      else
+        fwrite (s, 1, n, m);
+      s += n;
+    }
+  fclose (m);
+
+  free (defs);
+  return canon;
+}
+
+// Emit procedures 1 and up of program p with proc, each one after its
+// label, folding those with the code of an earlier one
+static void
+emit_asm_procs_folded (asm_list_t *l, const ir_program_t *p,
+                       void (*proc) (asm_list_t *, const ir_proc_t *))
+{
+  char **canon = alloc (p->nprocs * sizeof (*canon));
+  size_t folded = 0;
+  for (size_t k = 1; k < p->nprocs; k++)
+    {
+      canon[k] = NULL;
+      if (!emit_reached[k])
+        continue;
+
+      char label[LABEL_MAX];
+      proc_label (label, k);
+
+      // The predicates of a procedure that is left out call no stub
+      size_t uses[COND_COUNT];
+      memcpy (uses, bool_stubs_uses, sizeof (uses));
+      const size_t calls = bool_stubs_calls;
+
+      asm_list_t *code = asm_new ();
+      proc (code, p->procs[k]);
+
+      // The code is compared as it is printed
+      char *text = NULL;
+      size_t size = 0;
+      FILE *m = open_memstream (&text, &size);
+      if (!m)
+        err_oom ();
+      asm_print (m, code);
+      fclose (m);
+      canon[k] = fold_canonical (text, label);
+      free (text);
+      size_t j = 1;
+      while (j < k && (!canon[j] || strcmp (canon[j], canon[k])))
+        j++;
+      if (j < k)
+        {
+          memcpy (bool_stubs_uses, uses, sizeof (uses));
+          bool_stubs_calls = calls;
+          char other[LABEL_MAX];
+          proc_label (other, j);
+          asm_directive (l, ".set   %s, %s", label, other);
+          free (canon[k]);
+          canon[k] = NULL;
+          asm_free (code);
+          folded++;
+        }
+      else
+        {
+          emit_asm_label (l, label);
+          asm_append (l, code);
+        }
+    }
+
+  for (size_t k = 1; k < p->nprocs; k++)
+    free (canon[k]);
+  free (canon);
+  pass_record_stat ("size", "procedures folded", folded);
+}
+
+// Emit the body of program p followed by its procedures, each aligned
+static void
+emit_asm_procs (asm_list_t *l, const ir_program_t *p)
+{
+  emit_asm_proc (l, p->procs[0]);
+  for (size_t k = 1; k < p->nprocs; k++)
+    {
+      if (!emit_reached[k])
+        continue;
+
+      char label[LABEL_MAX];
+      proc_label (label, k);
+      asm_directive (l, ".p2align 4");
+      emit_asm_label (l, label);
+      emit_asm_proc (l, p->procs[k]);
+    }
+}
+
+// Count the predicates of program p that could call the stub of each
+// condition, emitting it with the code of all of them inline
+static void
+emit_asm_bool_stubs_count (const ir_program_t *p, unsigned int level,
+                           cpu_features_t cpu)
+{
+  asm_list_t *l = asm_new ();
+  memset (bool_stubs_uses, 0, sizeof (bool_stubs_uses));
+  bool_stubs_counting = true;
+  pass_report_pause (true);
+  emit_asm_program (l, p, level, cpu, true);
+  emit_asm_cold (l);
+  pass_report_pause (false);
+  bool_stubs_counting = false;
+  asm_free (l);
+}
+
+// Emit the body of a program, which returns its value, followed by the
+// code of its procedures, with the code generation options of -O level,
+// and for size if size
+void
+emit_asm_program (asm_list_t *l, const ir_program_t *p, unsigned int level,
+                  cpu_features_t cpu, bool size)
+{
+  const bool peephole = pass_enabled_p ("peephole", level);
+  if (size && !bool_stubs_counting)
+    emit_asm_bool_stubs_count (p, level, cpu);
+
+  emit_program = p;
+  emit_cpu = cpu;
+  emit_size = size;
+  check_stubs_count = 0;
+  arith_stubs_count = 0;
+  call_stubs_count = 0;
+  values_stubs_count = 0;
+  values_call_p = false;
+  bool_stubs_calls = 0;
+  gen_new_temp_label (check_error_label);
+  gen_new_temp_label (call_error_label);
+  gen_new_temp_label (values_call_label);
+
+  emit_reached = alloc (p->nprocs * sizeof (*emit_reached));
+  for (size_t k = 0; k < p->nprocs; k++)
+    emit_reached[k] = false;
+  emit_reach_block (p, p->procs[0]->body);
+  size_t dropped = 0;
+  for (size_t k = 1; k < p->nprocs; k++)
+    dropped += !emit_reached[k];
+  pass_record_stat ("dce", "procedures removed", dropped);
+
+  if (size)
+    {
+      void (*proc) (asm_list_t *, const ir_proc_t *)
+          = peephole ? emit_asm_proc_peephole : emit_asm_proc;
+      proc (l, p->procs[0]);
+      emit_asm_procs_folded (l, p, proc);
+    }
+  else if (peephole)
+    {
+      // The procedures are rewritten together, so that a tail call to the
+      // one that comes next falls through into it
+      asm_list_t *code = asm_new ();
+      emit_asm_procs (code, p);
+      peephole_run (code);
+      asm_append (l, code);
+    }
+  else
+    emit_asm_procs (l, p);
+  if (size)
+    pass_record_stat ("size", "predicates in stubs", bool_stubs_calls);
+  free (emit_reached);
+
+  // The static objects are aligned like those of the heap, so that their
+  // addresses have the tag of pointers
+  if (p->ndata)
+    asm_directive (l, ".section " ASM_RODATA_SECTION);
+  for (size_t k = 0; k < p->ndata; k++)
+    {
+      char label[LABEL_MAX];
+      data_label (label, k);
+      asm_directive (l, ".p2align 3");
+      emit_asm_label (l, label);
+      for (size_t w = 0; w < p->data[k]->nwords; w++)
+        asm_directive (l, ".quad  0x%" PRIx64, p->data[k]->words[w]);
+    }
+  if (p->ndata)
+    asm_directive (l, ".text");
 }
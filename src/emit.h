@@ -18,7 +18,9 @@
 
 #include <stdio.h>
 
-#include "env.h"
+#include "cpu.h"
+#include "ir.h"
+#include "peephole.h"
 
 #if defined(__APPLE__) || defined(__MACH__)
 #define ASM_SYMBOL_PREFIX "_"
@@ -28,37 +30,53 @@
 #error "Unsupported platform"
 #endif
 
+// Emitter prototypes
+void emit_asm_program (asm_list_t *, const ir_program_t *, unsigned int,
+                       cpu_features_t, bool);
+void emit_asm_cold (asm_list_t *);
+void emit_asm_epilogue (asm_list_t *);
+void emit_asm_prologue (asm_list_t *, const char *);
+void emit_asm_text_size (asm_list_t *, const char *, const char *);
+void emit_asm_values_spill (asm_list_t *);
+
 // Primitive emitter prototypes
-void emit_asm_expr (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_epilogue (FILE *);
-void emit_asm_prologue (FILE *, const char *);
-void emit_asm_imm (FILE *, schptr_t);
-void emit_asm_if (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_let (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_expr_seq (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxadd1 (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxsub1 (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxzerop (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_char_to_fixnum (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fixnum_to_char (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_nullp (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fixnump (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_booleanp (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_charp (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_not (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxlognot (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxadd (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxsub (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxmul (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxlogand (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxlogor (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxeq (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxlt (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxle (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxgt (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_fxge (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_chareq (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_charlt (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_charle (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_chargt (FILE *, schptr_t, size_t, env_t *);
-void emit_asm_prim_charge (FILE *, schptr_t, size_t, env_t *);
+void emit_asm_prim_fxadd1 (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxsub1 (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_char_to_fixnum (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fixnum_to_char (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxlognot (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxadd (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxsub (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxmul (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxlogand (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxlogor (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxlogxor (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxash (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxbit_count (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxlength (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxfirst_bit_set (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxquotient (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxremainder (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_fxmodulo (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_add (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_sub (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_mul (asm_list_t *, const ir_insn_t *);
+void emit_asm_prim_predicate (asm_list_t *, const ir_insn_t *);
+
+// Predicate tester prototypes
+cond_code emit_asm_test_fxzerop (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_nullp (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_not (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_fixnump (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_booleanp (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_charp (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_fxeq (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_fxlt (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_fxle (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_fxgt (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_fxge (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_chareq (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_charlt (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_charle (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_chargt (asm_list_t *, const ir_insn_t *);
+cond_code emit_asm_test_charge (asm_list_t *, const ir_insn_t *);
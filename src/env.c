@@ -29,11 +29,12 @@ make_env ()
 }
 
 env_t *
-env_add (schid_t *id, size_t si, env_t *env)
+env_add (schid_t *id, size_t temp, env_t *env)
 {
   env_t *e = alloc (sizeof (*e));
   e->id = id;
-  e->si = si;
+  e->temp = temp;
+  e->known = NULL;
   e->next = env;
   return e;
 }
@@ -51,18 +52,25 @@ env_append (env_t *env1, env_t *env2)
   return env1;
 }
 
-bool
-env_ref (schid_t *id, env_t *env, size_t *si)
+// Returns the innermost binding of id in env, or NULL
+env_t *
+env_find (schid_t *id, env_t *env)
 {
   for (env_t *e = env; e; e = e->next)
-    {
-      if (!strcmp (id->name, e->id->name))
-        {
-          *si = e->si;
-          return true;
-        }
-    }
-  return false;
+    if (!strcmp (id->name, e->id->name))
+      return e;
+  return NULL;
+}
+
+bool
+env_ref (schid_t *id, env_t *env, size_t *temp)
+{
+  const env_t *e = env_find (id, env);
+  if (!e)
+    return false;
+
+  *temp = e->temp;
+  return true;
 }
 
 void
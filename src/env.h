@@ -25,15 +25,21 @@
 //
 ///////////////////////////////////////////////////////////////////////
 
+struct known_proc;
+
+// Maps identifiers to the IR temporary holding their value, or for
+// procedures bound by letrec, to what lowering knows about them
 typedef struct env
 {
   schid_t *id;
-  size_t si;
+  size_t temp;
+  struct known_proc *known; // see lower.c, or NULL
   struct env *next;
 } env_t;
 
 env_t *make_env ();
 env_t *env_add (schid_t *, size_t, env_t *);
 env_t *env_append (env_t *, env_t *);
+env_t *env_find (schid_t *, env_t *);
 bool env_ref (schid_t *, env_t *, size_t *);
 void free_env_partial (env_t *, const env_t *, bool);
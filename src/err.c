@@ -42,6 +42,13 @@ err_parse (const char *s)
   exit (EXIT_FAILURE);
 }
 
+void
+err_syntax (const char *what, const char *s)
+{
+  fprintf (stderr, "error: %s `%s'\n", what, s);
+  exit (EXIT_FAILURE);
+}
+
 __attribute__ ((noreturn)) void
 err_unreachable (const char *s)
 {
@@ -18,4 +18,5 @@
 
 void err_oom (void);
 void err_parse (const char *);
+void err_syntax (const char *, const char *);
 __attribute__ ((noreturn)) void err_unreachable (const char *);
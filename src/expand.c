@@ -0,0 +1,1350 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "expand.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+#include "memory.h"
+#include "parse.h"
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Macro Expansion
+//
+// Expands the uses of the macros that define-syntax, let-syntax and
+// letrec-syntax bind to syntax-rules, before the program is parsed. The
+// program is read as datums, expanded, and written back as the text that
+// the parser then reads. A program that defines no macros is left as it
+// is.
+//
+// Expansion is hygienic, by renaming. Each expansion has a mark, which it
+// gives to the identifiers that its template introduces. A binding form
+// that binds an identifier with a mark gives it a new name, which no
+// other identifier has, so that it neither captures the identifiers of
+// the program nor is captured by them. An identifier with a mark that is
+// not bound inside the expansion refers to what it referred to where the
+// macro was defined. Likewise, a literal of a pattern only matches an
+// identifier of the use that refers to what the literal does where the
+// macro was defined, or that is free, as the literal is, with its name.
+//
+// Expansions are memoized per macro and input form, marks and what the
+// identifiers that are literals refer to included: a use that is the same
+// as one already expanded gets the same expansion, mark and all, without
+// matching it again. Two such uses can never be nested in each other, so
+// sharing a mark does not let them capture each other's identifiers.
+//
+///////////////////////////////////////////////////////////////////////
+
+#define EXPAND_DEPTH_MAX 1024
+
+// A datum is a list, or an atom with the text it was read from
+typedef struct datum
+{
+  bool list_p;
+  struct datum **elems; // elements of a list
+  size_t count;
+  const char *text; // text of an atom
+  bool id_p;        // true if the atom is an identifier
+  size_t mark;      // expansion that introduced the identifier, or 0
+  const struct datum *orig; // identifier of the template it comes from
+} datum_t;
+
+typedef struct datums
+{
+  datum_t **v;
+  size_t count;
+  size_t cap;
+} datums_t;
+
+typedef struct rule
+{
+  const datum_t *pattern;
+  const datum_t *template;
+} rule_t;
+
+typedef struct macro
+{
+  size_t id;
+  const char *ellipsis;
+  const datum_t *literals;
+  rule_t *rules;
+  size_t nrules;
+  struct frame *env; // where the macro was defined
+} macro_t;
+
+// A frame binds identifiers, by text and mark, to a variable with its
+// name in the expanded program, or to a macro
+typedef struct binding
+{
+  const char *text;
+  size_t mark;
+  const char *name;
+  const macro_t *macro;
+  struct binding *next;
+} binding_t;
+
+typedef struct frame
+{
+  binding_t *bindings; // the last one bound first
+  struct frame *up;
+} frame_t;
+
+// The datums a pattern variable matched: a single one at depth 0, or one
+// match of depth - 1 per repetition of the ellipsis after it
+typedef struct match
+{
+  const char *var;
+  size_t depth;
+  datum_t *d;
+  struct match *seq;
+  size_t n;
+} match_t;
+
+typedef struct matches
+{
+  match_t *v;
+  size_t count;
+  size_t cap;
+} matches_t;
+
+typedef struct table_entry
+{
+  char *key;
+  void *value;
+  struct table_entry *next;
+} table_entry_t;
+
+typedef struct table
+{
+  table_entry_t **buckets;
+  size_t nbuckets;
+  size_t count;
+} table_t;
+
+typedef struct strbuf
+{
+  char *s;
+  size_t len;
+  size_t cap;
+} strbuf_t;
+
+typedef struct expander
+{
+  void **objs; // everything allocated, freed once done
+  size_t objs_count;
+  size_t objs_cap;
+  frame_t **marks; // frame where the macro of each expansion was defined
+  size_t marks_count;
+  size_t marks_cap;
+  table_t names; // names of the identifiers of the expanded program
+  table_t free;  // identifiers of the templates of the macros
+  table_t cache; // expansions, by macro and input form
+  size_t macros;
+  size_t depth;
+  size_t renamed;
+  size_t expanded;
+  size_t reused;
+} expander_t;
+
+//
+// Allocation
+//
+
+static void *
+x_alloc (expander_t *x, size_t n)
+{
+  if (x->objs_count == x->objs_cap)
+    {
+      x->objs_cap = x->objs_cap ? 2 * x->objs_cap : 256;
+      x->objs = grow (x->objs, x->objs_cap * sizeof (*x->objs));
+    }
+  return x->objs[x->objs_count++] = alloc (n ? n : 1);
+}
+
+static char *
+x_strndup (expander_t *x, const char *s, size_t n)
+{
+  char *r = x_alloc (x, n + 1);
+  memcpy (r, s, n);
+  r[n] = '\0';
+  return r;
+}
+
+static void
+datums_push (datums_t *ds, datum_t *d)
+{
+  if (ds->count == ds->cap)
+    {
+      ds->cap = ds->cap ? 2 * ds->cap : 8;
+      ds->v = grow (ds->v, ds->cap * sizeof (*ds->v));
+    }
+  ds->v[ds->count++] = d;
+}
+
+static datum_t *
+make_atom (expander_t *x, const char *text, size_t mark,
+           const datum_t *orig)
+{
+  datum_t *d = x_alloc (x, sizeof (*d));
+  d->list_p = false;
+  d->elems = NULL;
+  d->count = 0;
+  d->text = text;
+  d->mark = mark;
+  d->orig = orig;
+  if (orig)
+    d->id_p = orig->id_p;
+  else
+    {
+      const char *ptr = text;
+      schptr_t c = (schptr_t)NULL;
+      d->id_p = !parse_constant (&ptr, &c) || *ptr;
+      if (c)
+        free_expression (c);
+    }
+  return d;
+}
+
+// Makes a list of the datums in ds, which it frees
+static datum_t *
+make_list (expander_t *x, datums_t *ds)
+{
+  datum_t *d = x_alloc (x, sizeof (*d));
+  d->list_p = true;
+  d->count = ds->count;
+  d->elems = x_alloc (x, ds->count * sizeof (*d->elems));
+  if (ds->count)
+    memcpy (d->elems, ds->v, ds->count * sizeof (*d->elems));
+  d->text = NULL;
+  d->id_p = false;
+  d->mark = 0;
+  d->orig = NULL;
+  free (ds->v);
+  ds->v = NULL;
+  ds->count = ds->cap = 0;
+  return d;
+}
+
+//
+// Tables of strings
+//
+
+static size_t
+table_hash (const char *s)
+{
+  uint64_t h = UINT64_C (14695981039346656037);
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * UINT64_C (1099511628211);
+  return h;
+}
+
+static void *
+table_get (const table_t *t, const char *key)
+{
+  if (!t->nbuckets)
+    return NULL;
+
+  for (const table_entry_t *e = t->buckets[table_hash (key) % t->nbuckets];
+       e; e = e->next)
+    if (!strcmp (e->key, key))
+      return e->value;
+  return NULL;
+}
+
+// Adds key, which the table then owns, with value
+static void
+table_put (table_t *t, char *key, void *value)
+{
+  if (t->count >= t->nbuckets)
+    {
+      const size_t n = t->nbuckets ? 2 * t->nbuckets : 256;
+      table_entry_t **buckets = alloc (n * sizeof (*buckets));
+      for (size_t b = 0; b < n; b++)
+        buckets[b] = NULL;
+      for (size_t b = 0; b < t->nbuckets; b++)
+        while (t->buckets[b])
+          {
+            table_entry_t *e = t->buckets[b];
+            t->buckets[b] = e->next;
+            e->next = buckets[table_hash (e->key) % n];
+            buckets[table_hash (e->key) % n] = e;
+          }
+      free (t->buckets);
+      t->buckets = buckets;
+      t->nbuckets = n;
+    }
+
+  table_entry_t *e = alloc (sizeof (*e));
+  e->key = key;
+  e->value = value;
+  e->next = t->buckets[table_hash (key) % t->nbuckets];
+  t->buckets[table_hash (key) % t->nbuckets] = e;
+  t->count++;
+}
+
+static char *
+table_key (const char *s)
+{
+  char *key = strdup (s);
+  if (!key)
+    err_oom ();
+  return key;
+}
+
+static void
+table_free (table_t *t)
+{
+  for (size_t b = 0; b < t->nbuckets; b++)
+    while (t->buckets[b])
+      {
+        table_entry_t *e = t->buckets[b];
+        t->buckets[b] = e->next;
+        free (e->key);
+        free (e);
+      }
+  free (t->buckets);
+}
+
+//
+// Reading and writing datums
+//
+
+static void
+strbuf_add (strbuf_t *b, const char *s, size_t n)
+{
+  if (b->len + n + 1 > b->cap)
+    {
+      while (b->len + n + 1 > b->cap)
+        b->cap = b->cap ? 2 * b->cap : 256;
+      b->s = grow (b->s, b->cap);
+    }
+  memcpy (b->s + b->len, s, n);
+  b->len += n;
+  b->s[b->len] = '\0';
+}
+
+static bool
+delimiter_p (char c)
+{
+  return !c || isspace (c) || c == '(' || c == ')' || c == ';';
+}
+
+// Reads a datum, or returns NULL if there is none at input
+static datum_t *
+read_datum (expander_t *x, const char **input)
+{
+  const char *ptr = *input;
+
+  if (parse_lparen (&ptr))
+    {
+      datums_t ds = { NULL, 0, 0 };
+      (void)parse_whitespace (&ptr);
+      while (!parse_rparen (&ptr))
+        {
+          datum_t *d = read_datum (x, &ptr);
+          if (!d)
+            {
+              free (ds.v);
+              return NULL;
+            }
+          datums_push (&ds, d);
+          (void)parse_whitespace (&ptr);
+        }
+      *input = ptr;
+      return make_list (x, &ds);
+    }
+
+  // 'd is read as (quote d)
+  if (parse_char (&ptr, '\''))
+    {
+      (void)parse_whitespace (&ptr);
+      datums_t ds = { NULL, 0, 0 };
+      datums_push (&ds, make_atom (x, "quote", 0, NULL));
+      datum_t *d = read_datum (x, &ptr);
+      if (!d)
+        {
+          free (ds.v);
+          return NULL;
+        }
+      datums_push (&ds, d);
+      *input = ptr;
+      return make_list (x, &ds);
+    }
+
+  if (ptr[0] == '#' && ptr[1] == '\\' && ptr[2])
+    ptr += 3;
+  else if (*ptr == '|')
+    {
+      ptr = strchr (ptr + 1, '|');
+      if (!ptr)
+        return NULL;
+      ptr++;
+    }
+  while (!delimiter_p (*ptr))
+    ptr++;
+  if (ptr == *input)
+    return NULL;
+
+  datum_t *d = make_atom (x, x_strndup (x, *input, ptr - *input), 0, NULL);
+  if (d->id_p && !table_get (&x->names, d->text))
+    table_put (&x->names, table_key (d->text), (void *)d->text);
+  *input = ptr;
+  return d;
+}
+
+// Writes datum d, with the marks of its identifiers if marks_p
+static void
+write_datum (strbuf_t *b, const datum_t *d, bool marks_p)
+{
+  if (!d->list_p)
+    {
+      strbuf_add (b, d->text, strlen (d->text));
+      if (marks_p && d->mark)
+        {
+          char mark[32];
+          const int n = snprintf (mark, sizeof (mark), "\x01%zu", d->mark);
+          strbuf_add (b, mark, n);
+        }
+      return;
+    }
+
+  strbuf_add (b, "(", 1);
+  for (size_t k = 0; k < d->count; k++)
+    {
+      if (k)
+        strbuf_add (b, " ", 1);
+      write_datum (b, d->elems[k], marks_p);
+    }
+  strbuf_add (b, ")", 1);
+}
+
+//
+// Syntactic environments
+//
+
+static frame_t *
+make_frame (expander_t *x, frame_t *up)
+{
+  frame_t *f = x_alloc (x, sizeof (*f));
+  f->bindings = NULL;
+  f->up = up;
+  return f;
+}
+
+static binding_t *
+frame_add (expander_t *x, frame_t *f, const datum_t *id)
+{
+  binding_t *b = x_alloc (x, sizeof (*b));
+  b->text = id->text;
+  b->mark = id->mark;
+  b->name = id->text;
+  b->macro = NULL;
+  b->next = f->bindings;
+  f->bindings = b;
+  return b;
+}
+
+// Binds identifier id to a variable in frame f, and returns the identifier
+// it is in the expanded program
+static datum_t *
+bind_variable (expander_t *x, frame_t *f, datum_t *id)
+{
+  binding_t *b = frame_add (x, f, id);
+  if (!id->mark && !table_get (&x->free, id->text))
+    return id;
+
+  // An identifier introduced by an expansion gets a name of its own, and
+  // so does one of the program that a template could refer to, so that
+  // it cannot capture what the template refers to. The name has to be an
+  // identifier too.
+  for (;;)
+    {
+      char suffix[32];
+      snprintf (suffix, sizeof (suffix), "%%%zu", ++x->renamed);
+
+      const size_t len = strlen (id->text);
+      char *name = x_alloc (x, len + strlen (suffix) + 1);
+      memcpy (name, id->text, len);
+      strcpy (name + len, suffix);
+
+      const char *ptr = name;
+      schptr_t sid = (schptr_t)NULL;
+      if (!parse_identifier (&ptr, &sid) || *ptr)
+        name = x_strndup (x, suffix, strlen (suffix));
+      if (sid)
+        free_expression (sid);
+      if (table_get (&x->names, name))
+        continue;
+
+      table_put (&x->names, table_key (name), name);
+      b->name = name;
+      return make_atom (x, name, 0, NULL);
+    }
+}
+
+static void
+bind_macro (expander_t *x, frame_t *f, const datum_t *id, const macro_t *m)
+{
+  frame_add (x, f, id)->macro = m;
+}
+
+static const binding_t *
+frame_find (const frame_t *f, const char *text, size_t mark)
+{
+  for (; f; f = f->up)
+    for (const binding_t *b = f->bindings; b; b = b->next)
+      if (b->mark == mark && !strcmp (b->text, text))
+        return b;
+  return NULL;
+}
+
+// Returns what identifier id refers to in frame f, NULL if it is free. An
+// identifier introduced by an expansion and not bound by it refers to
+// what the identifier of the template does where the macro was defined.
+static const binding_t *
+resolve (const expander_t *x, const datum_t *id, const frame_t *f)
+{
+  for (;;)
+    {
+      const binding_t *b = frame_find (f, id->text, id->mark);
+      if (b || !id->mark)
+        return b;
+      f = x->marks[id->mark];
+      id = id->orig;
+    }
+}
+
+// True if d is the keyword kw, unbound in frame f
+static bool
+keyword_p (const expander_t *x, const datum_t *d, const frame_t *f,
+           const char *kw)
+{
+  return !d->list_p && d->id_p && !strcmp (d->text, kw)
+         && !resolve (x, d, f);
+}
+
+// True if d is a list that starts with keyword kw
+static bool
+form_p (const expander_t *x, const datum_t *d, const frame_t *f,
+        const char *kw)
+{
+  return d->list_p && d->count && keyword_p (x, d->elems[0], f, kw);
+}
+
+// Returns the macro that d is a use of in frame f, if any
+static const macro_t *
+macro_use (const expander_t *x, const datum_t *d, const frame_t *f)
+{
+  if (!d->list_p || !d->count || d->elems[0]->list_p
+      || !d->elems[0]->id_p)
+    return NULL;
+
+  const binding_t *b = resolve (x, d->elems[0], f);
+  return b ? b->macro : NULL;
+}
+
+//
+// syntax-rules
+//
+
+// True if d is a list of identifiers
+static bool
+formals_p (const datum_t *d)
+{
+  if (!d->list_p)
+    return false;
+  for (size_t k = 0; k < d->count; k++)
+    if (d->elems[k]->list_p || !d->elems[k]->id_p)
+      return false;
+  return true;
+}
+
+// Adds the identifiers of template d to the free ones
+static void
+add_free (expander_t *x, const datum_t *d)
+{
+  if (d->list_p)
+    for (size_t k = 0; k < d->count; k++)
+      add_free (x, d->elems[k]);
+  else if (d->id_p && !table_get (&x->free, d->text))
+    table_put (&x->free, table_key (d->text), (void *)d->text);
+}
+
+// Makes the macro of spec, (syntax-rules [<ellipsis>] (<literal>*)
+// (<pattern> <template>)*), defined in frame f
+static macro_t *
+make_macro (expander_t *x, const datum_t *spec, frame_t *f)
+{
+  size_t k = 1;
+
+  if (!form_p (x, spec, f, "syntax-rules"))
+    err_syntax ("expected syntax-rules in the definition of a macro", "");
+
+  macro_t *m = x_alloc (x, sizeof (*m));
+  m->id = x->macros++;
+  m->ellipsis = "...";
+  m->env = f;
+  if (k < spec->count && !spec->elems[k]->list_p)
+    m->ellipsis = spec->elems[k++]->text;
+  if (k == spec->count || !formals_p (spec->elems[k]))
+    err_syntax ("expected the literals of syntax-rules", "");
+  m->literals = spec->elems[k++];
+
+  m->nrules = spec->count - k;
+  m->rules = x_alloc (x, m->nrules * sizeof (*m->rules));
+  for (size_t r = 0; k < spec->count; k++, r++)
+    {
+      const datum_t *rule = spec->elems[k];
+      if (!rule->list_p || rule->count != 2 || !rule->elems[0]->list_p
+          || !rule->elems[0]->count)
+        err_syntax ("expected a (<pattern> <template>) rule", "");
+      m->rules[r].pattern = rule->elems[0];
+      m->rules[r].template = rule->elems[1];
+      add_free (x, rule->elems[1]);
+    }
+  return m;
+}
+
+static bool
+ellipsis_p (const macro_t *m, const datum_t *d)
+{
+  return !d->list_p && d->id_p && !strcmp (d->text, m->ellipsis);
+}
+
+static bool
+literal_p (const macro_t *m, const datum_t *d)
+{
+  for (size_t k = 0; k < m->literals->count; k++)
+    if (!strcmp (m->literals->elems[k]->text, d->text))
+      return true;
+  return false;
+}
+
+// True if d, in a use of m in frame f, matches literal p of its patterns:
+// both refer to the same binding, or both are free and have the same name
+static bool
+literal_match_p (const expander_t *x, const macro_t *m, const datum_t *p,
+                 const datum_t *d, const frame_t *f)
+{
+  return !d->list_p && d->id_p && !strcmp (p->text, d->text)
+         && resolve (x, p, m->env) == resolve (x, d, f);
+}
+
+static void
+matches_push (matches_t *ms, match_t mt)
+{
+  if (ms->count == ms->cap)
+    {
+      ms->cap = ms->cap ? 2 * ms->cap : 8;
+      ms->v = grow (ms->v, ms->cap * sizeof (*ms->v));
+    }
+  ms->v[ms->count++] = mt;
+}
+
+static const match_t *
+matches_find (const matches_t *ms, const char *var)
+{
+  for (size_t k = 0; k < ms->count; k++)
+    if (!strcmp (ms->v[k].var, var))
+      return &ms->v[k];
+  return NULL;
+}
+
+// Adds to vars the pattern variables of p, with their depth below depth
+static void
+pattern_vars (const macro_t *m, const datum_t *p, size_t depth,
+              matches_t *vars)
+{
+  if (!p->list_p)
+    {
+      if (p->id_p && !ellipsis_p (m, p) && !literal_p (m, p)
+          && strcmp (p->text, "_"))
+        matches_push (vars, (match_t){ p->text, depth, NULL, NULL, 0 });
+      return;
+    }
+
+  for (size_t k = 0; k < p->count; k++)
+    {
+      const bool more_p = k + 1 < p->count && ellipsis_p (m, p->elems[k + 1]);
+      pattern_vars (m, p->elems[k], depth + more_p, vars);
+    }
+}
+
+static bool match (expander_t *, const macro_t *, const frame_t *,
+                   const datum_t *, datum_t *, matches_t *);
+
+// Matches the n patterns in ps, of which at most one is followed by the
+// ellipsis, with the count datums in ds of a use in frame f
+static bool
+match_elems (expander_t *x, const macro_t *m, const frame_t *f,
+             datum_t *const *ps, size_t n, datum_t **ds, size_t count,
+             matches_t *ms)
+{
+  size_t e = 0;
+  while (e + 1 < n && !ellipsis_p (m, ps[e + 1]))
+    e++;
+  if (e + 1 >= n)
+    {
+      if (n != count)
+        return false;
+      for (size_t k = 0; k < n; k++)
+        if (!match (x, m, f, ps[k], ds[k], ms))
+          return false;
+      return true;
+    }
+
+  // The pattern before the ellipsis matches what the others leave
+  const size_t after = n - e - 2;
+  if (count < e + after)
+    return false;
+  for (size_t k = 0; k < e; k++)
+    if (!match (x, m, f, ps[k], ds[k], ms))
+      return false;
+  for (size_t k = 0; k < after; k++)
+    if (!match (x, m, f, ps[e + 2 + k], ds[count - after + k], ms))
+      return false;
+
+  const size_t reps = count - e - after;
+  matches_t vars = { NULL, 0, 0 };
+  pattern_vars (m, ps[e], 0, &vars);
+  for (size_t v = 0; v < vars.count; v++)
+    {
+      vars.v[v].depth++;
+      vars.v[v].n = reps;
+      vars.v[v].seq = x_alloc (x, reps * sizeof (*vars.v[v].seq));
+    }
+
+  bool match_p = true;
+  for (size_t r = 0; r < reps && match_p; r++)
+    {
+      matches_t sub = { NULL, 0, 0 };
+      match_p = match (x, m, f, ps[e], ds[e + r], &sub);
+      for (size_t v = 0; v < vars.count && match_p; v++)
+        vars.v[v].seq[r] = *matches_find (&sub, vars.v[v].var);
+      free (sub.v);
+    }
+  for (size_t v = 0; v < vars.count && match_p; v++)
+    matches_push (ms, vars.v[v]);
+  free (vars.v);
+  return match_p;
+}
+
+// Matches pattern p with datum d of a use in frame f, adding what its
+// variables match to ms
+static bool
+match (expander_t *x, const macro_t *m, const frame_t *f, const datum_t *p,
+       datum_t *d, matches_t *ms)
+{
+  if (p->list_p)
+    return d->list_p
+           && match_elems (x, m, f, p->elems, p->count, d->elems, d->count,
+                           ms);
+
+  if (!p->id_p)
+    return !d->list_p && !strcmp (p->text, d->text);
+  if (!strcmp (p->text, "_"))
+    return true;
+  if (literal_p (m, p))
+    return literal_match_p (x, m, p, d, f);
+
+  matches_push (ms, (match_t){ p->text, 0, d, NULL, 0 });
+  return true;
+}
+
+// Adds to vars the variables of ms in template t that are followed by an
+// ellipsis at a depth where they still have more than one datum
+static void
+template_vars (const macro_t *m, const datum_t *t, const matches_t *ms,
+               matches_t *vars)
+{
+  if (t->list_p)
+    {
+      for (size_t k = 0; k < t->count; k++)
+        template_vars (m, t->elems[k], ms, vars);
+      return;
+    }
+
+  const match_t *mt = t->id_p ? matches_find (ms, t->text) : NULL;
+  if (mt && mt->depth && !matches_find (vars, mt->var))
+    matches_push (vars, *mt);
+}
+
+// Instantiates template t with the datums the pattern variables matched,
+// giving mark to the identifiers it introduces
+static datum_t *
+instantiate (expander_t *x, const macro_t *m, const datum_t *t,
+             const matches_t *ms, size_t mark, bool ellipsis_on)
+{
+  if (!t->list_p)
+    {
+      const match_t *mt = t->id_p ? matches_find (ms, t->text) : NULL;
+      if (!mt)
+        return t->id_p ? make_atom (x, t->text, mark, t) : (datum_t *)t;
+      if (mt->depth)
+        err_syntax ("pattern variable used without an ellipsis", t->text);
+      return mt->d;
+    }
+
+  // (... <template>) is the template, where the ellipsis is an identifier
+  if (ellipsis_on && t->count == 2 && ellipsis_p (m, t->elems[0]))
+    return instantiate (x, m, t->elems[1], ms, mark, false);
+
+  datums_t ds = { NULL, 0, 0 };
+  for (size_t k = 0; k < t->count; k++)
+    {
+      const datum_t *e = t->elems[k];
+      if (!ellipsis_on || k + 1 == t->count
+          || !ellipsis_p (m, t->elems[k + 1]))
+        {
+          datums_push (&ds, instantiate (x, m, e, ms, mark, ellipsis_on));
+          continue;
+        }
+      k++;
+
+      matches_t vars = { NULL, 0, 0 };
+      template_vars (m, e, ms, &vars);
+      if (!vars.count)
+        err_syntax ("no pattern variable before the ellipsis", m->ellipsis);
+      for (size_t v = 1; v < vars.count; v++)
+        if (vars.v[v].n != vars.v[0].n)
+          err_syntax ("pattern variables repeated a different number of "
+                      "times",
+                      vars.v[v].var);
+
+      // Each repetition sees the datums of one repetition of the match
+      matches_t sub = { NULL, 0, 0 };
+      for (size_t v = 0; v < ms->count; v++)
+        matches_push (&sub, ms->v[v]);
+      for (size_t r = 0; r < vars.v[0].n; r++)
+        {
+          for (size_t v = 0; v < vars.count; v++)
+            for (size_t s = 0; s < sub.count; s++)
+              if (!strcmp (sub.v[s].var, vars.v[v].var))
+                sub.v[s] = vars.v[v].seq[r];
+          datums_push (&ds, instantiate (x, m, e, &sub, mark, true));
+        }
+      free (sub.v);
+      free (vars.v);
+    }
+  return make_list (x, &ds);
+}
+
+// Adds to key what the identifiers of d that are literals of m refer to
+// in frame f, which the rule that d matches depends on
+static void
+literals_key (const expander_t *x, const macro_t *m, const datum_t *d,
+              const frame_t *f, strbuf_t *key)
+{
+  if (d->list_p)
+    {
+      for (size_t k = 0; k < d->count; k++)
+        literals_key (x, m, d->elems[k], f, key);
+      return;
+    }
+  if (!d->id_p || !literal_p (m, d))
+    return;
+
+  char b[32];
+  const int n = snprintf (b, sizeof (b), " %p", (void *)resolve (x, d, f));
+  strbuf_add (key, b, n);
+}
+
+// Expands use d of macro m in frame f
+static datum_t *
+expand_use (expander_t *x, const macro_t *m, datum_t *d, const frame_t *f)
+{
+  strbuf_t key = { NULL, 0, 0 };
+  char id[32];
+  const int n = snprintf (id, sizeof (id), "%zu:", m->id);
+  strbuf_add (&key, id, n);
+  write_datum (&key, d, true);
+  literals_key (x, m, d, f, &key);
+
+  datum_t *r = table_get (&x->cache, key.s);
+  if (r)
+    {
+      free (key.s);
+      x->reused++;
+      return r;
+    }
+
+  for (size_t k = 0; k < m->nrules; k++)
+    {
+      const datum_t *p = m->rules[k].pattern;
+      matches_t ms = { NULL, 0, 0 };
+
+      // The first element of the pattern stands for the keyword, and is
+      // not matched
+      if (match_elems (x, m, f, p->elems + 1, p->count - 1, d->elems + 1,
+                       d->count - 1, &ms))
+        {
+          if (x->marks_count == x->marks_cap)
+            {
+              x->marks_cap = x->marks_cap ? 2 * x->marks_cap : 64;
+              x->marks
+                  = grow (x->marks, x->marks_cap * sizeof (*x->marks));
+            }
+          const size_t mark = x->marks_count;
+          x->marks[x->marks_count++] = m->env;
+
+          r = instantiate (x, m, m->rules[k].template, &ms, mark, true);
+          free (ms.v);
+          table_put (&x->cache, key.s, r);
+          x->expanded++;
+          return r;
+        }
+      free (ms.v);
+    }
+
+  err_syntax ("no syntax-rules pattern matches the use of",
+              d->elems[0]->text);
+  return NULL;
+}
+
+//
+// Expansion
+//
+
+static datum_t *expand_expr (expander_t *, datum_t *, frame_t *);
+static void expand_body (expander_t *, datum_t **, size_t, frame_t *,
+                         datums_t *);
+
+static bool
+binding_specs_p (const datum_t *d)
+{
+  if (!d->list_p)
+    return false;
+  for (size_t k = 0; k < d->count; k++)
+    if (!d->elems[k]->list_p || !d->elems[k]->count
+        || d->elems[k]->elems[0]->list_p || !d->elems[k]->elems[0]->id_p)
+      return false;
+  return true;
+}
+
+// Binds formals to variables in frame f, and returns them as they are
+// in the expanded program
+static datum_t *
+expand_formals (expander_t *x, const datum_t *formals, frame_t *f)
+{
+  datums_t ds = { NULL, 0, 0 };
+  for (size_t k = 0; k < formals->count; k++)
+    datums_push (&ds, bind_variable (x, f, formals->elems[k]));
+  return make_list (x, &ds);
+}
+
+// Expands the n datums in es, in frame f, adding them to ds
+static void
+expand_each (expander_t *x, datum_t **es, size_t n, frame_t *f,
+             datums_t *ds)
+{
+  for (size_t k = 0; k < n; k++)
+    datums_push (ds, expand_expr (x, es[k], f));
+}
+
+// Expands the let family of binding forms: the inits of let are in the
+// frame of the let, those of let* in the one of the bindings before them,
+// and those of letrec and letrec* in the one of all the bindings
+static datum_t *
+expand_let (expander_t *x, const datum_t *d, frame_t *f)
+{
+  datums_t ds = { NULL, 0, 0 };
+  const char *kw = d->elems[0]->text;
+  const bool star_p = !strcmp (kw, "let*");
+  const bool rec_p = !strcmp (kw, "letrec") || !strcmp (kw, "letrec*");
+  size_t k = 1;
+
+  datums_push (&ds, make_atom (x, kw, 0, NULL));
+  frame_t *inner = make_frame (x, f);
+  if (!star_p && !rec_p && k < d->count && !d->elems[k]->list_p)
+    datums_push (&ds, bind_variable (x, inner, d->elems[k++]));
+  if (k == d->count || !binding_specs_p (d->elems[k]))
+    {
+      expand_each (x, d->elems + k, d->count - k, f, &ds);
+      return make_list (x, &ds);
+    }
+
+  const datum_t *specs = d->elems[k++];
+  datum_t **names = alloc ((specs->count + 1) * sizeof (*names));
+  if (rec_p)
+    for (size_t b = 0; b < specs->count; b++)
+      names[b] = bind_variable (x, inner, specs->elems[b]->elems[0]);
+
+  datums_t bs = { NULL, 0, 0 };
+  frame_t *scope = rec_p ? inner : f;
+  for (size_t b = 0; b < specs->count; b++)
+    {
+      const datum_t *spec = specs->elems[b];
+      datums_t s = { NULL, 0, 0 };
+      expand_each (x, spec->elems + 1, spec->count - 1, scope, &s);
+      if (star_p)
+        scope = inner = make_frame (x, scope);
+      if (!rec_p)
+        names[b] = bind_variable (x, inner, spec->elems[0]);
+
+      datums_t one = { NULL, 0, 0 };
+      datums_push (&one, names[b]);
+      for (size_t e = 0; e < s.count; e++)
+        datums_push (&one, s.v[e]);
+      free (s.v);
+      datums_push (&bs, make_list (x, &one));
+    }
+  free (names);
+
+  datums_push (&ds, make_list (x, &bs));
+  expand_body (x, d->elems + k, d->count - k, inner, &ds);
+  return make_list (x, &ds);
+}
+
+// Expands (let-values ((<formals> <init>)*) <body>), where the inits are
+// in frame f and the body in the one of all the formals
+static datum_t *
+expand_let_values (expander_t *x, const datum_t *d, frame_t *f)
+{
+  datums_t ds = { NULL, 0, 0 };
+  datums_push (&ds, make_atom (x, d->elems[0]->text, 0, NULL));
+
+  bool specs_p = d->count > 2 && d->elems[1]->list_p;
+  for (size_t b = 0; specs_p && b < d->elems[1]->count; b++)
+    {
+      const datum_t *spec = d->elems[1]->elems[b];
+      specs_p = spec->list_p && spec->count == 2 && formals_p (spec->elems[0]);
+    }
+  if (!specs_p)
+    {
+      expand_each (x, d->elems + 1, d->count - 1, f, &ds);
+      return make_list (x, &ds);
+    }
+
+  const datum_t *specs = d->elems[1];
+  frame_t *inner = make_frame (x, f);
+  datums_t bs = { NULL, 0, 0 };
+  for (size_t b = 0; b < specs->count; b++)
+    {
+      datum_t *init = expand_expr (x, specs->elems[b]->elems[1], f);
+      datums_t one = { NULL, 0, 0 };
+      datums_push (&one, expand_formals (x, specs->elems[b]->elems[0], inner));
+      datums_push (&one, init);
+      datums_push (&bs, make_list (x, &one));
+    }
+
+  datums_push (&ds, make_list (x, &bs));
+  expand_body (x, d->elems + 2, d->count - 2, inner, &ds);
+  return make_list (x, &ds);
+}
+
+// Expands (do ((<variable> <init> <step>)*) (<test> <expression>*)
+// <command>*), where the inits are in frame f and the rest in the one of
+// the variables
+static datum_t *
+expand_do (expander_t *x, const datum_t *d, frame_t *f)
+{
+  datums_t ds = { NULL, 0, 0 };
+  datums_push (&ds, make_atom (x, d->elems[0]->text, 0, NULL));
+  if (d->count < 3 || !binding_specs_p (d->elems[1]))
+    {
+      expand_each (x, d->elems + 1, d->count - 1, f, &ds);
+      return make_list (x, &ds);
+    }
+
+  // The inits are all expanded before any variable is bound
+  const datum_t *specs = d->elems[1];
+  datum_t **inits = alloc ((specs->count + 1) * sizeof (*inits));
+  for (size_t b = 0; b < specs->count; b++)
+    inits[b] = specs->elems[b]->count > 1
+                   ? expand_expr (x, specs->elems[b]->elems[1], f)
+                   : NULL;
+
+  frame_t *inner = make_frame (x, f);
+  datum_t **names = alloc ((specs->count + 1) * sizeof (*names));
+  for (size_t b = 0; b < specs->count; b++)
+    names[b] = bind_variable (x, inner, specs->elems[b]->elems[0]);
+
+  datums_t bs = { NULL, 0, 0 };
+  for (size_t b = 0; b < specs->count; b++)
+    {
+      const datum_t *spec = specs->elems[b];
+      datums_t one = { NULL, 0, 0 };
+      datums_push (&one, names[b]);
+      if (inits[b])
+        datums_push (&one, inits[b]);
+      if (spec->count > 2)
+        expand_each (x, spec->elems + 2, spec->count - 2, inner, &one);
+      datums_push (&bs, make_list (x, &one));
+    }
+  free (inits);
+  free (names);
+
+  datums_push (&ds, make_list (x, &bs));
+  expand_each (x, d->elems + 2, d->count - 2, inner, &ds);
+  return make_list (x, &ds);
+}
+
+// Expands expression d in frame f
+static datum_t *
+expand_expr (expander_t *x, datum_t *d, frame_t *f)
+{
+  const macro_t *m = macro_use (x, d, f);
+  if (m)
+    {
+      if (++x->depth > EXPAND_DEPTH_MAX)
+        err_syntax ("too many nested macro uses, from", d->elems[0]->text);
+      datum_t *r = expand_expr (x, expand_use (x, m, d, f), f);
+      x->depth--;
+      return r;
+    }
+
+  if (!d->list_p)
+    {
+      if (!d->id_p)
+        return d;
+
+      const binding_t *b = resolve (x, d, f);
+      if (b && b->macro)
+        err_syntax ("macro used as a variable", d->text);
+      if (!b || !strcmp (b->name, d->text))
+        return d;
+      return make_atom (x, b->name, 0, NULL);
+    }
+
+  // Quoted datums are not expressions
+  if (form_p (x, d, f, "quote"))
+    return d;
+
+  datums_t ds = { NULL, 0, 0 };
+  if (form_p (x, d, f, "let") || form_p (x, d, f, "let*")
+      || form_p (x, d, f, "letrec") || form_p (x, d, f, "letrec*"))
+    return expand_let (x, d, f);
+  if (form_p (x, d, f, "let-values"))
+    return expand_let_values (x, d, f);
+  if (form_p (x, d, f, "do"))
+    return expand_do (x, d, f);
+  if (form_p (x, d, f, "define-syntax"))
+    err_syntax ("define-syntax out of a body", d->text);
+
+  if (form_p (x, d, f, "lambda") && d->count > 2 && formals_p (d->elems[1]))
+    {
+      frame_t *inner = make_frame (x, f);
+      datums_push (&ds, d->elems[0]);
+      datums_push (&ds, expand_formals (x, d->elems[1], inner));
+      expand_body (x, d->elems + 2, d->count - 2, inner, &ds);
+      return make_list (x, &ds);
+    }
+
+  // let-syntax and letrec-syntax are a let without bindings, in the scope
+  // of their macros
+  const bool rec_p = form_p (x, d, f, "letrec-syntax");
+  if ((rec_p || form_p (x, d, f, "let-syntax")) && d->count > 2
+      && binding_specs_p (d->elems[1]))
+    {
+      const datum_t *specs = d->elems[1];
+      frame_t *inner = make_frame (x, f);
+      for (size_t b = 0; b < specs->count; b++)
+        {
+          if (specs->elems[b]->count != 2)
+            err_syntax ("expected (<keyword> <transformer spec>) in",
+                        d->elems[0]->text);
+          bind_macro (x, inner, specs->elems[b]->elems[0],
+                      make_macro (x, specs->elems[b]->elems[1],
+                                  rec_p ? inner : f));
+        }
+
+      datums_t none = { NULL, 0, 0 };
+      datums_push (&ds, make_atom (x, "let", 0, NULL));
+      datums_push (&ds, make_list (x, &none));
+      expand_body (x, d->elems + 2, d->count - 2, inner, &ds);
+      return make_list (x, &ds);
+    }
+
+  expand_each (x, d->elems, d->count, f, &ds);
+  return make_list (x, &ds);
+}
+
+// Binds the macro of (define-syntax <keyword> <transformer spec>) d in
+// frame f
+static void
+define_syntax (expander_t *x, const datum_t *d, frame_t *f)
+{
+  if (d->count != 3 || d->elems[1]->list_p || !d->elems[1]->id_p)
+    err_syntax ("expected (define-syntax <keyword> <transformer spec>)",
+                "");
+  bind_macro (x, f, d->elems[1], make_macro (x, d->elems[2], f));
+}
+
+// Returns the identifier that definition d defines, or NULL if d is not a
+// definition
+static datum_t *
+definition_id (const expander_t *x, const datum_t *d, const frame_t *f)
+{
+  if (!form_p (x, d, f, "define") || d->count < 3)
+    return NULL;
+
+  datum_t *target = d->elems[1];
+  if (!target->list_p)
+    return target->id_p ? target : NULL;
+  return target->count && formals_p (target) ? target->elems[0] : NULL;
+}
+
+// Expands the n forms of a body in es, in a new frame in frame f, adding
+// them to ds. The macros and the variables that the body defines are in
+// the scope of the whole body, so its macro uses are expanded first, to
+// find all of its definitions, and then what is left.
+static void
+expand_body (expander_t *x, datum_t **es, size_t n, frame_t *f,
+             datums_t *ds)
+{
+  frame_t *inner = make_frame (x, f);
+  for (size_t k = 0; k < n; k++)
+    if (form_p (x, es[k], inner, "define-syntax"))
+      define_syntax (x, es[k], inner);
+
+  datums_t forms = { NULL, 0, 0 };
+  datums_t names = { NULL, 0, 0 };
+  size_t *depths = alloc ((n + 1) * sizeof (*depths));
+  const size_t depth = x->depth;
+  for (size_t k = 0; k < n; k++)
+    {
+      datum_t *d = es[k];
+      const macro_t *m;
+      while ((m = macro_use (x, d, inner)))
+        {
+          if (++x->depth > EXPAND_DEPTH_MAX)
+            err_syntax ("too many nested macro uses, from",
+                        d->elems[0]->text);
+          d = expand_use (x, m, d, inner);
+        }
+
+      if (form_p (x, d, inner, "define-syntax"))
+        {
+          if (d != es[k])
+            define_syntax (x, d, inner);
+        }
+      else
+        {
+          datum_t *id = definition_id (x, d, inner);
+          datums_push (&names, id ? bind_variable (x, inner, id) : NULL);
+          depths[forms.count] = x->depth;
+          datums_push (&forms, d);
+        }
+      x->depth = depth;
+    }
+
+  for (size_t k = 0; k < forms.count; k++)
+    {
+      datum_t *d = forms.v[k];
+      x->depth = depths[k];
+      if (!names.v[k])
+        {
+          datums_push (ds, expand_expr (x, d, inner));
+          continue;
+        }
+
+      datums_t def = { NULL, 0, 0 };
+      datums_push (&def, d->elems[0]);
+      if (!d->elems[1]->list_p)
+        {
+          datums_push (&def, names.v[k]);
+          expand_each (x, d->elems + 2, d->count - 2, inner, &def);
+        }
+      else
+        {
+          const datum_t *target = d->elems[1];
+          frame_t *params = make_frame (x, inner);
+          datums_t t = { NULL, 0, 0 };
+          datums_push (&t, names.v[k]);
+          for (size_t p = 1; p < target->count; p++)
+            datums_push (&t, bind_variable (x, params, target->elems[p]));
+          datums_push (&def, make_list (x, &t));
+          expand_body (x, d->elems + 2, d->count - 2, params, &def);
+        }
+      datums_push (ds, make_list (x, &def));
+    }
+  x->depth = depth;
+
+  free (forms.v);
+  free (names.v);
+  free (depths);
+}
+
+char *
+expand_program (const char *s)
+{
+  if (!strstr (s, "define-syntax") && !strstr (s, "let-syntax")
+      && !strstr (s, "letrec-syntax"))
+    return NULL;
+
+  expander_t x;
+  x.objs = NULL;
+  x.objs_count = x.objs_cap = 0;
+  x.marks = NULL;
+  x.marks_count = x.marks_cap = 0;
+  x.names = (table_t){ NULL, 0, 0 };
+  x.free = (table_t){ NULL, 0, 0 };
+  x.cache = (table_t){ NULL, 0, 0 };
+  x.macros = 0;
+  x.depth = 0;
+  x.renamed = 0;
+  x.expanded = 0;
+  x.reused = 0;
+
+  // Mark 0 is the one of the identifiers of the program
+  x.marks_cap = 64;
+  x.marks = alloc (x.marks_cap * sizeof (*x.marks));
+  x.marks[x.marks_count++] = NULL;
+
+  datums_t forms = { NULL, 0, 0 };
+  const char *ptr = s;
+  (void)parse_whitespace (&ptr);
+  while (*ptr)
+    {
+      datum_t *d = read_datum (&x, &ptr);
+      if (!d)
+        err_parse (ptr);
+      datums_push (&forms, d);
+      (void)parse_whitespace (&ptr);
+    }
+
+  datums_t out = { NULL, 0, 0 };
+  expand_body (&x, forms.v, forms.count, NULL, &out);
+
+  strbuf_t b = { NULL, 0, 0 };
+  strbuf_add (&b, "", 0);
+  for (size_t k = 0; k < out.count; k++)
+    {
+      write_datum (&b, out.v[k], false);
+      strbuf_add (&b, "\n", 1);
+    }
+
+  pass_record_stat ("expand", "macro uses expanded", x.expanded);
+  pass_record_stat ("expand", "expansions reused", x.reused);
+
+  free (forms.v);
+  free (out.v);
+  table_free (&x.names);
+  table_free (&x.free);
+  table_free (&x.cache);
+  free (x.marks);
+  for (size_t k = 0; k < x.objs_count; k++)
+    free (x.objs[k]);
+  free (x.objs);
+  return b.s;
+}
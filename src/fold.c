@@ -0,0 +1,568 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fold.h"
+
+#include <stdlib.h>
+
+#include "memory.h"
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Primitive Folders
+//
+// Folders replay on 64 bit words the instructions that the emitters
+// produce, so that folded values wrap exactly like they would at
+// runtime, even for arguments of the wrong type.
+//
+///////////////////////////////////////////////////////////////////////
+
+// Arithmetic shift right, like sarq
+static inline uint64_t
+fold_sar (uint64_t x, uint8_t s)
+{
+  const uint64_t t = -(x >> 63);
+  return ((x ^ t) >> s) ^ t;
+}
+
+static inline bool
+fold_bool (bool b, schptr_t *r)
+{
+  *r = sch_encode_imm_bool (b);
+  return true;
+}
+
+bool
+fold_prim_fxadd1 (const schptr_t *a, schptr_t *r)
+{
+  *r = a[0] + (UINT64_C (1) << FX_SHIFT);
+  return true;
+}
+
+bool
+fold_prim_fxsub1 (const schptr_t *a, schptr_t *r)
+{
+  *r = a[0] - (UINT64_C (1) << FX_SHIFT);
+  return true;
+}
+
+bool
+fold_prim_fxzerop (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool (a[0] == FX_TAG, r);
+}
+
+bool
+fold_prim_char_to_fixnum (const schptr_t *a, schptr_t *r)
+{
+  *r = (fold_sar (a[0], CHAR_SHIFT) << FX_SHIFT) | FX_TAG;
+  return true;
+}
+
+bool
+fold_prim_fixnum_to_char (const schptr_t *a, schptr_t *r)
+{
+  *r = (fold_sar (a[0], FX_SHIFT) << CHAR_SHIFT) | CHAR_TAG;
+  return true;
+}
+
+bool
+fold_prim_nullp (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool (a[0] == NULL_CST, r);
+}
+
+bool
+fold_prim_fixnump (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool ((a[0] & FX_MASK) == FX_TAG, r);
+}
+
+bool
+fold_prim_booleanp (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool ((a[0] & BOOL_MASK) == BOOL_TAG, r);
+}
+
+bool
+fold_prim_charp (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool ((a[0] & CHAR_MASK) == CHAR_TAG, r);
+}
+
+bool
+fold_prim_not (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool (a[0] == FALSE_CST, r);
+}
+
+bool
+fold_prim_fxlognot (const schptr_t *a, schptr_t *r)
+{
+  *r = (~a[0] & ~FX_MASK) | FX_TAG;
+  return true;
+}
+
+bool
+fold_prim_fxadd (const schptr_t *a, schptr_t *r)
+{
+  *r = (a[0] ^ FX_MASK) + a[1];
+  return true;
+}
+
+bool
+fold_prim_fxsub (const schptr_t *a, schptr_t *r)
+{
+  uint64_t d = fold_sar (a[0], FX_SHIFT) - fold_sar (a[1], FX_SHIFT);
+  *r = (d << FX_SHIFT) | FX_TAG;
+  return true;
+}
+
+bool
+fold_prim_fxmul (const schptr_t *a, schptr_t *r)
+{
+  uint64_t m = fold_sar (a[0], FX_SHIFT) * fold_sar (a[1], FX_SHIFT);
+  *r = (m << FX_SHIFT) | FX_TAG;
+  return true;
+}
+
+bool
+fold_prim_fxlogand (const schptr_t *a, schptr_t *r)
+{
+  *r = a[0] & a[1];
+  return true;
+}
+
+bool
+fold_prim_fxlogor (const schptr_t *a, schptr_t *r)
+{
+  *r = a[0] | a[1];
+  return true;
+}
+
+bool
+fold_prim_fxlogxor (const schptr_t *a, schptr_t *r)
+{
+  *r = (a[0] ^ a[1]) | FX_TAG;
+  return true;
+}
+
+// Shift counts saturate at the bits of a fixnum, see emit.c
+bool
+fold_prim_fxash (const schptr_t *a, schptr_t *r)
+{
+  const int64_t bits = 64 - FX_SHIFT;
+  const int64_t k = (int64_t)fold_sar (a[1], FX_SHIFT);
+  const uint64_t x = a[0] & ~FX_MASK;
+  if (k >= 0)
+    *r = (x << (k < bits ? k : bits)) | FX_TAG;
+  else
+    *r = fold_sar (x, -k < bits ? -k : bits) | FX_TAG;
+  return true;
+}
+
+// Value of fixnum x with its bits flipped if it is negative
+static inline uint64_t
+fold_magnitude (schptr_t x)
+{
+  const uint64_t v = fold_sar (x, FX_SHIFT);
+  return v ^ -(v >> 63);
+}
+
+bool
+fold_prim_fxbit_count (const schptr_t *a, schptr_t *r)
+{
+  const uint64_t s = -(a[0] >> 63);
+  const uint64_t c = (uint64_t)__builtin_popcountll (fold_magnitude (a[0]));
+  *r = ((c ^ s) << FX_SHIFT) | FX_TAG;
+  return true;
+}
+
+bool
+fold_prim_fxlength (const schptr_t *a, schptr_t *r)
+{
+  const uint64_t m = fold_magnitude (a[0]);
+  const uint64_t l = m ? 64 - (uint64_t)__builtin_clzll (m) : 0;
+  *r = (l << FX_SHIFT) | FX_TAG;
+  return true;
+}
+
+bool
+fold_prim_fxfirst_bit_set (const schptr_t *a, schptr_t *r)
+{
+  const uint64_t x = a[0] & ~FX_MASK;
+  const uint64_t b
+      = x ? (uint64_t)__builtin_ctzll (x) - FX_SHIFT : ~UINT64_C (0);
+  *r = (b << FX_SHIFT) | FX_TAG;
+  return true;
+}
+
+// Division by 0 is left to the runtime, which raises
+bool
+fold_prim_fxquotient (const schptr_t *a, schptr_t *r)
+{
+  const int64_t n = (int64_t)fold_sar (a[0], FX_SHIFT);
+  const int64_t d = (int64_t)fold_sar (a[1], FX_SHIFT);
+  if (!d)
+    return false;
+  *r = ((uint64_t)(n / d) << FX_SHIFT) | FX_TAG;
+  return true;
+}
+
+bool
+fold_prim_fxremainder (const schptr_t *a, schptr_t *r)
+{
+  const int64_t n = (int64_t)fold_sar (a[0], FX_SHIFT);
+  const int64_t d = (int64_t)fold_sar (a[1], FX_SHIFT);
+  if (!d)
+    return false;
+  *r = ((uint64_t)(n % d) << FX_SHIFT) | FX_TAG;
+  return true;
+}
+
+bool
+fold_prim_fxmodulo (const schptr_t *a, schptr_t *r)
+{
+  const int64_t n = (int64_t)fold_sar (a[0], FX_SHIFT);
+  const int64_t d = (int64_t)fold_sar (a[1], FX_SHIFT);
+  if (!d)
+    return false;
+  int64_t m = n % d;
+  if (m && (m < 0) != (d < 0))
+    m += d;
+  *r = ((uint64_t)m << FX_SHIFT) | FX_TAG;
+  return true;
+}
+
+// Generic arithmetic folds only on fixnums, and only when the result is
+// a fixnum too: bignums and errors are left to the runtime
+static inline bool
+fold_number (int64_t v, bool overflow, schptr_t *r)
+{
+  if (overflow || v < FX_MIN || v > FX_MAX)
+    return false;
+  *r = sch_encode_imm_fixnum (v);
+  return true;
+}
+
+bool
+fold_prim_add (const schptr_t *a, schptr_t *r)
+{
+  if (!sch_imm_fixnum_p (a[0]) || !sch_imm_fixnum_p (a[1]))
+    return false;
+
+  int64_t v;
+  const bool o = __builtin_add_overflow (sch_decode_imm_fixnum (a[0]),
+                                         sch_decode_imm_fixnum (a[1]), &v);
+  return fold_number (v, o, r);
+}
+
+bool
+fold_prim_sub (const schptr_t *a, schptr_t *r)
+{
+  if (!sch_imm_fixnum_p (a[0]) || !sch_imm_fixnum_p (a[1]))
+    return false;
+
+  int64_t v;
+  const bool o = __builtin_sub_overflow (sch_decode_imm_fixnum (a[0]),
+                                         sch_decode_imm_fixnum (a[1]), &v);
+  return fold_number (v, o, r);
+}
+
+bool
+fold_prim_mul (const schptr_t *a, schptr_t *r)
+{
+  if (!sch_imm_fixnum_p (a[0]) || !sch_imm_fixnum_p (a[1]))
+    return false;
+
+  int64_t v;
+  const bool o = __builtin_mul_overflow (sch_decode_imm_fixnum (a[0]),
+                                         sch_decode_imm_fixnum (a[1]), &v);
+  return fold_number (v, o, r);
+}
+
+// Signed comparison of both arguments after shifting them right by s
+static inline int
+fold_cmp (const schptr_t *a, uint8_t s)
+{
+  int64_t x = (int64_t)fold_sar (a[0], s);
+  int64_t y = (int64_t)fold_sar (a[1], s);
+  return (x > y) - (x < y);
+}
+
+bool
+fold_prim_fxeq (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool (a[0] == a[1], r);
+}
+
+bool
+fold_prim_fxlt (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool (fold_cmp (a, FX_SHIFT) < 0, r);
+}
+
+bool
+fold_prim_fxle (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool (fold_cmp (a, FX_SHIFT) <= 0, r);
+}
+
+bool
+fold_prim_fxgt (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool (fold_cmp (a, FX_SHIFT) > 0, r);
+}
+
+bool
+fold_prim_fxge (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool (fold_cmp (a, FX_SHIFT) >= 0, r);
+}
+
+bool
+fold_prim_chareq (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool (a[0] == a[1], r);
+}
+
+bool
+fold_prim_charlt (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool (fold_cmp (a, CHAR_SHIFT) < 0, r);
+}
+
+bool
+fold_prim_charle (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool (fold_cmp (a, CHAR_SHIFT) <= 0, r);
+}
+
+bool
+fold_prim_chargt (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool (fold_cmp (a, CHAR_SHIFT) > 0, r);
+}
+
+bool
+fold_prim_charge (const schptr_t *a, schptr_t *r)
+{
+  return fold_bool (fold_cmp (a, CHAR_SHIFT) >= 0, r);
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Constant Folding and Propagation
+//
+// Walks the program in order keeping a substitution from temporaries to
+// the constants they are known to hold. Primitives whose operands are
+// all constant are evaluated with their folder, moves of constants
+// (let bindings) are propagated and conditionals on a constant are
+// replaced by the arm that is taken. Receivers of multiple values are
+// connected to the instruction that produces them when it is in sight,
+// which leaves it to dce.
+//
+///////////////////////////////////////////////////////////////////////
+
+typedef struct fold_stats
+{
+  size_t folded;
+  size_t propagated;
+  size_t branches;
+} fold_stats_t;
+
+// Tries to evaluate primitive instruction i, returning true and its value
+// in r on success
+static bool
+fold_prim (const ir_insn_t *i, schptr_t *r)
+{
+  schptr_t args[FOLD_ARGS_MAX];
+
+  if (!i->prim->folder || i->nargs > FOLD_ARGS_MAX)
+    return false;
+
+  for (size_t a = 0; a < i->nargs; a++)
+    {
+      if (i->args[a].kind != IR_OPND_IMM)
+        return false;
+      args[a] = i->args[a].imm;
+    }
+
+  return i->prim->folder (args, r);
+}
+
+// Returns the instruction that produces the multiple values in o, as
+// recorded in producers, or NULL if not known
+static const ir_insn_t *
+fold_producer (const ir_insn_t **producers, ir_opnd_t o)
+{
+  return o.kind == IR_OPND_TEMP ? producers[o.temp] : NULL;
+}
+
+static void fold_block (ir_block_t *, ir_opnd_t *, const ir_insn_t **,
+                        fold_stats_t *);
+
+static void
+fold_block (ir_block_t *b, ir_opnd_t *subst, const ir_insn_t **producers,
+            fold_stats_t *stats)
+{
+  ir_insn_t *i = b->first;
+
+  b->first = NULL;
+  b->last = NULL;
+  while (i)
+    {
+      ir_insn_t *next = i->next;
+      bool keep = true;
+
+      for (size_t a = 0; a < i->nargs; a++)
+        i->args[a] = ir_subst_opnd (i->args[a], subst);
+
+      switch (i->op)
+        {
+        case IR_PRIM:
+          {
+            schptr_t v;
+            if (fold_prim (i, &v))
+              {
+                subst[i->dst] = ir_opnd_imm (v);
+                stats->folded++;
+                keep = false;
+              }
+          }
+          break;
+        case IR_MOVE:
+          if (i->args[0].kind == IR_OPND_IMM)
+            {
+              subst[i->dst] = i->args[0];
+              stats->propagated++;
+              keep = false;
+            }
+          break;
+        case IR_CHECK:
+          if (i->args[0].kind == IR_OPND_IMM
+              && !(vtype_of_imm (i->args[0].imm) & ~i->prim->atype))
+            {
+              subst[i->dst] = i->args[0];
+              stats->propagated++;
+              keep = false;
+            }
+          break;
+        case IR_VALUES:
+          producers[i->dst] = i;
+          break;
+        case IR_RECEIVE:
+          {
+            const ir_insn_t *v = fold_producer (producers, i->args[0]);
+            if ((v && v->nargs == i->index)
+                || (i->args[0].kind == IR_OPND_IMM && i->index == 1))
+              {
+                subst[i->dst] = i->args[0];
+                stats->propagated++;
+                keep = false;
+              }
+          }
+          break;
+        case IR_VREF:
+          {
+            const ir_insn_t *v = fold_producer (producers, i->args[0]);
+            if (v && i->index < v->nargs)
+              subst[i->dst] = v->args[i->index];
+            else if (i->args[0].kind == IR_OPND_IMM && i->index == 0)
+              subst[i->dst] = i->args[0];
+            else
+              break;
+            stats->propagated++;
+            keep = false;
+          }
+          break;
+        case IR_CLOSURE:
+        case IR_FREF:
+        case IR_CALL:
+        case IR_CALL_KNOWN:
+        case IR_CALL_VALUES:
+        case IR_CONTINUE:
+        case IR_DATA:
+          break;
+        case IR_LOOP:
+          fold_block (i->body, subst, producers, stats);
+          break;
+        case IR_SWITCH:
+          if (i->args[0].kind == IR_OPND_IMM)
+            {
+              ir_block_t *taken = ir_switch_arm (i, i->args[0].imm);
+              fold_block (taken, subst, producers, stats);
+              ir_block_splice (b, taken);
+              subst[i->dst] = taken->result;
+              stats->branches++;
+              keep = false;
+            }
+          else
+            for (size_t k = 0; k < i->narms; k++)
+              fold_block (i->arms[k], subst, producers, stats);
+          break;
+        case IR_IF:
+          if (i->args[0].kind == IR_OPND_IMM)
+            {
+              // Only #f is false, every other constant takes the then arm
+              ir_block_t *taken = sch_imm_false_p (i->args[0].imm)
+                                      ? i->elseb
+                                      : i->thenb;
+              fold_block (taken, subst, producers, stats);
+              ir_block_splice (b, taken);
+              subst[i->dst] = taken->result;
+              stats->branches++;
+              keep = false;
+            }
+          else
+            {
+              fold_block (i->thenb, subst, producers, stats);
+              fold_block (i->elseb, subst, producers, stats);
+            }
+          break;
+        }
+
+      if (keep)
+        ir_block_append (b, i);
+      else
+        ir_free_insn (i);
+
+      i = next;
+    }
+
+  b->result = ir_subst_opnd (b->result, subst);
+}
+
+void
+pass_fold (ir_proc_t *p)
+{
+  fold_stats_t stats = { 0, 0, 0 };
+  ir_opnd_t *subst = ir_make_subst (p);
+  const ir_insn_t **producers
+      = alloc ((p->ntemps + 1) * sizeof (*producers));
+
+  for (size_t t = 0; t < p->ntemps; t++)
+    producers[t] = NULL;
+  fold_block (p->body, subst, producers, &stats);
+
+  pass_record_stat ("fold", "primitives folded", stats.folded);
+  pass_record_stat ("fold", "constants propagated", stats.propagated);
+  pass_record_stat ("fold", "branches folded", stats.branches);
+
+  free (producers);
+  free (subst);
+}
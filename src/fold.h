@@ -0,0 +1,65 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "structs.h"
+
+// Primitive folder prototypes
+//
+// Each folder computes, from the tagged values of constant arguments, the
+// exact tagged value that the code produced by the corresponding emitter
+// would compute at runtime. They return false when they cannot fold.
+// Primitives with more than FOLD_ARGS_MAX arguments are never folded.
+#define FOLD_ARGS_MAX 8
+
+bool fold_prim_fxadd1 (const schptr_t *, schptr_t *);
+bool fold_prim_fxsub1 (const schptr_t *, schptr_t *);
+bool fold_prim_fxzerop (const schptr_t *, schptr_t *);
+bool fold_prim_char_to_fixnum (const schptr_t *, schptr_t *);
+bool fold_prim_fixnum_to_char (const schptr_t *, schptr_t *);
+bool fold_prim_nullp (const schptr_t *, schptr_t *);
+bool fold_prim_fixnump (const schptr_t *, schptr_t *);
+bool fold_prim_booleanp (const schptr_t *, schptr_t *);
+bool fold_prim_charp (const schptr_t *, schptr_t *);
+bool fold_prim_not (const schptr_t *, schptr_t *);
+bool fold_prim_fxlognot (const schptr_t *, schptr_t *);
+bool fold_prim_fxadd (const schptr_t *, schptr_t *);
+bool fold_prim_fxsub (const schptr_t *, schptr_t *);
+bool fold_prim_fxmul (const schptr_t *, schptr_t *);
+bool fold_prim_fxlogand (const schptr_t *, schptr_t *);
+bool fold_prim_fxlogor (const schptr_t *, schptr_t *);
+bool fold_prim_fxlogxor (const schptr_t *, schptr_t *);
+bool fold_prim_fxash (const schptr_t *, schptr_t *);
+bool fold_prim_fxbit_count (const schptr_t *, schptr_t *);
+bool fold_prim_fxlength (const schptr_t *, schptr_t *);
+bool fold_prim_fxfirst_bit_set (const schptr_t *, schptr_t *);
+bool fold_prim_fxquotient (const schptr_t *, schptr_t *);
+bool fold_prim_fxremainder (const schptr_t *, schptr_t *);
+bool fold_prim_fxmodulo (const schptr_t *, schptr_t *);
+bool fold_prim_add (const schptr_t *, schptr_t *);
+bool fold_prim_sub (const schptr_t *, schptr_t *);
+bool fold_prim_mul (const schptr_t *, schptr_t *);
+bool fold_prim_fxeq (const schptr_t *, schptr_t *);
+bool fold_prim_fxlt (const schptr_t *, schptr_t *);
+bool fold_prim_fxle (const schptr_t *, schptr_t *);
+bool fold_prim_fxgt (const schptr_t *, schptr_t *);
+bool fold_prim_fxge (const schptr_t *, schptr_t *);
+bool fold_prim_chareq (const schptr_t *, schptr_t *);
+bool fold_prim_charlt (const schptr_t *, schptr_t *);
+bool fold_prim_charle (const schptr_t *, schptr_t *);
+bool fold_prim_chargt (const schptr_t *, schptr_t *);
+bool fold_prim_charge (const schptr_t *, schptr_t *);
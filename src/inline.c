@@ -0,0 +1,131 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Inlining
+//
+// Replaces direct calls to small known procedures by a copy of their
+// body, in which their parameters are the operands of the call, and
+// whose value is moved to the destination of the call. The size of a
+// procedure is the number of instructions in its body, arms of
+// conditionals and switches and bodies of loops included, and only
+// procedures up to INLINE_SIZE_MAX are inlined, which bounds the growth
+// of the code. The copies are not inlined into in turn, so a recursive
+// procedure is unrolled at most once per call.
+//
+///////////////////////////////////////////////////////////////////////
+
+#define INLINE_SIZE_MAX 16
+
+typedef struct inliner
+{
+  ir_program_t *prog;
+  size_t self; // procedure being inlined into
+  size_t inlined;
+} inliner_t;
+
+// Returns the size of block b, or INLINE_SIZE_MAX + 1 if it uses the
+// closure, which a known procedure has no value for
+static size_t
+inline_size (const ir_block_t *b)
+{
+  size_t n = 0;
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      for (size_t a = 0; a < i->nargs; a++)
+        if (i->args[a].kind == IR_OPND_TEMP && i->args[a].temp == 0)
+          return INLINE_SIZE_MAX + 1;
+
+      n++;
+      if (i->op == IR_IF)
+        n += inline_size (i->thenb) + inline_size (i->elseb);
+      if (i->op == IR_LOOP)
+        n += inline_size (i->body);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          n += inline_size (i->arms[k]);
+    }
+  return n;
+}
+
+static void
+inline_block (inliner_t *s, ir_block_t *b)
+{
+  ir_proc_t *p = s->prog->procs[s->self];
+  ir_insn_t *i = b->first;
+
+  b->first = NULL;
+  b->last = NULL;
+  while (i)
+    {
+      ir_insn_t *next = i->next;
+
+      if (i->op == IR_IF)
+        {
+          inline_block (s, i->thenb);
+          inline_block (s, i->elseb);
+        }
+      if (i->op == IR_LOOP)
+        inline_block (s, i->body);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          inline_block (s, i->arms[k]);
+
+      const ir_proc_t *q = NULL;
+      if (i->op == IR_CALL_KNOWN && i->proc != s->self)
+        q = s->prog->procs[i->proc];
+
+      if (!q || q->nparams != i->nargs + 1
+          || inline_size (q->body) > INLINE_SIZE_MAX)
+        {
+          ir_block_append (b, i);
+          i = next;
+          continue;
+        }
+
+      ir_opnd_t *map = ir_make_subst (q);
+      for (size_t a = 0; a < i->nargs; a++)
+        map[a + 1] = i->args[a];
+      ir_block_append_copy (p, q, q->body, b, map);
+
+      ir_insn_t *m = ir_make_insn (IR_MOVE, i->dst, 1);
+      m->args[0] = ir_subst_opnd (q->body->result, map);
+      ir_block_append (b, m);
+
+      free (map);
+      ir_free_insn (i);
+      s->inlined++;
+      i = next;
+    }
+}
+
+void
+pass_inline (ir_program_t *prog)
+{
+  inliner_t s;
+  s.prog = prog;
+  s.inlined = 0;
+
+  for (s.self = 0; s.self < prog->nprocs; s.self++)
+    inline_block (&s, prog->procs[s.self]->body);
+
+  pass_record_stat ("inline", "calls inlined", s.inlined);
+}
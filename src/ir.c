@@ -0,0 +1,618 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ir.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+#include "memory.h"
+
+//
+// Operands
+//
+
+ir_opnd_t
+ir_opnd_temp (size_t t)
+{
+  ir_opnd_t o = { .kind = IR_OPND_TEMP, .temp = t };
+  return o;
+}
+
+ir_opnd_t
+ir_opnd_imm (schptr_t imm)
+{
+  ir_opnd_t o = { .kind = IR_OPND_IMM, .imm = imm };
+  return o;
+}
+
+bool
+ir_opnd_eq (ir_opnd_t a, ir_opnd_t b)
+{
+  if (a.kind != b.kind)
+    return false;
+
+  switch (a.kind)
+    {
+    case IR_OPND_NONE:
+      return true;
+    case IR_OPND_TEMP:
+      return a.temp == b.temp;
+    case IR_OPND_IMM:
+      return a.imm == b.imm;
+    }
+  err_unreachable ("unknown operand kind");
+}
+
+//
+// Construction
+//
+
+// ir_make_program: creates a program with an empty body
+ir_program_t *
+ir_make_program (void)
+{
+  ir_program_t *p = alloc (sizeof *p);
+  p->nprocs = 0;
+  p->procs_cap = 0;
+  p->procs = NULL;
+  p->ndata = 0;
+  p->data_cap = 0;
+  p->data = NULL;
+  (void)ir_program_add_proc (p, ir_make_proc ());
+  return p;
+}
+
+ir_proc_t *
+ir_make_proc (void)
+{
+  ir_proc_t *p = alloc (sizeof *p);
+  p->body = ir_make_block ();
+  p->nparams = 0;
+  p->ntemps = 0;
+  p->temps_cap = 0;
+  p->temps = NULL;
+  return p;
+}
+
+// ir_program_add_proc: adds procedure q to p, returning its index
+size_t
+ir_program_add_proc (ir_program_t *p, ir_proc_t *q)
+{
+  if (p->nprocs == p->procs_cap)
+    {
+      p->procs_cap = p->procs_cap ? 2 * p->procs_cap : 8;
+      p->procs = grow (p->procs, p->procs_cap * sizeof (*p->procs));
+    }
+
+  p->procs[p->nprocs] = q;
+  return p->nprocs++;
+}
+
+// ir_program_add_data: adds to p the static object of type made of the
+// nwords words, unless it has an equal one already, and returns it
+const ir_data_t *
+ir_program_add_data (ir_program_t *p, vtype_t type, const uint64_t *words,
+                     size_t nwords)
+{
+  for (size_t k = 0; k < p->ndata; k++)
+    if (p->data[k]->type == type && p->data[k]->nwords == nwords
+        && !memcmp (p->data[k]->words, words, nwords * sizeof (*words)))
+      return p->data[k];
+
+  if (p->ndata == p->data_cap)
+    {
+      p->data_cap = p->data_cap ? 2 * p->data_cap : 8;
+      p->data = grow (p->data, p->data_cap * sizeof (*p->data));
+    }
+
+  ir_data_t *d = alloc (sizeof *d);
+  d->index = p->ndata;
+  d->type = type;
+  d->nwords = nwords;
+  d->words = alloc (nwords * sizeof (*words));
+  memcpy (d->words, words, nwords * sizeof (*words));
+  p->data[p->ndata++] = d;
+  return d;
+}
+
+ir_block_t *
+ir_make_block (void)
+{
+  ir_block_t *b = alloc (sizeof *b);
+  b->first = NULL;
+  b->last = NULL;
+  b->result.kind = IR_OPND_NONE;
+  return b;
+}
+
+// ir_new_temp: creates a new temporary in p, optionally named after the
+// source identifier it was bound to
+size_t
+ir_new_temp (ir_proc_t *p, const char *name)
+{
+  if (p->ntemps == p->temps_cap)
+    {
+      p->temps_cap = p->temps_cap ? 2 * p->temps_cap : 16;
+      p->temps = grow (p->temps, p->temps_cap * sizeof (*p->temps));
+    }
+
+  ir_temp_t *t = &p->temps[p->ntemps];
+  t->name = name ? strdup (name) : NULL;
+  if (name && !t->name)
+    err_oom ();
+  t->type = VT_ANY;
+  t->untagged = false;
+  t->reg = 0;
+
+  return p->ntemps++;
+}
+
+ir_insn_t *
+ir_make_insn (ir_op op, size_t dst, size_t nargs)
+{
+  ir_insn_t *i = alloc (sizeof *i);
+  i->op = op;
+  i->dst = dst;
+  i->prim = NULL;
+  i->nargs = nargs;
+  i->args = NULL;
+  if (nargs)
+    {
+      i->args = alloc (nargs * sizeof (*i->args));
+      for (size_t a = 0; a < nargs; a++)
+        i->args[a].kind = IR_OPND_NONE;
+    }
+  i->thenb = NULL;
+  i->elseb = NULL;
+  i->body = NULL;
+  i->narms = 0;
+  i->arms = NULL;
+  i->ncases = 0;
+  i->cases = NULL;
+  i->vars = 0;
+  i->proc = 0;
+  i->index = 0;
+  i->checked = false;
+  i->select = false;
+  i->data = NULL;
+  i->next = NULL;
+  return i;
+}
+
+void
+ir_block_append (ir_block_t *b, ir_insn_t *i)
+{
+  i->next = NULL;
+  if (!b->first)
+    b->first = i;
+  else
+    b->last->next = i;
+  b->last = i;
+}
+
+// ir_block_splice: moves the instructions of src to the end of dst
+void
+ir_block_splice (ir_block_t *dst, ir_block_t *src)
+{
+  ir_insn_t *i = src->first;
+  while (i)
+    {
+      ir_insn_t *next = i->next;
+      ir_block_append (dst, i);
+      i = next;
+    }
+  src->first = NULL;
+  src->last = NULL;
+}
+
+// ir_block_append_copy: appends to block to of procedure p a copy of the
+// instructions of block from of procedure q. With a map, which has an
+// entry per temporary of q, the temporaries the instructions define get
+// new ones in p, recorded in map, and their operands are replaced as in
+// map. Without one, the copy keeps the same temporaries, for passes that
+// only look at the copy.
+void
+ir_block_append_copy (ir_proc_t *p, const ir_proc_t *q, const ir_block_t *from,
+                      ir_block_t *to, ir_opnd_t *map)
+{
+  for (const ir_insn_t *i = from->first; i; i = i->next)
+    {
+      ir_insn_t *c = ir_make_insn (i->op, i->dst, i->nargs);
+      c->prim = i->prim;
+      c->vars = i->vars;
+      c->proc = i->proc;
+      c->index = i->index;
+      c->checked = i->checked;
+      c->select = i->select;
+      c->data = i->data;
+      for (size_t a = 0; a < i->nargs; a++)
+        c->args[a] = map ? ir_subst_opnd (i->args[a], map) : i->args[a];
+
+      if (map)
+        {
+          c->dst = ir_new_temp (p, q->temps[i->dst].name);
+          map[i->dst] = ir_opnd_temp (c->dst);
+        }
+
+      // The variables of a loop stay consecutive, and the loops that an
+      // IR_CONTINUE goes back to are found by them
+      if (map && i->op == IR_LOOP)
+        {
+          c->vars = c->dst;
+          for (size_t a = 0; a < i->nargs; a++)
+            {
+              const size_t t = ir_new_temp (p, q->temps[i->vars + a].name);
+              map[i->vars + a] = ir_opnd_temp (t);
+              if (!a)
+                c->vars = t;
+            }
+        }
+      else if (map && i->op == IR_CONTINUE
+               && map[i->vars].kind == IR_OPND_TEMP)
+        c->vars = map[i->vars].temp;
+
+      if (i->op == IR_IF)
+        {
+          c->thenb = ir_copy_block (p, q, i->thenb, map);
+          c->elseb = ir_copy_block (p, q, i->elseb, map);
+        }
+      if (i->op == IR_LOOP)
+        c->body = ir_copy_block (p, q, i->body, map);
+      if (i->op == IR_SWITCH)
+        {
+          c->narms = i->narms;
+          c->arms = alloc (i->narms * sizeof (*c->arms));
+          for (size_t k = 0; k < i->narms; k++)
+            c->arms[k] = ir_copy_block (p, q, i->arms[k], map);
+          c->ncases = i->ncases;
+          c->cases = alloc (i->ncases * sizeof (*c->cases));
+          memcpy (c->cases, i->cases, i->ncases * sizeof (*c->cases));
+        }
+
+      ir_block_append (to, c);
+    }
+}
+
+// ir_copy_block: returns a copy of block b of procedure q for procedure
+// p, see ir_block_append_copy
+ir_block_t *
+ir_copy_block (ir_proc_t *p, const ir_proc_t *q, const ir_block_t *b,
+               ir_opnd_t *map)
+{
+  ir_block_t *c = ir_make_block ();
+  ir_block_append_copy (p, q, b, c, map);
+  c->result = map ? ir_subst_opnd (b->result, map) : b->result;
+  return c;
+}
+
+// ir_switch_arm: returns the arm that switch i takes when its key is
+// value
+ir_block_t *
+ir_switch_arm (const ir_insn_t *i, schptr_t value)
+{
+  size_t lo = 0;
+  size_t hi = i->ncases;
+  while (lo < hi)
+    {
+      const size_t mid = lo + (hi - lo) / 2;
+      const schptr_t v = i->cases[mid].value;
+      if (v == value)
+        return i->arms[i->cases[mid].arm];
+      if ((int64_t)v < (int64_t)value)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return i->arms[i->narms - 1];
+}
+
+//
+// Substitutions
+//
+// Passes that replace temporaries by other operands record the
+// replacements in an array indexed by temporary. Since definitions
+// dominate their uses, walking the program in order always records a
+// replacement before any of the uses that need it.
+//
+
+ir_opnd_t *
+ir_make_subst (const ir_proc_t *p)
+{
+  ir_opnd_t *subst = alloc ((p->ntemps + 1) * sizeof (*subst));
+  for (size_t t = 0; t < p->ntemps; t++)
+    subst[t].kind = IR_OPND_NONE;
+  return subst;
+}
+
+ir_opnd_t
+ir_subst_opnd (ir_opnd_t o, const ir_opnd_t *subst)
+{
+  if (o.kind == IR_OPND_TEMP && subst[o.temp].kind != IR_OPND_NONE)
+    return subst[o.temp];
+  return o;
+}
+
+// ir_constant_p: returns true if the whole program p reduced to a
+// constant, which is then stored in v
+bool
+ir_constant_p (const ir_program_t *p, schptr_t *v)
+{
+  const ir_block_t *body = p->procs[0]->body;
+  if (body->first || body->result.kind != IR_OPND_IMM)
+    return false;
+
+  *v = body->result.imm;
+  return true;
+}
+
+//
+// Destruction
+//
+
+void
+ir_free_insn (ir_insn_t *i)
+{
+  if (i->thenb)
+    ir_free_block (i->thenb);
+  if (i->elseb)
+    ir_free_block (i->elseb);
+  if (i->body)
+    ir_free_block (i->body);
+  for (size_t k = 0; k < i->narms; k++)
+    ir_free_block (i->arms[k]);
+  free (i->arms);
+  free (i->cases);
+  free (i->args);
+  free (i);
+}
+
+void
+ir_free_block (ir_block_t *b)
+{
+  ir_insn_t *i = b->first;
+  while (i)
+    {
+      ir_insn_t *tmp = i->next;
+      ir_free_insn (i);
+      i = tmp;
+    }
+  free (b);
+}
+
+void
+ir_free_proc (ir_proc_t *p)
+{
+  ir_free_block (p->body);
+  for (size_t t = 0; t < p->ntemps; t++)
+    free (p->temps[t].name);
+  free (p->temps);
+  free (p);
+}
+
+void
+ir_free_program (ir_program_t *p)
+{
+  for (size_t k = 0; k < p->nprocs; k++)
+    ir_free_proc (p->procs[k]);
+  free (p->procs);
+  for (size_t k = 0; k < p->ndata; k++)
+    {
+      free (p->data[k]->words);
+      free (p->data[k]);
+    }
+  free (p->data);
+  free (p);
+}
+
+//
+// Debugging
+//
+
+static void
+ir_dump_opnd (FILE *f, const ir_proc_t *p, ir_opnd_t o)
+{
+  switch (o.kind)
+    {
+    case IR_OPND_NONE:
+      fprintf (f, "<none>");
+      break;
+    case IR_OPND_TEMP:
+      if (p->temps[o.temp].name)
+        fprintf (f, "t%zu.%s", o.temp, p->temps[o.temp].name);
+      else
+        fprintf (f, "t%zu", o.temp);
+      if (p->temps[o.temp].untagged)
+        fprintf (f, ":raw");
+      if (p->temps[o.temp].reg)
+        fprintf (f, "@r%u", p->temps[o.temp].reg);
+      break;
+    case IR_OPND_IMM:
+      fprintf (f, "$0x%" PRIx64, (uint64_t)o.imm);
+      break;
+    }
+}
+
+static void
+ir_dump_block (FILE *f, const ir_proc_t *p, const ir_block_t *b,
+               unsigned int indent)
+{
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      fprintf (f, "%*s", indent, "");
+      ir_dump_opnd (f, p, ir_opnd_temp (i->dst));
+      fprintf (f, " = ");
+
+      switch (i->op)
+        {
+        case IR_PRIM:
+          fprintf (f, "%s", i->prim->name);
+          for (size_t a = 0; a < i->nargs; a++)
+            {
+              fprintf (f, " ");
+              ir_dump_opnd (f, p, i->args[a]);
+            }
+          fprintf (f, "\n");
+          break;
+        case IR_MOVE:
+          ir_dump_opnd (f, p, i->args[0]);
+          fprintf (f, "\n");
+          break;
+        case IR_CHECK:
+          fprintf (f, "check %s ", i->prim->name);
+          ir_dump_opnd (f, p, i->args[0]);
+          fprintf (f, "\n");
+          break;
+        case IR_CLOSURE:
+          fprintf (f, "closure proc%zu", i->proc);
+          for (size_t a = 0; a < i->nargs; a++)
+            {
+              fprintf (f, " ");
+              ir_dump_opnd (f, p, i->args[a]);
+            }
+          fprintf (f, "\n");
+          break;
+        case IR_FREF:
+          fprintf (f, "fref ");
+          ir_dump_opnd (f, p, i->args[0]);
+          fprintf (f, " %zu\n", i->index);
+          break;
+        case IR_CALL:
+          fprintf (f, "%s", i->checked ? "call checked" : "call");
+          for (size_t a = 0; a < i->nargs; a++)
+            {
+              fprintf (f, " ");
+              ir_dump_opnd (f, p, i->args[a]);
+            }
+          fprintf (f, "\n");
+          break;
+        case IR_CALL_KNOWN:
+          fprintf (f, "call proc%zu", i->proc);
+          for (size_t a = 0; a < i->nargs; a++)
+            {
+              fprintf (f, " ");
+              ir_dump_opnd (f, p, i->args[a]);
+            }
+          fprintf (f, "\n");
+          break;
+        case IR_IF:
+          fprintf (f, "%s ", i->select ? "select" : "if");
+          ir_dump_opnd (f, p, i->args[0]);
+          fprintf (f, "\n");
+          ir_dump_block (f, p, i->thenb, indent + 2);
+          fprintf (f, "%*selse\n", indent, "");
+          ir_dump_block (f, p, i->elseb, indent + 2);
+          break;
+        case IR_LOOP:
+        case IR_CONTINUE:
+          fprintf (f, "%s", i->op == IR_LOOP ? "loop" : "continue");
+          for (size_t a = 0; a < i->nargs; a++)
+            {
+              fprintf (f, " ");
+              ir_dump_opnd (f, p, ir_opnd_temp (i->vars + a));
+              fprintf (f, "=");
+              ir_dump_opnd (f, p, i->args[a]);
+            }
+          if (!i->nargs)
+            fprintf (f, " t%zu", i->vars);
+          fprintf (f, "\n");
+          if (i->op == IR_LOOP)
+            ir_dump_block (f, p, i->body, indent + 2);
+          break;
+        case IR_DATA:
+          fprintf (f, "data%zu\n", i->data->index);
+          break;
+        case IR_VALUES:
+          fprintf (f, "values");
+          for (size_t a = 0; a < i->nargs; a++)
+            {
+              fprintf (f, " ");
+              ir_dump_opnd (f, p, i->args[a]);
+            }
+          fprintf (f, "\n");
+          break;
+        case IR_RECEIVE:
+          fprintf (f, "%s %zu ", i->checked ? "receive checked" : "receive",
+                   i->index);
+          ir_dump_opnd (f, p, i->args[0]);
+          fprintf (f, "\n");
+          break;
+        case IR_VREF:
+          fprintf (f, "vref ");
+          ir_dump_opnd (f, p, i->args[0]);
+          fprintf (f, " %zu\n", i->index);
+          break;
+        case IR_CALL_VALUES:
+          fprintf (f, "%s ", i->checked ? "call-values checked"
+                                         : "call-values");
+          ir_dump_opnd (f, p, i->args[0]);
+          fprintf (f, " ");
+          ir_dump_opnd (f, p, i->args[1]);
+          fprintf (f, "\n");
+          break;
+        case IR_SWITCH:
+          fprintf (f, "switch ");
+          ir_dump_opnd (f, p, i->args[0]);
+          fprintf (f, "\n");
+          for (size_t k = 0; k < i->narms; k++)
+            {
+              fprintf (f, "%*s%s", indent, "",
+                       k + 1 < i->narms ? "case" : "else");
+              for (size_t c = 0; c < i->ncases; c++)
+                if (i->cases[c].arm == k)
+                  {
+                    fprintf (f, " ");
+                    ir_dump_opnd (f, p, ir_opnd_imm (i->cases[c].value));
+                  }
+              fprintf (f, "\n");
+              ir_dump_block (f, p, i->arms[k], indent + 2);
+            }
+          break;
+        }
+    }
+
+  fprintf (f, "%*s=> ", indent, "");
+  ir_dump_opnd (f, p, b->result);
+  fprintf (f, "\n");
+}
+
+void
+ir_dump (FILE *f, const ir_program_t *p)
+{
+  for (size_t k = 0; k < p->ndata; k++)
+    {
+      fprintf (f, "data%zu:", k);
+      for (size_t w = 0; w < p->data[k]->nwords; w++)
+        fprintf (f, " 0x%" PRIx64, p->data[k]->words[w]);
+      fprintf (f, "\n");
+    }
+  ir_dump_block (f, p->procs[0], p->procs[0]->body, 2);
+
+  for (size_t k = 1; k < p->nprocs; k++)
+    {
+      const ir_proc_t *q = p->procs[k];
+      fprintf (f, "proc%zu", k);
+      for (size_t t = 0; t < q->nparams; t++)
+        {
+          fprintf (f, " ");
+          ir_dump_opnd (f, q, ir_opnd_temp (t));
+        }
+      fprintf (f, ":\n");
+      ir_dump_block (f, q, q->body, 2);
+    }
+}
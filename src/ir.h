@@ -0,0 +1,222 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include "structs.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Intermediate Representation
+//
+// The IR is a structured A-normal form: a block is a linear list of
+// instructions, each defining one fresh temporary from operands that
+// are either temporaries or immediates. Control flow is only introduced
+// by IR_IF and IR_SWITCH, whose arms are nested blocks, and by IR_LOOP,
+// whose body is a nested block that IR_CONTINUE, in tail position in it,
+// goes back to the start of. Every temporary has exactly one definition,
+// so the nesting of blocks is also the dominator tree. The variables of a
+// loop are the exception: they are defined by the loop, and get new values
+// at each IR_CONTINUE.
+//
+// A program is a list of procedures, the first one being the body of the
+// program and the others the code of its lambda expressions, which get
+// their closure and then their arguments as parameters. Procedures bound
+// by letrec are also called directly, with IR_CALL_KNOWN: they then get
+// no closure, and their free variables come as extra parameters after
+// the arguments. Temporaries are numbered per procedure, and the
+// parameters are the first ones, defined on entry instead of by an
+// instruction.
+//
+///////////////////////////////////////////////////////////////////////
+
+typedef enum
+{
+  IR_OPND_NONE,
+  IR_OPND_TEMP,
+  IR_OPND_IMM
+} ir_opnd_kind;
+
+typedef struct ir_opnd
+{
+  ir_opnd_kind kind;
+  union
+  {
+    size_t temp;  // IR_OPND_TEMP
+    schptr_t imm; // IR_OPND_IMM
+  };
+} ir_opnd_t;
+
+typedef enum
+{
+  IR_PRIM,       // dst = prim (args...)
+  IR_MOVE,       // dst = args[0]
+  IR_IF,         // dst = args[0] != #f ? thenb : elseb
+  IR_CHECK,      // dst = args[0], which must have the type that prim expects
+  IR_CLOSURE,    // dst = closure of procedure proc, with free variables args
+  IR_FREF,       // dst = free variable index of the closure args[0]
+  IR_CALL,       // dst = args[0] (args[1], ...)
+  IR_CALL_KNOWN, // dst = procedure proc (args...), called directly
+  IR_LOOP,       // dst = body, with the loop variables starting as args
+  IR_CONTINUE,   // loop variables = args, and back to the start of the body
+  IR_SWITCH,     // dst = the arm of the case that args[0] is, see below
+  IR_DATA,       // dst = the static object data
+  IR_VALUES,     // dst = the values args, see below
+  IR_RECEIVE,    // dst = args[0], which must be index values
+  IR_VREF,       // dst = value index of the values args[0]
+  IR_CALL_VALUES // dst = args[0] (the values that args[1] is)
+} ir_op;
+
+struct ir_block;
+
+// A constant object of the program, laid out in the data of the output
+// as the words it is made of, instead of being allocated
+typedef struct ir_data
+{
+  size_t index; // in the data of the program
+  vtype_t type;
+  size_t nwords;
+  uint64_t *words;
+} ir_data_t;
+
+// Case of an IR_SWITCH
+typedef struct ir_case
+{
+  schptr_t value; // immediate compared to the key
+  size_t arm;     // index of the arm taken when the key is value
+} ir_case_t;
+
+typedef struct ir_insn
+{
+  ir_op op;
+  size_t dst;             // temporary defined by this instruction
+  const schprim_t *prim;  // IR_PRIM and IR_CHECK only
+  size_t nargs;           // number of operands in args
+  ir_opnd_t *args;        // operands
+  struct ir_block *thenb; // IR_IF only
+  struct ir_block *elseb; // IR_IF only
+  struct ir_block *body;  // IR_LOOP only
+  size_t narms;           // IR_SWITCH only
+  struct ir_block **arms; // IR_SWITCH only
+  size_t ncases;          // IR_SWITCH only
+  ir_case_t *cases;       // IR_SWITCH only
+  size_t vars;            // IR_LOOP and IR_CONTINUE only, see below
+  size_t proc;            // IR_CLOSURE and IR_CALL_KNOWN only
+  size_t index;           // IR_FREF, IR_RECEIVE and IR_VREF only
+  bool checked;           // IR_CALL, IR_CALL_VALUES and IR_RECEIVE only
+  bool select;            // IR_IF only, see the cmov pass
+  const ir_data_t *data;  // IR_DATA only
+  struct ir_insn *next;
+} ir_insn_t;
+
+// The variables of a loop are nargs consecutive temporaries, the first
+// one being vars, and an IR_CONTINUE names the loop it goes back to by
+// them. A loop without variables uses its destination as vars instead.
+//
+// An IR_SWITCH takes the arm of the case whose value is its key, which is
+// compared as a word, and its last arm when there is none. Its cases have
+// distinct values and are sorted by them, as signed words.
+//
+// Multiple values, other than exactly one, are a single value in the IR,
+// which IR_VALUES makes and IR_VREF takes apart, see common.h. The values
+// are kept in memory that any other multiple values would reuse, so they
+// are taken apart right after they are made or returned by a call, and
+// no pass moves an IR_VREF or IR_RECEIVE away from there. The checks pass
+// marks IR_RECEIVE as checked, and only then does it verify the number of
+// values.
+
+typedef struct ir_block
+{
+  ir_insn_t *first;
+  ir_insn_t *last;
+  ir_opnd_t result; // value of the block
+} ir_block_t;
+
+// Number of registers the temporaries are allocated to
+#define REGALLOC_REGS 5
+
+typedef struct ir_temp
+{
+  char *name;       // source name for let-bound temporaries, or NULL
+  vtype_t type;     // types the temporary may have
+  bool untagged;    // holds a fixnum with its tag bits cleared
+  unsigned int reg; // register it lives in, from 1, or 0 for its slot
+} ir_temp_t;
+
+typedef struct ir_proc
+{
+  ir_block_t *body;
+  size_t nparams; // number of parameters, including the closure
+  size_t ntemps;
+  size_t temps_cap;
+  ir_temp_t *temps;
+} ir_proc_t;
+
+typedef struct ir_program
+{
+  size_t nprocs;
+  size_t procs_cap;
+  ir_proc_t **procs; // procs[0] is the body of the program
+  size_t ndata;
+  size_t data_cap;
+  ir_data_t **data; // static objects, without duplicates
+} ir_program_t;
+
+// Operands
+ir_opnd_t ir_opnd_temp (size_t);
+ir_opnd_t ir_opnd_imm (schptr_t);
+bool ir_opnd_eq (ir_opnd_t, ir_opnd_t);
+
+// Construction
+ir_program_t *ir_make_program (void);
+ir_proc_t *ir_make_proc (void);
+size_t ir_program_add_proc (ir_program_t *, ir_proc_t *);
+const ir_data_t *ir_program_add_data (ir_program_t *, vtype_t,
+                                      const uint64_t *, size_t);
+ir_block_t *ir_make_block (void);
+size_t ir_new_temp (ir_proc_t *, const char *);
+ir_insn_t *ir_make_insn (ir_op, size_t, size_t);
+void ir_block_append (ir_block_t *, ir_insn_t *);
+void ir_block_splice (ir_block_t *, ir_block_t *);
+void ir_block_append_copy (ir_proc_t *, const ir_proc_t *, const ir_block_t *,
+                           ir_block_t *, ir_opnd_t *);
+ir_block_t *ir_copy_block (ir_proc_t *, const ir_proc_t *, const ir_block_t *,
+                           ir_opnd_t *);
+bool ir_constant_p (const ir_program_t *, schptr_t *);
+ir_block_t *ir_switch_arm (const ir_insn_t *, schptr_t);
+
+// Substitutions
+ir_opnd_t *ir_make_subst (const ir_proc_t *);
+ir_opnd_t ir_subst_opnd (ir_opnd_t, const ir_opnd_t *);
+
+// Destruction
+void ir_free_insn (ir_insn_t *);
+void ir_free_block (ir_block_t *);
+void ir_free_proc (ir_proc_t *);
+void ir_free_program (ir_program_t *);
+
+// Analysis
+vtype_t vtype_of_imm (schptr_t);
+effects_t ir_insn_effects (const ir_insn_t *);
+effects_t ir_block_effects (const ir_block_t *);
+
+// Debugging
+void ir_dump (FILE *, const ir_program_t *);
+
+// Lowering from the AST in structs.h
+ir_program_t *ir_lower (schptr_t);
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include "memory.h"
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Loop Invariant Code Motion
+//
+// Moves out of a loop, right before it, the instructions of its body
+// whose operands are all defined out of it, so that they are evaluated
+// once instead of at every iteration. The body of a loop is always
+// evaluated at least once, so this never evaluates anything that would
+// not have been. Instructions without effects are moved from anywhere in
+// the body, arms of conditionals included. Those that may raise, like
+// type checks, are only moved from the start of the body, before anything
+// observable, so that they would have raised first anyway. Instructions
+// that write or allocate stay.
+//
+// Inner loops are done first, so what is moved out of them can then move
+// out of the loops around them.
+//
+///////////////////////////////////////////////////////////////////////
+
+typedef struct licm
+{
+  bool *inside;   // temporaries defined in the loop being done
+  size_t hoisted; // number of instructions moved out of loops
+} licm_t;
+
+static void
+licm_mark (licm_t *s, const ir_block_t *b, bool inside)
+{
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      s->inside[i->dst] = inside;
+      if (i->op == IR_IF)
+        {
+          licm_mark (s, i->thenb, inside);
+          licm_mark (s, i->elseb, inside);
+        }
+      if (i->op == IR_LOOP)
+        {
+          for (size_t a = 0; a < i->nargs; a++)
+            s->inside[i->vars + a] = inside;
+          licm_mark (s, i->body, inside);
+        }
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          licm_mark (s, i->arms[k], inside);
+    }
+}
+
+static bool
+licm_invariant_p (const licm_t *s, const ir_insn_t *i)
+{
+  if (i->op != IR_PRIM && i->op != IR_MOVE && i->op != IR_CHECK
+      && i->op != IR_FREF)
+    return false;
+
+  for (size_t a = 0; a < i->nargs; a++)
+    if (i->args[a].kind == IR_OPND_TEMP && s->inside[i->args[a].temp])
+      return false;
+  return true;
+}
+
+// Moves the invariant instructions of block b, a part of the body of a
+// loop, to the end of block out. prefix_p tells if nothing observable can
+// have happened in the body before b starts, and is left telling if that
+// is still the case after it.
+static void
+licm_hoist (licm_t *s, ir_block_t *b, ir_block_t *out, bool *prefix_p)
+{
+  ir_insn_t *i = b->first;
+
+  b->first = NULL;
+  b->last = NULL;
+  while (i)
+    {
+      ir_insn_t *next = i->next;
+      const effects_t effects = ir_insn_effects (i);
+
+      if (licm_invariant_p (s, i)
+          && (effects == EFFECT_NONE
+              || (effects == EFFECT_RAISE && *prefix_p)))
+        {
+          s->inside[i->dst] = false;
+          ir_block_append (out, i);
+          s->hoisted++;
+          i = next;
+          continue;
+        }
+
+      bool arm_p = false;
+      if (i->op == IR_IF)
+        {
+          licm_hoist (s, i->thenb, out, &arm_p);
+          licm_hoist (s, i->elseb, out, &arm_p);
+        }
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          licm_hoist (s, i->arms[k], out, &arm_p);
+      if (effects & EFFECT_OBSERVABLE)
+        *prefix_p = false;
+
+      ir_block_append (b, i);
+      i = next;
+    }
+}
+
+static void
+licm_block (licm_t *s, ir_block_t *b)
+{
+  ir_insn_t *i = b->first;
+
+  b->first = NULL;
+  b->last = NULL;
+  while (i)
+    {
+      ir_insn_t *next = i->next;
+
+      if (i->op == IR_IF)
+        {
+          licm_block (s, i->thenb);
+          licm_block (s, i->elseb);
+        }
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          licm_block (s, i->arms[k]);
+      if (i->op == IR_LOOP)
+        {
+          licm_block (s, i->body);
+
+          for (size_t a = 0; a < i->nargs; a++)
+            s->inside[i->vars + a] = true;
+          licm_mark (s, i->body, true);
+
+          bool prefix_p = true;
+          licm_hoist (s, i->body, b, &prefix_p);
+
+          for (size_t a = 0; a < i->nargs; a++)
+            s->inside[i->vars + a] = false;
+          licm_mark (s, i->body, false);
+        }
+
+      ir_block_append (b, i);
+      i = next;
+    }
+}
+
+void
+pass_licm (ir_proc_t *p)
+{
+  licm_t s;
+  s.inside = alloc ((p->ntemps + 1) * sizeof (*s.inside));
+  s.hoisted = 0;
+  for (size_t t = 0; t < p->ntemps; t++)
+    s.inside[t] = false;
+
+  licm_block (&s, p->body);
+  pass_record_stat ("licm", "instructions hoisted", s.hoisted);
+
+  free (s.inside);
+}
@@ -0,0 +1,1288 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "env.h"
+#include "err.h"
+#include "ir.h"
+#include "memory.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Lowering
+//
+// Translates the parse tree into IR. Every intermediate value gets its
+// own temporary and every let binding becomes an IR_MOVE into a
+// temporary named after the identifier.
+//
+// Lambda expressions are closure converted: the code of each one becomes
+// a procedure of its own, and the expression becomes the allocation of a
+// flat closure that keeps a copy of the values of its free variables,
+// which the procedure loads from its closure on entry.
+//
+// Lambda expressions bound by letrec, or by internal definitions, are
+// known procedures instead: as there is no set!, their bindings are never
+// mutated, so calls to them are direct and need no closure. The variables
+// a known procedure needs from its environment are lambda lifted: they
+// are passed as extra arguments after the ones of the call. When the
+// extra arguments would not fit in registers, the procedures of the
+// letrec share a record with those variables instead, built once when
+// the letrec is entered, and only the record is passed. A known procedure
+// that is used as a value gets a closure of a wrapper procedure, which
+// calls it directly.
+//
+// A named let whose name is only ever called in tail position of its
+// body, and not from a lambda expression, is a loop: its variables are
+// those of an IR_LOOP and the calls go back to its start with
+// IR_CONTINUE, without any closure or call frame. Any other named let is
+// lowered as the letrec of a known procedure. do loops are named lets
+// already, see parse_do.
+//
+///////////////////////////////////////////////////////////////////////
+
+#define LOWER_NONE ((size_t)-1)
+
+// Parameters passed in registers, including the closure, see emit.c
+#define LOWER_REG_PARAMS 6
+
+typedef struct known_proc
+{
+  size_t proc;             // procedure with its code
+  size_t arity;            // number of arguments of a call
+  env_t *extras;           // variables passed after the arguments
+  size_t wrapper;          // procedure for its closures, or LOWER_NONE
+  size_t loop;             // variables of the loop it names, or LOWER_NONE
+  struct known_proc *next; // next known procedure, for freeing
+} known_proc_t;
+
+// Program being lowered, which lambda expressions add procedures to
+static ir_program_t *lower_program = NULL;
+
+// Known procedures and the aliases made for their extra arguments, which
+// live as long as the lowering
+static known_proc_t *lower_known = NULL;
+static env_t *lower_aliases = NULL;
+static size_t lower_aliases_count = 0;
+
+static ir_opnd_t lower_expr (ir_proc_t *, ir_block_t *, schptr_t, env_t *);
+static ir_opnd_t lower_known_closure (ir_proc_t *, ir_block_t *,
+                                      known_proc_t *, env_t *);
+static ir_opnd_t lower_letrec (ir_proc_t *, ir_block_t *, schlet_t *,
+                               env_t *);
+static ir_opnd_t lower_named_let (ir_proc_t *, ir_block_t *, schlet_t *,
+                                  env_t *);
+
+static size_t
+lower_length (const env_t *e)
+{
+  size_t n = 0;
+  for (; e; e = e->next)
+    n++;
+  return n;
+}
+
+static bool
+lower_lambda_p (schptr_t sptr)
+{
+  return !sch_imm_p (sptr) && *((sch_type *)sptr) == SCH_LAMBDA;
+}
+
+static ir_opnd_t
+lower_identifier (ir_proc_t *p, ir_block_t *b, schptr_t sptr, env_t *env)
+{
+  schid_t *id = (schid_t *)sptr;
+  assert (id->type == SCH_ID);
+
+  env_t *e = env_find (id, env);
+  if (e && e->known)
+    return lower_known_closure (p, b, e->known, env);
+
+  // Variables of a letrec have no temporary until they are evaluated
+  if (!e || e->temp == LOWER_NONE)
+    {
+      fprintf (stderr, "undefined variable: %.*s\n",
+               (int)strcspn (id->name, "#"), id->name);
+      exit (EXIT_FAILURE);
+    }
+
+  return ir_opnd_temp (e->temp);
+}
+
+// Lowers a constant to a reference to its static object, which the
+// program has only one of, however many times it appears
+static ir_opnd_t
+lower_const (ir_proc_t *p, ir_block_t *b, schptr_t sptr)
+{
+  schconst_t *c = (schconst_t *)sptr;
+  assert (c->type == SCH_CONST);
+
+  ir_insn_t *i = ir_make_insn (IR_DATA, ir_new_temp (p, NULL), 0);
+  i->data = ir_program_add_data (lower_program, c->vtype, c->words, c->nwords);
+  ir_block_append (b, i);
+
+  return ir_opnd_temp (i->dst);
+}
+
+static ir_opnd_t
+lower_prim_eval1 (ir_proc_t *p, ir_block_t *b, schptr_t sptr, env_t *env)
+{
+  schprim_eval1_t *pe = (schprim_eval1_t *)sptr;
+  assert (pe->type == SCH_PRIM_EVAL1);
+
+  ir_opnd_t arg1 = lower_expr (p, b, pe->arg1, env);
+
+  ir_insn_t *i = ir_make_insn (IR_PRIM, ir_new_temp (p, NULL), 1);
+  i->prim = pe->prim;
+  i->args[0] = arg1;
+  ir_block_append (b, i);
+
+  return ir_opnd_temp (i->dst);
+}
+
+static ir_opnd_t
+lower_prim_eval2 (ir_proc_t *p, ir_block_t *b, schptr_t sptr, env_t *env)
+{
+  schprim_eval2_t *pe = (schprim_eval2_t *)sptr;
+  assert (pe->type == SCH_PRIM_EVAL2);
+
+  ir_opnd_t arg1 = lower_expr (p, b, pe->arg1, env);
+  ir_opnd_t arg2 = lower_expr (p, b, pe->arg2, env);
+
+  ir_insn_t *i = ir_make_insn (IR_PRIM, ir_new_temp (p, NULL), 2);
+  i->prim = pe->prim;
+  i->args[0] = arg1;
+  i->args[1] = arg2;
+  ir_block_append (b, i);
+
+  return ir_opnd_temp (i->dst);
+}
+
+static ir_opnd_t
+lower_if (ir_proc_t *p, ir_block_t *b, schptr_t sptr, env_t *env)
+{
+  schif_t *pif = (schif_t *)sptr;
+  assert (pif->type == SCH_IF);
+
+  ir_opnd_t cond = lower_expr (p, b, pif->condition, env);
+
+  ir_block_t *thenb = ir_make_block ();
+  thenb->result = lower_expr (p, thenb, pif->thenv, env);
+
+  ir_block_t *elseb = ir_make_block ();
+  elseb->result = lower_expr (p, elseb, pif->elsev, env);
+
+  ir_insn_t *i = ir_make_insn (IR_IF, ir_new_temp (p, NULL), 1);
+  i->args[0] = cond;
+  i->thenb = thenb;
+  i->elseb = elseb;
+  ir_block_append (b, i);
+
+  return ir_opnd_temp (i->dst);
+}
+
+// Orders cases by value, and cases with the same value by arm
+static int
+lower_case_cmp (const void *x, const void *y)
+{
+  const ir_case_t *a = x;
+  const ir_case_t *c = y;
+  if (a->value != c->value)
+    return (int64_t)a->value < (int64_t)c->value ? -1 : 1;
+  return (a->arm > c->arm) - (a->arm < c->arm);
+}
+
+// A case expression is an IR_SWITCH with an arm per clause, and the else
+// arm last. A datum that is in more than one clause takes the first one.
+static ir_opnd_t
+lower_case (ir_proc_t *p, ir_block_t *b, schptr_t sptr, env_t *env)
+{
+  schcase_t *pc = (schcase_t *)sptr;
+  assert (pc->type == SCH_CASE);
+
+  ir_opnd_t key = lower_expr (p, b, pc->key, env);
+
+  size_t narms = 1;
+  size_t ncases = 0;
+  for (case_clause_list_t *c = pc->clauses; c; c = c->next, narms++)
+    for (expression_list_t *d = c->datums; d; d = d->next)
+      ncases++;
+
+  ir_block_t **arms = alloc (narms * sizeof (*arms));
+  ir_case_t *cases = alloc ((ncases + 1) * sizeof (*cases));
+  size_t k = 0;
+  ncases = 0;
+  for (case_clause_list_t *c = pc->clauses; c; c = c->next, k++)
+    {
+      for (expression_list_t *d = c->datums; d; d = d->next)
+        cases[ncases++] = (ir_case_t){ .value = d->expr, .arm = k };
+
+      arms[k] = ir_make_block ();
+      arms[k]->result = lower_expr (p, arms[k], c->body, env);
+    }
+  arms[k] = ir_make_block ();
+  arms[k]->result = lower_expr (p, arms[k], pc->elsev, env);
+
+  qsort (cases, ncases, sizeof (*cases), lower_case_cmp);
+  size_t n = 0;
+  for (size_t c = 0; c < ncases; c++)
+    if (!n || cases[n - 1].value != cases[c].value)
+      cases[n++] = cases[c];
+
+  ir_insn_t *i = ir_make_insn (IR_SWITCH, ir_new_temp (p, NULL), 1);
+  i->args[0] = key;
+  i->narms = narms;
+  i->arms = arms;
+  i->ncases = n;
+  i->cases = cases;
+  ir_block_append (b, i);
+
+  return ir_opnd_temp (i->dst);
+}
+
+static ir_opnd_t
+lower_let (ir_proc_t *p, ir_block_t *b, schptr_t sptr, env_t *env)
+{
+  schlet_t *let = (schlet_t *)sptr;
+  assert (let->type == SCH_LET);
+
+  if (let->name)
+    return lower_named_let (p, b, let, env);
+  if (let->rec_p)
+    return lower_letrec (p, b, let, env);
+
+  // Each binding is moved into its own named temporary. In a let* later
+  // bindings already see the earlier ones.
+  env_t *nenv = env;
+  for (binding_spec_list_t *bs = let->bindings; bs != NULL; bs = bs->next)
+    {
+      ir_opnd_t v = lower_expr (p, b, bs->expr, let->star_p ? nenv : env);
+
+      ir_insn_t *i = ir_make_insn (IR_MOVE, ir_new_temp (p, bs->id->name), 1);
+      i->args[0] = v;
+      ir_block_append (b, i);
+
+      nenv = env_add (bs->id, i->dst, nenv);
+    }
+
+  ir_opnd_t r = lower_expr (p, b, let->body, nenv);
+  free_env_partial (nenv, env, /*shallow=*/true);
+  return r;
+}
+
+static ir_opnd_t
+lower_expr_seq (ir_proc_t *p, ir_block_t *b, schptr_t sptr, env_t *env)
+{
+  schexprseq_t *seq = (schexprseq_t *)sptr;
+  assert (seq->type == SCH_EXPR_SEQ);
+
+  ir_opnd_t r = { .kind = IR_OPND_NONE };
+  for (expression_list_t *s = seq->seq; s; s = s->next)
+    r = lower_expr (p, b, s->expr, env);
+
+  return r;
+}
+
+static ir_opnd_t
+lower_values (ir_proc_t *p, ir_block_t *b, schptr_t sptr, env_t *env)
+{
+  schvalues_t *v = (schvalues_t *)sptr;
+  assert (v->type == SCH_VALUES);
+
+  size_t nargs = 0;
+  for (expression_list_t *e = v->args; e; e = e->next)
+    nargs++;
+
+  ir_insn_t *i = ir_make_insn (IR_VALUES, 0, nargs);
+  nargs = 0;
+  for (expression_list_t *e = v->args; e; e = e->next)
+    i->args[nargs++] = lower_expr (p, b, e->expr, env);
+
+  i->dst = ir_new_temp (p, NULL);
+  ir_block_append (b, i);
+  return ir_opnd_temp (i->dst);
+}
+
+// Each formal of a receive is moved into its own named temporary, like
+// the variables of a let. When the expression is a values of as many
+// expressions, the formals get them as they are, and otherwise they are
+// taken apart from the values right after these are made.
+static ir_opnd_t
+lower_receive (ir_proc_t *p, ir_block_t *b, schptr_t sptr, env_t *env)
+{
+  schreceive_t *r = (schreceive_t *)sptr;
+  assert (r->type == SCH_RECEIVE);
+
+  size_t n = 0;
+  for (expression_list_t *f = r->formals; f; f = f->next)
+    n++;
+
+  schvalues_t *v = (schvalues_t *)r->expr;
+  expression_list_t *arg = NULL;
+  if (sch_ptr_p (r->expr) && v->type == SCH_VALUES)
+    {
+      size_t nargs = 0;
+      for (expression_list_t *e = v->args; e; e = e->next)
+        nargs++;
+      if (nargs == n)
+        arg = v->args;
+    }
+
+  ir_opnd_t values = { .kind = IR_OPND_NONE };
+  if (!arg)
+    {
+      ir_insn_t *i = ir_make_insn (IR_RECEIVE, ir_new_temp (p, NULL), 1);
+      i->args[0] = lower_expr (p, b, r->expr, env);
+      i->index = n;
+      ir_block_append (b, i);
+      values = ir_opnd_temp (i->dst);
+    }
+
+  ir_opnd_t *args = alloc ((n + 1) * sizeof (*args));
+  n = 0;
+  for (; arg; arg = arg->next)
+    args[n++] = lower_expr (p, b, arg->expr, env);
+
+  env_t *nenv = env;
+  n = 0;
+  for (expression_list_t *f = r->formals; f; f = f->next, n++)
+    {
+      schid_t *id = (schid_t *)f->expr;
+      ir_insn_t *i;
+      if (values.kind == IR_OPND_NONE)
+        {
+          i = ir_make_insn (IR_MOVE, ir_new_temp (p, id->name), 1);
+          i->args[0] = args[n];
+        }
+      else
+        {
+          i = ir_make_insn (IR_VREF, ir_new_temp (p, id->name), 1);
+          i->args[0] = values;
+          i->index = n;
+        }
+      ir_block_append (b, i);
+
+      nenv = env_add (id, i->dst, nenv);
+    }
+  free (args);
+
+  ir_opnd_t result = lower_expr (p, b, r->body, nenv);
+  free_env_partial (nenv, env, /*shallow=*/true);
+  return result;
+}
+
+// The producer is called without arguments, and the consumer with the
+// values it returns
+static ir_opnd_t
+lower_call_values (ir_proc_t *p, ir_block_t *b, schptr_t sptr, env_t *env)
+{
+  schcallvalues_t *cv = (schcallvalues_t *)sptr;
+  assert (cv->type == SCH_CALL_VALUES);
+
+  ir_opnd_t producer = lower_expr (p, b, cv->producer, env);
+  ir_opnd_t consumer = lower_expr (p, b, cv->consumer, env);
+
+  ir_insn_t *call = ir_make_insn (IR_CALL, ir_new_temp (p, NULL), 1);
+  call->args[0] = producer;
+  ir_block_append (b, call);
+
+  ir_insn_t *i = ir_make_insn (IR_CALL_VALUES, ir_new_temp (p, NULL), 2);
+  i->args[0] = consumer;
+  i->args[1] = ir_opnd_temp (call->dst);
+  ir_block_append (b, i);
+  return ir_opnd_temp (i->dst);
+}
+
+// Adds to fv the variables referenced in expression sptr that are bound
+// neither in it nor in bound
+static void
+lower_free_vars (schptr_t sptr, env_t *bound, env_t **fv)
+{
+  if (sch_imm_p (sptr))
+    return;
+
+  size_t temp;
+  switch (*((sch_type *)sptr))
+    {
+    case SCH_ID:
+      {
+        schid_t *id = (schid_t *)sptr;
+        if (!env_ref (id, bound, &temp) && !env_ref (id, *fv, &temp))
+          *fv = env_add (id, 0, *fv);
+      }
+      break;
+    case SCH_PRIM_EVAL1:
+      lower_free_vars (((schprim_eval1_t *)sptr)->arg1, bound, fv);
+      break;
+    case SCH_PRIM_EVAL2:
+      lower_free_vars (((schprim_eval2_t *)sptr)->arg1, bound, fv);
+      lower_free_vars (((schprim_eval2_t *)sptr)->arg2, bound, fv);
+      break;
+    case SCH_IF:
+      {
+        schif_t *pif = (schif_t *)sptr;
+        lower_free_vars (pif->condition, bound, fv);
+        lower_free_vars (pif->thenv, bound, fv);
+        lower_free_vars (pif->elsev, bound, fv);
+      }
+      break;
+    case SCH_CASE:
+      {
+        schcase_t *pc = (schcase_t *)sptr;
+        lower_free_vars (pc->key, bound, fv);
+        for (case_clause_list_t *c = pc->clauses; c; c = c->next)
+          lower_free_vars (c->body, bound, fv);
+        lower_free_vars (pc->elsev, bound, fv);
+      }
+      break;
+    case SCH_LET:
+      {
+        schlet_t *let = (schlet_t *)sptr;
+        env_t *nbound = bound;
+        if (let->rec_p)
+          for (binding_spec_list_t *bs = let->bindings; bs; bs = bs->next)
+            nbound = env_add (bs->id, 0, nbound);
+        for (binding_spec_list_t *bs = let->bindings; bs; bs = bs->next)
+          {
+            lower_free_vars (bs->expr,
+                             let->star_p || let->rec_p ? nbound : bound, fv);
+            if (!let->rec_p)
+              nbound = env_add (bs->id, 0, nbound);
+          }
+        if (let->name)
+          nbound = env_add (let->name, 0, nbound);
+        lower_free_vars (let->body, nbound, fv);
+        free_env_partial (nbound, bound, /*shallow=*/true);
+      }
+      break;
+    case SCH_EXPR_SEQ:
+      for (expression_list_t *e = ((schexprseq_t *)sptr)->seq; e;
+           e = e->next)
+        lower_free_vars (e->expr, bound, fv);
+      break;
+    case SCH_LAMBDA:
+      {
+        schlambda_t *lam = (schlambda_t *)sptr;
+        env_t *nbound = bound;
+        for (expression_list_t *e = lam->formals; e; e = e->next)
+          nbound = env_add ((schid_t *)e->expr, 0, nbound);
+        lower_free_vars (lam->body, nbound, fv);
+        free_env_partial (nbound, bound, /*shallow=*/true);
+      }
+      break;
+    case SCH_CALL:
+      lower_free_vars (((schcall_t *)sptr)->op, bound, fv);
+      for (expression_list_t *e = ((schcall_t *)sptr)->args; e; e = e->next)
+        lower_free_vars (e->expr, bound, fv);
+      break;
+    case SCH_VALUES:
+      for (expression_list_t *e = ((schvalues_t *)sptr)->args; e;
+           e = e->next)
+        lower_free_vars (e->expr, bound, fv);
+      break;
+    case SCH_RECEIVE:
+      {
+        schreceive_t *r = (schreceive_t *)sptr;
+        lower_free_vars (r->expr, bound, fv);
+        env_t *nbound = bound;
+        for (expression_list_t *e = r->formals; e; e = e->next)
+          nbound = env_add ((schid_t *)e->expr, 0, nbound);
+        lower_free_vars (r->body, nbound, fv);
+        free_env_partial (nbound, bound, /*shallow=*/true);
+      }
+      break;
+    case SCH_CALL_VALUES:
+      lower_free_vars (((schcallvalues_t *)sptr)->producer, bound, fv);
+      lower_free_vars (((schcallvalues_t *)sptr)->consumer, bound, fv);
+      break;
+    default:
+      break;
+    }
+}
+
+static ir_opnd_t
+lower_lambda (ir_proc_t *p, ir_block_t *b, schptr_t sptr, env_t *env)
+{
+  schlambda_t *lam = (schlambda_t *)sptr;
+  assert (lam->type == SCH_LAMBDA);
+
+  // The closure comes first, then the arguments
+  ir_proc_t *q = ir_make_proc ();
+  const size_t self = ir_new_temp (q, NULL);
+  env_t *qenv = make_env ();
+  for (expression_list_t *e = lam->formals; e; e = e->next)
+    {
+      schid_t *id = (schid_t *)e->expr;
+      qenv = env_add (id, ir_new_temp (q, id->name), qenv);
+    }
+  q->nparams = q->ntemps;
+
+  env_t *fv = make_env ();
+  lower_free_vars (lam->body, qenv, &fv);
+
+  // Known procedures are not captured, the extra arguments to call them
+  // are, and they stay known in the procedure
+  env_t *captured = make_env ();
+  env_t *known = make_env ();
+  for (env_t *e = fv; e; e = e->next)
+    {
+      env_t *k = env_find (e->id, env);
+      if (!k || !k->known)
+        {
+          captured = env_add (e->id, 0, captured);
+          continue;
+        }
+
+      known = env_add (e->id, LOWER_NONE, known);
+      known->known = k->known;
+      for (env_t *x = k->known->extras; x; x = x->next)
+        if (!env_find (x->id, captured))
+          captured = env_add (x->id, 0, captured);
+    }
+
+  size_t nfree = 0;
+  for (env_t *e = captured; e; e = e->next)
+    {
+      ir_insn_t *i = ir_make_insn (IR_FREF, ir_new_temp (q, e->id->name), 1);
+      i->args[0] = ir_opnd_temp (self);
+      i->index = nfree++;
+      ir_block_append (q->body, i);
+
+      qenv = env_add (e->id, i->dst, qenv);
+    }
+  for (env_t *e = known; e; e = e->next)
+    {
+      qenv = env_add (e->id, LOWER_NONE, qenv);
+      qenv->known = e->known;
+    }
+
+  q->body->result = lower_expr (q, q->body, lam->body, qenv);
+  free_env_partial (qenv, NULL, /*shallow=*/true);
+
+  ir_insn_t *i = ir_make_insn (IR_CLOSURE, ir_new_temp (p, NULL), nfree);
+  i->proc = ir_program_add_proc (lower_program, q);
+  nfree = 0;
+  for (env_t *e = captured; e; e = e->next)
+    i->args[nfree++] = lower_identifier (p, b, (schptr_t)e->id, env);
+  ir_block_append (b, i);
+
+  free_env_partial (fv, NULL, /*shallow=*/true);
+  free_env_partial (captured, NULL, /*shallow=*/true);
+  free_env_partial (known, NULL, /*shallow=*/true);
+  return ir_opnd_temp (i->dst);
+}
+
+static ir_opnd_t
+lower_call (ir_proc_t *p, ir_block_t *b, schptr_t sptr, env_t *env)
+{
+  schcall_t *call = (schcall_t *)sptr;
+  assert (call->type == SCH_CALL);
+
+  size_t nargs = 1;
+  for (expression_list_t *e = call->args; e; e = e->next)
+    nargs++;
+
+  // Calls to a known procedure with the right number of arguments are
+  // direct, the others go through its closure and fail there. Calls to a
+  // loop go back to its start.
+  if (!sch_imm_p (call->op) && *((sch_type *)call->op) == SCH_ID)
+    {
+      env_t *k = env_find ((schid_t *)call->op, env);
+      if (k && k->known && k->known->loop != LOWER_NONE)
+        {
+          ir_insn_t *i = ir_make_insn (IR_CONTINUE, 0, nargs - 1);
+          i->vars = k->known->loop;
+          nargs = 0;
+          for (expression_list_t *e = call->args; e; e = e->next)
+            i->args[nargs++] = lower_expr (p, b, e->expr, env);
+
+          i->dst = ir_new_temp (p, NULL);
+          ir_block_append (b, i);
+          return ir_opnd_temp (i->dst);
+        }
+      if (k && k->known && k->known->arity == nargs - 1)
+        {
+          ir_insn_t *i = ir_make_insn (
+              IR_CALL_KNOWN, 0, nargs - 1 + lower_length (k->known->extras));
+          i->proc = k->known->proc;
+          nargs = 0;
+          for (expression_list_t *e = call->args; e; e = e->next)
+            i->args[nargs++] = lower_expr (p, b, e->expr, env);
+          for (env_t *x = k->known->extras; x; x = x->next)
+            i->args[nargs++] = lower_identifier (p, b, (schptr_t)x->id, env);
+
+          i->dst = ir_new_temp (p, NULL);
+          ir_block_append (b, i);
+          return ir_opnd_temp (i->dst);
+        }
+    }
+
+  ir_insn_t *i = ir_make_insn (IR_CALL, 0, nargs);
+  i->args[0] = lower_expr (p, b, call->op, env);
+  nargs = 1;
+  for (expression_list_t *e = call->args; e; e = e->next)
+    i->args[nargs++] = lower_expr (p, b, e->expr, env);
+
+  i->dst = ir_new_temp (p, NULL);
+  ir_block_append (b, i);
+
+  return ir_opnd_temp (i->dst);
+}
+
+// Lowers a use of the known procedure k as a value, which needs a
+// closure: the closure is one of a wrapper procedure, made the first time
+// it is needed, that keeps the extra arguments as free variables and
+// calls k directly
+static ir_opnd_t
+lower_known_closure (ir_proc_t *p, ir_block_t *b, known_proc_t *k,
+                     env_t *env)
+{
+  const size_t nextras = lower_length (k->extras);
+
+  if (k->wrapper == LOWER_NONE)
+    {
+      ir_proc_t *w = ir_make_proc ();
+      const size_t self = ir_new_temp (w, NULL);
+      for (size_t a = 0; a < k->arity; a++)
+        (void)ir_new_temp (w, NULL);
+      w->nparams = w->ntemps;
+
+      ir_insn_t *call = ir_make_insn (IR_CALL_KNOWN, 0, k->arity + nextras);
+      call->proc = k->proc;
+      for (size_t a = 0; a < k->arity; a++)
+        call->args[a] = ir_opnd_temp (a + 1);
+
+      size_t x = 0;
+      for (env_t *e = k->extras; e; e = e->next, x++)
+        {
+          ir_insn_t *i
+              = ir_make_insn (IR_FREF, ir_new_temp (w, e->id->name), 1);
+          i->args[0] = ir_opnd_temp (self);
+          i->index = x;
+          ir_block_append (w->body, i);
+          call->args[k->arity + x] = ir_opnd_temp (i->dst);
+        }
+
+      call->dst = ir_new_temp (w, NULL);
+      ir_block_append (w->body, call);
+      w->body->result = ir_opnd_temp (call->dst);
+      k->wrapper = ir_program_add_proc (lower_program, w);
+    }
+
+  ir_insn_t *i = ir_make_insn (IR_CLOSURE, ir_new_temp (p, NULL), nextras);
+  i->proc = k->wrapper;
+  size_t x = 0;
+  for (env_t *e = k->extras; e; e = e->next)
+    i->args[x++] = lower_identifier (p, b, (schptr_t)e->id, env);
+  ir_block_append (b, i);
+
+  return ir_opnd_temp (i->dst);
+}
+
+// Alias of a variable that the known procedures of a letrec use, which
+// is how they refer to it in their extra arguments: unlike its name, the
+// alias cannot be shadowed by a binding between the letrec and a call
+typedef struct lower_alias
+{
+  env_t *var;   // binding of the variable in the scope of the letrec
+  env_t *alias; // binding of the alias, to the same temporary
+  struct lower_alias *next;
+} lower_alias_t;
+
+// Makes an identifier for a variable named name that no identifier in
+// the source can be equal to, since they cannot contain a #
+static schid_t *
+lower_new_alias (const char *name)
+{
+  const size_t len = strlen (name) + 24;
+  schid_t *id = alloc (sizeof (*id));
+  id->type = SCH_ID;
+  id->name = alloc (len);
+  snprintf (id->name, len, "%s#%zu", name, lower_aliases_count++);
+
+  lower_aliases = env_add (id, 0, lower_aliases);
+  return id;
+}
+
+static schid_t *
+lower_alias_of (lower_alias_t **aliases, env_t *var)
+{
+  for (lower_alias_t *a = *aliases; a; a = a->next)
+    if (a->var == var)
+      return a->alias->id;
+
+  lower_alias_t *a = alloc (sizeof (*a));
+  a->var = var;
+  a->alias = env_add (lower_new_alias (var->id->name), var->temp, NULL);
+  a->next = *aliases;
+  *aliases = a;
+  return a->alias->id;
+}
+
+// Adds id to the extra arguments of k. Returns true if it was not one.
+static bool
+lower_add_extra (known_proc_t *k, schid_t *id)
+{
+  if (env_find (id, k->extras))
+    return false;
+
+  k->extras = env_add (id, 0, k->extras);
+  return true;
+}
+
+// Lowers the body of the known procedure k, the lambda expression lam
+// with free variables fv, bound in the scope senv of a letrec. If record
+// is not NULL, the only extra argument is the record with the variables
+// in shared.
+static void
+lower_known_body (known_proc_t *k, schlambda_t *lam, env_t *fv,
+                  env_t *senv, lower_alias_t **aliases, schid_t *record,
+                  env_t *shared)
+{
+  ir_proc_t *q = lower_program->procs[k->proc];
+
+  // Known procedures are called without a closure, but they still have
+  // the parameter for it so that their arguments come where they would
+  (void)ir_new_temp (q, NULL);
+  env_t *qenv = make_env ();
+  for (expression_list_t *e = lam->formals; e; e = e->next)
+    {
+      schid_t *id = (schid_t *)e->expr;
+      qenv = env_add (id, ir_new_temp (q, id->name), qenv);
+    }
+  for (env_t *x = k->extras; x; x = x->next)
+    qenv = env_add (x->id, ir_new_temp (q, x->id->name), qenv);
+  q->nparams = q->ntemps;
+
+  if (record)
+    {
+      const size_t rec = qenv->temp;
+      size_t index = 0;
+      for (env_t *e = shared; e; e = e->next)
+        {
+          ir_insn_t *i
+              = ir_make_insn (IR_FREF, ir_new_temp (q, e->id->name), 1);
+          i->args[0] = ir_opnd_temp (rec);
+          i->index = index++;
+          ir_block_append (q->body, i);
+
+          qenv = env_add (e->id, i->dst, qenv);
+        }
+    }
+
+  // Variables are found through their aliases, and known procedures stay
+  // known
+  for (env_t *v = fv; v; v = v->next)
+    {
+      env_t *var = env_find (v->id, senv);
+      if (!var)
+        continue;
+
+      if (var->known)
+        {
+          qenv = env_add (v->id, LOWER_NONE, qenv);
+          qenv->known = var->known;
+        }
+      else
+        {
+          schid_t *alias = lower_alias_of (aliases, var);
+          qenv = env_add (v->id, env_find (alias, qenv)->temp, qenv);
+        }
+    }
+
+  q->body->result = lower_expr (q, q->body, lam->body, qenv);
+  free_env_partial (qenv, NULL, /*shallow=*/true);
+}
+
+static ir_opnd_t
+lower_letrec (ir_proc_t *p, ir_block_t *b, schlet_t *let, env_t *env)
+{
+  size_t n = 0;
+  for (binding_spec_list_t *bs = let->bindings; bs; bs = bs->next)
+    n++;
+
+  // All the bindings are in scope from the start. Lambda expressions are
+  // bound to known procedures, the other variables get their temporary
+  // when they are evaluated, in order.
+  env_t **vars = alloc ((n + 1) * sizeof (*vars));
+  env_t **fvs = alloc ((n + 1) * sizeof (*fvs));
+  env_t *senv = env;
+  size_t k = 0;
+  for (binding_spec_list_t *bs = let->bindings; bs; bs = bs->next, k++)
+    {
+      senv = env_add (bs->id, LOWER_NONE, senv);
+      vars[k] = senv;
+      fvs[k] = make_env ();
+      if (!lower_lambda_p (bs->expr))
+        continue;
+
+      schlambda_t *lam = (schlambda_t *)bs->expr;
+      known_proc_t *kp = alloc (sizeof (*kp));
+      kp->proc = ir_program_add_proc (lower_program, ir_make_proc ());
+      kp->arity = 0;
+      kp->extras = make_env ();
+      kp->wrapper = LOWER_NONE;
+      kp->loop = LOWER_NONE;
+      kp->next = lower_known;
+      lower_known = kp;
+      senv->known = kp;
+
+      env_t *bound = make_env ();
+      for (expression_list_t *e = lam->formals; e; e = e->next)
+        {
+          bound = env_add ((schid_t *)e->expr, 0, bound);
+          kp->arity++;
+        }
+      lower_free_vars (lam->body, bound, &fvs[k]);
+      free_env_partial (bound, NULL, /*shallow=*/true);
+    }
+
+  // The extra arguments of a known procedure are the variables it uses
+  // and the extra arguments of the known procedures it uses, which are
+  // found as a fixed point
+  lower_alias_t *aliases = NULL;
+  for (bool changed = true; changed;)
+    {
+      changed = false;
+      for (k = 0; k < n; k++)
+        {
+          known_proc_t *kp = vars[k]->known;
+          if (!kp)
+            continue;
+
+          for (env_t *v = fvs[k]; v; v = v->next)
+            {
+              env_t *var = env_find (v->id, senv);
+              if (!var)
+                continue;
+
+              if (!var->known)
+                changed
+                    |= lower_add_extra (kp, lower_alias_of (&aliases, var));
+              else
+                for (env_t *x = var->known->extras; x; x = x->next)
+                  changed |= lower_add_extra (kp, x->id);
+            }
+        }
+    }
+  for (lower_alias_t *a = aliases; a; a = a->next)
+    {
+      a->alias->next = senv;
+      senv = a->alias;
+    }
+
+  // Extra arguments are cheaper than loading the variables from memory as
+  // long as they fit in registers. When they do not, the procedures share
+  // a record with all their variables, if these are bound by then. The
+  // record is laid out as a closure, but it is never called.
+  bool record_p = false;
+  env_t *shared = make_env ();
+  known_proc_t *first = NULL;
+  for (k = 0; k < n; k++)
+    {
+      known_proc_t *kp = vars[k]->known;
+      if (!kp)
+        continue;
+
+      const size_t nextras = lower_length (kp->extras);
+      if (nextras > 1 && 1 + kp->arity + nextras > LOWER_REG_PARAMS)
+        record_p = true;
+      for (env_t *x = kp->extras; x; x = x->next)
+        if (!env_find (x->id, shared))
+          shared = env_add (x->id, 0, shared);
+      first = kp;
+    }
+  for (env_t *x = shared; x && record_p; x = x->next)
+    if (env_find (x->id, senv)->temp == LOWER_NONE)
+      record_p = false;
+
+  schid_t *record = NULL;
+  if (record_p)
+    {
+      record = lower_new_alias ("env");
+      ir_insn_t *i = ir_make_insn (IR_CLOSURE, ir_new_temp (p, record->name),
+                                   lower_length (shared));
+      i->proc = first->proc;
+      size_t x = 0;
+      for (env_t *e = shared; e; e = e->next)
+        i->args[x++] = lower_identifier (p, b, (schptr_t)e->id, senv);
+      ir_block_append (b, i);
+      senv = env_add (record, i->dst, senv);
+
+      for (k = 0; k < n; k++)
+        if (vars[k]->known)
+          {
+            known_proc_t *kp = vars[k]->known;
+            free_env_partial (kp->extras, NULL, /*shallow=*/true);
+            kp->extras = env_add (record, 0, make_env ());
+          }
+    }
+
+  k = 0;
+  for (binding_spec_list_t *bs = let->bindings; bs; bs = bs->next, k++)
+    if (vars[k]->known)
+      lower_known_body (vars[k]->known, (schlambda_t *)bs->expr, fvs[k],
+                        senv, &aliases, record, shared);
+
+  k = 0;
+  for (binding_spec_list_t *bs = let->bindings; bs; bs = bs->next, k++)
+    {
+      if (vars[k]->known)
+        continue;
+
+      ir_opnd_t v = lower_expr (p, b, bs->expr, senv);
+
+      ir_insn_t *i = ir_make_insn (IR_MOVE, ir_new_temp (p, bs->id->name), 1);
+      i->args[0] = v;
+      ir_block_append (b, i);
+
+      vars[k]->temp = i->dst;
+      for (lower_alias_t *a = aliases; a; a = a->next)
+        if (a->var == vars[k])
+          a->alias->temp = i->dst;
+    }
+
+  ir_opnd_t r = lower_expr (p, b, let->body, senv);
+
+  free_env_partial (senv, env, /*shallow=*/true);
+  free_env_partial (shared, NULL, /*shallow=*/true);
+  for (k = 0; k < n; k++)
+    free_env_partial (fvs[k], NULL, /*shallow=*/true);
+  while (aliases)
+    {
+      lower_alias_t *next = aliases->next;
+      free (aliases);
+      aliases = next;
+    }
+  free (vars);
+  free (fvs);
+  return r;
+}
+
+// True if one of the bindings bs is of id
+static bool
+lower_binds_p (const binding_spec_list_t *bs, const schid_t *id)
+{
+  for (; bs; bs = bs->next)
+    if (!strcmp (bs->id->name, id->name))
+      return true;
+  return false;
+}
+
+// Returns true if every reference to name in expression sptr is a call
+// with arity arguments in tail position, tail telling if sptr itself is
+// in tail position. References from lambda expressions never are, since
+// they are in another procedure.
+static bool
+lower_loop_p (schptr_t sptr, const schid_t *name, size_t arity, bool tail)
+{
+  if (sch_imm_p (sptr))
+    return true;
+
+  switch (*((sch_type *)sptr))
+    {
+    case SCH_ID:
+      return strcmp (((schid_t *)sptr)->name, name->name) != 0;
+    case SCH_PRIM_EVAL1:
+      return lower_loop_p (((schprim_eval1_t *)sptr)->arg1, name, arity,
+                           false);
+    case SCH_PRIM_EVAL2:
+      return lower_loop_p (((schprim_eval2_t *)sptr)->arg1, name, arity,
+                           false)
+             && lower_loop_p (((schprim_eval2_t *)sptr)->arg2, name, arity,
+                              false);
+    case SCH_IF:
+      {
+        schif_t *pif = (schif_t *)sptr;
+        return lower_loop_p (pif->condition, name, arity, false)
+               && lower_loop_p (pif->thenv, name, arity, tail)
+               && lower_loop_p (pif->elsev, name, arity, tail);
+      }
+    case SCH_CASE:
+      {
+        schcase_t *pc = (schcase_t *)sptr;
+        for (case_clause_list_t *c = pc->clauses; c; c = c->next)
+          if (!lower_loop_p (c->body, name, arity, tail))
+            return false;
+        return lower_loop_p (pc->key, name, arity, false)
+               && lower_loop_p (pc->elsev, name, arity, tail);
+      }
+    case SCH_LET:
+      {
+        schlet_t *let = (schlet_t *)sptr;
+        const bool shadowed_p
+            = lower_binds_p (let->bindings, name)
+              || (let->name && !strcmp (let->name->name, name->name));
+
+        if (!(let->rec_p && shadowed_p))
+          for (binding_spec_list_t *bs = let->bindings; bs; bs = bs->next)
+            if (!lower_loop_p (bs->expr, name, arity, false))
+              return false;
+        if (shadowed_p)
+          return true;
+
+        // The body of a named let is in another procedure unless it is a
+        // loop too
+        size_t n = 0;
+        for (binding_spec_list_t *bs = let->bindings; bs; bs = bs->next)
+          n++;
+        if (let->name && !lower_loop_p (let->body, let->name, n, true))
+          tail = false;
+        return lower_loop_p (let->body, name, arity, tail);
+      }
+    case SCH_EXPR_SEQ:
+      for (expression_list_t *e = ((schexprseq_t *)sptr)->seq; e;
+           e = e->next)
+        if (!lower_loop_p (e->expr, name, arity, tail && !e->next))
+          return false;
+      return true;
+    case SCH_LAMBDA:
+      {
+        schlambda_t *lam = (schlambda_t *)sptr;
+        for (expression_list_t *e = lam->formals; e; e = e->next)
+          if (!strcmp (((schid_t *)e->expr)->name, name->name))
+            return true;
+        return lower_loop_p (lam->body, name, arity, false);
+      }
+    case SCH_CALL:
+      {
+        schcall_t *call = (schcall_t *)sptr;
+        size_t nargs = 0;
+        for (expression_list_t *e = call->args; e; e = e->next, nargs++)
+          if (!lower_loop_p (e->expr, name, arity, false))
+            return false;
+
+        if (!sch_imm_p (call->op) && *((sch_type *)call->op) == SCH_ID
+            && !strcmp (((schid_t *)call->op)->name, name->name))
+          return tail && nargs == arity;
+        return lower_loop_p (call->op, name, arity, false);
+      }
+    case SCH_VALUES:
+      for (expression_list_t *e = ((schvalues_t *)sptr)->args; e;
+           e = e->next)
+        if (!lower_loop_p (e->expr, name, arity, false))
+          return false;
+      return true;
+    case SCH_RECEIVE:
+      {
+        schreceive_t *r = (schreceive_t *)sptr;
+        if (!lower_loop_p (r->expr, name, arity, false))
+          return false;
+        for (expression_list_t *e = r->formals; e; e = e->next)
+          if (!strcmp (((schid_t *)e->expr)->name, name->name))
+            return true;
+        return lower_loop_p (r->body, name, arity, tail);
+      }
+    case SCH_CALL_VALUES:
+      return lower_loop_p (((schcallvalues_t *)sptr)->producer, name, arity,
+                           false)
+             && lower_loop_p (((schcallvalues_t *)sptr)->consumer, name,
+                              arity, false);
+    default:
+      return true;
+    }
+}
+
+// Lowers a named let that is not a loop, like
+//   (letrec ((name (lambda (<variable>*) <body>))) (name <init>*))
+// but with the initial values evaluated out of the scope of the name
+static ir_opnd_t
+lower_named_letrec (ir_proc_t *p, ir_block_t *b, schlet_t *let, env_t *env)
+{
+  expression_list_t *formals = NULL;
+  expression_list_t *lastf = NULL;
+  expression_list_t *args = NULL;
+  expression_list_t *lasta = NULL;
+  env_t *nenv = env;
+  for (binding_spec_list_t *bs = let->bindings; bs; bs = bs->next)
+    {
+      ir_opnd_t v = lower_expr (p, b, bs->expr, env);
+
+      ir_insn_t *i = ir_make_insn (IR_MOVE, ir_new_temp (p, bs->id->name), 1);
+      i->args[0] = v;
+      ir_block_append (b, i);
+
+      schid_t *alias = lower_new_alias (bs->id->name);
+      nenv = env_add (alias, i->dst, nenv);
+
+      expression_list_t *f = alloc (sizeof (*f));
+      f->expr = (schptr_t)bs->id;
+      f->next = NULL;
+      expression_list_t *a = alloc (sizeof (*a));
+      a->expr = (schptr_t)alias;
+      a->next = NULL;
+      if (!formals)
+        {
+          formals = f;
+          args = a;
+        }
+      else
+        {
+          lastf->next = f;
+          lasta->next = a;
+        }
+      lastf = f;
+      lasta = a;
+    }
+
+  schlambda_t lam
+      = { .type = SCH_LAMBDA, .formals = formals, .body = let->body };
+  binding_spec_list_t proc
+      = { .id = let->name, .expr = (schptr_t)&lam, .next = NULL };
+  schcall_t call
+      = { .type = SCH_CALL, .op = (schptr_t)let->name, .args = args };
+  schlet_t rec = { .type = SCH_LET,
+                   .star_p = true,
+                   .rec_p = true,
+                   .name = NULL,
+                   .bindings = &proc,
+                   .body = (schptr_t)&call };
+  ir_opnd_t r = lower_letrec (p, b, &rec, nenv);
+
+  while (formals)
+    {
+      expression_list_t *next = formals->next;
+      free (formals);
+      formals = next;
+    }
+  while (args)
+    {
+      expression_list_t *next = args->next;
+      free (args);
+      args = next;
+    }
+  free_env_partial (nenv, env, /*shallow=*/true);
+  return r;
+}
+
+static ir_opnd_t
+lower_named_let (ir_proc_t *p, ir_block_t *b, schlet_t *let, env_t *env)
+{
+  size_t n = 0;
+  for (binding_spec_list_t *bs = let->bindings; bs; bs = bs->next)
+    n++;
+
+  if (!lower_loop_p (let->body, let->name, n, true))
+    return lower_named_letrec (p, b, let, env);
+
+  // The initial values are evaluated out of the scope of the loop, whose
+  // variables then get consecutive temporaries
+  ir_insn_t *i = ir_make_insn (IR_LOOP, 0, n);
+  n = 0;
+  for (binding_spec_list_t *bs = let->bindings; bs; bs = bs->next)
+    i->args[n++] = lower_expr (p, b, bs->expr, env);
+
+  i->dst = ir_new_temp (p, NULL);
+  i->vars = i->dst;
+
+  known_proc_t *kp = alloc (sizeof (*kp));
+  kp->proc = LOWER_NONE;
+  kp->arity = n;
+  kp->extras = make_env ();
+  kp->wrapper = LOWER_NONE;
+  kp->next = lower_known;
+  lower_known = kp;
+
+  env_t *nenv = env_add (let->name, LOWER_NONE, env);
+  nenv->known = kp;
+  n = 0;
+  for (binding_spec_list_t *bs = let->bindings; bs; bs = bs->next)
+    {
+      const size_t t = ir_new_temp (p, bs->id->name);
+      if (!n++)
+        i->vars = t;
+      nenv = env_add (bs->id, t, nenv);
+    }
+  kp->loop = i->vars;
+
+  i->body = ir_make_block ();
+  i->body->result = lower_expr (p, i->body, let->body, nenv);
+  ir_block_append (b, i);
+
+  free_env_partial (nenv, env, /*shallow=*/true);
+  return ir_opnd_temp (i->dst);
+}
+
+static ir_opnd_t
+lower_expr (ir_proc_t *p, ir_block_t *b, schptr_t sptr, env_t *env)
+{
+  if (sch_imm_p (sptr))
+    return ir_opnd_imm (sptr);
+
+  assert (sch_ptr_p (sptr));
+
+  sch_type type = *((sch_type *)sptr);
+  switch (type)
+    {
+    case SCH_PRIM:
+      fprintf (stderr, "cannot emit singleton primitive types\n");
+      exit (EXIT_FAILURE);
+      break;
+    case SCH_PRIM_EVAL1:
+      return lower_prim_eval1 (p, b, sptr, env);
+    case SCH_PRIM_EVAL2:
+      return lower_prim_eval2 (p, b, sptr, env);
+    case SCH_IF:
+      return lower_if (p, b, sptr, env);
+    case SCH_CASE:
+      return lower_case (p, b, sptr, env);
+    case SCH_ID:
+      return lower_identifier (p, b, sptr, env);
+    case SCH_LET:
+      return lower_let (p, b, sptr, env);
+    case SCH_EXPR_SEQ:
+      return lower_expr_seq (p, b, sptr, env);
+    case SCH_LAMBDA:
+      return lower_lambda (p, b, sptr, env);
+    case SCH_CALL:
+      return lower_call (p, b, sptr, env);
+    case SCH_CONST:
+      return lower_const (p, b, sptr);
+    case SCH_VALUES:
+      return lower_values (p, b, sptr, env);
+    case SCH_RECEIVE:
+      return lower_receive (p, b, sptr, env);
+    case SCH_CALL_VALUES:
+      return lower_call_values (p, b, sptr, env);
+    default:
+      fprintf (stderr, "unknown type 0x%08x\n", type);
+      err_unreachable ("unknown type");
+      break;
+    }
+}
+
+ir_program_t *
+ir_lower (schptr_t sptr)
+{
+  ir_program_t *p = ir_make_program ();
+  ir_proc_t *body = p->procs[0];
+
+  lower_program = p;
+  body->body->result = lower_expr (body, body->body, sptr, make_env ());
+  lower_program = NULL;
+
+  while (lower_known)
+    {
+      known_proc_t *next = lower_known->next;
+      free_env_partial (lower_known->extras, NULL, /*shallow=*/true);
+      free (lower_known);
+      lower_known = next;
+    }
+  free_env_partial (lower_aliases, NULL, /*shallow=*/false);
+  lower_aliases = NULL;
+  return p;
+}
@@ -265,6 +265,7 @@ parse_peculiar_identifier (const char **input)
   // | <explicit sign> <sign subsequent> <subsequent>*
   // | <explicit sign> . <dot subsequent> <subsequent>*
   // | . <dot subsequent> <subsequent>*
+  // Each alternative starts over from the beginning of the input
   if (parse_explicit_sign (&ptr) && parse_sign_subsequent (&ptr))
     {
       while (parse_subsequent (&ptr))
@@ -272,22 +273,28 @@ parse_peculiar_identifier (const char **input)
       *input = ptr;
       return true;
     }
-  else if (parse_explicit_sign (&ptr) && parse_char (&ptr, '.')
-           && parse_dot_subsequent (&ptr))
+
+  ptr = *input;
+  if (parse_explicit_sign (&ptr) && parse_char (&ptr, '.')
+      && parse_dot_subsequent (&ptr))
     {
       while (parse_subsequent (&ptr))
         ;
       *input = ptr;
       return true;
     }
-  else if (parse_char (&ptr, '.') && parse_dot_subsequent (&ptr))
+
+  ptr = *input;
+  if (parse_char (&ptr, '.') && parse_dot_subsequent (&ptr))
     {
       while (parse_subsequent (&ptr))
         ;
       *input = ptr;
       return true;
     }
-  else if (parse_explicit_sign (&ptr))
+
+  ptr = *input;
+  if (parse_explicit_sign (&ptr))
     {
       *input = ptr;
       return true;
@@ -381,11 +388,195 @@ parse_binding_spec (const char **input, schptr_t *left, schptr_t *right)
   return true;
 }
 
-/* bool */
-/* parse_definition (const char **input, schptr_t *sptr) */
-/* { */
-/*   return false; */
-/* } */
+// Parses the identifiers up to the closing rparen of a list of formals,
+// <identifier>* ), into a list of identifiers
+static bool
+parse_formals_tail (const char **input, expression_list_t **formals)
+{
+  const char *ptr = *input;
+  expression_list_t *first = NULL;
+  expression_list_t *last = NULL;
+  schptr_t id;
+  while (parse_identifier (&ptr, &id))
+    {
+      // skip possible whitespace between formals
+      (void)parse_whitespace (&ptr);
+
+      expression_list_t *node = alloc (sizeof *node);
+      node->expr = id;
+      node->next = NULL;
+
+      if (!first)
+        first = node;
+      else
+        last->next = node;
+      last = node;
+    }
+
+  if (!parse_rparen (&ptr))
+    {
+      free_expression_list (first);
+      return false;
+    }
+
+  *input = ptr;
+  *formals = first;
+  return true;
+}
+
+// Parses the formals of a lambda expression, (<identifier>*)
+static bool
+parse_formals (const char **input, expression_list_t **formals)
+{
+  const char *ptr = *input;
+
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and the first formal
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_formals_tail (&ptr, formals))
+    return false;
+
+  *input = ptr;
+  return true;
+}
+
+bool
+parse_definition (const char **input, schptr_t *left, schptr_t *right)
+{
+  const char *ptr = *input;
+
+  // Parses a definition as follows:
+  //    (define <identifier> <expression>)
+  // |  (define (<identifier> <identifier>*) <body>)
+  // where the second form defines the identifier to a lambda expression
+  // with the rest of the identifiers as formals
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and define keyword
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_char_sequence (&ptr, "define"))
+    return false;
+
+  // the keyword has to end here, otherwise this is an identifier that
+  // starts with define
+  if (!parse_whitespace (&ptr) && *ptr != '(')
+    return false;
+
+  schptr_t identifier;
+  schptr_t expression;
+  if (parse_lparen (&ptr))
+    {
+      // skip possible whitespace between lparen and the identifier
+      (void)parse_whitespace (&ptr);
+
+      if (!parse_identifier (&ptr, &identifier))
+        return false;
+
+      // skip possible whitespace between the identifier and the formals
+      (void)parse_whitespace (&ptr);
+
+      expression_list_t *formals;
+      schptr_t body;
+      if (!parse_formals_tail (&ptr, &formals))
+        {
+          free_expression (identifier);
+          return false;
+        }
+
+      // skip possible whitespace between formals and body
+      (void)parse_whitespace (&ptr);
+
+      if (!parse_body (&ptr, &body))
+        {
+          free_expression (identifier);
+          free_expression_list (formals);
+          return false;
+        }
+
+      schlambda_t *l = alloc (sizeof *l);
+      l->type = SCH_LAMBDA;
+      l->formals = formals;
+      l->body = body;
+      expression = (schptr_t)l;
+    }
+  else
+    {
+      if (!parse_identifier (&ptr, &identifier))
+        return false;
+
+      // skip possible whitespace between identifier and expression
+      (void)parse_whitespace (&ptr);
+
+      if (!parse_expression (&ptr, &expression))
+        {
+          free_expression (identifier);
+          return false;
+        }
+    }
+
+  // skip possible whitespace between definition and rparen
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_rparen (&ptr))
+    {
+      free_expression (identifier);
+      free_expression (expression);
+      return false;
+    }
+
+  *input = ptr;
+
+  *left = identifier;
+  *right = expression;
+
+  return true;
+}
+
+// Appends the definition of id to expr to the list of bindings that
+// starts at *first and ends at *last
+static void
+append_definition (binding_spec_list_t **first, binding_spec_list_t **last,
+                   schptr_t id, schptr_t expr)
+{
+  binding_spec_list_t *b = alloc (sizeof (*b));
+  b->id = (schid_t *)id;
+  b->expr = expr;
+  b->next = NULL;
+
+  if (!*first)
+    *first = b;
+  else
+    (*last)->next = b;
+  *last = b;
+}
+
+// Makes the sequence of expressions elst into an expression, in the scope
+// of the definitions defs if there are any: definitions in a body are
+// equivalent to a letrec* of their bindings
+static schptr_t
+make_body (binding_spec_list_t *defs, expression_list_t *elst)
+{
+  schexprseq_t *seq = alloc (sizeof (*seq));
+  seq->type = SCH_EXPR_SEQ;
+  seq->seq = elst;
+
+  if (!defs)
+    return (schptr_t)seq;
+
+  schlet_t *l = alloc (sizeof (*l));
+  l->type = SCH_LET;
+  l->star_p = true;
+  l->rec_p = true;
+  l->name = NULL;
+  l->bindings = defs;
+  l->body = (schptr_t)seq;
+  return (schptr_t)l;
+}
 
 bool
 parse_body (const char **input, schptr_t *sptr)
@@ -394,20 +585,23 @@ parse_body (const char **input, schptr_t *sptr)
 
   // a body is a sequence of definitions followed by a
   // non empty sequence of expressions
-  // TODO skipping definitions for now
-  /* definition_list_t *defs = NULL; */
-  /* definition_t def; */
-  /* while (parse_definition (ptr, *def)) */
-  /*   { */
-
-  /*   } */
+  binding_spec_list_t *defs = NULL;
+  binding_spec_list_t *lastdef = NULL;
+  schptr_t id;
+  schptr_t e;
+  while (parse_definition (&ptr, &id, &e))
+    {
+      (void)parse_whitespace (&ptr);
+      append_definition (&defs, &lastdef, id, e);
+    }
 
-  // parse for now a non-empty list of expressions
   expression_list_t *elst = NULL;
   expression_list_t *last = NULL;
-  schptr_t e;
   if (!parse_expression (&ptr, &e))
-    return false;
+    {
+      free_binding_spec_list (defs);
+      return false;
+    }
 
   elst = alloc (sizeof (*elst));
   elst->expr = e;
@@ -416,248 +610,1271 @@ parse_body (const char **input, schptr_t *sptr)
 
   (void)parse_whitespace (&ptr);
 
-  while (parse_expression (&ptr, &e))
+  while (parse_expression (&ptr, &e))
+    {
+      (void)parse_whitespace (&ptr);
+
+      expression_list_t *n = alloc (sizeof (*n));
+      n->expr = e;
+      n->next = NULL;
+      last->next = n;
+      last = n;
+    }
+
+  *input = ptr;
+  *sptr = make_body (defs, elst);
+
+  return true;
+}
+
+bool
+parse_command (const char **input, schptr_t *sptr)
+{
+  // Syntax:
+  // <command> -> <expression>
+
+  return parse_expression (input, sptr);
+}
+
+bool
+parse_command_or_definition (const char **input, schptr_t *sptr,
+                             schptr_t *id)
+{
+  // Syntax:
+  // <command or definition> ->
+  //          <command>
+  // |        <definition>
+  // |        (begin <command or definition>+)
+  //
+  // A definition leaves its identifier in id and its expression in sptr,
+  // a command sets id to NULL.
+  //
+  // TODO: implement (begin ...) support
+
+  if (parse_definition (input, id, sptr))
+    return true;
+
+  *id = (schptr_t)NULL;
+  return parse_command (input, sptr);
+}
+
+bool
+parse_program (const char **input, schptr_t *sptr)
+{
+  const char *ptr = *input;
+
+  // Syntax:
+  // <program> ->
+  //          <import declaration>+
+  // |        <command or definition>+
+  //
+  // The definitions of a program are all in the scope of each other, as
+  // in a body, and it needs at least one command to have a value.
+  //
+  // TODO: implement import declaration support
+
+  binding_spec_list_t *defs = NULL;
+  binding_spec_list_t *lastdef = NULL;
+  expression_list_t *elst = NULL;
+  expression_list_t *last = NULL;
+  schptr_t e;
+  schptr_t id;
+  while (parse_command_or_definition (&ptr, &e, &id))
+    {
+      (void)parse_whitespace (&ptr);
+
+      if (id)
+        {
+          append_definition (&defs, &lastdef, id, e);
+          continue;
+        }
+
+      expression_list_t *n = alloc (sizeof (*n));
+      n->expr = e;
+      n->next = NULL;
+      if (!elst)
+        elst = n;
+      else
+        last->next = n;
+      last = n;
+    }
+
+  if (!elst)
+    {
+      free_binding_spec_list (defs);
+      return false;
+    }
+
+  *input = ptr;
+  *sptr = make_body (defs, elst);
+
+  return true;
+}
+
+bool
+parse_let_wo_id (const char **input, schptr_t *sptr)
+{
+  const char *ptr = *input;
+
+  // Parses an expression as follows:
+  //    (<let keyword> (<binding spec>*) <body>)
+  // |  (let <identifier> (<binding spec>*) <body>)
+  // where the keyword is one of let, let*, letrec and letrec*, and the
+  // second form is a named let
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and let keyword
+  (void)parse_whitespace (&ptr);
+
+  bool letstar = false;
+  bool letrec = false;
+  if (parse_char_sequence (&ptr, "letrec*"))
+    letstar = letrec = true;
+  else if (parse_char_sequence (&ptr, "letrec"))
+    letrec = true;
+  else if (parse_char_sequence (&ptr, "let*"))
+    letstar = true;
+  else if (!parse_char_sequence (&ptr, "let"))
+    return false;
+
+  // skip possible whitespace between let and lparen, which has to be
+  // there before the name of a named let
+  schptr_t name = (schptr_t)NULL;
+  if (parse_whitespace (&ptr) && !letstar && !letrec
+      && parse_identifier (&ptr, &name))
+    (void)parse_whitespace (&ptr);
+
+  if (!parse_lparen (&ptr))
+    {
+      if (name)
+        free_expression (name);
+      return false;
+    }
+
+  // Now we parse each of the binding specs and store them
+  binding_spec_list_t *bindings = NULL;
+  binding_spec_list_t *last = NULL;
+  schptr_t body;
+
+  while (1)
+    {
+      schptr_t id;
+      schptr_t expr;
+      if (!parse_binding_spec (&ptr, &id, &expr))
+        break;
+
+      // skip possible whitespace between binding specs
+      (void)parse_whitespace (&ptr);
+
+      binding_spec_list_t *b = alloc (sizeof (*b));
+      b->id = (schid_t *)id;
+      b->expr = expr;
+      b->next = NULL;
+
+      if (!bindings)
+        {
+          bindings = b;
+          last = b;
+        }
+      else
+        {
+          last->next = b;
+          last = b;
+        }
+    }
+
+  // skip possible whitespace between last binding spec and rparen
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_rparen (&ptr))
+    {
+      if (name)
+        free_expression (name);
+      free_binding_spec_list (bindings);
+      return false;
+    }
+
+  // skip possible whitespace between rparen and body
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_body (&ptr, &body))
+    {
+      if (name)
+        free_expression (name);
+      free_binding_spec_list (bindings);
+      return false;
+    }
+
+  // skip possible whitespace between body and rparen
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_rparen (&ptr))
+    {
+      if (name)
+        free_expression (name);
+      free_binding_spec_list (bindings);
+      free_expression (body);
+      return false;
+    }
+
+  // Parse of let successful and complete
+  *input = ptr;
+
+  schlet_t *l = (schlet_t *)alloc (sizeof (*l));
+  l->type = SCH_LET;
+  l->star_p = letstar;
+  l->rec_p = letrec;
+  l->name = (schid_t *)name;
+  l->bindings = bindings;
+  l->body = body;
+
+  *sptr = (schptr_t)l;
+
+  return true;
+}
+
+// Parses keyword kw, which has to end there for it not to be the start of
+// a longer identifier
+static bool
+parse_keyword (const char **input, const char *kw)
+{
+  const char *ptr = *input;
+
+  if (!parse_char_sequence (&ptr, kw))
+    return false;
+
+  if (*ptr && *ptr != '(' && *ptr != ')' && !parse_whitespace (&ptr))
+    return false;
+
+  *input = ptr;
+  return true;
+}
+
+// Derived expressions are turned into the expressions they are equivalent
+// to by the parser, with the following helpers. The variables they
+// introduce have names that cannot be equal to an identifier.
+
+static schid_t *
+make_id (const char *name)
+{
+  schid_t *id = alloc (sizeof (*id));
+  id->type = SCH_ID;
+  id->name = strdup (name);
+  if (!id->name)
+    err_oom ();
+  return id;
+}
+
+static schptr_t
+make_if (schptr_t condition, schptr_t thenv, schptr_t elsev)
+{
+  schif_t *ifv = alloc (sizeof (*ifv));
+  ifv->type = SCH_IF;
+  ifv->condition = condition;
+  ifv->thenv = thenv;
+  ifv->elsev = elsev;
+  return (schptr_t)ifv;
+}
+
+// Makes (let ((id expr)) body)
+static schptr_t
+make_let1 (schid_t *id, schptr_t expr, schptr_t body)
+{
+  binding_spec_list_t *b = alloc (sizeof (*b));
+  b->id = id;
+  b->expr = expr;
+  b->next = NULL;
+
+  schlet_t *l = alloc (sizeof (*l));
+  l->type = SCH_LET;
+  l->star_p = false;
+  l->rec_p = false;
+  l->name = NULL;
+  l->bindings = b;
+  l->body = body;
+  return (schptr_t)l;
+}
+
+// Returns the number of expressions in elst, which must be at most
+// VALUES_MAX when they are values, or variables that receive them
+static size_t
+values_length (const expression_list_t *elst)
+{
+  size_t n = 0;
+  for (; elst; elst = elst->next)
+    n++;
+
+  if (n > VALUES_MAX)
+    {
+      fprintf (stderr, "too many values, at most %d are supported\n",
+               VALUES_MAX);
+      exit (EXIT_FAILURE);
+    }
+  return n;
+}
+
+// Makes the receive of the values of expr in formals, in body
+static schptr_t
+make_receive (expression_list_t *formals, schptr_t expr, schptr_t body)
+{
+  (void)values_length (formals);
+
+  schreceive_t *r = alloc (sizeof (*r));
+  r->type = SCH_RECEIVE;
+  r->formals = formals;
+  r->expr = expr;
+  r->body = body;
+  return (schptr_t)r;
+}
+
+// Makes (values <expression>*) of the expressions in elst. A single value
+// is the expression itself.
+static schptr_t
+make_values (expression_list_t *elst)
+{
+  if (values_length (elst) == 1)
+    {
+      schptr_t e = elst->expr;
+      free (elst);
+      return e;
+    }
+
+  schvalues_t *v = alloc (sizeof (*v));
+  v->type = SCH_VALUES;
+  v->args = elst;
+  return (schptr_t)v;
+}
+
+// Makes (call-with-values producer consumer). A lambda expression as
+// consumer is a receive of the values of the producer in its formals:
+// the body of the producer when it is a lambda expression without
+// formals too, and a call to it otherwise.
+static schptr_t
+make_call_values (schptr_t producer, schptr_t consumer)
+{
+  if (sch_imm_p (consumer) || *(sch_type *)consumer != SCH_LAMBDA)
+    {
+      schcallvalues_t *c = alloc (sizeof (*c));
+      c->type = SCH_CALL_VALUES;
+      c->producer = producer;
+      c->consumer = consumer;
+      return (schptr_t)c;
+    }
+
+  schptr_t expr;
+  schlambda_t *p = (schlambda_t *)producer;
+  if (sch_ptr_p (producer) && p->type == SCH_LAMBDA && !p->formals)
+    {
+      expr = p->body;
+      free (p);
+    }
+  else
+    {
+      schcall_t *call = alloc (sizeof (*call));
+      call->type = SCH_CALL;
+      call->op = producer;
+      call->args = NULL;
+      expr = (schptr_t)call;
+    }
+
+  schlambda_t *c = (schlambda_t *)consumer;
+  schptr_t r = make_receive (c->formals, expr, c->body);
+  free (c);
+  return r;
+}
+
+// Parses the specification of a variable of a do loop,
+// (<identifier> <init> <step>), where the step is optional. A variable
+// without a step keeps its value, so its step is a reference to it.
+static bool
+parse_do_spec (const char **input, binding_spec_list_t **spec,
+               expression_list_t **step)
+{
+  const char *ptr = *input;
+
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and the identifier
+  (void)parse_whitespace (&ptr);
+
+  schptr_t id;
+  if (!parse_identifier (&ptr, &id))
+    return false;
+
+  // skip possible whitespace between identifier and init
+  (void)parse_whitespace (&ptr);
+
+  schptr_t init;
+  if (!parse_expression (&ptr, &init))
+    {
+      free_expression (id);
+      return false;
+    }
+
+  // skip possible whitespace between init and step
+  (void)parse_whitespace (&ptr);
+
+  schptr_t next;
+  if (parse_expression (&ptr, &next))
+    (void)parse_whitespace (&ptr);
+  else
+    next = (schptr_t)clone_schid ((schid_t *)id);
+
+  if (!parse_rparen (&ptr))
+    {
+      free_expression (id);
+      free_expression (init);
+      free_expression (next);
+      return false;
+    }
+
+  *input = ptr;
+
+  *spec = alloc (sizeof (**spec));
+  (*spec)->id = (schid_t *)id;
+  (*spec)->expr = init;
+  (*spec)->next = NULL;
+
+  *step = alloc (sizeof (**step));
+  (*step)->expr = next;
+  (*step)->next = NULL;
+  return true;
+}
+
+// Parses the expressions up to the closing rparen of a list, into a list
+// of expressions
+static bool
+parse_expression_list_tail (const char **input, expression_list_t **elst,
+                            expression_list_t **elast)
+{
+  const char *ptr = *input;
+  expression_list_t *first = NULL;
+  expression_list_t *last = NULL;
+  schptr_t e;
+  while (parse_expression (&ptr, &e))
+    {
+      // skip possible whitespace between expressions
+      (void)parse_whitespace (&ptr);
+
+      expression_list_t *node = alloc (sizeof *node);
+      node->expr = e;
+      node->next = NULL;
+
+      if (!first)
+        first = node;
+      else
+        last->next = node;
+      last = node;
+    }
+
+  if (!parse_rparen (&ptr))
+    {
+      free_expression_list (first);
+      return false;
+    }
+
+  *input = ptr;
+  *elst = first;
+  *elast = last;
+  return true;
+}
+
+// Parses the test clause and the commands of a do loop,
+// (<test> <expression>*) <command>* ), up to its closing rparen
+static bool
+parse_do_clauses (const char **input, schptr_t *test,
+                  expression_list_t **exprs, expression_list_t **commands,
+                  expression_list_t **lastc)
+{
+  const char *ptr = *input;
+
+  // skip possible whitespace between the variables and the test clause
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and the test
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_expression (&ptr, test))
+    return false;
+
+  // skip possible whitespace between the test and the expressions
+  (void)parse_whitespace (&ptr);
+
+  expression_list_t *lastx;
+  if (!parse_expression_list_tail (&ptr, exprs, &lastx))
+    {
+      free_expression (*test);
+      return false;
+    }
+
+  // skip possible whitespace between the test clause and the commands
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_expression_list_tail (&ptr, commands, lastc))
+    {
+      free_expression (*test);
+      free_expression_list (*exprs);
+      return false;
+    }
+
+  *input = ptr;
+  return true;
+}
+
+bool
+parse_do (const char **input, schptr_t *sptr)
+{
+  const char *ptr = *input;
+
+  // Parses an expression as follows:
+  // (do ((<identifier> <init> <step>)*) (<test> <expression>*) <command>*)
+  // which is turned into the named let
+  // (let do# ((<identifier> <init>)*)
+  //   (if <test>
+  //       (begin <expression>*)
+  //       (begin <command>* (do# <step>*))))
+  // whose name cannot be equal to an identifier. A do without
+  // expressions after its test has the value ().
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and do keyword
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_char_sequence (&ptr, "do"))
+    return false;
+
+  // the keyword has to end here, otherwise this is an identifier that
+  // starts with do
+  if (!parse_whitespace (&ptr) && *ptr != '(')
+    return false;
+
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and the first variable
+  (void)parse_whitespace (&ptr);
+
+  binding_spec_list_t *bindings = NULL;
+  binding_spec_list_t *lastb = NULL;
+  expression_list_t *steps = NULL;
+  expression_list_t *lasts = NULL;
+  binding_spec_list_t *spec;
+  expression_list_t *step;
+  while (parse_do_spec (&ptr, &spec, &step))
+    {
+      // skip possible whitespace between variables
+      (void)parse_whitespace (&ptr);
+
+      if (!bindings)
+        {
+          bindings = spec;
+          steps = step;
+        }
+      else
+        {
+          lastb->next = spec;
+          lasts->next = step;
+        }
+      lastb = spec;
+      lasts = step;
+    }
+
+  schptr_t test;
+  expression_list_t *exprs;
+  expression_list_t *commands;
+  expression_list_t *lastc;
+  if (!parse_rparen (&ptr)
+      || !parse_do_clauses (&ptr, &test, &exprs, &commands, &lastc))
+    {
+      free_binding_spec_list (bindings);
+      free_expression_list (steps);
+      return false;
+    }
+
+  *input = ptr;
+
+  schid_t *name = make_id ("do#");
+
+  schcall_t *call = alloc (sizeof (*call));
+  call->type = SCH_CALL;
+  call->op = (schptr_t)clone_schid (name);
+  call->args = steps;
+
+  expression_list_t *node = alloc (sizeof (*node));
+  node->expr = (schptr_t)call;
+  node->next = NULL;
+  if (!commands)
+    commands = node;
+  else
+    lastc->next = node;
+
+  schexprseq_t *elsev = alloc (sizeof (*elsev));
+  elsev->type = SCH_EXPR_SEQ;
+  elsev->seq = commands;
+
+  schptr_t thenv = sch_encode_imm_null ();
+  if (exprs)
+    {
+      schexprseq_t *seq = alloc (sizeof (*seq));
+      seq->type = SCH_EXPR_SEQ;
+      seq->seq = exprs;
+      thenv = (schptr_t)seq;
+    }
+
+  schlet_t *l = alloc (sizeof (*l));
+  l->type = SCH_LET;
+  l->star_p = false;
+  l->rec_p = false;
+  l->name = name;
+  l->bindings = bindings;
+  l->body = make_if (test, thenv, (schptr_t)elsev);
+
+  *sptr = (schptr_t)l;
+  return true;
+}
+
+// Parses the binding of a let-values, (<formals> <expression>)
+static bool
+parse_values_spec (const char **input, expression_list_t **formals,
+                   schptr_t *expr)
+{
+  const char *ptr = *input;
+
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and the formals
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_formals (&ptr, formals))
+    return false;
+
+  // skip possible whitespace between the formals and the expression
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_expression (&ptr, expr))
+    {
+      free_expression_list (*formals);
+      return false;
+    }
+
+  // skip possible whitespace between the expression and rparen
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_rparen (&ptr))
+    {
+      free_expression_list (*formals);
+      free_expression (*expr);
+      return false;
+    }
+
+  *input = ptr;
+  return true;
+}
+
+bool
+parse_let_values (const char **input, schptr_t *sptr)
+{
+  const char *ptr = *input;
+
+  // Parses an expression as follows:
+  //    (let-values ((<formals> <expression>)*) <body>)
+  // A single binding is a receive of the values of its expression. The
+  // expressions of several bindings are all evaluated out of the scope of
+  // their formals, so each one is received in variables whose names
+  // cannot be equal to an identifier, which a let then binds the formals
+  // to around the body:
+  //    (let-values (((a b) e) ((c) f)) body)
+  // => (receive (a# b#) e (receive (c#) f (let ((a a#) (b b#) (c c#)) body)))
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and let-values keyword
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_keyword (&ptr, "let-values"))
+    return false;
+
+  // skip possible whitespace between let-values and lparen
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and the first binding
+  (void)parse_whitespace (&ptr);
+
+  // The receives are chained by their bodies, which the last one is not
+  // set for until the body is parsed
+  schreceive_t *first = NULL;
+  schreceive_t *last = NULL;
+  binding_spec_list_t *renames = NULL;
+  binding_spec_list_t *lastr = NULL;
+  expression_list_t *formals;
+  schptr_t expr;
+  while (parse_values_spec (&ptr, &formals, &expr))
+    {
+      // skip possible whitespace between bindings
+      (void)parse_whitespace (&ptr);
+
+      schreceive_t *r = (schreceive_t *)make_receive (
+          formals, expr, sch_encode_imm_null ());
+      if (!first)
+        first = r;
+      else
+        last->body = (schptr_t)r;
+      last = r;
+    }
+
+  if (!parse_rparen (&ptr))
+    {
+      if (first)
+        free_expression ((schptr_t)first);
+      return false;
+    }
+
+  // skip possible whitespace between the bindings and the body
+  (void)parse_whitespace (&ptr);
+
+  schptr_t body;
+  if (!parse_body (&ptr, &body))
+    {
+      if (first)
+        free_expression ((schptr_t)first);
+      return false;
+    }
+
+  // skip possible whitespace between body and rparen
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_rparen (&ptr))
+    {
+      if (first)
+        free_expression ((schptr_t)first);
+      free_expression (body);
+      return false;
+    }
+
+  *input = ptr;
+
+  if (!first)
+    {
+      *sptr = body;
+      return true;
+    }
+
+  for (schreceive_t *r = first; first != last && r;
+       r = r == last ? NULL : (schreceive_t *)r->body)
+    for (expression_list_t *f = r->formals; f; f = f->next)
+      {
+        schid_t *id = (schid_t *)f->expr;
+        const size_t len = strlen (id->name) + 2;
+        schid_t *renamed = alloc (sizeof (*renamed));
+        renamed->type = SCH_ID;
+        renamed->name = alloc (len);
+        snprintf (renamed->name, len, "%s#", id->name);
+        f->expr = (schptr_t)renamed;
+
+        binding_spec_list_t *b = alloc (sizeof (*b));
+        b->id = id;
+        b->expr = (schptr_t)clone_schid (renamed);
+        b->next = NULL;
+        if (!renames)
+          renames = b;
+        else
+          lastr->next = b;
+        lastr = b;
+      }
+
+  last->body = body;
+  if (renames)
+    {
+      schlet_t *l = alloc (sizeof (*l));
+      l->type = SCH_LET;
+      l->star_p = false;
+      l->rec_p = false;
+      l->name = NULL;
+      l->bindings = renames;
+      l->body = body;
+      last->body = (schptr_t)l;
+    }
+
+  *sptr = (schptr_t)first;
+  return true;
+}
+
+bool
+parse_if (const char **input, schptr_t *sptr)
+{
+  const char *ptr = *input;
+  // Parses an expression as follows:
+  // (if <expr> <expr> <expr>)
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and if keyword
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_char_sequence (&ptr, "if"))
+    return false;
+
+  // skip whitespace between if identifier and condition
+  (void)parse_whitespace (&ptr);
+
+  schptr_t condition;
+  schptr_t thenv;
+  schptr_t elsev;
+
+  if (!parse_expression (&ptr, &condition))
+    return false;
+
+  // skip whitespace between condition and then-value
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_expression (&ptr, &thenv))
+    return false;
+
+  // skip whitespace between then-value and else-value
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_expression (&ptr, &elsev))
+    return false;
+
+  // skip whitespace between else-value and right paren
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_rparen (&ptr))
+    return false;
+
+  // We parsed all we wanted now, so prepare return value
+  *input = ptr;
+  schif_t *ifv = (schif_t *)alloc (sizeof *ifv);
+
+  ifv->type = SCH_IF;
+  ifv->condition = condition;
+  ifv->thenv = thenv;
+  ifv->elsev = elsev;
+
+  *sptr = (schptr_t)ifv;
+  return true;
+}
+
+// Makes the and, or when and_p is false, of the expressions in elst,
+// whose nodes it frees
+static schptr_t
+make_and_or (expression_list_t *elst, bool and_p)
+{
+  if (!elst)
+    return sch_encode_imm_bool (and_p);
+
+  schptr_t e = elst->expr;
+  expression_list_t *rest = elst->next;
+  free (elst);
+  if (!rest)
+    return e;
+
+  if (and_p)
+    return make_if (e, make_and_or (rest, true), sch_encode_imm_bool (false));
+
+  schid_t *id = make_id ("or#");
+  return make_let1 (id, e,
+                    make_if ((schptr_t)clone_schid (id),
+                             (schptr_t)clone_schid (id),
+                             make_and_or (rest, false)));
+}
+
+bool
+parse_and_or (const char **input, schptr_t *sptr)
+{
+  const char *ptr = *input;
+
+  // Parses an expression as follows:
+  //    (and <expression>*)
+  // |  (or <expression>*)
+  // which are turned into conditionals:
+  //   (and) => #t, (and e) => e
+  //   (and e r ...) => (if e (and r ...) #f)
+  //   (or) => #f, (or e) => e
+  //   (or e r ...) => (let ((or# e)) (if or# or# (or r ...)))
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and keyword
+  (void)parse_whitespace (&ptr);
+
+  const bool and_p = parse_keyword (&ptr, "and");
+  if (!and_p && !parse_keyword (&ptr, "or"))
+    return false;
+
+  expression_list_t *elst;
+  expression_list_t *elast;
+  if (!parse_expression_list_tail (&ptr, &elst, &elast))
+    return false;
+
+  *input = ptr;
+  *sptr = make_and_or (elst, and_p);
+  return true;
+}
+
+// Parses an else clause, (else <expression>+), into the sequence of its
+// expressions
+static bool
+parse_else_clause (const char **input, schptr_t *sptr)
+{
+  const char *ptr = *input;
+
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and else keyword
+  (void)parse_whitespace (&ptr);
+
+  if (!parse_keyword (&ptr, "else"))
+    return false;
+
+  expression_list_t *exprs;
+  expression_list_t *last;
+  if (!parse_expression_list_tail (&ptr, &exprs, &last))
+    return false;
+
+  if (!exprs)
+    return false;
+
+  *input = ptr;
+  *sptr = make_body (NULL, exprs);
+  return true;
+}
+
+// Parses the clauses of a cond, from the current one up to the closing
+// rparen, into the expression they are equivalent to
+static bool
+parse_cond_clauses (const char **input, schptr_t *sptr)
+{
+  const char *ptr = *input;
+
+  if (parse_rparen (&ptr))
+    {
+      *input = ptr;
+      *sptr = sch_encode_imm_null ();
+      return true;
+    }
+
+  // the else clause has to be the last one
+  schptr_t elsev;
+  if (parse_else_clause (&ptr, &elsev))
+    {
+      // skip possible whitespace between the clause and rparen
+      (void)parse_whitespace (&ptr);
+
+      if (!parse_rparen (&ptr))
+        {
+          free_expression (elsev);
+          return false;
+        }
+
+      *input = ptr;
+      *sptr = elsev;
+      return true;
+    }
+
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and the test
+  (void)parse_whitespace (&ptr);
+
+  expression_list_t *exprs = NULL;
+  expression_list_t *last;
+  schptr_t test;
+  if (!parse_expression (&ptr, &test))
+    return false;
+
+  // skip possible whitespace between the test and the expressions
+  (void)parse_whitespace (&ptr);
+
+  schptr_t receiver = (schptr_t)NULL;
+  if (parse_keyword (&ptr, "=>"))
+    {
+      if (!parse_expression (&ptr, &receiver))
+        {
+          free_expression (test);
+          return false;
+        }
+
+      // skip possible whitespace between the receiver and rparen
+      (void)parse_whitespace (&ptr);
+
+      if (!parse_rparen (&ptr))
+        {
+          free_expression (test);
+          free_expression (receiver);
+          return false;
+        }
+    }
+  else if (!parse_expression_list_tail (&ptr, &exprs, &last))
+    {
+      free_expression (test);
+      return false;
+    }
+
+  // skip possible whitespace between clauses
+  (void)parse_whitespace (&ptr);
+
+  schptr_t rest;
+  if (!parse_cond_clauses (&ptr, &rest))
     {
-      (void)parse_whitespace (&ptr);
-
-      expression_list_t *n = alloc (sizeof (*n));
-      n->expr = e;
-      n->next = NULL;
-      last->next = n;
-      last = n;
+      free_expression (test);
+      if (receiver)
+        free_expression (receiver);
+      free_expression_list (exprs);
+      return false;
     }
 
   *input = ptr;
 
-  schexprseq_t *seq = alloc (sizeof (*seq));
-  seq->type = SCH_EXPR_SEQ;
-  seq->seq = elst;
-  *sptr = (schptr_t)seq;
+  if (exprs)
+    {
+      *sptr = make_if (test, make_body (NULL, exprs), rest);
+      return true;
+    }
 
+  // Without expressions, the value of the clause is the one of its test,
+  // or the receiver applied to it
+  schid_t *id = make_id ("cond#");
+  schptr_t thenv = (schptr_t)clone_schid (id);
+  if (receiver)
+    {
+      schcall_t *call = alloc (sizeof (*call));
+      call->type = SCH_CALL;
+      call->op = receiver;
+      call->args = alloc (sizeof (*call->args));
+      call->args->expr = thenv;
+      call->args->next = NULL;
+      thenv = (schptr_t)call;
+    }
+  *sptr = make_let1 (id, test,
+                     make_if ((schptr_t)clone_schid (id), thenv, rest));
   return true;
 }
 
 bool
-parse_command (const char **input, schptr_t *sptr)
+parse_cond (const char **input, schptr_t *sptr)
 {
-  // Syntax:
-  // <command> -> <expression>
+  const char *ptr = *input;
 
-  return parse_expression (input, sptr);
-}
+  // Parses an expression as follows:
+  // (cond <cond clause>* (else <expression>+)?)
+  // where a clause is one of
+  //    (<test> <expression>+)
+  // |  (<test>)
+  // |  (<test> => <receiver>)
+  // which is turned into nested conditionals:
+  //   (cond) => ()
+  //   (cond (else e ...)) => (begin e ...)
+  //   (cond (t e ...) c ...) => (if t (begin e ...) (cond c ...))
+  //   (cond (t) c ...) => (let ((cond# t)) (if cond# cond# (cond c ...)))
+  //   (cond (t => r) c ...)
+  //     => (let ((cond# t)) (if cond# (r cond#) (cond c ...)))
+  if (!parse_lparen (&ptr))
+    return false;
 
-bool
-parse_command_or_definition (const char **input, schptr_t *sptr)
-{
-  // Syntax:
-  // <command or definition> ->
-  //          <command>
-  // |        <definition>
-  // |        (begin <command or definition>+)
-  //
-  // TODO: implement definition and (begin ...) support
+  // skip possible whitespace between lparen and cond keyword
+  (void)parse_whitespace (&ptr);
 
-  return parse_command (input, sptr);
+  if (!parse_keyword (&ptr, "cond"))
+    return false;
+
+  if (!parse_cond_clauses (&ptr, sptr))
+    return false;
+
+  *input = ptr;
+  return true;
 }
 
-bool
-parse_program (const char **input, schptr_t *sptr)
+// Parses a clause of a case expression, ((<datum>*) <expression>+),
+// where the datums are immediates
+static bool
+parse_case_clause (const char **input, case_clause_list_t **clause)
 {
   const char *ptr = *input;
 
-  // Syntax:
-  // <program> ->
-  //          <import declaration>+
-  // |        <command or definition>+
-  //
-  // TODO: implement import declaration support
-
-  expression_list_t *elst = NULL;
-  expression_list_t *last = NULL;
-  schptr_t e;
-  if (!parse_command_or_definition (&ptr, &e))
+  if (!parse_lparen (&ptr))
     return false;
 
-  elst = alloc (sizeof (*elst));
-  elst->expr = e;
-  elst->next = NULL;
-  last = elst;
+  // skip possible whitespace between lparen and the datums
+  (void)parse_whitespace (&ptr);
 
+  if (!parse_lparen (&ptr))
+    return false;
+
+  // skip possible whitespace between lparen and the first datum
   (void)parse_whitespace (&ptr);
 
-  while (parse_command_or_definition (&ptr, &e))
+  expression_list_t *datums = NULL;
+  expression_list_t *lastd = NULL;
+  schptr_t d;
+  while (parse_imm (&ptr, &d))
     {
+      // skip possible whitespace between datums
       (void)parse_whitespace (&ptr);
 
-      expression_list_t *n = alloc (sizeof (*n));
-      n->expr = e;
-      n->next = NULL;
-      last->next = n;
-      last = n;
+      expression_list_t *node = alloc (sizeof (*node));
+      node->expr = d;
+      node->next = NULL;
+      if (!datums)
+        datums = node;
+      else
+        lastd->next = node;
+      lastd = node;
     }
 
-  *input = ptr;
+  if (!parse_rparen (&ptr))
+    {
+      free_expression_list (datums);
+      return false;
+    }
 
-  schexprseq_t *seq = alloc (sizeof (*seq));
-  seq->type = SCH_EXPR_SEQ;
-  seq->seq = elst;
-  *sptr = (schptr_t)seq;
+  // skip possible whitespace between the datums and the expressions
+  (void)parse_whitespace (&ptr);
+
+  expression_list_t *exprs;
+  expression_list_t *laste;
+  if (!parse_expression_list_tail (&ptr, &exprs, &laste) || !exprs)
+    {
+      free_expression_list (datums);
+      return false;
+    }
+
+  *input = ptr;
 
+  *clause = alloc (sizeof (**clause));
+  (*clause)->datums = datums;
+  (*clause)->body = make_body (NULL, exprs);
+  (*clause)->next = NULL;
   return true;
 }
 
 bool
-parse_let_wo_id (const char **input, schptr_t *sptr)
+parse_case (const char **input, schptr_t *sptr)
 {
   const char *ptr = *input;
 
   // Parses an expression as follows:
-  // (let (<binding spec>*) <body>)
+  // (case <key> <case clause>* (else <expression>+)?)
+  // A case without an else clause has the value () when the key is none
+  // of the datums.
   if (!parse_lparen (&ptr))
     return false;
 
-  // skip possible whitespace between lparen and let keyword
+  // skip possible whitespace between lparen and case keyword
   (void)parse_whitespace (&ptr);
 
-  bool letstar = false;
-  if (parse_char_sequence (&ptr, "let*"))
-    letstar = true;
-  else if (!parse_char_sequence (&ptr, "let"))
+  if (!parse_keyword (&ptr, "case"))
     return false;
 
-  // skip possible whitespace between let and lparen
-  (void)parse_whitespace (&ptr);
-
-  if (!parse_lparen (&ptr))
+  schptr_t key;
+  if (!parse_expression (&ptr, &key))
     return false;
 
-  // Now we parse each of the binding specs and store them
-  binding_spec_list_t *bindings = NULL;
-  binding_spec_list_t *last = NULL;
-  schptr_t body;
+  // skip possible whitespace between the key and the clauses
+  (void)parse_whitespace (&ptr);
 
-  while (1)
+  case_clause_list_t *clauses = NULL;
+  case_clause_list_t *lastc = NULL;
+  case_clause_list_t *clause;
+  while (parse_case_clause (&ptr, &clause))
     {
-      schptr_t id;
-      schptr_t expr;
-      if (!parse_binding_spec (&ptr, &id, &expr))
-        break;
-
-      // skip possible whitespace between binding specs
+      // skip possible whitespace between clauses
       (void)parse_whitespace (&ptr);
 
-      binding_spec_list_t *b = alloc (sizeof (*b));
-      b->id = (schid_t *)id;
-      b->expr = expr;
-      b->next = NULL;
-
-      if (!bindings)
-        {
-          bindings = b;
-          last = b;
-        }
+      if (!clauses)
+        clauses = clause;
       else
-        {
-          last->next = b;
-          last = b;
-        }
-    }
-
-  // skip possible whitespace between last binding spec and rparen
-  (void)parse_whitespace (&ptr);
-
-  if (!parse_rparen (&ptr))
-    {
-      free_binding_spec_list (bindings);
-      return false;
+        lastc->next = clause;
+      lastc = clause;
     }
 
-  // skip possible whitespace between rparen and body
-  (void)parse_whitespace (&ptr);
+  schcase_t *c = alloc (sizeof (*c));
+  c->type = SCH_CASE;
+  c->key = key;
+  c->clauses = clauses;
+  c->elsev = sch_encode_imm_null ();
 
-  if (!parse_body (&ptr, &body))
+  if (parse_else_clause (&ptr, &c->elsev))
     {
-      free_binding_spec_list (bindings);
-      return false;
+      // skip possible whitespace between the else clause and rparen
+      (void)parse_whitespace (&ptr);
     }
 
-  // skip possible whitespace between body and rparen
-  (void)parse_whitespace (&ptr);
-
   if (!parse_rparen (&ptr))
     {
-      free_binding_spec_list (bindings);
-      free_expression (body);
+      free_expression ((schptr_t)c);
       return false;
     }
 
-  // Parse of let successful and complete
   *input = ptr;
-
-  schlet_t *l = (schlet_t *)alloc (sizeof (*l));
-  l->type = SCH_LET;
-  l->star_p = letstar;
-  l->bindings = bindings;
-  l->body = body;
-
-  *sptr = (schptr_t)l;
-
+  *sptr = (schptr_t)c;
   return true;
 }
 
 bool
-parse_if (const char **input, schptr_t *sptr)
+parse_lambda (const char **input, schptr_t *sptr)
 {
   const char *ptr = *input;
   // Parses an expression as follows:
-  // (if <expr> <expr> <expr>)
+  // (lambda (<identifier>*) <body>)
   if (!parse_lparen (&ptr))
     return false;
 
-  // skip possible whitespace between lparen and if keyword
+  // skip possible whitespace between lparen and lambda keyword
   (void)parse_whitespace (&ptr);
 
-  if (!parse_char_sequence (&ptr, "if"))
+  if (!parse_char_sequence (&ptr, "lambda"))
     return false;
 
-  // skip whitespace between if identifier and condition
-  (void)parse_whitespace (&ptr);
-
-  schptr_t condition;
-  schptr_t thenv;
-  schptr_t elsev;
-
-  if (!parse_expression (&ptr, &condition))
+  // the keyword has to end here, otherwise this is an identifier that
+  // starts with lambda
+  if (!parse_whitespace (&ptr) && *ptr != '(')
     return false;
 
-  // skip whitespace between condition and then-value
-  (void)parse_whitespace (&ptr);
-
-  if (!parse_expression (&ptr, &thenv))
+  expression_list_t *formals;
+  if (!parse_formals (&ptr, &formals))
     return false;
 
-  // skip whitespace between then-value and else-value
+  // skip possible whitespace between formals and body
   (void)parse_whitespace (&ptr);
 
-  if (!parse_expression (&ptr, &elsev))
-    return false;
+  schptr_t body;
+  if (!parse_body (&ptr, &body))
+    {
+      free_expression_list (formals);
+      return false;
+    }
 
-  // skip whitespace between else-value and right paren
+  // skip possible whitespace between body and rparen
   (void)parse_whitespace (&ptr);
 
   if (!parse_rparen (&ptr))
-    return false;
+    {
+      free_expression_list (formals);
+      free_expression (body);
+      return false;
+    }
 
-  // We parsed all we wanted now, so prepare return value
   *input = ptr;
-  schif_t *ifv = (schif_t *)alloc (sizeof *ifv);
 
-  ifv->type = SCH_IF;
-  ifv->condition = condition;
-  ifv->thenv = thenv;
-  ifv->elsev = elsev;
+  schlambda_t *l = alloc (sizeof *l);
+  l->type = SCH_LAMBDA;
+  l->formals = formals;
+  l->body = body;
 
-  *sptr = (schptr_t)ifv;
+  *sptr = (schptr_t)l;
   return true;
 }
 
@@ -693,8 +1910,13 @@ parse_imm_fixnum (const char **input, schptr_t *imm)
   uint64_t v = 0;
   for (; isdigit (*ptr); ptr++)
     {
+      const uint64_t d = *ptr - '0';
+
+      // Out of the range of fixnums, it is a bignum
+      if (v > ((uint64_t)FX_MAX + 1 - d) / 10)
+        return false;
       seen_num = true;
-      v = (v * 10) + (*ptr - '0');
+      v = (v * 10) + d;
     }
 
   if (seen_num)
@@ -806,6 +2028,105 @@ parse_imm (const char **input, schptr_t *imm)
          || parse_imm_null (input, imm) || parse_imm_char (input, imm);
 }
 
+// Parses an integer out of the range of fixnums, as a constant with the
+// words of its bignum
+bool
+parse_bignum (const char **input, schptr_t *sptr)
+{
+  const char *ptr = *input;
+  bool neg = false;
+
+  if (*ptr == '+' || *ptr == '-')
+    neg = *ptr++ == '-';
+  if (!isdigit (*ptr))
+    return false;
+
+  // Room for the header and the limbs, which take less than 19 digits each
+  size_t ndigits = 0;
+  while (isdigit (ptr[ndigits]))
+    ndigits++;
+  uint64_t *words = alloc ((ndigits / 19 + 2) * sizeof (*words));
+  uint64_t *limbs = words + 1;
+  size_t size = 0;
+
+  for (; isdigit (*ptr); ptr++)
+    {
+      uint64_t carry = *ptr - '0';
+      for (size_t k = 0; k < size; k++)
+        {
+          const unsigned __int128 t
+              = (unsigned __int128)limbs[k] * 10 + carry;
+          limbs[k] = (uint64_t)t;
+          carry = (uint64_t)(t >> 64);
+        }
+      if (carry)
+        limbs[size++] = carry;
+    }
+
+  if (size < 2 && (!size || limbs[0] <= (uint64_t)FX_MAX + neg))
+    {
+      free (words);
+      return false;
+    }
+
+  schconst_t *c = alloc (sizeof (*c));
+  c->type = SCH_CONST;
+  c->vtype = VT_BIGNUM;
+  c->nwords = size + 1;
+  c->words = words;
+  words[0] = ((uint64_t)size << BIGNUM_SIZE_SHIFT) | (neg ? BIGNUM_SIGN : 0)
+             | HEAP_BIGNUM;
+  *sptr = (schptr_t)c;
+  *input = ptr;
+  return true;
+}
+
+// Parses a constant: an immediate, or an object that is laid out
+// statically, like a bignum
+bool
+parse_constant (const char **input, schptr_t *sptr)
+{
+  return parse_imm (input, sptr) || parse_bignum (input, sptr);
+}
+
+// Parses a quotation, '<datum> or (quote <datum>). The only datums are
+// constants for now, whose quotation is the constant itself.
+bool
+parse_quotation (const char **input, schptr_t *sptr)
+{
+  const char *ptr = *input;
+
+  if (parse_char (&ptr, '\''))
+    {
+      (void)parse_whitespace (&ptr);
+      if (!parse_constant (&ptr, sptr))
+        return false;
+      *input = ptr;
+      return true;
+    }
+
+  if (!parse_lparen (&ptr))
+    return false;
+  (void)parse_whitespace (&ptr);
+  if (!parse_keyword (&ptr, "quote"))
+    return false;
+  (void)parse_whitespace (&ptr);
+
+  schptr_t c;
+  if (!parse_constant (&ptr, &c))
+    return false;
+  (void)parse_whitespace (&ptr);
+  if (!parse_rparen (&ptr))
+    {
+      free_expression (c);
+      return false;
+    }
+
+  *sptr = c;
+  *input = ptr;
+  return true;
+}
+
 bool
 parse_char (const char **input, char c)
 {
@@ -833,14 +2154,19 @@ bool
 parse_expression (const char **input, schptr_t *sptr)
 {
   // An expression is:
-  //   * an immediate,
+  //   * a constant, or a quotation of one,
   //   * a primitive,
-  //   * an if conditional
+  //   * an if conditional, or a derived conditional
+  //   * a let, let-values or do expression
+  //   * a lambda expression
   // or a parenthesized expression
 
-  if (parse_imm (input, sptr) || parse_identifier (input, sptr)
-      || parse_if (input, sptr) || parse_let_wo_id (input, sptr)
-      || parse_procedure_call (input, sptr))
+  if (parse_constant (input, sptr) || parse_quotation (input, sptr)
+      || parse_identifier (input, sptr) || parse_if (input, sptr)
+      || parse_cond (input, sptr) || parse_case (input, sptr)
+      || parse_and_or (input, sptr) || parse_let_values (input, sptr)
+      || parse_let_wo_id (input, sptr) || parse_do (input, sptr)
+      || parse_lambda (input, sptr) || parse_procedure_call (input, sptr))
     return true;
 
   return false;
@@ -908,30 +2234,55 @@ parse_procedure_call (const char **input, schptr_t *sptr)
   // Done with parsing procedure call
   *input = ptr;
 
-  // Ensure that we support these types of procedure calls
-  // Currently operator should be a primitive
+  // Applications of primitives are resolved here, anything else is a call
+  // to a procedure. values and call-with-values are resolved like them,
+  // as forms that the lowering connects to each other.
   schid_t *id = (schid_t *)op;
-  if (sch_imm_p (op) || id->type != SCH_ID)
+  const schprim_t *prim = NULL;
+  if (sch_ptr_p (op) && id->type == SCH_ID && !strcmp (id->name, "values"))
     {
-      fprintf (stderr, "unsupported operator type for procedure call\n");
-      exit (EXIT_FAILURE);
+      free_identifier (id);
+      *sptr = make_values (es);
+      return true;
     }
-
-  const schprim_t *prim = NULL;
-  for (size_t pi = 0; pi < primitives_count; pi++)
+  if (sch_ptr_p (op) && id->type == SCH_ID
+      && !strcmp (id->name, "call-with-values"))
     {
-      const schprim_t *p = &(primitives[pi]);
-      if (!strcmp (id->name, p->name))
+      if (noperands != 2)
         {
-          prim = p;
-          break;
+          fprintf (stderr,
+                   "wrong number of arguments to `call-with-values', "
+                   "expected 2, got %u\n",
+                   noperands);
+          exit (EXIT_FAILURE);
         }
+
+      free_identifier (id);
+      *sptr = make_call_values (es->expr, es->next->expr);
+      free (es->next);
+      free (es);
+      return true;
     }
 
+  if (sch_ptr_p (op) && id->type == SCH_ID)
+    for (size_t pi = 0; pi < primitives_count; pi++)
+      {
+        const schprim_t *p = &(primitives[pi]);
+        if (!strcmp (id->name, p->name))
+          {
+            prim = p;
+            break;
+          }
+      }
+
   if (!prim)
     {
-      fprintf (stderr, "unknown primitive function `%s'\n", id->name);
-      exit (EXIT_FAILURE);
+      schcall_t *c = alloc (sizeof *c);
+      c->type = SCH_CALL;
+      c->op = op;
+      c->args = es;
+      *sptr = (schptr_t)c;
+      return true;
     }
 
   if (prim->argcount != noperands)
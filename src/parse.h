@@ -28,17 +28,28 @@
 // Main parsing procedures
 
 bool parse_program (const char **, schptr_t *);
+bool parse_body (const char **, schptr_t *);
+bool parse_definition (const char **, schptr_t *, schptr_t *);
 bool parse_identifier (const char **, schptr_t *);
 bool parse_prim (const char **, schptr_t *);
 bool parse_prim1 (const char **, schptr_t *);
 bool parse_prim2 (const char **, schptr_t *);
 bool parse_expression (const char **, schptr_t *);
 bool parse_imm (const char **, schptr_t *);
+bool parse_bignum (const char **, schptr_t *);
+bool parse_constant (const char **, schptr_t *);
+bool parse_quotation (const char **, schptr_t *);
 bool parse_imm_bool (const char **, schptr_t *);
 bool parse_imm_null (const char **, schptr_t *);
 bool parse_imm_fixnum (const char **, schptr_t *);
 bool parse_imm_char (const char **, schptr_t *);
 bool parse_if (const char **, schptr_t *);
+bool parse_cond (const char **, schptr_t *);
+bool parse_case (const char **, schptr_t *);
+bool parse_and_or (const char **, schptr_t *);
+bool parse_let_values (const char **, schptr_t *);
+bool parse_do (const char **, schptr_t *);
+bool parse_lambda (const char **, schptr_t *);
 bool parse_procedure_call (const char **, schptr_t *);
 
 // Helper parsing procedures
@@ -0,0 +1,238 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pass.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "err.h"
+
+// Passes run in the order they appear here, each one only at -O levels
+// greater or equal than its level. Entries without a run function are
+// code generation options that the emitters query with pass_enabled_p.
+// Entries above OPT_LEVEL_MAX only run when forced on with -f.
+// Each pass runs on every procedure of the program in turn, except for
+// those that work across procedures.
+static const pass_t passes[]
+    = { { "checks", OPT_LEVEL_MAX + 1, pass_checks, NULL },
+        { "inline", 1, NULL, pass_inline },
+        { "unroll", 2, pass_unroll, NULL },
+        { "copyprop", 1, pass_copyprop, NULL },
+        { "fold", 1, pass_fold, NULL },
+        { "types", 1, pass_types, NULL },
+        { "cse", 1, pass_cse, NULL },
+        { "licm", 1, pass_licm, NULL },
+        { "dce", 1, pass_dce, NULL },
+        { "cmov", 1, pass_cmov, NULL },
+        { "cmov-force", OPT_LEVEL_MAX + 1, NULL, NULL },
+        { "sched", 2, pass_sched, NULL },
+        { "untag", 1, pass_untag, NULL },
+        { "regalloc", 1, pass_regalloc, NULL },
+        { "peephole", 1, NULL, NULL } };
+static const size_t passes_count = sizeof (passes) / sizeof (passes[0]);
+
+typedef enum
+{
+  PASS_DEFAULT,
+  PASS_FORCE_ON,
+  PASS_FORCE_OFF
+} pass_override;
+
+static pass_override overrides[sizeof (passes) / sizeof (passes[0])];
+
+static const pass_t *
+find_pass (const char *name, size_t *idx)
+{
+  for (size_t pi = 0; pi < passes_count; pi++)
+    if (!strcmp (passes[pi].name, name))
+      {
+        *idx = pi;
+        return &passes[pi];
+      }
+  return NULL;
+}
+
+// pass_configure: handles a `-f name' or `-f no-name' option, forcing a
+// pass on or off regardless of the optimization level.
+// Returns false if the pass is unknown.
+bool
+pass_configure (const char *opt)
+{
+  pass_override o = PASS_FORCE_ON;
+  if (!strncmp (opt, "no-", 3))
+    {
+      o = PASS_FORCE_OFF;
+      opt += 3;
+    }
+
+  size_t idx;
+  if (!find_pass (opt, &idx))
+    return false;
+
+  overrides[idx] = o;
+  return true;
+}
+
+bool
+pass_enabled_p (const char *name, unsigned int level)
+{
+  size_t idx;
+  const pass_t *p = find_pass (name, &idx);
+  if (!p)
+    err_unreachable ("querying unknown pass");
+
+  switch (overrides[idx])
+    {
+    case PASS_FORCE_ON:
+      return true;
+    case PASS_FORCE_OFF:
+      return false;
+    default:
+      return level >= p->level;
+    }
+}
+
+void
+pass_run_all (ir_program_t *prog, unsigned int level)
+{
+  for (size_t pi = 0; pi < passes_count; pi++)
+    {
+      const pass_t *p = &passes[pi];
+      if ((!p->run && !p->run_program) || !pass_enabled_p (p->name, level))
+        continue;
+
+      double start = pass_clock ();
+      if (p->run_program)
+        p->run_program (prog);
+      else
+        for (size_t k = 0; k < prog->nprocs; k++)
+          p->run (prog->procs[k]);
+      pass_record_time (p->name, pass_clock () - start);
+    }
+}
+
+//
+// Timing and statistics report
+//
+
+#define REPORT_MAX 64
+
+typedef struct report_time
+{
+  const char *name;
+  double secs;
+} report_time_t;
+
+typedef struct report_stat
+{
+  const char *pass;
+  const char *what;
+  size_t count;
+} report_stat_t;
+
+static report_time_t times[REPORT_MAX];
+static size_t times_count = 0;
+static report_stat_t stats[REPORT_MAX];
+static size_t stats_count = 0;
+static unsigned int report_paused = 0;
+
+// pass_clock: returns a monotonic time in seconds
+double
+pass_clock (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// pass_report_pause: stops recording times and statistics while paused,
+// as when a program is compiled again only to be measured. Pauses nest,
+// recording resumes once each of them is over.
+void
+pass_report_pause (bool paused)
+{
+  if (paused)
+    report_paused++;
+  else
+    report_paused--;
+}
+
+// pass_record_time: accumulates secs into the time spent in phase name
+void
+pass_record_time (const char *name, double secs)
+{
+  if (report_paused)
+    return;
+  for (size_t i = 0; i < times_count; i++)
+    if (!strcmp (times[i].name, name))
+      {
+        times[i].secs += secs;
+        return;
+      }
+
+  if (times_count == REPORT_MAX)
+    return;
+
+  times[times_count].name = name;
+  times[times_count].secs = secs;
+  times_count++;
+}
+
+// pass_record_stat: accumulates count into the statistic what of pass
+void
+pass_record_stat (const char *pass, const char *what, size_t count)
+{
+  if (report_paused)
+    return;
+  for (size_t i = 0; i < stats_count; i++)
+    if (!strcmp (stats[i].pass, pass) && !strcmp (stats[i].what, what))
+      {
+        stats[i].count += count;
+        return;
+      }
+
+  if (stats_count == REPORT_MAX)
+    return;
+
+  stats[stats_count].pass = pass;
+  stats[stats_count].what = what;
+  stats[stats_count].count = count;
+  stats_count++;
+}
+
+void
+pass_print_report (FILE *f)
+{
+  double total = 0;
+
+  fprintf (f, "Pass timing report:\n");
+  for (size_t i = 0; i < times_count; i++)
+    {
+      fprintf (f, "  %-20s %10.3f ms\n", times[i].name,
+               times[i].secs * 1e3);
+      total += times[i].secs;
+    }
+  fprintf (f, "  %-20s %10.3f ms\n", "total", total * 1e3);
+
+  if (!stats_count)
+    return;
+
+  fprintf (f, "Pass statistics:\n");
+  for (size_t i = 0; i < stats_count; i++)
+    fprintf (f, "  %-20s %-24s %zu\n", stats[i].pass, stats[i].what,
+             stats[i].count);
+}
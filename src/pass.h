@@ -0,0 +1,67 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include "ir.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Pass Manager
+//
+//
+///////////////////////////////////////////////////////////////////////
+
+typedef void (*pass_fn) (ir_proc_t *);
+typedef void (*program_pass_fn) (ir_program_t *);
+
+typedef struct pass
+{
+  const char *name;            // name used by -f and in the report
+  unsigned int level;          // lowest -O level at which the pass runs
+  pass_fn run;                 // run on each procedure in turn
+  program_pass_fn run_program; // or on the whole program at once
+} pass_t;
+
+#define OPT_LEVEL_MAX 2
+
+bool pass_configure (const char *);
+bool pass_enabled_p (const char *, unsigned int);
+void pass_run_all (ir_program_t *, unsigned int);
+
+// Timing and statistics report
+double pass_clock (void);
+void pass_report_pause (bool);
+void pass_record_time (const char *, double);
+void pass_record_stat (const char *, const char *, size_t);
+void pass_print_report (FILE *);
+
+// Passes
+void pass_checks (ir_proc_t *);
+void pass_inline (ir_program_t *);
+void pass_unroll (ir_proc_t *);
+void pass_copyprop (ir_proc_t *);
+void pass_fold (ir_proc_t *);
+void pass_cse (ir_proc_t *);
+void pass_licm (ir_proc_t *);
+void pass_types (ir_proc_t *);
+void pass_dce (ir_proc_t *);
+void pass_cmov (ir_proc_t *);
+void pass_sched (ir_proc_t *);
+void pass_untag (ir_proc_t *);
+void pass_regalloc (ir_proc_t *);
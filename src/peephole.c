@@ -0,0 +1,763 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "peephole.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+#include "memory.h"
+#include "pass.h"
+
+//
+// Building and printing
+//
+
+// asm_new: returns an empty list
+asm_list_t *
+asm_new (void)
+{
+  asm_list_t *l = alloc (sizeof (*l));
+  l->cap = 64;
+  l->lines = alloc (l->cap * sizeof (*l->lines));
+  l->count = 0;
+  return l;
+}
+
+// Returns a new line at the end of l
+static asm_line_t *
+asm_add (asm_list_t *l, asm_kind kind)
+{
+  if (l->count == l->cap)
+    {
+      l->cap *= 2;
+      l->lines = grow (l->lines, l->cap * sizeof (*l->lines));
+    }
+  asm_line_t *i = &l->lines[l->count++];
+  i->kind = kind;
+  i->text = NULL;
+  i->nargs = 0;
+  i->deleted = false;
+  return i;
+}
+
+// Appends the line in the n characters of s as it is
+static void
+asm_add_text (asm_list_t *l, const char *s, size_t n)
+{
+  asm_line_t *i = asm_add (l, ASM_OTHER);
+  i->text = alloc (n + 1);
+  memcpy (i->text, s, n);
+  i->text[n] = '\0';
+}
+
+// asm_insn_args: appends the instruction with the mnemonic and then the
+// operands in AT&T order in args, up to NULL. One that does not fit in
+// an asm_line_t is kept as text, which no rule matches.
+void
+asm_insn_args (asm_list_t *l, const char *const *args)
+{
+  size_t nargs = 0;
+  bool fits = strlen (args[0]) < ASM_OPND_MAX;
+  for (const char *const *a = args + 1; *a; a++, nargs++)
+    fits = fits && nargs < ASM_ARGS_MAX && strlen (*a) < ASM_OPND_MAX;
+
+  if (!fits)
+    {
+      char *text = NULL;
+      size_t size = 0;
+      FILE *m = open_memstream (&text, &size);
+      if (!m)
+        err_oom ();
+      fprintf (m, "    %-6s", args[0]);
+      for (size_t a = 1; a <= nargs; a++)
+        fprintf (m, "%s%s", a > 1 ? ", " : " ", args[a]);
+      fclose (m);
+      asm_add_text (l, text, size);
+      free (text);
+      return;
+    }
+
+  asm_line_t *i = asm_add (l, ASM_INSN);
+  strcpy (i->op, args[0]);
+  for (i->nargs = 0; i->nargs < nargs; i->nargs++)
+    strcpy (i->args[i->nargs], args[i->nargs + 1]);
+}
+
+// asm_label: appends the definition of label name
+void
+asm_label (asm_list_t *l, const char *name)
+{
+  if (strlen (name) >= ASM_OPND_MAX)
+    {
+      char text[strlen (name) + 2];
+      sprintf (text, "%s:", name);
+      asm_add_text (l, text, strlen (text));
+      return;
+    }
+  strcpy (asm_add (l, ASM_LABEL)->op, name);
+}
+
+// asm_directive: appends the directive formatted from fmt
+void
+asm_directive (asm_list_t *l, const char *fmt, ...)
+{
+  char *text = NULL;
+  size_t size = 0;
+  FILE *m = open_memstream (&text, &size);
+  if (!m)
+    err_oom ();
+  va_list ap;
+  va_start (ap, fmt);
+  fprintf (m, "    ");
+  vfprintf (m, fmt, ap);
+  va_end (ap);
+  fclose (m);
+  asm_add_text (l, text, size);
+  free (text);
+}
+
+// asm_fmt: returns the operand formatted from fmt, which has to fit
+asm_opnd_t
+asm_fmt (const char *fmt, ...)
+{
+  asm_opnd_t o;
+  va_list ap;
+  va_start (ap, fmt);
+  const int n = vsnprintf (o.s, sizeof (o.s), fmt, ap);
+  va_end (ap);
+  if (n < 0 || (size_t)n >= sizeof (o.s))
+    err_unreachable ("operand too long");
+  return o;
+}
+
+// asm_append: moves the lines of from to the end of l, and frees from
+void
+asm_append (asm_list_t *l, asm_list_t *from)
+{
+  for (size_t k = 0; k < from->count; k++)
+    *asm_add (l, ASM_OTHER) = from->lines[k];
+  free (from->lines);
+  free (from);
+}
+
+// asm_print: prints the lines of l that are left
+void
+asm_print (FILE *f, const asm_list_t *l)
+{
+  for (size_t k = 0; k < l->count; k++)
+    {
+      const asm_line_t *i = &l->lines[k];
+      if (i->deleted)
+        continue;
+      if (i->text)
+        fprintf (f, "%s\n", i->text);
+      else if (i->kind == ASM_LABEL)
+        fprintf (f, "%s:\n", i->op);
+      else
+        {
+          fprintf (f, "    %-6s", i->op);
+          for (size_t a = 0; a < i->nargs; a++)
+            fprintf (f, "%s%s", a ? ", " : " ", i->args[a]);
+          fprintf (f, "\n");
+        }
+    }
+}
+
+void
+asm_free (asm_list_t *l)
+{
+  for (size_t k = 0; k < l->count; k++)
+    free (l->lines[k].text);
+  free (l->lines);
+  free (l);
+}
+
+// Replaces instruction l by op with operands a and b, if not NULL
+static void
+asm_set (asm_line_t *l, const char *op, const char *a, const char *b)
+{
+  // The operands may be those of l itself
+  char args[2][ASM_OPND_MAX];
+  strcpy (args[0], a);
+  strcpy (args[1], b ? b : "");
+
+  strcpy (l->op, op);
+  strcpy (l->args[0], args[0]);
+  strcpy (l->args[1], args[1]);
+  l->nargs = b ? 2 : 1;
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Peephole Optimizer
+//
+// Rewrites the short sequences of instructions that the emitters leave
+// behind, since each one of them only sees its own instruction of the
+// IR: results computed in %rax and then moved to their temporaries, only
+// to be moved back for the next instruction, and jumps around the code of
+// the arm that comes next, among others.
+//
+// Each rule in peep_rules looks at the lines from one position on, and
+// rewrites them if they match. The rules are tried at every position in
+// turn until none of them does. The rules rely on what the emitters do:
+// the flags are not live across a label or a jump, and %rax is only live
+// from one instruction to the next.
+//
+///////////////////////////////////////////////////////////////////////
+
+#define PEEP_WINDOW 5
+
+typedef struct peep_window
+{
+  const asm_list_t *l;
+  asm_line_t *w[PEEP_WINDOW]; // lines left from the position on, or NULL
+  size_t idx[PEEP_WINDOW];    // and their index in l
+} peep_window_t;
+
+typedef bool (*peep_fn) (peep_window_t *);
+
+typedef struct peep_rule
+{
+  const char *name; // name in the statistics
+  peep_fn apply;
+} peep_rule_t;
+
+static void
+peep_fill (peep_window_t *pw, const asm_list_t *l, size_t k)
+{
+  pw->l = l;
+  for (size_t n = 0; n < PEEP_WINDOW; n++)
+    {
+      while (k < l->count && l->lines[k].deleted)
+        k++;
+      pw->w[n] = k < l->count ? &l->lines[k] : NULL;
+      pw->idx[n] = k++;
+    }
+}
+
+static bool
+insn_p (const asm_line_t *l, const char *op, size_t nargs)
+{
+  return l && l->kind == ASM_INSN && !strcmp (l->op, op)
+         && l->nargs == nargs;
+}
+
+static bool
+reg_p (const char *o)
+{
+  return o[0] == '%';
+}
+
+static bool
+mem_p (const char *o)
+{
+  return strchr (o, '(') != NULL;
+}
+
+// True if operand o mentions %rax, in any of its sizes
+static bool
+rax_in_p (const char *o)
+{
+  return strstr (o, "%rax") || strstr (o, "%eax") || strstr (o, "%ax")
+         || strstr (o, "%al") || strstr (o, "%ah");
+}
+
+// Value of the immediate operand o, false if it is not one
+static bool
+imm_value (const char *o, int64_t *v)
+{
+  char *end;
+  if (o[0] != '$' || !o[1])
+    return false;
+  *v = (int64_t)strtoull (o + 1, &end, 0);
+  return !*end;
+}
+
+static bool
+imm32_value_p (int64_t v)
+{
+  return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+// True if l is a jump, other than an indirect one, to a label
+static bool
+jump_p (const asm_line_t *l)
+{
+  return l && l->kind == ASM_INSN && l->op[0] == 'j' && l->nargs == 1
+         && l->args[0][0] != '*';
+}
+
+// Calls are taken to read the flags, since with -Os predicates call stubs
+// that turn them into booleans
+static bool
+flags_read_p (const char *op)
+{
+  return (op[0] == 'j' && strcmp (op, "jmp")) || !strncmp (op, "set", 3)
+         || !strcmp (op, "call")
+         || !strncmp (op, "cmov", 4) || !strncmp (op, "adc", 3)
+         || !strncmp (op, "sbb", 3);
+}
+
+static bool
+flags_write_p (const char *op)
+{
+  static const char *writers[]
+      = { "add",  "sub", "and", "or",     "xor",   "cmp",  "test",
+          "sal",  "sar", "shl", "shr",    "neg",   "inc",  "dec",
+          "imul", "bsf", "bsr", "popcnt", "lzcnt", "tzcnt" };
+
+  // The BMI2 shifts leave the flags alone
+  if (!strncmp (op, "sarx", 4) || !strncmp (op, "shlx", 4)
+      || !strncmp (op, "shrx", 4))
+    return false;
+  for (size_t k = 0; k < sizeof (writers) / sizeof (writers[0]); k++)
+    if (!strncmp (op, writers[k], strlen (writers[k])))
+      return true;
+  return false;
+}
+
+// True if the flags are not read after the first n lines of pw
+static bool
+peep_flags_dead_p (const peep_window_t *pw, size_t n)
+{
+  for (size_t k = pw->idx[n - 1] + 1; k < pw->l->count; k++)
+    {
+      const asm_line_t *i = &pw->l->lines[k];
+      if (i->deleted)
+        continue;
+      if (i->kind != ASM_INSN)
+        return true;
+      if (flags_read_p (i->op))
+        return false;
+      if (flags_write_p (i->op) || i->op[0] == 'j' || !strcmp (i->op, "ret"))
+        return true;
+    }
+  return true;
+}
+
+// movq A, B ; movq B, A => movq A, B
+// unless A is in memory at an address that B is part of, which the first
+// move changes
+static bool
+peep_reload (peep_window_t *pw)
+{
+  asm_line_t *a = pw->w[0];
+  asm_line_t *b = pw->w[1];
+  if (!insn_p (a, "movq", 2) || !insn_p (b, "movq", 2)
+      || strcmp (a->args[1], b->args[0]) || strcmp (a->args[0], b->args[1])
+      || (mem_p (a->args[0]) && strstr (a->args[0], a->args[1])))
+    return false;
+
+  b->deleted = true;
+  return true;
+}
+
+// movq R, M ; movq M, S => movq R, M ; movq R, S
+static bool
+peep_forward (peep_window_t *pw)
+{
+  asm_line_t *a = pw->w[0];
+  asm_line_t *b = pw->w[1];
+  if (!insn_p (a, "movq", 2) || !insn_p (b, "movq", 2)
+      || !reg_p (a->args[0]) || !mem_p (a->args[1])
+      || strcmp (a->args[1], b->args[0]) || !reg_p (b->args[1]))
+    return false;
+
+  asm_set (b, "movq", a->args[0], b->args[1]);
+  return true;
+}
+
+// True if l sets %rax without reading it
+static bool
+rax_set_p (const asm_line_t *l)
+{
+  return l && l->kind == ASM_INSN && l->nargs == 2
+         && (!strcmp (l->op, "movq") || !strcmp (l->op, "movl")
+             || !strcmp (l->op, "movabsq") || !strcmp (l->op, "leaq"))
+         && (!strcmp (l->args[1], "%rax") || !strcmp (l->args[1], "%eax"))
+         && !rax_in_p (l->args[0]);
+}
+
+// movq A, %rax ; movq %rax, B ; X => movq A, B ; X
+// where X sets %rax again, and the same with movl $n, %eax and with leaq
+static bool
+peep_through_rax (peep_window_t *pw)
+{
+  asm_line_t *a = pw->w[0];
+  asm_line_t *b = pw->w[1];
+  if (!rax_set_p (pw->w[2]) || !insn_p (b, "movq", 2)
+      || strcmp (b->args[0], "%rax") || rax_in_p (b->args[1]))
+    return false;
+
+  int64_t v;
+  const char *op = "movq";
+  if (insn_p (a, "leaq", 2) && !strcmp (a->args[1], "%rax")
+      && reg_p (b->args[1]))
+    op = "leaq";
+  else if (insn_p (a, "movl", 2) && !strcmp (a->args[1], "%eax")
+           && imm_value (a->args[0], &v) && v >= 0 && v <= INT32_MAX)
+    ;
+  else if (!insn_p (a, "movq", 2) || strcmp (a->args[1], "%rax")
+           || (mem_p (a->args[0]) && mem_p (b->args[1])))
+    return false;
+
+  a->deleted = true;
+  if (!strcmp (op, "movq") && !strcmp (a->args[0], b->args[1]))
+    b->deleted = true;
+  else
+    asm_set (b, op, a->args[0], b->args[1]);
+  return true;
+}
+
+// Names of the general purpose registers, in each of their sizes
+static const char *reg_names[][5]
+    = { { "%rax", "%eax", "%ax", "%al", "%ah" },
+        { "%rbx", "%ebx", "%bx", "%bl", "%bh" },
+        { "%rcx", "%ecx", "%cx", "%cl", "%ch" },
+        { "%rdx", "%edx", "%dx", "%dl", "%dh" },
+        { "%rsi", "%esi", "%si", NULL, NULL },
+        { "%rdi", "%edi", "%di", NULL, NULL },
+        { "%rbp", "%ebp", "%bp", NULL, NULL },
+        { "%rsp", "%esp", "%sp", NULL, NULL },
+        { "%r8", NULL, NULL, NULL, NULL },
+        { "%r9", NULL, NULL, NULL, NULL },
+        { "%r10", NULL, NULL, NULL, NULL },
+        { "%r11", NULL, NULL, NULL, NULL },
+        { "%r12", NULL, NULL, NULL, NULL },
+        { "%r13", NULL, NULL, NULL, NULL },
+        { "%r14", NULL, NULL, NULL, NULL },
+        { "%r15", NULL, NULL, NULL, NULL } };
+#define REG_NAMES_COUNT (sizeof (reg_names) / sizeof (reg_names[0]))
+
+// True if operand o mentions register r of reg_names, in any of its
+// sizes; the names of the sizes of %r8 to %r15 all start with the first
+static bool
+reg_in_p (const char *o, size_t r)
+{
+  for (size_t k = 0; k < 5 && reg_names[r][k]; k++)
+    if (strstr (o, reg_names[r][k]))
+      return true;
+  return false;
+}
+
+// movq A, R ; X => X
+// where R is set by an instruction after X, before anything reads it,
+// and no label, jump, call or return comes in between. Such moves are
+// left behind when a value only goes through a register on the way to
+// the one it ends up in.
+static bool
+peep_dead_move (peep_window_t *pw)
+{
+  const asm_line_t *a = pw->w[0];
+  if (!insn_p (a, "movq", 2) || !reg_p (a->args[1]))
+    return false;
+
+  size_t r = 0;
+  while (r < REG_NAMES_COUNT && strcmp (reg_names[r][0], a->args[1]))
+    r++;
+  if (r == REG_NAMES_COUNT || !strcmp (a->args[1], "%rsp"))
+    return false;
+
+  // Instructions with fewer than two operands may use registers without
+  // naming them, such as imulq and cqto
+  for (size_t k = pw->idx[0] + 1; k < pw->l->count; k++)
+    {
+      const asm_line_t *i = &pw->l->lines[k];
+      if (i->deleted)
+        continue;
+      if (i->kind != ASM_INSN || i->nargs < 2)
+        return false;
+      for (size_t o = 0; o + 1 < i->nargs; o++)
+        if (reg_in_p (i->args[o], r))
+          return false;
+
+      const char *dst = i->args[i->nargs - 1];
+      if (!reg_in_p (dst, r))
+        continue;
+      if ((!strcmp (i->op, "movq") || !strcmp (i->op, "leaq")
+           || !strcmp (i->op, "movabsq"))
+          && !strcmp (dst, reg_names[r][0]))
+        {
+          pw->w[0]->deleted = true;
+          return true;
+        }
+      return false;
+    }
+  return false;
+}
+
+// Parses leaq operand o when it scales a register by 2^n, as in
+// d(,S,2^n), or by 2, as in d(S,S), into d, S and n
+static bool
+lea_scaled (const char *o, int64_t *d, char *s, int64_t *n)
+{
+  const char *p = strchr (o, '(');
+  if (!p)
+    return false;
+
+  *d = 0;
+  if (p != o)
+    {
+      char *end;
+      *d = strtoll (o, &end, 0);
+      if (end != p)
+        return false;
+    }
+
+  char in[ASM_OPND_MAX];
+  strcpy (in, p + 1);
+  char *close = strchr (in, ')');
+  if (!close || close[1])
+    return false;
+  *close = '\0';
+
+  char *comma = strchr (in, ',');
+  if (!comma)
+    return false;
+  *comma = '\0';
+  const char *rest = comma + 1;
+  if (!in[0])
+    {
+      const char *c = strchr (rest, ',');
+      if (!c || (c[1] != '2' && c[1] != '4' && c[1] != '8') || c[2])
+        return false;
+      memcpy (s, rest, c - rest);
+      s[c - rest] = '\0';
+      *n = c[1] == '2' ? 1 : c[1] == '4' ? 2 : 3;
+      return true;
+    }
+  if (strcmp (in, rest))
+    return false;
+  strcpy (s, in);
+  *n = 1;
+  return true;
+}
+
+// sarq $a, R ; [andq $m, R ;] [movq R, S ;] salq $a, S
+//   => andq $(m << a), R ; [movq R, S]
+// and the same with shrq, and with leaq d(,S,2^a), S or d(S,S), S as the
+// left shift, which leaves leaq d(S), S. Shifting right and back left
+// only clears the low bits, as when fxarithmetic-shift goes back and
+// forth, or fixnum->char follows char->fixnum. With the movq, R is %rax,
+// which is not read after it.
+static bool
+peep_shifts (peep_window_t *pw)
+{
+  asm_line_t *sr = pw->w[0];
+  int64_t a;
+  if ((!insn_p (sr, "sarq", 2) && !insn_p (sr, "shrq", 2))
+      || !imm_value (sr->args[0], &a) || a < 1 || a > 63
+      || !reg_p (sr->args[1]))
+    return false;
+
+  const char *r = sr->args[1];
+  size_t n = 1;
+  int64_t m = -1;
+  asm_line_t *am = pw->w[n];
+  if (insn_p (am, "andq", 2) && !strcmp (am->args[1], r)
+      && imm_value (am->args[0], &m))
+    n++;
+  else
+    am = NULL;
+
+  const char *s = r;
+  asm_line_t *mov = pw->w[n];
+  if (insn_p (mov, "movq", 2) && !strcmp (mov->args[0], r)
+      && !strcmp (r, "%rax") && reg_p (mov->args[1]))
+    {
+      s = mov->args[1];
+      n++;
+    }
+
+  asm_line_t *sl = pw->w[n];
+  int64_t b;
+  int64_t d = 0;
+  if (insn_p (sl, "salq", 2) || insn_p (sl, "shlq", 2))
+    {
+      if (!imm_value (sl->args[0], &b) || strcmp (sl->args[1], s))
+        return false;
+    }
+  else if (insn_p (sl, "leaq", 2))
+    {
+      char x[ASM_OPND_MAX];
+      if (!lea_scaled (sl->args[0], &d, x, &b) || strcmp (x, s)
+          || strcmp (sl->args[1], s))
+        return false;
+    }
+  else
+    return false;
+
+  const int64_t mask = (int64_t)((uint64_t)m << a);
+  if (b != a || !imm32_value_p (mask) || !peep_flags_dead_p (pw, n + 1))
+    return false;
+
+  char k[ASM_OPND_MAX];
+  sprintf (k, "$%" PRId64, mask);
+  asm_set (sr, "andq", k, r);
+  if (am)
+    am->deleted = true;
+  if (d)
+    {
+      char o[ASM_OPND_MAX];
+      sprintf (o, "%" PRId64 "(%s)", d, s);
+      asm_set (sl, "leaq", o, s);
+    }
+  else
+    sl->deleted = true;
+  return true;
+}
+
+// andq $a, R ; andq $b, R => andq $(a & b), R
+// orq $a, R ; andq $b, R => andq $b, R, if a & b is 0
+static bool
+peep_masks (peep_window_t *pw)
+{
+  asm_line_t *a = pw->w[0];
+  asm_line_t *b = pw->w[1];
+  int64_t x;
+  int64_t y;
+  if (!insn_p (b, "andq", 2) || !imm_value (b->args[0], &y)
+      || (!insn_p (a, "andq", 2) && !insn_p (a, "orq", 2))
+      || !imm_value (a->args[0], &x) || strcmp (a->args[1], b->args[1]))
+    return false;
+
+  if (!strcmp (a->op, "orq"))
+    {
+      if (x & y)
+        return false;
+      a->deleted = true;
+      return true;
+    }
+  if (!imm32_value_p (x & y))
+    return false;
+
+  char n[ASM_OPND_MAX];
+  sprintf (n, "$%" PRId64, x & y);
+  asm_set (b, "andq", n, b->args[1]);
+  a->deleted = true;
+  return true;
+}
+
+// cmpq $0, R => testq R, R
+static bool
+peep_cmp_zero (peep_window_t *pw)
+{
+  asm_line_t *a = pw->w[0];
+  if (!insn_p (a, "cmpq", 2) || strcmp (a->args[0], "$0")
+      || !reg_p (a->args[1]))
+    return false;
+
+  asm_set (a, "testq", a->args[1], a->args[1]);
+  return true;
+}
+
+// jmp L ; [.p2align ;] L: => [.p2align ;] L:, and the same for conditional
+// jumps, as in a tail call to the procedure that comes next. Padding for
+// alignment in code is made of nops, which the fall through runs.
+static bool
+peep_jump_next (peep_window_t *pw)
+{
+  asm_line_t *a = pw->w[0];
+  if (!jump_p (a))
+    return false;
+
+  for (size_t n = 1; n < PEEP_WINDOW && pw->w[n]; n++)
+    {
+      const asm_line_t *l = pw->w[n];
+      if (l->kind == ASM_OTHER && l->text && strstr (l->text, ".p2align"))
+        continue;
+      if (l->kind != ASM_LABEL)
+        return false;
+      if (!strcmp (l->op, a->args[0]))
+        {
+          a->deleted = true;
+          return true;
+        }
+    }
+  return false;
+}
+
+// Conditional jumps, each one next to its negation
+static const char *negated_jumps[]
+    = { "je", "jne", "jz", "jnz", "jl", "jge", "jle", "jg", "jb",
+        "jae", "jbe", "ja", "jo", "jno", "js", "jns", "jc", "jnc" };
+
+// jcc L ; jmp M ; L: => jncc M ; L:
+static bool
+peep_branch_over (peep_window_t *pw)
+{
+  asm_line_t *a = pw->w[0];
+  asm_line_t *b = pw->w[1];
+  asm_line_t *l = pw->w[2];
+  if (!jump_p (a) || !jump_p (b) || strcmp (b->op, "jmp") || !l
+      || l->kind != ASM_LABEL || strcmp (l->op, a->args[0]))
+    return false;
+
+  for (size_t k = 0; k < sizeof (negated_jumps) / sizeof (negated_jumps[0]);
+       k++)
+    if (!strcmp (a->op, negated_jumps[k]))
+      {
+        asm_set (a, negated_jumps[k ^ 1], b->args[0], NULL);
+        b->deleted = true;
+        return true;
+      }
+  return false;
+}
+
+static const peep_rule_t peep_rules[]
+    = { { "stores reloaded", peep_reload },
+        { "loads forwarded", peep_forward },
+        { "moves through %rax", peep_through_rax },
+        { "moves overwritten", peep_dead_move },
+        { "shifts merged", peep_shifts },
+        { "masks merged", peep_masks },
+        { "compares with zero", peep_cmp_zero },
+        { "jumps to next", peep_jump_next },
+        { "branches over jumps", peep_branch_over } };
+#define PEEP_RULES_COUNT (sizeof (peep_rules) / sizeof (peep_rules[0]))
+
+// peephole_run: rewrites the instructions in l until no rule matches,
+// counting how often each rule does
+void
+peephole_run (asm_list_t *l)
+{
+  size_t fired[PEEP_RULES_COUNT] = { 0 };
+  bool changed = true;
+
+  while (changed)
+    {
+      changed = false;
+      for (size_t k = 0; k < l->count; k++)
+        for (size_t r = 0; r < PEEP_RULES_COUNT && !l->lines[k].deleted; r++)
+          {
+            peep_window_t pw;
+            peep_fill (&pw, l, k);
+            if (peep_rules[r].apply (&pw))
+              {
+                fired[r]++;
+                changed = true;
+              }
+          }
+    }
+
+  for (size_t r = 0; r < PEEP_RULES_COUNT; r++)
+    pass_record_stat ("peephole", peep_rules[r].name, fired[r]);
+}
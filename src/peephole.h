@@ -0,0 +1,81 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Assembly Lists
+//
+// The code of a procedure, or of all of them, as a list of lines:
+// instructions, with their mnemonic and operands in AT&T order, labels,
+// and the directives and anything else that is kept as it is. The
+// emitters build it a line at a time, and it is printed once the peephole
+// optimizer is done with it.
+//
+///////////////////////////////////////////////////////////////////////
+
+#define ASM_ARGS_MAX 3
+#define ASM_OPND_MAX 64
+
+typedef enum
+{
+  ASM_INSN,
+  ASM_LABEL,
+  ASM_OTHER
+} asm_kind;
+
+typedef struct asm_line
+{
+  asm_kind kind;
+  char *text; // line as it is printed, for those of kind ASM_OTHER
+  char op[ASM_OPND_MAX]; // mnemonic, or name of a label
+  char args[ASM_ARGS_MAX][ASM_OPND_MAX];
+  size_t nargs;
+  bool deleted;
+} asm_line_t;
+
+typedef struct asm_list
+{
+  asm_line_t *lines;
+  size_t count;
+  size_t cap;
+} asm_list_t;
+
+// An operand formatted by asm_fmt, which lives until the end of the
+// statement it is formatted in, as in asm_insn (l, "addq", asm_fmt ("$%d",
+// n).s, "%rax")
+typedef struct
+{
+  char s[ASM_OPND_MAX];
+} asm_opnd_t;
+
+asm_list_t *asm_new (void);
+void asm_insn_args (asm_list_t *, const char *const *);
+#define asm_insn(l, ...)                                                      \
+  asm_insn_args (l, (const char *const[]){ __VA_ARGS__, NULL })
+void asm_label (asm_list_t *, const char *);
+void asm_directive (asm_list_t *, const char *, ...)
+    __attribute__ ((format (printf, 2, 3)));
+asm_opnd_t asm_fmt (const char *, ...) __attribute__ ((format (printf, 1, 2)));
+void asm_append (asm_list_t *, asm_list_t *);
+void asm_print (FILE *, const asm_list_t *);
+void asm_free (asm_list_t *);
+
+void peephole_run (asm_list_t *);
@@ -17,34 +17,117 @@
 #pragma once
 
 #include "emit.h"
+#include "fold.h"
 
 // Order matter
 static const schprim_t primitives[]
-    = { { SCH_PRIM, "fxadd1", 1, emit_asm_prim_fxadd1 },
-        { SCH_PRIM, "fxsub1", 1, emit_asm_prim_fxsub1 },
-        { SCH_PRIM, "fxzero?", 1, emit_asm_prim_fxzerop },
-        { SCH_PRIM, "char->fixnum", 1, emit_asm_prim_char_to_fixnum },
-        { SCH_PRIM, "fixnum->char", 1, emit_asm_prim_fixnum_to_char },
-        { SCH_PRIM, "null?", 1, emit_asm_prim_nullp },
-        { SCH_PRIM, "not", 1, emit_asm_prim_not },
-        { SCH_PRIM, "fixnum?", 1, emit_asm_prim_fixnump },
-        { SCH_PRIM, "boolean?", 1, emit_asm_prim_booleanp },
-        { SCH_PRIM, "char?", 1, emit_asm_prim_charp },
-        { SCH_PRIM, "fxlognot", 1, emit_asm_prim_fxlognot },
-        { SCH_PRIM, "fx+", 2, emit_asm_prim_fxadd },
-        { SCH_PRIM, "fx-", 2, emit_asm_prim_fxsub },
-        { SCH_PRIM, "fx*", 2, emit_asm_prim_fxmul },
-        { SCH_PRIM, "fxlogand", 2, emit_asm_prim_fxlogand },
-        { SCH_PRIM, "fxlogor", 2, emit_asm_prim_fxlogor },
-        { SCH_PRIM, "fx=", 2, emit_asm_prim_fxeq },
-        { SCH_PRIM, "fx<=", 2, emit_asm_prim_fxle },
-        { SCH_PRIM, "fx<", 2, emit_asm_prim_fxlt },
-        { SCH_PRIM, "fx>=", 2, emit_asm_prim_fxge },
-        { SCH_PRIM, "fx>", 2, emit_asm_prim_fxgt },
-        { SCH_PRIM, "char=", 2, emit_asm_prim_chareq },
-        { SCH_PRIM, "char<=", 2, emit_asm_prim_charle },
-        { SCH_PRIM, "char<", 2, emit_asm_prim_charlt },
-        { SCH_PRIM, "char>=", 2, emit_asm_prim_charge },
-        { SCH_PRIM, "char>", 2, emit_asm_prim_chargt } };
+    = { { SCH_PRIM, "fxadd1", 1, emit_asm_prim_fxadd1, NULL,
+          fold_prim_fxadd1, EFFECT_NONE, VT_FIXNUM, VT_FIXNUM, VT_NONE,
+          UNTAGGED_BOTH, 1 },
+        { SCH_PRIM, "fxsub1", 1, emit_asm_prim_fxsub1, NULL,
+          fold_prim_fxsub1, EFFECT_NONE, VT_FIXNUM, VT_FIXNUM, VT_NONE,
+          UNTAGGED_BOTH, 1 },
+        { SCH_PRIM, "fxzero?", 1, emit_asm_prim_predicate,
+          emit_asm_test_fxzerop, fold_prim_fxzerop, EFFECT_NONE, VT_FIXNUM,
+          VT_BOOL, VT_NONE, UNTAGGED_ARGS, 3 },
+        { SCH_PRIM, "char->fixnum", 1, emit_asm_prim_char_to_fixnum, NULL,
+          fold_prim_char_to_fixnum, EFFECT_NONE, VT_CHAR, VT_FIXNUM, VT_NONE,
+          UNTAGGED_RESULT, 1 },
+        { SCH_PRIM, "fixnum->char", 1, emit_asm_prim_fixnum_to_char, NULL,
+          fold_prim_fixnum_to_char, EFFECT_NONE, VT_FIXNUM, VT_CHAR, VT_NONE,
+          UNTAGGED_ARGS, 2 },
+        { SCH_PRIM, "null?", 1, emit_asm_prim_predicate, emit_asm_test_nullp,
+          fold_prim_nullp, EFFECT_NONE, VT_ANY, VT_BOOL, VT_NULL,
+          UNTAGGED_NONE, 3 },
+        { SCH_PRIM, "not", 1, emit_asm_prim_predicate, emit_asm_test_not,
+          fold_prim_not, EFFECT_NONE, VT_ANY, VT_BOOL, VT_FALSE,
+          UNTAGGED_NONE, 3 },
+        { SCH_PRIM, "fixnum?", 1, emit_asm_prim_predicate,
+          emit_asm_test_fixnump, fold_prim_fixnump, EFFECT_NONE, VT_ANY,
+          VT_BOOL, VT_FIXNUM, UNTAGGED_NONE, 3 },
+        { SCH_PRIM, "boolean?", 1, emit_asm_prim_predicate,
+          emit_asm_test_booleanp, fold_prim_booleanp, EFFECT_NONE, VT_ANY,
+          VT_BOOL, VT_BOOL, UNTAGGED_NONE, 3 },
+        { SCH_PRIM, "char?", 1, emit_asm_prim_predicate, emit_asm_test_charp,
+          fold_prim_charp, EFFECT_NONE, VT_ANY, VT_BOOL, VT_CHAR,
+          UNTAGGED_NONE, 3 },
+        { SCH_PRIM, "fxlognot", 1, emit_asm_prim_fxlognot, NULL,
+          fold_prim_fxlognot, EFFECT_NONE, VT_FIXNUM, VT_FIXNUM, VT_NONE,
+          UNTAGGED_BOTH, 1 },
+        { SCH_PRIM, "fx+", 2, emit_asm_prim_fxadd, NULL, fold_prim_fxadd,
+          EFFECT_NONE, VT_FIXNUM, VT_FIXNUM, VT_NONE, UNTAGGED_BOTH, 1 },
+        { SCH_PRIM, "fx-", 2, emit_asm_prim_fxsub, NULL, fold_prim_fxsub,
+          EFFECT_NONE, VT_FIXNUM, VT_FIXNUM, VT_NONE, UNTAGGED_BOTH, 1 },
+        { SCH_PRIM, "fx*", 2, emit_asm_prim_fxmul, NULL, fold_prim_fxmul,
+          EFFECT_NONE, VT_FIXNUM, VT_FIXNUM, VT_NONE, UNTAGGED_BOTH, 4 },
+        { SCH_PRIM, "fxlogand", 2, emit_asm_prim_fxlogand, NULL,
+          fold_prim_fxlogand, EFFECT_NONE, VT_FIXNUM, VT_FIXNUM, VT_NONE,
+          UNTAGGED_BOTH, 1 },
+        { SCH_PRIM, "fxlogor", 2, emit_asm_prim_fxlogor, NULL,
+          fold_prim_fxlogor, EFFECT_NONE, VT_FIXNUM, VT_FIXNUM, VT_NONE,
+          UNTAGGED_BOTH, 1 },
+        { SCH_PRIM, "fxlogxor", 2, emit_asm_prim_fxlogxor, NULL,
+          fold_prim_fxlogxor, EFFECT_NONE, VT_FIXNUM, VT_FIXNUM, VT_NONE,
+          UNTAGGED_BOTH, 1 },
+        { SCH_PRIM, "fxarithmetic-shift", 2, emit_asm_prim_fxash, NULL,
+          fold_prim_fxash, EFFECT_NONE, VT_FIXNUM, VT_FIXNUM, VT_NONE,
+          UNTAGGED_BOTH, 2 },
+        { SCH_PRIM, "fxbit-count", 1, emit_asm_prim_fxbit_count, NULL,
+          fold_prim_fxbit_count, EFFECT_NONE, VT_FIXNUM, VT_FIXNUM, VT_NONE,
+          UNTAGGED_BOTH, 5 },
+        { SCH_PRIM, "fxlength", 1, emit_asm_prim_fxlength, NULL,
+          fold_prim_fxlength, EFFECT_NONE, VT_FIXNUM, VT_FIXNUM, VT_NONE,
+          UNTAGGED_BOTH, 5 },
+        { SCH_PRIM, "fxfirst-bit-set", 1, emit_asm_prim_fxfirst_bit_set,
+          NULL, fold_prim_fxfirst_bit_set, EFFECT_NONE, VT_FIXNUM, VT_FIXNUM,
+          VT_NONE, UNTAGGED_BOTH, 4 },
+        { SCH_PRIM, "fxquotient", 2, emit_asm_prim_fxquotient, NULL,
+          fold_prim_fxquotient, EFFECT_DIVIDE, VT_FIXNUM, VT_FIXNUM, VT_NONE,
+          UNTAGGED_BOTH, 6 },
+        { SCH_PRIM, "fxremainder", 2, emit_asm_prim_fxremainder, NULL,
+          fold_prim_fxremainder, EFFECT_DIVIDE, VT_FIXNUM, VT_FIXNUM, VT_NONE,
+          UNTAGGED_BOTH, 9 },
+        { SCH_PRIM, "fxmodulo", 2, emit_asm_prim_fxmodulo, NULL,
+          fold_prim_fxmodulo, EFFECT_DIVIDE, VT_FIXNUM, VT_FIXNUM, VT_NONE,
+          UNTAGGED_BOTH, 10 },
+        { SCH_PRIM, "+", 2, emit_asm_prim_add, NULL, fold_prim_add,
+          EFFECT_RAISE | EFFECT_ALLOC, VT_NUMBER, VT_NUMBER, VT_NONE,
+          UNTAGGED_NONE, 2 },
+        { SCH_PRIM, "-", 2, emit_asm_prim_sub, NULL, fold_prim_sub,
+          EFFECT_RAISE | EFFECT_ALLOC, VT_NUMBER, VT_NUMBER, VT_NONE,
+          UNTAGGED_NONE, 2 },
+        { SCH_PRIM, "*", 2, emit_asm_prim_mul, NULL, fold_prim_mul,
+          EFFECT_RAISE | EFFECT_ALLOC, VT_NUMBER, VT_NUMBER, VT_NONE,
+          UNTAGGED_NONE, 4 },
+        { SCH_PRIM, "fx=", 2, emit_asm_prim_predicate, emit_asm_test_fxeq,
+          fold_prim_fxeq, EFFECT_NONE, VT_FIXNUM, VT_BOOL, VT_NONE,
+          UNTAGGED_ARGS, 3 },
+        { SCH_PRIM, "fx<=", 2, emit_asm_prim_predicate, emit_asm_test_fxle,
+          fold_prim_fxle, EFFECT_NONE, VT_FIXNUM, VT_BOOL, VT_NONE,
+          UNTAGGED_ARGS, 3 },
+        { SCH_PRIM, "fx<", 2, emit_asm_prim_predicate, emit_asm_test_fxlt,
+          fold_prim_fxlt, EFFECT_NONE, VT_FIXNUM, VT_BOOL, VT_NONE,
+          UNTAGGED_ARGS, 3 },
+        { SCH_PRIM, "fx>=", 2, emit_asm_prim_predicate, emit_asm_test_fxge,
+          fold_prim_fxge, EFFECT_NONE, VT_FIXNUM, VT_BOOL, VT_NONE,
+          UNTAGGED_ARGS, 3 },
+        { SCH_PRIM, "fx>", 2, emit_asm_prim_predicate, emit_asm_test_fxgt,
+          fold_prim_fxgt, EFFECT_NONE, VT_FIXNUM, VT_BOOL, VT_NONE,
+          UNTAGGED_ARGS, 3 },
+        { SCH_PRIM, "char=", 2, emit_asm_prim_predicate,
+          emit_asm_test_chareq, fold_prim_chareq, EFFECT_NONE, VT_CHAR,
+          VT_BOOL, VT_NONE, UNTAGGED_NONE, 3 },
+        { SCH_PRIM, "char<=", 2, emit_asm_prim_predicate,
+          emit_asm_test_charle, fold_prim_charle, EFFECT_NONE, VT_CHAR,
+          VT_BOOL, VT_NONE, UNTAGGED_NONE, 3 },
+        { SCH_PRIM, "char<", 2, emit_asm_prim_predicate,
+          emit_asm_test_charlt, fold_prim_charlt, EFFECT_NONE, VT_CHAR,
+          VT_BOOL, VT_NONE, UNTAGGED_NONE, 3 },
+        { SCH_PRIM, "char>=", 2, emit_asm_prim_predicate,
+          emit_asm_test_charge, fold_prim_charge, EFFECT_NONE, VT_CHAR,
+          VT_BOOL, VT_NONE, UNTAGGED_NONE, 3 },
+        { SCH_PRIM, "char>", 2, emit_asm_prim_predicate,
+          emit_asm_test_chargt, fold_prim_chargt, EFFECT_NONE, VT_CHAR,
+          VT_BOOL, VT_NONE, UNTAGGED_NONE, 3 } };
 static const size_t primitives_count
     = sizeof (primitives) / sizeof (primitives[0]);
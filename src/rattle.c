@@ -28,10 +28,14 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "cpu.h"
 #include "emit.h"
 #include "err.h"
+#include "expand.h"
+#include "ir.h"
 #include "memory.h"
 #include "parse.h"
+#include "pass.h"
 #include "structs.h"
 
 #include "common.h"
@@ -46,23 +50,31 @@ static const char *CC = "/usr/bin/cc";
 void __attribute__ ((noreturn)) usage (const char *prog)
 {
   fprintf (stderr, "rattle version %d.%d\n", VERSION_MAJOR, VERSION_MINOR);
-  fprintf (stderr, "Usage: %s [-hec] [expression ...]\n", prog);
+  fprintf (stderr,
+           "Usage: %s [-hdsetiCO<level|s>] [-f [no-]pass] [-m cpu=<name>] "
+           "[-c file -o out] [expression ...]\n",
+           prog);
   exit (EXIT_FAILURE);
 }
 
 void __attribute__ ((noreturn)) help (const char *prog) { usage (prog); }
 
 // Prototypes
-void evaluate (const char *);
+int evaluate (const char *);
 void compile (const char *, const char *);
-void compile_program (const char *);
+int compile_program (const char *);
 
 // TODO find correct posix value
 #define FILE_PATH_MAX 1024
 
 // Option globals
 static bool dump_p = false;
+static bool dump_ir_p = false;
 static bool save_temps_p = false;
+static bool timing_p = false;
+static unsigned int opt_level = 1;
+static bool size_p = false;
+static cpu_features_t cpu_features = 0;
 
 int
 main (int argc, char *argv[])
@@ -70,11 +82,15 @@ main (int argc, char *argv[])
 
   bool compile_p = false;
   bool evaluate_p = false;
+  int status = EXIT_SUCCESS;
   char input[FILE_PATH_MAX];
   char output[FILE_PATH_MAX];
 
+  // Code is for the host, unless -m cpu says otherwise
+  cpu_features = cpu_host_features ();
+
   int opt;
-  while ((opt = getopt (argc, argv, "hdsec:o:")) != -1)
+  while ((opt = getopt (argc, argv, "hdisetCO:f:m:c:o:")) != -1)
     {
       switch (opt)
         {
@@ -84,9 +100,56 @@ main (int argc, char *argv[])
         case 'd':
           dump_p = true;
           break;
+        case 'i':
+          dump_ir_p = true;
+          break;
         case 's':
           save_temps_p = true;
           break;
+        case 't':
+          timing_p = true;
+          break;
+        case 'C':
+          // Safe mode, checking the types of the arguments of primitives
+          pass_configure ("checks");
+          break;
+        case 'O':
+          // -Os runs the passes of -O1, without the unrolling of -O2, and
+          // emits the code for size
+          if (!strcmp (optarg, "s"))
+            {
+              opt_level = 1;
+              size_p = true;
+              break;
+            }
+          {
+            char *end;
+            unsigned long l = strtoul (optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || l > OPT_LEVEL_MAX)
+              {
+                fprintf (stderr, "invalid optimization level `%s'\n",
+                         optarg);
+                usage (argv[0]);
+              }
+            opt_level = (unsigned int)l;
+            size_p = false;
+          }
+          break;
+        case 'f':
+          if (!pass_configure (optarg))
+            {
+              fprintf (stderr, "unknown pass `%s'\n", optarg);
+              usage (argv[0]);
+            }
+          break;
+        case 'm':
+          if (strncmp (optarg, "cpu=", 4)
+              || !cpu_parse (optarg + 4, &cpu_features))
+            {
+              fprintf (stderr, "unknown machine option `%s'\n", optarg);
+              usage (argv[0]);
+            }
+          break;
         case 'c':
           compile_p = true;
           strncpy (input, optarg, FILE_PATH_MAX);
@@ -129,13 +192,16 @@ main (int argc, char *argv[])
         }
 
       const char *cmd = argv[optind];
-      evaluate (cmd);
+      status = evaluate (cmd);
     }
 
   if (compile_p)
     compile (input, output);
 
-  return 0;
+  if (timing_p)
+    pass_print_report (stderr);
+
+  return status;
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -149,16 +215,28 @@ main (int argc, char *argv[])
 
 // Prototypes
 const char *find_system_tmpdir (void);
+void report_text_size (const ir_program_t *);
 
-// Evaluation
-void
+// Evaluation, returns the exit status of the program
+int
 evaluate (const char *cmd)
 {
-  compile_program (cmd);
+  return compile_program (cmd);
 }
 
+// Registers that scheme_entry saves for C: the allocation pointer and the
+// registers that temporaries are allocated to. With the C stack pointer,
+// they take the first SAVED_REGS_FRAME bytes of the stack, rounded up to
+// keep it aligned.
+static const char *saved_regs[]
+    = { "%r15", "%rbx", "%r12", "%r13", "%r14", "%rbp" };
+#define SAVED_REGS_COUNT (sizeof (saved_regs) / sizeof (saved_regs[0]))
+#define SAVED_REGS_FRAME (((SAVED_REGS_COUNT + 2) & ~(size_t)1) * WORD_BYTES)
+
+// Writes the assembly of program ir to a temporary file, emitted for size
+// if size, and returns its path
 char *
-output_asm (schptr_t sptr)
+output_asm (const ir_program_t *ir, bool size)
 {
   const char *tmpdir = find_system_tmpdir ();
   char itemplate[FILE_PATH_MAX] = {
@@ -183,21 +261,46 @@ output_asm (schptr_t sptr)
     }
 
   // write asm file
-  emit_asm_prologue (i, "L_scheme_entry");
-  emit_asm_expr (i, sptr, WORD_BYTES, make_env ());
-  emit_asm_epilogue (i);
-
-  // scheme entry received one argument in %rdi,
-  // which is the stack top pointer.
-  emit_asm_prologue (i, "scheme_entry");
-  fprintf (i, "    movq %%rsp, %%rcx\n");
-  fprintf (i, "    leaq -4(%%rdi), %%rsp\n");
-  fprintf (i, "    call %sL_scheme_entry\n", ASM_SYMBOL_PREFIX);
-  fprintf (i, "    movq %%rcx, %%rsp\n");
-  emit_asm_epilogue (i);
+  double start = pass_clock ();
+  asm_list_t *code = asm_new ();
+  emit_asm_prologue (code, "L_scheme_entry");
+  emit_asm_program (code, ir, opt_level, cpu_features, size);
+  emit_asm_cold (code);
+
+  // scheme entry received two arguments, the stack top pointer in %rdi
+  // and the heap in %rsi. The C stack pointer, %r15, which the program
+  // uses as its allocation pointer, and the other registers that C
+  // expects to be kept, which the program allocates temporaries to, are
+  // saved in the first words of the stack. It stays aligned like the C
+  // stack so that the program can call into the runtime. Multiple values
+  // returned by the program are all left in runtime_values, where the
+  // runtime prints them from.
+  emit_asm_prologue (code, "scheme_entry");
+  asm_insn (code, "movq", "%rsp", "-8(%rdi)");
+  for (size_t k = 0; k < SAVED_REGS_COUNT; k++)
+    asm_insn (code, "movq", saved_regs[k],
+              asm_fmt ("-%zu(%%rdi)", (k + 2) * WORD_BYTES).s);
+  asm_insn (code, "leaq", asm_fmt ("-%zu(%%rdi)", SAVED_REGS_FRAME).s,
+            "%rsp");
+  asm_insn (code, "movq", "%rsi", "%r15");
+  asm_insn (code, "call", ASM_SYMBOL_PREFIX "L_scheme_entry");
+  emit_asm_values_spill (code);
+  for (size_t k = 0; k < SAVED_REGS_COUNT; k++)
+    {
+      const size_t slot = SAVED_REGS_FRAME - (k + 2) * WORD_BYTES;
+      asm_insn (code, "movq", asm_fmt ("%zu(%%rsp)", slot).s, saved_regs[k]);
+    }
+  asm_insn (code, "movq",
+            asm_fmt ("%zu(%%rsp)", SAVED_REGS_FRAME - WORD_BYTES).s, "%rsp");
+  emit_asm_epilogue (code);
+  if (timing_p)
+    emit_asm_text_size (code, "L_scheme_entry", "scheme_text_size");
+  asm_print (i, code);
+  asm_free (code);
 
   // close file
   fclose (i);
+  pass_record_time ("isel", pass_clock () - start);
 
   char *ipath = strdup (itemplate);
   if (!ipath)
@@ -206,6 +309,45 @@ output_asm (schptr_t sptr)
   return ipath;
 }
 
+// Parses the program in s, lowers it to IR and optimizes it
+ir_program_t *
+front_end (const char *s)
+{
+  schptr_t sptr = 0;
+
+  double start = pass_clock ();
+  char *expanded = expand_program (s);
+  if (expanded)
+    pass_record_time ("expand", pass_clock () - start);
+
+  start = pass_clock ();
+  const char *cs = expanded ? expanded : s;
+  (void)parse_whitespace (&cs);
+
+  if (!parse_program (&cs, &sptr))
+    err_parse (cs);
+  pass_record_time ("parse", pass_clock () - start);
+  free (expanded);
+
+  start = pass_clock ();
+  ir_program_t *ir = ir_lower (sptr);
+  pass_record_time ("lower", pass_clock () - start);
+
+  // free expression
+  free_expression (sptr);
+
+  pass_run_all (ir, opt_level);
+
+  if (dump_ir_p)
+    {
+      printf ("IR dump:\n");
+      ir_dump (stdout, ir);
+      printf ("End of IR dump\n");
+    }
+
+  return ir;
+}
+
 char *
 read_file_to_mem (const char *path)
 {
@@ -259,22 +401,19 @@ void
 compile (const char *input, const char *output)
 {
   char *s = read_file_to_mem (input);
-  schptr_t sptr = 0;
-  const char *cs = s;
-
-  (void)parse_whitespace (&cs);
-
-  if (!parse_program (&cs, &sptr))
-    err_parse (cs);
+  ir_program_t *ir = front_end (s);
 
   // free parsed string
   free (s);
 
-  char *asmtmp = output_asm (sptr);
+  if (timing_p)
+    report_text_size (ir);
+
+  char *asmtmp = output_asm (ir, size_p);
   dump_asm_if_needed (asmtmp);
 
-  // free expression
-  free_expression (sptr);
+  // free intermediate representation
+  ir_free_program (ir);
 
   // Now compile file and link with runtime
   {
@@ -324,56 +463,115 @@ find_system_tmpdir (void)
   return real_tmpdir;
 }
 
+// Sets path to a new temporary file for a shared library
 void
-compile_program (const char *e)
+temp_library_path (char *path)
 {
-  schptr_t sptr = 0;
-
-  (void)parse_whitespace (&e);
-
-  if (!parse_program (&e, &sptr))
-    err_parse (e);
-
   const char *tmpdir = find_system_tmpdir ();
-  char otemplate[FILE_PATH_MAX] = {
-    0,
-  };
-  strncpy (otemplate, tmpdir, FILE_PATH_MAX);
-  strncat (otemplate, "/librattleXXXXXX.so", FILE_PATH_MAX - strlen (tmpdir));
-  otemplate[FILE_PATH_MAX - 1] = '\0';
+  strncpy (path, tmpdir, FILE_PATH_MAX);
+  path[FILE_PATH_MAX - 1] = '\0';
+  strncat (path, "/librattleXXXXXX.so", FILE_PATH_MAX - strlen (path) - 1);
 
-  int ofd = mkstemps (otemplate, 3);
-  if (ofd == -1)
+  int fd = mkstemps (path, 3);
+  if (fd == -1)
     {
       fprintf (stderr, "error creating temporary files for compilation\n");
       exit (EXIT_FAILURE);
     }
 
-  char *asmtmp = output_asm (sptr);
-  dump_asm_if_needed (asmtmp);
+  // close fd so gcc can write to it
+  close (fd);
+}
 
-  // free expression
-  free_expression (sptr);
+// Assembles the file at asmpath and links it with the runtime into the
+// shared library at sopath
+void
+link_library (const char *asmpath, const char *sopath)
+{
+  int child = fork ();
+  if (child == 0)
+    {
+      // inside child
+      execl (CC, CC, "-shared", "-fPIC", "-o", sopath, asmpath, "runtime.o",
+             (char *)NULL);
 
-  // close ofd so gcc can write to it
-  close (ofd);
+      // unreachable
+      assert (false);
+    }
 
-  // Now compile file and link with runtime
-  {
-    int child = fork ();
-    if (child == 0)
-      {
-        // inside child
-        execl (CC, CC, "-shared", "-fPIC", "-o", otemplate, asmtmp,
-               "runtime.o", (char *)NULL);
+  // wait for child to complete compilation
+  waitpid (child, NULL, 0);
+}
 
-        // unreachable
-        assert (false);
-      }
+// Returns the size in bytes of the code of program ir, emitted for size if
+// size, as the assembler lays it out in a library of its own
+size_t
+text_size (const ir_program_t *ir, bool size)
+{
+  pass_report_pause (true);
+  char *asmtmp = output_asm (ir, size);
+  pass_report_pause (false);
+
+  char sopath[FILE_PATH_MAX];
+  temp_library_path (sopath);
+  link_library (asmtmp, sopath);
+  unlink (asmtmp);
+  free (asmtmp);
 
-    // wait for child to complete compilation
-    waitpid (child, NULL, 0);
-  }
+  size_t n = 0;
+  void *handle = dlopen (sopath, RTLD_NOW | RTLD_LOCAL);
+  if (handle)
+    {
+      const uint64_t *p = dlsym (handle, "scheme_text_size");
+      if (p)
+        n = *p;
+      dlclose (handle);
+    }
+  unlink (sopath);
+  return n;
+}
+
+// Records the size of the code of program ir in the report of -t, and with
+// -Os its size without it
+void
+report_text_size (const ir_program_t *ir)
+{
+  pass_record_stat ("size", "text bytes", text_size (ir, size_p));
+  if (size_p)
+    pass_record_stat ("size", "text bytes without -Os", text_size (ir, false));
+}
+
+int
+compile_program (const char *e)
+{
+  ir_program_t *ir = front_end (e);
+
+  // Programs that folded to a constant are printed right away, there
+  // is no need to assemble and run them. Keep going if the user asked to
+  // see the assembly or the temporary files though.
+  schptr_t v;
+  if (!dump_p && !save_temps_p && ir_constant_p (ir, &v))
+    {
+      sch_print_imm (stdout, v);
+      printf ("\n");
+      ir_free_program (ir);
+      return EXIT_SUCCESS;
+    }
+
+  if (timing_p)
+    report_text_size (ir);
+
+  char otemplate[FILE_PATH_MAX];
+  temp_library_path (otemplate);
+
+  char *asmtmp = output_asm (ir, size_p);
+  dump_asm_if_needed (asmtmp);
+
+  // free intermediate representation
+  ir_free_program (ir);
+
+  // Now compile file and link with runtime
+  link_library (asmtmp, otemplate);
 
   // remove input file and close port
   if (save_temps_p)
@@ -384,9 +582,10 @@ compile_program (const char *e)
 
   // We have compiled the linked library so we are ready to
   // dynamically load the library
+  int status;
   {
     void *handle = NULL;
-    void (*fn) (void);
+    int (*fn) (void);
     handle = dlopen (otemplate, RTLD_NOW | RTLD_GLOBAL);
 
     if (!handle)
@@ -403,7 +602,7 @@ compile_program (const char *e)
         exit (EXIT_FAILURE);
       }
 
-    fn ();
+    status = fn ();
     dlclose (handle);
   }
 
@@ -412,4 +611,6 @@ compile_program (const char *e)
     printf ("Temporary shared object kept at `%s'\n", otemplate);
   else
     unlink (otemplate);
+
+  return status;
 }
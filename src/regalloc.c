@@ -0,0 +1,290 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include "memory.h"
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Register Allocation
+//
+// Linear scan over the instructions in the order they are emitted. Each
+// instruction reads its operands at one position and, after the blocks
+// nested in it, writes its destination at the next one, so the live
+// interval of a temporary goes from its definition to its last use. A
+// temporary defined before a loop and used in it is live until the end
+// of the loop, since the next iteration may use it again, and so are the
+// variables of the loop.
+//
+// Calls clobber every register, so the temporaries live across one stay
+// in their stack slots. The others are given one of the REGALLOC_REGS
+// registers, in the order their intervals start. When none is free, the
+// interval that ends last, among the ones in registers and the one being
+// allocated, is spilled to its slot.
+//
+///////////////////////////////////////////////////////////////////////
+
+#define REGALLOC_NONE ((size_t)-1)
+
+typedef struct interval
+{
+  size_t temp;
+  size_t start;
+  size_t end;
+} interval_t;
+
+typedef struct regalloc
+{
+  ir_proc_t *p;
+  size_t pos;        // next position
+  interval_t *ivs;   // live interval of each temporary
+  interval_t *loops; // extent of each loop, in the order they start
+  size_t nloops;
+  size_t *open; // loops around the current position, outermost first
+  size_t nopen;
+  size_t *calls; // positions of the calls, in order
+  size_t ncalls;
+  size_t calls_cap;
+} regalloc_t;
+
+static void
+regalloc_def (regalloc_t *s, size_t t, size_t pos)
+{
+  interval_t *iv = &s->ivs[t];
+  if (iv->start == REGALLOC_NONE || pos < iv->start)
+    iv->start = pos;
+  if (iv->end == REGALLOC_NONE || pos > iv->end)
+    iv->end = pos;
+}
+
+static void
+regalloc_use (regalloc_t *s, ir_opnd_t o, size_t pos)
+{
+  if (o.kind != IR_OPND_TEMP)
+    return;
+
+  regalloc_def (s, o.temp, pos);
+  interval_t *iv = &s->ivs[o.temp];
+  for (size_t k = 0; k < s->nopen; k++)
+    {
+      const interval_t *l = &s->loops[s->open[k]];
+      if (l->start > iv->start)
+        {
+          if (l->end > iv->end)
+            iv->end = l->end;
+          break;
+        }
+    }
+}
+
+static void
+regalloc_block (regalloc_t *s, const ir_block_t *b)
+{
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      const size_t use = s->pos++;
+      for (size_t a = 0; a < i->nargs; a++)
+        regalloc_use (s, i->args[a], use);
+
+      if (i->op == IR_CALL || i->op == IR_CALL_KNOWN
+          || i->op == IR_CALL_VALUES)
+        {
+          if (s->ncalls == s->calls_cap)
+            {
+              s->calls_cap = s->calls_cap ? 2 * s->calls_cap : 16;
+              s->calls = grow (s->calls, s->calls_cap * sizeof (*s->calls));
+            }
+          s->calls[s->ncalls++] = use;
+        }
+
+      if (i->op == IR_IF)
+        {
+          regalloc_block (s, i->thenb);
+          regalloc_block (s, i->elseb);
+        }
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          regalloc_block (s, i->arms[k]);
+      if (i->op == IR_LOOP)
+        {
+          // The ends of the loops are known from the first walk on
+          const size_t l = s->nloops++;
+          s->loops[l].start = use;
+          for (size_t a = 0; a < i->nargs; a++)
+            {
+              regalloc_def (s, i->vars + a, use);
+              regalloc_def (s, i->vars + a, s->loops[l].end);
+            }
+
+          s->open[s->nopen++] = l;
+          regalloc_block (s, i->body);
+          s->nopen--;
+          s->loops[l].end = s->pos;
+        }
+
+      regalloc_def (s, i->dst, s->pos++);
+    }
+
+  regalloc_use (s, b->result, s->pos++);
+}
+
+// Walks the body of the procedure, filling in the intervals
+static void
+regalloc_walk (regalloc_t *s)
+{
+  s->pos = 1;
+  s->nloops = 0;
+  s->ncalls = 0;
+  for (size_t t = 0; t < s->p->ntemps; t++)
+    {
+      s->ivs[t].temp = t;
+      s->ivs[t].start = t < s->p->nparams ? 0 : REGALLOC_NONE;
+      s->ivs[t].end = s->ivs[t].start;
+    }
+  regalloc_block (s, s->p->body);
+}
+
+// Number of loops in block b
+static size_t
+regalloc_count_loops (const ir_block_t *b)
+{
+  size_t n = 0;
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      if (i->op == IR_IF)
+        n += regalloc_count_loops (i->thenb)
+             + regalloc_count_loops (i->elseb);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          n += regalloc_count_loops (i->arms[k]);
+      if (i->op == IR_LOOP)
+        n += 1 + regalloc_count_loops (i->body);
+    }
+  return n;
+}
+
+// True if interval iv contains a call, which clobbers its register
+static bool
+regalloc_across_call_p (const regalloc_t *s, const interval_t *iv)
+{
+  size_t lo = 0;
+  size_t hi = s->ncalls;
+
+  // First call after the start of iv
+  while (lo < hi)
+    {
+      const size_t mid = lo + (hi - lo) / 2;
+      if (s->calls[mid] <= iv->start)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo < s->ncalls && s->calls[lo] < iv->end;
+}
+
+static int
+regalloc_cmp (const void *a, const void *b)
+{
+  const interval_t *x = a;
+  const interval_t *y = b;
+  if (x->start != y->start)
+    return x->start < y->start ? -1 : 1;
+  return x->temp < y->temp ? -1 : x->temp > y->temp;
+}
+
+void
+pass_regalloc (ir_proc_t *p)
+{
+  regalloc_t s;
+  s.p = p;
+  const size_t nloops = regalloc_count_loops (p->body);
+  s.ivs = alloc ((p->ntemps + 1) * sizeof (*s.ivs));
+  s.loops = alloc ((nloops + 1) * sizeof (*s.loops));
+  s.open = alloc ((nloops + 1) * sizeof (*s.open));
+  s.nopen = 0;
+  for (size_t l = 0; l < nloops; l++)
+    s.loops[l].end = 0;
+  s.calls = NULL;
+  s.calls_cap = 0;
+
+  // The first walk finds where the loops end, which the second one
+  // extends the intervals used in them to
+  regalloc_walk (&s);
+  regalloc_walk (&s);
+
+  interval_t *order = alloc ((p->ntemps + 1) * sizeof (*order));
+  size_t n = 0;
+  for (size_t t = 0; t < p->ntemps; t++)
+    {
+      p->temps[t].reg = 0;
+      if (s.ivs[t].start != REGALLOC_NONE)
+        order[n++] = s.ivs[t];
+    }
+  qsort (order, n, sizeof (*order), regalloc_cmp);
+
+  // Intervals in registers, indexed by their register
+  const interval_t *active[REGALLOC_REGS + 1] = { NULL };
+  size_t allocated = 0;
+  size_t spilled = 0;
+  size_t across = 0;
+
+  for (size_t k = 0; k < n; k++)
+    {
+      const interval_t *iv = &order[k];
+      if (regalloc_across_call_p (&s, iv))
+        {
+          across++;
+          continue;
+        }
+
+      unsigned int reg = 0;
+      unsigned int last = 0;
+      for (unsigned int r = 1; r <= REGALLOC_REGS; r++)
+        {
+          if (active[r] && active[r]->end < iv->start)
+            active[r] = NULL;
+          if (!active[r] && !reg)
+            reg = r;
+          if (active[r] && (!last || active[r]->end > active[last]->end))
+            last = r;
+        }
+
+      if (!reg)
+        {
+          spilled++;
+          if (active[last]->end <= iv->end)
+            continue;
+          p->temps[active[last]->temp].reg = 0;
+          allocated--;
+          reg = last;
+        }
+      active[reg] = iv;
+      p->temps[iv->temp].reg = reg;
+      allocated++;
+    }
+
+  pass_record_stat ("regalloc", "in registers", allocated);
+  pass_record_stat ("regalloc", "spilled", spilled);
+  pass_record_stat ("regalloc", "kept across calls", across);
+
+  free (order);
+  free (s.ivs);
+  free (s.loops);
+  free (s.open);
+  free (s.calls);
+}
@@ -0,0 +1,412 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bignum.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Bignums
+//
+// Integers outside of the fixnum range, which the generic arithmetic
+// primitives produce when the inline fixnum code overflows. Magnitudes
+// are arrays of 64 bit limbs. Fixnum arguments are viewed as one limb
+// magnitudes without allocating, and every result is allocated once, with
+// room for the largest magnitude it can have.
+//
+// There is no collector yet, so bignums live until the program exits.
+//
+///////////////////////////////////////////////////////////////////////
+
+typedef unsigned __int128 uint128_t;
+
+// Products with an operand shorter than this many limbs are computed with
+// the schoolbook method
+#define KARATSUBA_CUTOFF 32
+
+// Largest power of 10 that fits in a limb, for printing
+#define DECIMAL_BASE UINT64_C (10000000000000000000)
+#define DECIMAL_DIGITS 19
+
+// Magnitude and sign of a number. The limb of a fixnum is kept in the view
+// itself, so views are passed around by pointer.
+typedef struct num
+{
+  const uint64_t *limbs;
+  size_t size;
+  bool neg;
+  uint64_t small;
+} num_t;
+
+static inline size_t
+bignum_size (const bignum_t *b)
+{
+  return b->header >> BIGNUM_SIZE_SHIFT;
+}
+
+bool
+bignum_p (schptr_t x)
+{
+  return x && sch_ptr_p (x)
+         && (((const bignum_t *)x)->header & HEAP_TYPE_MASK) == HEAP_BIGNUM;
+}
+
+static void
+num_view (schptr_t x, num_t *n)
+{
+  if (sch_imm_fixnum_p (x))
+    {
+      const int64_t v = sch_decode_imm_fixnum (x);
+      n->neg = v < 0;
+      n->small = n->neg ? -(uint64_t)v : (uint64_t)v;
+      n->limbs = &n->small;
+      n->size = n->small != 0;
+      return;
+    }
+
+  const bignum_t *b = (const bignum_t *)x;
+  n->limbs = b->limbs;
+  n->size = bignum_size (b);
+  n->neg = b->header & BIGNUM_SIGN;
+}
+
+static bignum_t *
+bignum_alloc (size_t size)
+{
+  bignum_t *b = malloc (sizeof (*b) + size * sizeof (b->limbs[0]));
+  if (!b)
+    {
+      fprintf (stderr, "out of memory allocating a bignum\n");
+      exit (EXIT_FAILURE);
+    }
+  return b;
+}
+
+// Normalizes the magnitude of at most size limbs in b, with sign neg, into
+// a number. If it fits in a fixnum, b is freed and the fixnum returned.
+static schptr_t
+bignum_finish (bignum_t *b, size_t size, bool neg)
+{
+  while (size && !b->limbs[size - 1])
+    size--;
+
+  if (size <= 1)
+    {
+      const uint64_t m = size ? b->limbs[0] : 0;
+      if (m <= (uint64_t)FX_MAX || (neg && m == -(uint64_t)FX_MIN))
+        {
+          free (b);
+          return sch_encode_imm_fixnum (neg ? -(int64_t)m : (int64_t)m);
+        }
+    }
+
+  b->header = ((uint64_t)size << BIGNUM_SIZE_SHIFT)
+              | (neg ? BIGNUM_SIGN : 0) | HEAP_BIGNUM;
+  return (schptr_t)b;
+}
+
+//
+// Magnitudes
+//
+
+static int
+mag_cmp (const num_t *a, const num_t *b)
+{
+  if (a->size != b->size)
+    return a->size < b->size ? -1 : 1;
+
+  for (size_t i = a->size; i-- > 0;)
+    if (a->limbs[i] != b->limbs[i])
+      return a->limbs[i] < b->limbs[i] ? -1 : 1;
+  return 0;
+}
+
+// r = a + b, where na >= nb. Returns the carry out of the na limbs of r,
+// which may be a.
+static uint64_t
+mag_add (uint64_t *r, const uint64_t *a, size_t na, const uint64_t *b,
+         size_t nb)
+{
+  uint64_t c = 0;
+  size_t i = 0;
+
+  for (; i < nb; i++)
+    {
+      const uint128_t s = (uint128_t)a[i] + b[i] + c;
+      r[i] = (uint64_t)s;
+      c = s >> 64;
+    }
+  for (; i < na && c; i++)
+    {
+      r[i] = a[i] + 1;
+      c = r[i] == 0;
+    }
+  if (r != a)
+    memcpy (r + i, a + i, (na - i) * sizeof (*r));
+  return c;
+}
+
+// r = a - b, where a >= b and na >= nb. r may be a.
+static void
+mag_sub (uint64_t *r, const uint64_t *a, size_t na, const uint64_t *b,
+         size_t nb)
+{
+  uint64_t borrow = 0;
+  size_t i = 0;
+
+  for (; i < nb; i++)
+    {
+      const uint64_t d = a[i] - b[i];
+      const uint64_t under = a[i] < b[i];
+      r[i] = d - borrow;
+      borrow = under | (d < borrow);
+    }
+  for (; i < na && borrow; i++)
+    {
+      const uint64_t d = a[i];
+      r[i] = d - 1;
+      borrow = d == 0;
+    }
+  if (r != a)
+    memcpy (r + i, a + i, (na - i) * sizeof (*r));
+}
+
+// r = a * b, schoolbook. r has room for na + nb limbs and overlaps
+// neither a nor b.
+static void
+mag_mul_school (uint64_t *r, const uint64_t *a, size_t na, const uint64_t *b,
+                size_t nb)
+{
+  memset (r, 0, (na + nb) * sizeof (*r));
+  for (size_t j = 0; j < nb; j++)
+    {
+      uint64_t c = 0;
+      for (size_t i = 0; i < na; i++)
+        {
+          const uint128_t p = (uint128_t)a[i] * b[j] + r[i + j] + c;
+          r[i + j] = (uint64_t)p;
+          c = p >> 64;
+        }
+      r[j + na] = c;
+    }
+}
+
+// Limbs of scratch space mag_mul needs for operands of at most n limbs
+static size_t
+mag_mul_scratch (size_t n)
+{
+  return 4 * n + 16 * 64;
+}
+
+// r = a * b, where na >= nb. r has room for na + nb limbs and overlaps
+// neither a nor b. Long operands are split in halves and multiplied with
+// three products of half the length instead of four (Karatsuba), using
+// the scratch space in t.
+static void
+mag_mul (uint64_t *r, const uint64_t *a, size_t na, const uint64_t *b,
+         size_t nb, uint64_t *t)
+{
+  if (nb < KARATSUBA_CUTOFF)
+    {
+      mag_mul_school (r, a, na, b, nb);
+      return;
+    }
+
+  // Unbalanced operands: multiply b by slices of a as long as b
+  if (2 * nb <= na)
+    {
+      memset (r, 0, (na + nb) * sizeof (*r));
+      for (size_t i = 0; i < na; i += nb)
+        {
+          const size_t n = na - i < nb ? na - i : nb;
+          if (n == nb)
+            mag_mul (t, a + i, n, b, nb, t + 2 * nb);
+          else
+            mag_mul (t, b, nb, a + i, n, t + 2 * nb);
+          mag_add (r + i, r + i, na + nb - i, t, n + nb);
+        }
+      return;
+    }
+
+  // a = a1 B^h + a0 and b = b1 B^h + b0, where b1 may be empty
+  const size_t h = (na + 1) / 2;
+  const size_t na1 = na - h;
+  const size_t nb1 = nb - h;
+
+  // z0 = a0 b0 and z2 = a1 b1 go straight to their place in r
+  mag_mul (r, a, h, b, h, t);
+  if (nb1)
+    mag_mul (r + 2 * h, a + h, na1, b + h, nb1, t);
+  else
+    memset (r + 2 * h, 0, na1 * sizeof (*r));
+
+  // z1 = (a0 + a1) (b0 + b1) - z0 - z2 = a0 b1 + a1 b0
+  uint64_t *sa = t;
+  uint64_t *sb = t + h + 1;
+  uint64_t *z1 = t + 2 * h + 2;
+  sa[h] = mag_add (sa, a, h, a + h, na1);
+  sb[h] = mag_add (sb, b, h, b + h, nb1);
+  mag_mul (z1, sa, h + 1, sb, h + 1, z1 + 2 * h + 2);
+  mag_sub (z1, z1, 2 * h + 2, r, 2 * h);
+  mag_sub (z1, z1, 2 * h + 2, r + 2 * h, na1 + nb1);
+
+  // The limbs of z1 beyond the product are zero
+  const size_t nr = na + nb - h;
+  mag_add (r + h, r + h, nr, z1, 2 * h + 2 < nr ? 2 * h + 2 : nr);
+}
+
+//
+// Arithmetic
+//
+
+// a + b, where b is negative if bneg
+static schptr_t
+num_add (const num_t *a, const num_t *b, bool bneg)
+{
+  if (a->neg == bneg)
+    {
+      if (a->size < b->size)
+        {
+          const num_t *tmp = a;
+          a = b;
+          b = tmp;
+        }
+
+      bignum_t *r = bignum_alloc (a->size + 1);
+      r->limbs[a->size]
+          = mag_add (r->limbs, a->limbs, a->size, b->limbs, b->size);
+      return bignum_finish (r, a->size + 1, bneg);
+    }
+
+  // Different signs: subtract the smaller magnitude from the larger one
+  bool neg = a->neg;
+  const int c = mag_cmp (a, b);
+  if (c == 0)
+    return sch_encode_imm_fixnum (0);
+  if (c < 0)
+    {
+      const num_t *tmp = a;
+      a = b;
+      b = tmp;
+      neg = bneg;
+    }
+
+  bignum_t *r = bignum_alloc (a->size);
+  mag_sub (r->limbs, a->limbs, a->size, b->limbs, b->size);
+  return bignum_finish (r, a->size, neg);
+}
+
+schptr_t
+bignum_add (schptr_t x, schptr_t y)
+{
+  num_t a, b;
+  num_view (x, &a);
+  num_view (y, &b);
+  return num_add (&a, &b, b.neg);
+}
+
+schptr_t
+bignum_sub (schptr_t x, schptr_t y)
+{
+  num_t a, b;
+  num_view (x, &a);
+  num_view (y, &b);
+  return num_add (&a, &b, !b.neg);
+}
+
+schptr_t
+bignum_mul (schptr_t x, schptr_t y)
+{
+  num_t va, vb;
+  num_view (x, &va);
+  num_view (y, &vb);
+
+  const num_t *a = &va;
+  const num_t *b = &vb;
+  if (a->size < b->size)
+    {
+      a = &vb;
+      b = &va;
+    }
+  if (!b->size)
+    return sch_encode_imm_fixnum (0);
+
+  uint64_t *t = NULL;
+  if (b->size >= KARATSUBA_CUTOFF)
+    {
+      t = malloc (mag_mul_scratch (a->size) * sizeof (*t));
+      if (!t)
+        {
+          fprintf (stderr, "out of memory multiplying bignums\n");
+          exit (EXIT_FAILURE);
+        }
+    }
+
+  bignum_t *r = bignum_alloc (a->size + b->size);
+  mag_mul (r->limbs, a->limbs, a->size, b->limbs, b->size, t);
+  free (t);
+  return bignum_finish (r, a->size + b->size, a->neg != b->neg);
+}
+
+//
+// Printing
+//
+
+// Prints the bignum x in decimal, converting its magnitude to base 10^19
+// by repeated division
+void
+bignum_print (FILE *f, schptr_t x)
+{
+  const bignum_t *b = (const bignum_t *)x;
+  size_t size = bignum_size (b);
+  uint64_t *q = malloc (size * sizeof (*q));
+  uint64_t *digits = malloc ((2 * size + 1) * sizeof (*digits));
+  size_t ndigits = 0;
+
+  if (!q || !digits)
+    {
+      fprintf (stderr, "out of memory printing a bignum\n");
+      exit (EXIT_FAILURE);
+    }
+
+  memcpy (q, b->limbs, size * sizeof (*q));
+  do
+    {
+      uint128_t rem = 0;
+      for (size_t i = size; i-- > 0;)
+        {
+          const uint128_t cur = (rem << 64) | q[i];
+          q[i] = (uint64_t)(cur / DECIMAL_BASE);
+          rem = cur % DECIMAL_BASE;
+        }
+      digits[ndigits++] = (uint64_t)rem;
+      while (size && !q[size - 1])
+        size--;
+    }
+  while (size);
+
+  if (b->header & BIGNUM_SIGN)
+    fputc ('-', f);
+  fprintf (f, "%" PRIu64, digits[ndigits - 1]);
+  for (size_t i = ndigits - 1; i-- > 0;)
+    fprintf (f, "%0*" PRIu64, DECIMAL_DIGITS, digits[i]);
+
+  free (q);
+  free (digits);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../common.h"
+
+// Bignums are heap objects made of a header word followed by the limbs of
+// their magnitude, see common.h.
+//
+// Bignums are always normalized: the most significant limb is not zero,
+// and integers in the fixnum range are fixnums, never bignums.
+typedef struct bignum
+{
+  uint64_t header;
+  uint64_t limbs[];
+} bignum_t;
+
+bool bignum_p (schptr_t);
+void bignum_print (FILE *, schptr_t);
+
+// Arithmetic on numbers, fixnums or bignums
+schptr_t bignum_add (schptr_t, schptr_t);
+schptr_t bignum_sub (schptr_t, schptr_t);
+schptr_t bignum_mul (schptr_t, schptr_t);
@@ -16,71 +16,136 @@
 
 #include <inttypes.h>
 #include <limits.h>
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 #include "../common.h"
+#include "bignum.h"
 
 // Runtime entry point.
 // The compiler generated code is linked here.
-extern schptr_t scheme_entry (uint8_t *);
+extern schptr_t scheme_entry (uint8_t *, uint8_t *);
 
+// Multiple values that are not in registers, see common.h. It is hidden
+// so that the compiled code can address it relative to %rip.
+schptr_t runtime_values[VALUES_MAX] __attribute__ ((visibility ("hidden")));
+
+static bool
+closure_p (schptr_t x)
+{
+  return x && sch_ptr_p (x)
+         && (*(const uint64_t *)x & HEAP_TYPE_MASK) == HEAP_CLOSURE;
+}
+
+// Prints the external representation of any value
 static void
-print_char (char code)
+print_value (FILE *f, schptr_t x)
 {
-  switch (code)
+  if (bignum_p (x))
+    bignum_print (f, x);
+  else if (closure_p (x))
+    fprintf (f, "#<procedure>");
+  else if (sch_values_p (x))
+    fprintf (f, "#<%zu values>", sch_values_count (x));
+  else
+    sch_print_imm (f, x);
+}
+
+// Prints the value of the program, one line per value when it has many.
+// scheme_entry leaves all of them in runtime_values.
+static void
+print_ptr (schptr_t x)
+{
+  if (!sch_values_p (x))
     {
-    case 0x7:
-      printf ("#\\alarm");
-      break;
-    case 0x8:
-      printf ("#\\backspace");
-      break;
-    case 0x7f:
-      printf ("#\\delete");
-      break;
-    case 0x1b:
-      printf ("#\\escape");
-      break;
-    case 0xa:
-      printf ("#\\newline");
-      break;
-    case 0x0:
-      printf ("#\\null");
-      break;
-    case 0xd:
-      printf ("#\\return");
-      break;
-    case ' ':
-      printf ("#\\space");
-      break;
-    case 0x9:
-      printf ("#\\tab");
-      break;
-    default:
-      printf ("#\\%c", (char)code);
-      break;
+      print_value (stdout, x);
+      printf ("\n");
+      return;
     }
+
+  for (size_t k = 0; k < sch_values_count (x); k++)
+    {
+      print_value (stdout, runtime_values[k]);
+      printf ("\n");
+    }
+}
+
+// Where to go back to when the program raises an error
+static jmp_buf error_jmp;
+
+// Called when a primitive gets an argument x of the wrong type, by the
+// type checks of safe mode and by generic arithmetic. msg names the
+// primitive and the expected type.
+void __attribute__ ((noreturn)) runtime_type_error (const char *msg, schptr_t x)
+{
+  fflush (stdout);
+  fprintf (stderr, "error: %s, got ", msg);
+  print_value (stderr, x);
+  fprintf (stderr, "\n");
+  longjmp (error_jmp, 1);
+}
+
+// Called by checked calls when f is not a procedure that takes nargs
+// arguments
+void __attribute__ ((noreturn)) runtime_call_error (schptr_t f, size_t nargs)
+{
+  if (!closure_p (f))
+    runtime_type_error ("application: expected procedure", f);
+
+  fflush (stdout);
+  const uint64_t arity = *(const uint64_t *)f >> CLOSURE_ARITY_SHIFT;
+  fprintf (stderr, "error: procedure expects %" PRIu64 " arguments, got %zu\n",
+           arity, nargs);
+  longjmp (error_jmp, 1);
 }
 
+// Called by checked receivers of multiple values when x is not n values
+void __attribute__ ((noreturn)) runtime_values_error (schptr_t x, size_t n)
+{
+  fflush (stdout);
+  fprintf (stderr, "error: expected %zu value%s, got %zu\n", n,
+           n == 1 ? "" : "s", sch_values_count (x));
+  longjmp (error_jmp, 1);
+}
+
+// Generic arithmetic
+//
+// Called by the compiled code when the inline fixnum code for +, - or *
+// cannot compute the result: an argument is not a fixnum or the result
+// overflows. Arguments that are not numbers raise an error, in any mode.
+
 static void
-print_ptr (schptr_t x)
+runtime_check_number (const char *msg, schptr_t x)
 {
-  if (sch_imm_fixnum_p (x))
-    printf ("%" PRIi64, sch_decode_imm_fixnum (x));
-  else if (sch_imm_char_p (x))
-    print_char (sch_decode_imm_char (x));
-  else if (sch_imm_false_p (x))
-    printf ("#f");
-  else if (sch_imm_true_p (x))
-    printf ("#t");
-  else if (sch_imm_null_p (x))
-    printf ("()");
-  else
-    printf ("#<unknown 0x%08" PRIxPTR ">", x);
-  printf ("\n");
+  if (!sch_imm_fixnum_p (x) && !bignum_p (x))
+    runtime_type_error (msg, x);
+}
+
+schptr_t
+runtime_add (schptr_t x, schptr_t y)
+{
+  runtime_check_number ("+: expected number", x);
+  runtime_check_number ("+: expected number", y);
+  return bignum_add (x, y);
+}
+
+schptr_t
+runtime_sub (schptr_t x, schptr_t y)
+{
+  runtime_check_number ("-: expected number", x);
+  runtime_check_number ("-: expected number", y);
+  return bignum_sub (x, y);
+}
+
+schptr_t
+runtime_mul (schptr_t x, schptr_t y)
+{
+  runtime_check_number ("*: expected number", x);
+  runtime_check_number ("*: expected number", y);
+  return bignum_mul (x, y);
 }
 
 size_t
@@ -100,6 +165,10 @@ getpagesz (void)
 // Stack size in words (enough for 16K words)
 #define WORD_STACK_SIZE (16 * 1024)
 
+// Heap size in words. Nothing is ever collected, and the pages that the
+// program does not touch are never backed by memory.
+#define WORD_HEAP_SIZE (64 * 1024 * 1024)
+
 /*
   | ...                      |
   +--------------------------+
@@ -139,7 +208,7 @@ allocate_protected_space (size_t size)
   // protection
   uint8_t *p
       = mmap (NULL, aligned_size + (2 * pagesize), PROT_READ | PROT_WRITE,
-              MAP_ANONYMOUS | MAP_PRIVATE, 0, 0);
+              MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, 0, 0);
   if (p == MAP_FAILED)
     {
       fprintf (stderr, "failed to allocate stack space of size `%zu'\n", size);
@@ -178,20 +247,30 @@ deallocate_protected_space (uint8_t *p, size_t size)
              size);
 }
 
-void
+// Runs the program, returning its exit status
+int
 runtime_startup (void)
 {
   size_t stack_size
       = (WORD_STACK_SIZE * WORD_BYTES); // 16K words of space in stack
   uint8_t *stack_top = allocate_protected_space (stack_size);
   uint8_t *stack_base = stack_top + stack_size;
-  print_ptr (scheme_entry (stack_base));
+  size_t heap_size = WORD_HEAP_SIZE * WORD_BYTES;
+  uint8_t *heap = allocate_protected_space (heap_size);
+  int status = EXIT_SUCCESS;
+
+  if (!setjmp (error_jmp))
+    print_ptr (scheme_entry (stack_base, heap));
+  else
+    status = EXIT_FAILURE;
+
+  deallocate_protected_space (heap, heap_size);
   deallocate_protected_space (stack_top, stack_size);
+  return status;
 }
 
 int
 main (void)
 {
-  runtime_startup ();
-  return 0;
+  return runtime_startup ();
 }
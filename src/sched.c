@@ -0,0 +1,301 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include "memory.h"
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Instruction Scheduling
+//
+// List scheduling of the instructions without effects: moves, primitives
+// with EFFECT_NONE and the reads of free variables and static data. The
+// other instructions stay where they are and split each block into the
+// regions that are scheduled, and so do the predicates and nots that make
+// the test of a conditional, or of the block, which stay right before it
+// to be fused into it.
+//
+// An instruction depends on the earlier ones in its region that define a
+// temporary it uses, or that use or define its destination. Instructions
+// issue one per cycle, once the results of the ones they depend on are
+// ready, which is the latency of the primitive, SCHED_LOAD_LATENCY for a
+// read of a free variable, and one cycle for the others. Among the
+// instructions that can issue first, the one with the longest path of
+// latencies to the end of the region goes first, and the original order
+// breaks the ties. The region is reordered only if that makes it shorter,
+// so the regions with nothing to overlap keep the order of the program.
+//
+// Regions longer than SCHED_REGION_MAX stay as they are. Out of order
+// processors find most of this overlap by themselves, so the pass only
+// runs at level 2.
+//
+///////////////////////////////////////////////////////////////////////
+
+#define SCHED_LOAD_LATENCY 4
+#define SCHED_REGION_MAX 512
+
+typedef struct sched
+{
+  ir_proc_t *p;
+  size_t moved;
+  size_t saved;
+} sched_t;
+
+static bool
+sched_movable_p (const ir_insn_t *i)
+{
+  switch (i->op)
+    {
+    case IR_MOVE:
+    case IR_FREF:
+    case IR_DATA:
+      return true;
+    case IR_PRIM:
+      return ir_insn_effects (i) == EFFECT_NONE;
+    default:
+      return false;
+    }
+}
+
+static size_t
+sched_latency (const ir_insn_t *i)
+{
+  if (i->op == IR_PRIM)
+    return i->prim->latency;
+  if (i->op == IR_FREF)
+    return SCHED_LOAD_LATENCY;
+  return 1;
+}
+
+// True if instruction i uses temporary t
+static bool
+sched_uses_p (const ir_insn_t *i, size_t t)
+{
+  for (size_t a = 0; a < i->nargs; a++)
+    if (i->args[a].kind == IR_OPND_TEMP && i->args[a].temp == t)
+      return true;
+  return false;
+}
+
+// True if instruction j, after i, has to stay after it
+static bool
+sched_depends_p (const ir_insn_t *i, const ir_insn_t *j)
+{
+  return i->dst == j->dst || sched_uses_p (j, i->dst)
+         || sched_uses_p (i, j->dst);
+}
+
+// True if instruction i is a predicate whose value is operand o
+static bool
+sched_test_p (const ir_insn_t *i, ir_opnd_t o)
+{
+  return i->op == IR_PRIM && i->prim->tester && o.kind == IR_OPND_TEMP
+         && o.temp == i->dst;
+}
+
+// Returns the length of the n instructions in v issued in order, where
+// dep[j * n + k] tells whether v[k] depends on v[j]
+static size_t
+sched_length (ir_insn_t **v, size_t n, const bool *dep, size_t *ready)
+{
+  size_t cycle = 0;
+  size_t length = 0;
+  for (size_t k = 0; k < n; k++)
+    {
+      size_t t = cycle;
+      for (size_t j = 0; j < k; j++)
+        if (dep[j * n + k] && ready[j] > t)
+          t = ready[j];
+      ready[k] = t + sched_latency (v[k]);
+      cycle = t + 1;
+      if (ready[k] > length)
+        length = ready[k];
+    }
+  return length;
+}
+
+// Appends to block b the n instructions in v, scheduled
+static void
+sched_region (sched_t *s, ir_block_t *b, ir_insn_t **v, size_t n)
+{
+  if (n < 3 || n > SCHED_REGION_MAX)
+    {
+      for (size_t k = 0; k < n; k++)
+        ir_block_append (b, v[k]);
+      return;
+    }
+
+  bool *dep = alloc (n * n * sizeof (*dep));
+  bool *issued = alloc (n * sizeof (*issued));
+  size_t *height = alloc (n * sizeof (*height));
+  size_t *ready = alloc (n * sizeof (*ready));
+  size_t *preds = alloc (n * sizeof (*preds));
+  ir_insn_t **order = alloc (n * sizeof (*order));
+
+  for (size_t j = 0; j < n; j++)
+    for (size_t k = 0; k < n; k++)
+      dep[j * n + k] = j < k && sched_depends_p (v[j], v[k]);
+
+  // height[j] is the longest path of latencies from v[j] to the end
+  for (size_t j = n; j-- > 0;)
+    {
+      const size_t l = sched_latency (v[j]);
+      height[j] = l;
+      for (size_t k = j + 1; k < n; k++)
+        if (dep[j * n + k] && l + height[k] > height[j])
+          height[j] = l + height[k];
+    }
+
+  const size_t before = sched_length (v, n, dep, ready);
+
+  // ready[k] is when the operands of v[k] are ready, as far as the
+  // instructions issued so far go, and preds[k] how many of the ones it
+  // depends on are still to issue
+  for (size_t k = 0; k < n; k++)
+    {
+      issued[k] = false;
+      ready[k] = 0;
+      preds[k] = 0;
+      for (size_t j = 0; j < k; j++)
+        preds[k] += dep[j * n + k];
+    }
+
+  size_t cycle = 0;
+  size_t after = 0;
+  for (size_t m = 0; m < n; m++)
+    {
+      size_t best = n;
+      size_t best_t = 0;
+      for (size_t k = 0; k < n; k++)
+        {
+          if (issued[k] || preds[k])
+            continue;
+          const size_t t = ready[k] > cycle ? ready[k] : cycle;
+          if (best == n || t < best_t
+              || (t == best_t && height[k] > height[best]))
+            {
+              best = k;
+              best_t = t;
+            }
+        }
+
+      const size_t done = best_t + sched_latency (v[best]);
+      for (size_t k = best + 1; k < n; k++)
+        if (dep[best * n + k])
+          {
+            preds[k]--;
+            if (done > ready[k])
+              ready[k] = done;
+          }
+      if (done > after)
+        after = done;
+      cycle = best_t + 1;
+      issued[best] = true;
+      order[m] = v[best];
+    }
+
+  if (after < before)
+    {
+      for (size_t k = 0; k < n; k++)
+        s->moved += order[k] != v[k];
+      s->saved += before - after;
+      v = order;
+    }
+  for (size_t k = 0; k < n; k++)
+    ir_block_append (b, v[k]);
+
+  free (dep);
+  free (issued);
+  free (height);
+  free (ready);
+  free (preds);
+  free (order);
+}
+
+// Returns the index in v, from which the instructions up to k are the
+// predicates that make the test of operand o, one feeding the next
+static size_t
+sched_tests_from (ir_insn_t **v, size_t k, ir_opnd_t o)
+{
+  while (k > 0 && sched_test_p (v[k - 1], o))
+    o = v[--k]->args[0];
+  return k;
+}
+
+static void
+sched_block (sched_t *s, ir_block_t *b)
+{
+  size_t n = 0;
+  for (ir_insn_t *i = b->first; i; i = i->next)
+    {
+      n++;
+      if (i->op == IR_IF)
+        {
+          sched_block (s, i->thenb);
+          sched_block (s, i->elseb);
+        }
+      if (i->op == IR_LOOP)
+        sched_block (s, i->body);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          sched_block (s, i->arms[k]);
+    }
+
+  ir_insn_t **v = alloc ((n + 1) * sizeof (*v));
+  size_t k = 0;
+  for (ir_insn_t *i = b->first; i; i = i->next)
+    v[k++] = i;
+
+  b->first = NULL;
+  b->last = NULL;
+  size_t start = 0;
+  for (k = 0; k <= n; k++)
+    {
+      if (k < n && sched_movable_p (v[k]))
+        continue;
+
+      // The region ends at v[k], or at the end of the block
+      size_t end = k;
+      if (k == n)
+        end = sched_tests_from (v, k, b->result);
+      else if (v[k]->op == IR_IF && v[k]->nargs)
+        end = sched_tests_from (v, k, v[k]->args[0]);
+      if (end < start)
+        end = start;
+
+      sched_region (s, b, v + start, end - start);
+      for (size_t j = end; j <= k && j < n; j++)
+        ir_block_append (b, v[j]);
+      start = k + 1;
+    }
+
+  free (v);
+}
+
+void
+pass_sched (ir_proc_t *p)
+{
+  sched_t s;
+  s.p = p;
+  s.moved = 0;
+  s.saved = 0;
+
+  sched_block (&s, p->body);
+  pass_record_stat ("sched", "instructions moved", s.moved);
+  pass_record_stat ("sched", "estimated cycles saved", s.saved);
+}
@@ -40,6 +40,8 @@ free_if (schif_t *e)
 void
 free_let (schlet_t *e)
 {
+  if (e->name)
+    free_identifier (e->name);
   free_binding_spec_list (e->bindings);
   free_expression (e->body);
   free (e);
@@ -80,6 +82,71 @@ free_prim_eval2 (schprim_eval2_t *e)
   free (e);
 }
 
+void
+free_lambda (schlambda_t *e)
+{
+  free_expression_list (e->formals);
+  free_expression (e->body);
+  free (e);
+}
+
+void
+free_call (schcall_t *e)
+{
+  free_expression (e->op);
+  free_expression_list (e->args);
+  free (e);
+}
+
+void
+free_case (schcase_t *e)
+{
+  case_clause_list_t *tmp = NULL;
+  case_clause_list_t *c = e->clauses;
+  while (c)
+    {
+      tmp = c->next;
+      free_expression_list (c->datums);
+      free_expression (c->body);
+      free (c);
+      c = tmp;
+    }
+  free_expression (e->key);
+  free_expression (e->elsev);
+  free (e);
+}
+
+void
+free_const (schconst_t *e)
+{
+  free (e->words);
+  free (e);
+}
+
+void
+free_values (schvalues_t *e)
+{
+  free_expression_list (e->args);
+  free (e);
+}
+
+void
+free_receive (schreceive_t *e)
+{
+  free_expression_list (e->formals);
+  free_expression (e->expr);
+  free_expression (e->body);
+  free (e);
+}
+
+void
+free_call_values (schcallvalues_t *e)
+{
+  free_expression (e->producer);
+  free_expression (e->consumer);
+  free (e);
+}
+
 #define SCHTYPE(e) (((schtype_t *)e)->type)
 
 void
@@ -118,6 +185,34 @@ free_expression (schptr_t e)
       free_prim_eval2 ((schprim_eval2_t *)e);
       break;
 
+    case SCH_LAMBDA:
+      free_lambda ((schlambda_t *)e);
+      break;
+
+    case SCH_CALL:
+      free_call ((schcall_t *)e);
+      break;
+
+    case SCH_CASE:
+      free_case ((schcase_t *)e);
+      break;
+
+    case SCH_CONST:
+      free_const ((schconst_t *)e);
+      break;
+
+    case SCH_VALUES:
+      free_values ((schvalues_t *)e);
+      break;
+
+    case SCH_RECEIVE:
+      free_receive ((schreceive_t *)e);
+      break;
+
+    case SCH_CALL_VALUES:
+      free_call_values ((schcallvalues_t *)e);
+      break;
+
     default:
       err_unreachable ("unknown type");
     }
@@ -141,6 +236,7 @@ schid_t *
 clone_schid (const schid_t *id)
 {
   schid_t *clone = alloc (sizeof *clone);
+  clone->type = SCH_ID;
   clone->name = strdup (id->name);
   return clone;
 }
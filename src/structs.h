@@ -31,8 +31,25 @@ typedef uint64_t sch_imm;
 
 // Primitives
 struct schprim;
-struct env;
-typedef void (*prim_emmiter) (FILE *, schptr_t, size_t, struct env *);
+struct ir_insn;
+struct asm_list;
+typedef void (*prim_emmiter) (struct asm_list *, const struct ir_insn *);
+typedef bool (*prim_folder) (const schptr_t *, schptr_t *);
+
+// Conditions on the flags, each one next to its negation
+typedef enum
+{
+  COND_E,
+  COND_NE,
+  COND_L,
+  COND_GE,
+  COND_LE,
+  COND_G
+} cond_code;
+
+// A tester emits the comparison of a predicate, and returns the condition
+// on the flags under which the predicate holds
+typedef cond_code (*prim_tester) (struct asm_list *, const struct ir_insn *);
 
 typedef enum
 {
@@ -42,7 +59,14 @@ typedef enum
   SCH_LET,
   SCH_EXPR_SEQ,
   SCH_PRIM_EVAL1,
-  SCH_PRIM_EVAL2
+  SCH_PRIM_EVAL2,
+  SCH_LAMBDA,
+  SCH_CALL,
+  SCH_CASE,
+  SCH_CONST,
+  SCH_VALUES,
+  SCH_RECEIVE,
+  SCH_CALL_VALUES
 } sch_type;
 
 typedef struct schtype
@@ -50,12 +74,70 @@ typedef struct schtype
   sch_type type;
 } schtype_t;
 
+// Sets of types that a value may have
+typedef enum
+{
+  VT_FIXNUM = 1 << 0,
+  VT_CHAR = 1 << 1,
+  VT_TRUE = 1 << 2,
+  VT_FALSE = 1 << 3,
+  VT_NULL = 1 << 4,
+  VT_BIGNUM = 1 << 5,
+  VT_OTHER = 1 << 6, // any other object in the heap
+} vtype_flag;
+
+typedef unsigned int vtype_t;
+
+#define VT_NONE 0
+#define VT_BOOL (VT_TRUE | VT_FALSE)
+#define VT_NUMBER (VT_FIXNUM | VT_BIGNUM)
+#define VT_ANY                                                                \
+  (VT_FIXNUM | VT_CHAR | VT_BOOL | VT_NULL | VT_BIGNUM | VT_OTHER)
+
+// Effects of evaluating a primitive, besides computing its value.
+// Primitives without effects can be removed when their value is unused.
+typedef enum
+{
+  EFFECT_NONE = 0,
+  EFFECT_RAISE = 1 << 0,  // may signal an error
+  EFFECT_WRITE = 1 << 1,  // writes to memory or performs I/O
+  EFFECT_ALLOC = 1 << 2,  // allocates memory
+  EFFECT_DIVIDE = 1 << 3, // raises if its last argument is 0
+} effect_flag;
+
+typedef unsigned int effects_t;
+
+// Effects that must be preserved even if the value is never used, once
+// ir_insn_effects has turned EFFECT_DIVIDE into EFFECT_RAISE or nothing
+#define EFFECT_OBSERVABLE (EFFECT_RAISE | EFFECT_WRITE)
+
+// Fixnum representations that a primitive emitter handles besides tagged
+// values, see the untag pass
+typedef enum
+{
+  UNTAGGED_NONE = 0,
+  UNTAGGED_ARGS = 1 << 0,   // arguments may be untagged
+  UNTAGGED_RESULT = 1 << 1, // result may be left untagged
+} untagged_flag;
+
+typedef unsigned int untagged_t;
+
+#define UNTAGGED_BOTH (UNTAGGED_ARGS | UNTAGGED_RESULT)
+
 typedef struct schprim
 {
   sch_type type;         // Type (always SCH_PRIM)
   char *name;            // Primitive name
   unsigned int argcount; // Number of arguments for the primitive
   prim_emmiter emitter;  // Primitive function emmiter
+  prim_tester tester;    // Emitter of the flags of a predicate, or NULL
+  prim_folder folder;    // Compile-time evaluator for constant arguments
+  effects_t effects;     // Effects of evaluating the primitive
+  vtype_t atype;         // Type expected for every argument
+  vtype_t rtype;         // Type of the result, for arguments of the right type
+  vtype_t tests;         // Type tested by a type predicate, or VT_NONE
+  untagged_t untagged;   // Untagged fixnums handled by the emitter
+  unsigned int latency;  // Cycles until the result is ready, see sched
 } schprim_t;
 
 typedef struct schprim_eval
@@ -101,7 +183,9 @@ typedef struct binding_spec_list
 typedef struct schlet
 {
   sch_type type;
-  bool star_p;
+  bool star_p;   // bindings see the earlier ones
+  bool rec_p;    // bindings see all of them, as in letrec
+  schid_t *name; // name of a named let, or NULL
   binding_spec_list_t *bindings;
   schptr_t body;
 } schlet_t;
@@ -118,6 +202,74 @@ typedef struct schexprseq
   expression_list_t *seq;
 } schexprseq_t;
 
+typedef struct schlambda
+{
+  sch_type type;
+  expression_list_t *formals; // identifiers of the parameters
+  schptr_t body;
+} schlambda_t;
+
+// Application of anything that is not a primitive
+typedef struct schcall
+{
+  sch_type type;
+  schptr_t op;
+  expression_list_t *args;
+} schcall_t;
+
+// Clause of a case expression, taken when the key is one of its datums
+typedef struct case_clause_list
+{
+  expression_list_t *datums; // immediates
+  schptr_t body;
+  struct case_clause_list *next;
+} case_clause_list_t;
+
+typedef struct schcase
+{
+  sch_type type;
+  schptr_t key;
+  case_clause_list_t *clauses;
+  schptr_t elsev; // value when the key is none of the datums
+} schcase_t;
+
+// Constant that is not an immediate, like a bignum literal, given as the
+// words of the object it is
+typedef struct schconst
+{
+  sch_type type;
+  vtype_t vtype; // type of the object
+  size_t nwords;
+  uint64_t *words;
+} schconst_t;
+
+// (values <expression>*), with any number of expressions but one
+typedef struct schvalues
+{
+  sch_type type;
+  expression_list_t *args;
+} schvalues_t;
+
+// Binds the identifiers in formals to the values of expr, of which there
+// must be as many, in body. let-values and call-with-values with a
+// lambda expression as consumer are turned into it.
+typedef struct schreceive
+{
+  sch_type type;
+  expression_list_t *formals;
+  schptr_t expr;
+  schptr_t body;
+} schreceive_t;
+
+// (call-with-values <producer> <consumer>), where the consumer is not a
+// lambda expression
+typedef struct schcallvalues
+{
+  sch_type type;
+  schptr_t producer;
+  schptr_t consumer;
+} schcallvalues_t;
+
 void free_expression (schptr_t);
 void free_expression_list (expression_list_t *);
 void free_identifier (schid_t *);
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Generated by scripts/superopt.c, see make superopt.
+//
+// Shortest sequences for the primitives with their operands in the
+// registers they are allocated to, by whether the operands and the
+// result are tagged, with the second operand of a unary primitive
+// taken as tagged. The result is left in %0, which is %rax, %1 is
+// %r8, and %2 and %3 are the registers of the operands.
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SUPEROPT_LEN_MAX 3
+
+// The layout of fixnums and characters the sequences are for
+#define SUPEROPT_FX_TAG 0x1
+#define SUPEROPT_FX_SHIFT 1
+#define SUPEROPT_CHAR_TAG 0x2
+#define SUPEROPT_CHAR_SHIFT 3
+
+typedef struct
+{
+  const char *op;
+  const char *args[3]; // Up to NULL
+} superopt_insn_t;
+
+typedef struct
+{
+  const char *prim;     // Name of the primitive
+  bool tagged[3];       // Whether the operands and result are tagged
+  superopt_insn_t insns[SUPEROPT_LEN_MAX + 1]; // Up to no op
+} superopt_seq_t;
+
+static const superopt_seq_t superopt_seqs[] = {
+  { "fxadd1", { 1, 1, 1 },
+    { { "leaq", { "2(%2)", "%0" } } } },
+  { "fxadd1", { 1, 1, 0 },
+    { { "leaq", { "1(%2)", "%0" } } } },
+  { "fxadd1", { 0, 1, 1 },
+    { { "leaq", { "3(%2)", "%0" } } } },
+  { "fxadd1", { 0, 1, 0 },
+    { { "leaq", { "2(%2)", "%0" } } } },
+  { "fxsub1", { 1, 1, 1 },
+    { { "leaq", { "-2(%2)", "%0" } } } },
+  { "fxsub1", { 1, 1, 0 },
+    { { "leaq", { "-3(%2)", "%0" } } } },
+  { "fxsub1", { 0, 1, 1 },
+    { { "leaq", { "-1(%2)", "%0" } } } },
+  { "fxsub1", { 0, 1, 0 },
+    { { "leaq", { "-2(%2)", "%0" } } } },
+  { "fxlognot", { 1, 1, 1 },
+    { { "imulq", { "$-1", "%2", "%0" } } } },
+  { "fxlognot", { 1, 1, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "notq", { "%0" } } } },
+  { "fxlognot", { 0, 1, 1 },
+    { { "movq", { "%2", "%0" } },
+      { "notq", { "%0" } } } },
+  { "fxlognot", { 0, 1, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "xorq", { "$-2", "%0" } } } },
+  { "char->fixnum", { 1, 1, 1 },
+    { { "leaq", { "2(%2)", "%0" } },
+      { "sarq", { "$2", "%0" } } } },
+  { "char->fixnum", { 1, 1, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "sarq", { "$2", "%0" } } } },
+  { "fixnum->char", { 1, 1, 1 },
+    { { "leaq", { "-2(,%2,4)", "%0" } } } },
+  { "fixnum->char", { 0, 1, 1 },
+    { { "leaq", { "2(,%2,4)", "%0" } } } },
+  { "fx+", { 1, 1, 1 },
+    { { "leaq", { "-1(%2,%3)", "%0" } } } },
+  { "fx+", { 1, 1, 0 },
+    { { "leaq", { "-2(%2,%3)", "%0" } } } },
+  { "fx+", { 1, 0, 1 },
+    { { "leaq", { "(%2,%3)", "%0" } } } },
+  { "fx+", { 1, 0, 0 },
+    { { "leaq", { "-1(%2,%3)", "%0" } } } },
+  { "fx+", { 0, 1, 1 },
+    { { "leaq", { "(%2,%3)", "%0" } } } },
+  { "fx+", { 0, 1, 0 },
+    { { "leaq", { "-1(%2,%3)", "%0" } } } },
+  { "fx+", { 0, 0, 1 },
+    { { "leaq", { "1(%2,%3)", "%0" } } } },
+  { "fx+", { 0, 0, 0 },
+    { { "leaq", { "(%2,%3)", "%0" } } } },
+  { "fx-", { 1, 1, 1 },
+    { { "leaq", { "1(%2)", "%0" } },
+      { "subq", { "%3", "%0" } } } },
+  { "fx-", { 1, 1, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "subq", { "%3", "%0" } } } },
+  { "fx-", { 1, 0, 1 },
+    { { "movq", { "%2", "%0" } },
+      { "subq", { "%3", "%0" } } } },
+  { "fx-", { 1, 0, 0 },
+    { { "leaq", { "-1(%2)", "%0" } },
+      { "subq", { "%3", "%0" } } } },
+  { "fx-", { 0, 1, 1 },
+    { { "leaq", { "2(%2)", "%0" } },
+      { "subq", { "%3", "%0" } } } },
+  { "fx-", { 0, 1, 0 },
+    { { "leaq", { "1(%2)", "%0" } },
+      { "subq", { "%3", "%0" } } } },
+  { "fx-", { 0, 0, 1 },
+    { { "leaq", { "1(%2)", "%0" } },
+      { "subq", { "%3", "%0" } } } },
+  { "fx-", { 0, 0, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "subq", { "%3", "%0" } } } },
+  { "fx*", { 1, 0, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "sarq", { "$1", "%0" } },
+      { "imulq", { "%3", "%0" } } } },
+  { "fx*", { 0, 1, 0 },
+    { { "movq", { "%3", "%0" } },
+      { "sarq", { "$1", "%0" } },
+      { "imulq", { "%2", "%0" } } } },
+  { "fx*", { 0, 0, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "sarq", { "$1", "%0" } },
+      { "imulq", { "%3", "%0" } } } },
+  { "fxlogand", { 1, 1, 1 },
+    { { "movq", { "%2", "%0" } },
+      { "andq", { "%3", "%0" } } } },
+  { "fxlogand", { 1, 1, 0 },
+    { { "leaq", { "-1(%2)", "%0" } },
+      { "andq", { "%3", "%0" } } } },
+  { "fxlogand", { 1, 0, 1 },
+    { { "leaq", { "1(%3)", "%0" } },
+      { "andq", { "%2", "%0" } } } },
+  { "fxlogand", { 1, 0, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "andq", { "%3", "%0" } } } },
+  { "fxlogand", { 0, 1, 1 },
+    { { "leaq", { "1(%2)", "%0" } },
+      { "andq", { "%3", "%0" } } } },
+  { "fxlogand", { 0, 1, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "andq", { "%3", "%0" } } } },
+  { "fxlogand", { 0, 0, 1 },
+    { { "movq", { "%2", "%0" } },
+      { "andq", { "%3", "%0" } },
+      { "addq", { "$1", "%0" } } } },
+  { "fxlogand", { 0, 0, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "andq", { "%3", "%0" } } } },
+  { "fxlogor", { 1, 1, 1 },
+    { { "movq", { "%2", "%0" } },
+      { "orq", { "%3", "%0" } } } },
+  { "fxlogor", { 1, 1, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "orq", { "%3", "%0" } },
+      { "addq", { "$-1", "%0" } } } },
+  { "fxlogor", { 1, 0, 1 },
+    { { "movq", { "%2", "%0" } },
+      { "orq", { "%3", "%0" } } } },
+  { "fxlogor", { 1, 0, 0 },
+    { { "leaq", { "-1(%2)", "%0" } },
+      { "orq", { "%3", "%0" } } } },
+  { "fxlogor", { 0, 1, 1 },
+    { { "movq", { "%2", "%0" } },
+      { "orq", { "%3", "%0" } } } },
+  { "fxlogor", { 0, 1, 0 },
+    { { "leaq", { "-1(%3)", "%0" } },
+      { "orq", { "%2", "%0" } } } },
+  { "fxlogor", { 0, 0, 1 },
+    { { "leaq", { "1(%2)", "%0" } },
+      { "orq", { "%3", "%0" } } } },
+  { "fxlogor", { 0, 0, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "orq", { "%3", "%0" } } } },
+  { "fxlogxor", { 1, 1, 1 },
+    { { "leaq", { "-1(%2)", "%0" } },
+      { "xorq", { "%3", "%0" } } } },
+  { "fxlogxor", { 1, 1, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "xorq", { "%3", "%0" } } } },
+  { "fxlogxor", { 1, 0, 1 },
+    { { "movq", { "%2", "%0" } },
+      { "xorq", { "%3", "%0" } } } },
+  { "fxlogxor", { 1, 0, 0 },
+    { { "leaq", { "-1(%2)", "%0" } },
+      { "xorq", { "%3", "%0" } } } },
+  { "fxlogxor", { 0, 1, 1 },
+    { { "movq", { "%2", "%0" } },
+      { "xorq", { "%3", "%0" } } } },
+  { "fxlogxor", { 0, 1, 0 },
+    { { "leaq", { "1(%2)", "%0" } },
+      { "xorq", { "%3", "%0" } } } },
+  { "fxlogxor", { 0, 0, 1 },
+    { { "leaq", { "1(%2)", "%0" } },
+      { "xorq", { "%3", "%0" } } } },
+  { "fxlogxor", { 0, 0, 0 },
+    { { "movq", { "%2", "%0" } },
+      { "xorq", { "%3", "%0" } } } },
+};
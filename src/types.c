@@ -0,0 +1,376 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Type Inference
+//
+// Computes the set of types each temporary may have, and leaves it in the
+// temporary for later passes. The inference is flow sensitive: the type of
+// a temporary is refined in the region dominated by
+//   - an application of a primitive to it, since from then on it must
+//     have the type that the primitive expects;
+//   - the test of a conditional, which is not #f in the then arm and #f
+//     in the else arm;
+//   - the test of a conditional on a type predicate (occurrence typing),
+//     in which case the argument of the predicate has the type tested in
+//     the then arm, and any other type in the else arm;
+//   - the key of a switch, which has the type of one of the values of the
+//     cases of the arm taken.
+// A type predicate whose answer is known from the type of its argument is
+// replaced by a constant, and so is a temporary refined to a type that
+// only has one value. In safe mode, this is also where type checks on
+// values already known to have the right type are eliminated.
+//
+// Refinements are recorded in a trail and undone when the region they
+// apply to is left.
+//
+// The variables of a loop have the types of their initial values joined
+// with those of the values they get at each IR_CONTINUE. These are found
+// as a fixed point, by inferring the types in copies of the body, which
+// are thrown away with whatever was changed in them, until the types of
+// the variables stop growing. Only then is the body itself changed.
+//
+///////////////////////////////////////////////////////////////////////
+
+#define TYPES_NONE ((size_t)-1)
+
+typedef struct types_undo
+{
+  size_t temp;
+  vtype_t type;
+  ir_opnd_t subst;
+} types_undo_t;
+
+typedef struct types
+{
+  ir_proc_t *p;
+  ir_opnd_t *subst;    // replacements for folded predicates and constants
+  size_t *tested;      // argument of the type predicate defining a temporary
+  vtype_t *tests;      // type tested by the predicate defining a temporary
+  vtype_t *next;       // types a loop variable gets at its IR_CONTINUEs
+  types_undo_t *trail; // refinements in the current region
+  size_t ntrail;
+  size_t trail_cap;
+  size_t folded;     // number of predicates folded
+  size_t refined;    // number of refinements
+  size_t eliminated; // number of type checks eliminated
+} types_t;
+
+static vtype_t
+types_opnd (const types_t *s, ir_opnd_t o)
+{
+  switch (o.kind)
+    {
+    case IR_OPND_IMM:
+      return vtype_of_imm (o.imm);
+    case IR_OPND_TEMP:
+      return s->p->temps[o.temp].type;
+    default:
+      return VT_ANY;
+    }
+}
+
+// Refines the type of temporary t to those in type
+static void
+types_refine (types_t *s, size_t t, vtype_t type)
+{
+  ir_temp_t *tmp = &s->p->temps[t];
+  const vtype_t nt = tmp->type & type;
+  if (nt == tmp->type)
+    return;
+
+  if (s->ntrail == s->trail_cap)
+    {
+      s->trail_cap = s->trail_cap ? 2 * s->trail_cap : 16;
+      s->trail = grow (s->trail, s->trail_cap * sizeof (*s->trail));
+    }
+  s->trail[s->ntrail].temp = t;
+  s->trail[s->ntrail].type = tmp->type;
+  s->trail[s->ntrail].subst = s->subst[t];
+  s->ntrail++;
+
+  tmp->type = nt;
+  s->refined++;
+
+  // Types with a single value
+  if (nt == VT_TRUE)
+    s->subst[t] = ir_opnd_imm (TRUE_CST);
+  else if (nt == VT_FALSE)
+    s->subst[t] = ir_opnd_imm (FALSE_CST);
+  else if (nt == VT_NULL)
+    s->subst[t] = ir_opnd_imm (NULL_CST);
+}
+
+// Undoes the refinements done since the trail had mark entries
+static void
+types_undo (types_t *s, size_t mark)
+{
+  while (s->ntrail > mark)
+    {
+      const types_undo_t *u = &s->trail[--s->ntrail];
+      s->p->temps[u->temp].type = u->type;
+      s->subst[u->temp] = u->subst;
+    }
+}
+
+static vtype_t types_block (types_t *, ir_block_t *);
+static vtype_t types_loop (types_t *, ir_insn_t *);
+
+// Infers the types in arm b of a conditional on test, where test is known
+// to be #f if false_p, and not to be #f otherwise. Returns the type of the
+// value of the arm.
+static vtype_t
+types_arm (types_t *s, ir_block_t *b, ir_opnd_t test, bool false_p)
+{
+  const size_t mark = s->ntrail;
+
+  if (test.kind == IR_OPND_TEMP)
+    {
+      const size_t t = test.temp;
+      const size_t x = s->tested[t];
+
+      types_refine (s, t, false_p ? VT_FALSE : ~VT_FALSE);
+      if (x != TYPES_NONE)
+        types_refine (s, x, false_p ? ~s->tests[t] : s->tests[t]);
+    }
+
+  const vtype_t type = types_block (s, b);
+  types_undo (s, mark);
+  return type;
+}
+
+// Infers the types in arm k of switch i. Returns the type of the value of
+// the arm.
+static vtype_t
+types_case (types_t *s, ir_insn_t *i, size_t k)
+{
+  const size_t mark = s->ntrail;
+
+  if (k + 1 < i->narms && i->args[0].kind == IR_OPND_TEMP)
+    {
+      vtype_t t = VT_NONE;
+      for (size_t c = 0; c < i->ncases; c++)
+        if (i->cases[c].arm == k)
+          t |= vtype_of_imm (i->cases[c].value);
+      types_refine (s, i->args[0].temp, t);
+    }
+
+  const vtype_t type = types_block (s, i->arms[k]);
+  types_undo (s, mark);
+  return type;
+}
+
+// Replaces the type predicate i by a constant if the type of its argument
+// decides it. Returns true if it did.
+static bool
+types_fold_predicate (types_t *s, const ir_insn_t *i)
+{
+  const vtype_t at = types_opnd (s, i->args[0]);
+  const vtype_t tests = i->prim->tests;
+
+  if (!(at & ~tests))
+    s->subst[i->dst] = ir_opnd_imm (TRUE_CST);
+  else if (!(at & tests))
+    s->subst[i->dst] = ir_opnd_imm (FALSE_CST);
+  else
+    return false;
+
+  s->folded++;
+  return true;
+}
+
+static vtype_t
+types_block (types_t *s, ir_block_t *b)
+{
+  const size_t mark = s->ntrail;
+  ir_insn_t *i = b->first;
+
+  b->first = NULL;
+  b->last = NULL;
+  while (i)
+    {
+      ir_insn_t *next = i->next;
+      ir_temp_t *dst = &s->p->temps[i->dst];
+      bool keep = true;
+
+      for (size_t a = 0; a < i->nargs; a++)
+        i->args[a] = ir_subst_opnd (i->args[a], s->subst);
+
+      switch (i->op)
+        {
+        case IR_PRIM:
+          if (i->prim->tests != VT_NONE)
+            {
+              if (types_fold_predicate (s, i))
+                {
+                  keep = false;
+                  break;
+                }
+              if (i->args[0].kind == IR_OPND_TEMP)
+                {
+                  s->tested[i->dst] = i->args[0].temp;
+                  s->tests[i->dst] = i->prim->tests;
+                }
+            }
+
+          dst->type = i->prim->rtype;
+          for (size_t a = 0; a < i->nargs; a++)
+            if (i->args[a].kind == IR_OPND_TEMP)
+              types_refine (s, i->args[a].temp, i->prim->atype);
+          break;
+        case IR_MOVE:
+          dst->type = types_opnd (s, i->args[0]);
+          break;
+        case IR_CHECK:
+          {
+            const vtype_t at = types_opnd (s, i->args[0]);
+            if (!(at & ~i->prim->atype))
+              {
+                s->subst[i->dst] = i->args[0];
+                s->eliminated++;
+                keep = false;
+                break;
+              }
+
+            dst->type = at & i->prim->atype;
+            if (i->args[0].kind == IR_OPND_TEMP)
+              types_refine (s, i->args[0].temp, i->prim->atype);
+          }
+          break;
+        case IR_CLOSURE:
+          dst->type = VT_OTHER;
+          break;
+        case IR_DATA:
+          dst->type = i->data->type;
+          break;
+        case IR_FREF:
+        case IR_CALL:
+        case IR_CALL_KNOWN:
+        case IR_VALUES:
+        case IR_RECEIVE:
+        case IR_VREF:
+        case IR_CALL_VALUES:
+          dst->type = VT_ANY;
+          break;
+        case IR_IF:
+          dst->type = types_arm (s, i->thenb, i->args[0], false)
+                      | types_arm (s, i->elseb, i->args[0], true);
+          break;
+        case IR_LOOP:
+          dst->type = types_loop (s, i);
+          break;
+        case IR_SWITCH:
+          dst->type = VT_NONE;
+          for (size_t k = 0; k < i->narms; k++)
+            dst->type |= types_case (s, i, k);
+          break;
+        case IR_CONTINUE:
+          for (size_t a = 0; a < i->nargs; a++)
+            s->next[i->vars + a] |= types_opnd (s, i->args[a]);
+          dst->type = VT_NONE;
+          break;
+        }
+
+      if (keep)
+        ir_block_append (b, i);
+      else
+        ir_free_insn (i);
+
+      i = next;
+    }
+
+  b->result = ir_subst_opnd (b->result, s->subst);
+  const vtype_t type = types_opnd (s, b->result);
+  types_undo (s, mark);
+  return type;
+}
+
+// Infers the types in loop i, see above. Returns the type of its value.
+static vtype_t
+types_loop (types_t *s, ir_insn_t *i)
+{
+  ir_temp_t *vars = &s->p->temps[i->vars];
+  vtype_t *next = &s->next[i->vars];
+  for (size_t a = 0; a < i->nargs; a++)
+    next[a] = types_opnd (s, i->args[a]);
+
+  const size_t ntemps = s->p->ntemps;
+  ir_opnd_t *subst = alloc ((ntemps + 1) * sizeof (*subst));
+  const types_t saved = *s;
+  for (bool changed = true; changed;)
+    {
+      for (size_t a = 0; a < i->nargs; a++)
+        vars[a].type = next[a];
+
+      memcpy (subst, s->subst, ntemps * sizeof (*subst));
+      ir_block_t *copy = ir_copy_block (s->p, s->p, i->body, NULL);
+      (void)types_block (s, copy);
+      ir_free_block (copy);
+      memcpy (s->subst, subst, ntemps * sizeof (*subst));
+
+      changed = false;
+      for (size_t a = 0; a < i->nargs; a++)
+        changed |= next[a] != vars[a].type;
+    }
+  free (subst);
+
+  s->folded = saved.folded;
+  s->refined = saved.refined;
+  s->eliminated = saved.eliminated;
+  return types_block (s, i->body);
+}
+
+void
+pass_types (ir_proc_t *p)
+{
+  types_t s;
+  s.p = p;
+  s.subst = ir_make_subst (p);
+  s.tested = alloc ((p->ntemps + 1) * sizeof (*s.tested));
+  s.tests = alloc ((p->ntemps + 1) * sizeof (*s.tests));
+  s.next = alloc ((p->ntemps + 1) * sizeof (*s.next));
+  s.trail = NULL;
+  s.ntrail = 0;
+  s.trail_cap = 0;
+  s.folded = 0;
+  s.refined = 0;
+  s.eliminated = 0;
+
+  for (size_t t = 0; t < p->ntemps; t++)
+    {
+      p->temps[t].type = VT_ANY;
+      s.tested[t] = TYPES_NONE;
+      s.tests[t] = VT_NONE;
+    }
+
+  types_block (&s, p->body);
+  pass_record_stat ("types", "predicates folded", s.folded);
+  pass_record_stat ("types", "refinements", s.refined);
+  pass_record_stat ("types", "checks eliminated", s.eliminated);
+
+  free (s.subst);
+  free (s.tested);
+  free (s.tests);
+  free (s.next);
+  free (s.trail);
+}
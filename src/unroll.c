@@ -0,0 +1,389 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "fold.h"
+#include "memory.h"
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Loop Unrolling
+//
+// Fully unrolls the loops that go round a small, known number of times.
+// That number is found by running the body with the folders of the
+// primitives, from the initial values of the loop variables, for as long
+// as every conditional on the way has a known test. Variables that no test
+// depends on, like accumulators, may stay unknown.
+//
+// The loop is then replaced by one copy of its body per time round, each
+// one where the IR_CONTINUE of the one before was, and with its own copy
+// of the variables. The last copy still goes back to the loop itself, in
+// an arm that fold then finds is never taken. The result is the same
+// whether or not the count was right, so the count only decides if it
+// pays off.
+//
+// Only loops with a single IR_CONTINUE are unrolled, at most
+// UNROLL_TRIPS_MAX times round, and while the copies add up to at most
+// UNROLL_SIZE_MAX instructions.
+//
+///////////////////////////////////////////////////////////////////////
+
+#define UNROLL_TRIPS_MAX 8
+#define UNROLL_SIZE_MAX 64
+
+typedef enum
+{
+  SIM_EXIT,     // the body finished with a value
+  SIM_CONTINUE, // the body went back to the start of the loop
+  SIM_UNKNOWN   // the body cannot be followed
+} sim_result;
+
+typedef struct unroller
+{
+  ir_proc_t *p;
+  ir_opnd_t *vals; // values of the temporaries, IR_OPND_NONE if unknown
+  size_t unrolled;
+} unroller_t;
+
+static size_t
+unroll_size (const ir_block_t *b)
+{
+  size_t n = 0;
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      n++;
+      if (i->op == IR_IF)
+        n += unroll_size (i->thenb) + unroll_size (i->elseb);
+      if (i->op == IR_LOOP)
+        n += unroll_size (i->body);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          n += unroll_size (i->arms[k]);
+    }
+  return n;
+}
+
+// Returns the number of IR_CONTINUE to the loop with variables vars in b
+static size_t
+unroll_continues (const ir_block_t *b, size_t vars)
+{
+  size_t n = 0;
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      if (i->op == IR_CONTINUE && i->vars == vars)
+        n++;
+      if (i->op == IR_IF)
+        n += unroll_continues (i->thenb, vars)
+             + unroll_continues (i->elseb, vars);
+      if (i->op == IR_LOOP)
+        n += unroll_continues (i->body, vars);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          n += unroll_continues (i->arms[k], vars);
+    }
+  return n;
+}
+
+// Returns the IR_CONTINUE to the loop with variables vars in b, and
+// the block it ends in in
+static ir_insn_t *
+unroll_find (ir_block_t *b, size_t vars, ir_block_t **in)
+{
+  for (ir_insn_t *i = b->first; i; i = i->next)
+    {
+      ir_insn_t *c = NULL;
+      if (i->op == IR_CONTINUE && i->vars == vars)
+        {
+          *in = b;
+          return i;
+        }
+      if (i->op == IR_IF)
+        {
+          c = unroll_find (i->thenb, vars, in);
+          if (!c)
+            c = unroll_find (i->elseb, vars, in);
+        }
+      if (i->op == IR_LOOP)
+        c = unroll_find (i->body, vars, in);
+      for (size_t k = 0; !c && i->op == IR_SWITCH && k < i->narms; k++)
+        c = unroll_find (i->arms[k], vars, in);
+      if (c)
+        return c;
+    }
+  return NULL;
+}
+
+static ir_opnd_t
+unroll_val (const unroller_t *s, ir_opnd_t o)
+{
+  if (o.kind == IR_OPND_TEMP)
+    return s->vals[o.temp];
+  return o;
+}
+
+// Runs block b of loop l, leaving in next the values of the variables when
+// it goes back to the start
+static sim_result
+unroll_sim (unroller_t *s, const ir_block_t *b, const ir_insn_t *l,
+            ir_opnd_t *next)
+{
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      ir_opnd_t v = { .kind = IR_OPND_NONE };
+
+      switch (i->op)
+        {
+        case IR_PRIM:
+          {
+            schptr_t args[FOLD_ARGS_MAX];
+            schptr_t r;
+            bool known_p = i->prim->folder && i->nargs <= FOLD_ARGS_MAX;
+            for (size_t a = 0; known_p && a < i->nargs; a++)
+              {
+                const ir_opnd_t o = unroll_val (s, i->args[a]);
+                known_p = o.kind == IR_OPND_IMM;
+                args[a] = o.imm;
+              }
+            if (known_p && i->prim->folder (args, &r))
+              v = ir_opnd_imm (r);
+          }
+          break;
+        case IR_MOVE:
+          v = unroll_val (s, i->args[0]);
+          break;
+        case IR_CHECK:
+          v = unroll_val (s, i->args[0]);
+          if (v.kind == IR_OPND_IMM
+              && (vtype_of_imm (v.imm) & ~i->prim->atype))
+            return SIM_UNKNOWN;
+          break;
+        case IR_IF:
+          {
+            const ir_opnd_t test = unroll_val (s, i->args[0]);
+            if (test.kind != IR_OPND_IMM)
+              {
+                if (unroll_continues (i->thenb, l->vars)
+                    || unroll_continues (i->elseb, l->vars))
+                  return SIM_UNKNOWN;
+                break;
+              }
+
+            const ir_block_t *taken
+                = sch_imm_false_p (test.imm) ? i->elseb : i->thenb;
+            const sim_result r = unroll_sim (s, taken, l, next);
+            if (r != SIM_EXIT)
+              return r;
+            v = unroll_val (s, taken->result);
+          }
+          break;
+        case IR_SWITCH:
+          {
+            const ir_opnd_t key = unroll_val (s, i->args[0]);
+            if (key.kind != IR_OPND_IMM)
+              {
+                for (size_t k = 0; k < i->narms; k++)
+                  if (unroll_continues (i->arms[k], l->vars))
+                    return SIM_UNKNOWN;
+                break;
+              }
+
+            const ir_block_t *taken = ir_switch_arm (i, key.imm);
+            const sim_result r = unroll_sim (s, taken, l, next);
+            if (r != SIM_EXIT)
+              return r;
+            v = unroll_val (s, taken->result);
+          }
+          break;
+        case IR_LOOP:
+          if (unroll_continues (i->body, l->vars))
+            return SIM_UNKNOWN;
+          break;
+        case IR_CONTINUE:
+          if (i->vars != l->vars)
+            return SIM_UNKNOWN;
+          for (size_t a = 0; a < i->nargs; a++)
+            next[a] = unroll_val (s, i->args[a]);
+          return SIM_CONTINUE;
+        case IR_CLOSURE:
+        case IR_FREF:
+        case IR_CALL:
+        case IR_CALL_KNOWN:
+        case IR_DATA:
+        case IR_VALUES:
+        case IR_RECEIVE:
+        case IR_VREF:
+        case IR_CALL_VALUES:
+          break;
+        }
+
+      s->vals[i->dst] = v;
+    }
+  return SIM_EXIT;
+}
+
+// Returns the number of times loop l goes back to its start, or
+// UNROLL_TRIPS_MAX + 1 if it is not known
+static size_t
+unroll_trips (unroller_t *s, const ir_insn_t *l)
+{
+  ir_opnd_t *next = alloc ((l->nargs + 1) * sizeof (*next));
+  size_t trips = 0;
+
+  s->vals = ir_make_subst (s->p);
+  for (size_t a = 0; a < l->nargs; a++)
+    s->vals[l->vars + a] = l->args[a];
+  while (trips <= UNROLL_TRIPS_MAX)
+    {
+      const sim_result r = unroll_sim (s, l->body, l, next);
+      if (r == SIM_EXIT)
+        break;
+
+      trips = r == SIM_UNKNOWN ? UNROLL_TRIPS_MAX + 1 : trips + 1;
+      for (size_t a = 0; a < l->nargs; a++)
+        s->vals[l->vars + a] = next[a];
+    }
+
+  free (s->vals);
+  free (next);
+  return trips;
+}
+
+// Removes the last instruction of block b
+static void
+unroll_remove_last (ir_block_t *b)
+{
+  if (b->first == b->last)
+    {
+      b->first = NULL;
+      b->last = NULL;
+      return;
+    }
+
+  ir_insn_t *i = b->first;
+  while (i->next != b->last)
+    i = i->next;
+  i->next = NULL;
+  b->last = i;
+}
+
+// Appends to block b the copies of the body of loop l, and then l itself
+// where the last one goes back to the start
+static void
+unroll_loop (unroller_t *s, ir_insn_t *l, size_t trips, ir_block_t *b)
+{
+  ir_proc_t *p = s->p;
+  ir_block_t *dest = b;
+  ir_insn_t *prev = NULL; // the IR_CONTINUE the copy replaces
+  const ir_opnd_t *args = l->args;
+
+  for (size_t k = 0; k <= trips; k++)
+    {
+      ir_opnd_t *map = ir_make_subst (p);
+      ir_block_t *c = ir_make_block ();
+      size_t vars = l->vars;
+
+      for (size_t a = 0; a < l->nargs; a++)
+        {
+          const size_t t = ir_new_temp (p, p->temps[l->vars + a].name);
+          ir_insn_t *m = ir_make_insn (IR_MOVE, t, 1);
+          m->args[0] = args[a];
+          map[l->vars + a] = ir_opnd_temp (m->dst);
+          if (!a)
+            vars = m->dst;
+          ir_block_append (c, m);
+        }
+      ir_block_append_copy (p, p, l->body, c, map);
+      c->result = ir_subst_opnd (l->body->result, map);
+      free (map);
+      if (prev)
+        ir_free_insn (prev);
+
+      ir_block_t *in = NULL;
+      prev = unroll_find (c, vars, &in);
+      assert (prev && in != c);
+      unroll_remove_last (in);
+      args = prev->args;
+
+      ir_block_splice (dest, c);
+      if (k)
+        dest->result = c->result;
+      else
+        {
+          ir_insn_t *m = ir_make_insn (IR_MOVE, l->dst, 1);
+          m->args[0] = c->result;
+          ir_block_append (b, m);
+        }
+      ir_free_block (c);
+      dest = in;
+    }
+
+  free (l->args);
+  l->args = prev->args;
+  l->dst = prev->dst;
+  prev->args = NULL;
+  ir_free_insn (prev);
+  ir_block_append (dest, l);
+}
+
+static void
+unroll_block (unroller_t *s, ir_block_t *b)
+{
+  ir_insn_t *i = b->first;
+
+  b->first = NULL;
+  b->last = NULL;
+  while (i)
+    {
+      ir_insn_t *next = i->next;
+
+      if (i->op == IR_IF)
+        {
+          unroll_block (s, i->thenb);
+          unroll_block (s, i->elseb);
+        }
+      if (i->op == IR_LOOP)
+        unroll_block (s, i->body);
+
+      size_t trips = UNROLL_TRIPS_MAX + 1;
+      if (i->op == IR_LOOP && unroll_continues (i->body, i->vars) == 1)
+        trips = unroll_trips (s, i);
+
+      if (trips <= UNROLL_TRIPS_MAX
+          && (trips + 1) * unroll_size (i->body) <= UNROLL_SIZE_MAX)
+        {
+          unroll_loop (s, i, trips, b);
+          s->unrolled++;
+        }
+      else
+        ir_block_append (b, i);
+      i = next;
+    }
+}
+
+void
+pass_unroll (ir_proc_t *p)
+{
+  unroller_t s;
+  s.p = p;
+  s.vals = NULL;
+  s.unrolled = 0;
+
+  unroll_block (&s, p->body);
+  pass_record_stat ("unroll", "loops unrolled", s.unrolled);
+}
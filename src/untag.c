@@ -0,0 +1,110 @@
+/*
+ * Copyright 2020 Paulo Matos
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include "memory.h"
+#include "pass.h"
+
+///////////////////////////////////////////////////////////////////////
+//
+// Section Untagging
+//
+// Chooses the representation of fixnum temporaries. Most fixnum
+// primitives clear the tag of their arguments, compute and tag the result
+// again, so a fixnum that only flows from one of them into others is
+// better kept untagged, that is with its tag bits cleared. Untagged
+// fixnums still wrap around exactly like tagged ones.
+//
+// A temporary is left untagged when the types pass proved it is a fixnum,
+// the emitter of its definition can leave it untagged, and every use is
+// an argument of a primitive whose emitter accepts untagged arguments.
+//
+///////////////////////////////////////////////////////////////////////
+
+// Marks in tagged the temporaries that have some use requiring a tag
+static void
+untag_uses (const ir_block_t *b, bool *tagged)
+{
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      const bool raw_args_p
+          = i->op == IR_PRIM && (i->prim->untagged & UNTAGGED_ARGS);
+
+      for (size_t a = 0; a < i->nargs; a++)
+        if (i->args[a].kind == IR_OPND_TEMP && !raw_args_p)
+          tagged[i->args[a].temp] = true;
+
+      if (i->op == IR_IF)
+        {
+          untag_uses (i->thenb, tagged);
+          untag_uses (i->elseb, tagged);
+        }
+      if (i->op == IR_LOOP)
+        untag_uses (i->body, tagged);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          untag_uses (i->arms[k], tagged);
+    }
+
+  if (b->result.kind == IR_OPND_TEMP)
+    tagged[b->result.temp] = true;
+}
+
+static size_t
+untag_block (ir_proc_t *p, const ir_block_t *b, const bool *tagged)
+{
+  size_t untagged = 0;
+
+  for (const ir_insn_t *i = b->first; i; i = i->next)
+    {
+      ir_temp_t *t = &p->temps[i->dst];
+
+      if (i->op == IR_PRIM && (i->prim->untagged & UNTAGGED_RESULT)
+          && t->type == VT_FIXNUM && !tagged[i->dst])
+        {
+          t->untagged = true;
+          untagged++;
+        }
+
+      if (i->op == IR_IF)
+        {
+          untagged += untag_block (p, i->thenb, tagged);
+          untagged += untag_block (p, i->elseb, tagged);
+        }
+      if (i->op == IR_LOOP)
+        untagged += untag_block (p, i->body, tagged);
+      if (i->op == IR_SWITCH)
+        for (size_t k = 0; k < i->narms; k++)
+          untagged += untag_block (p, i->arms[k], tagged);
+    }
+
+  return untagged;
+}
+
+void
+pass_untag (ir_proc_t *p)
+{
+  bool *tagged = alloc ((p->ntemps + 1) * sizeof (*tagged));
+  for (size_t t = 0; t < p->ntemps; t++)
+    tagged[t] = false;
+
+  untag_uses (p->body, tagged);
+  size_t untagged = untag_block (p, p->body, tagged);
+  pass_record_stat ("untag", "temporaries untagged", untagged);
+
+  free (tagged);
+}
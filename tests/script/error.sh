@@ -0,0 +1,10 @@
+#!/bin/sh
+# Prints the value of the expression in $2, compiled by the rattle command
+# line in $1, or the error that it raises instead
+err=$(mktemp)
+if value=$($1 -e -- "$2" 2> "$err"); then
+  printf "%s\n" "$value"
+else
+  grep '^error: ' "$err" || echo error
+fi
+rm -f "$err"
@@ -0,0 +1,15 @@
+#!/bin/sh
+# Prints the value of the expression in $2, compiled by the rattle command
+# line in $1 with -t, followed by the peephole rules that fired on its code
+set -e
+
+stats=$(mktemp)
+value=$($1 -t -e -- "$2" 2> "$stats")
+rules=$(awk '$1 == "peephole" && $NF ~ /^[0-9]+$/ && $NF > 0 {
+               $1 = ""
+               $NF = ""
+               gsub(/^ +| +$/, "")
+               printf "%s%s", n++ ? ", " : "", $0
+             }' "$stats")
+rm -f "$stats"
+printf "%s [%s]\n" "$value" "$rules"